@@ -0,0 +1,819 @@
+#include "common.h"
+#include "wire_buffer.h"
+#include "event_loop.h"
+#include "metrics.h"
+#include "kafka_utils.h"
+#include "crc32c.h"
+
+// Load generator for a broker on the local machine: replays a weighted mix of requests over many pipelined
+// connections and reports throughput and latency percentiles per API. Each bench thread runs an EventLoop
+// driving its share of the connections, responses are matched to requests by arrival order like the broker answers them.
+
+namespace
+{
+
+enum BenchApi
+{
+    API_VERSIONS,
+    DESCRIBE_TOPIC_PARTITIONS,
+    METADATA,
+    PRODUCE,
+    FETCH,
+    LIST_OFFSETS,
+    BENCH_APIS
+};
+
+struct ApiInfo
+{
+    int16_t api_key;
+    int16_t api_version;
+    bool needs_topic;
+};
+
+constexpr std::array<ApiInfo, BENCH_APIS> BENCH_API_INFO = {{{18, 4, false}, {75, 0, true}, {3, 12, true}, {0, 11, true}, {1, 16, true}, {2, 9, true}}};
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    uint16_t port = 9092;
+    size_t connections = 16;
+    size_t threads = 0; // 0 picks one per two cores, at most one per connection
+    size_t pipeline = 8; // Requests outstanding per connection
+    double duration_s = 10;
+    double warmup_s = 2;
+    std::array<uint32_t, BENCH_APIS> weights = {1, 0, 0, 0, 0, 0};
+    std::string topic;
+    int32_t partition = 0;
+    int16_t acks = -1;
+    size_t record_size = 100;
+    size_t records_per_batch = 10;
+    int32_t fetch_max_bytes = 1024 * 1024;
+};
+
+void usage()
+{
+    std::cerr << "Usage: kafka_bench [--host HOST] [--port PORT] [--connections N] [--threads N] [--pipeline N]\n"
+                 "                   [--duration SECONDS] [--warmup SECONDS] [--mix API=WEIGHT,...] [--topic NAME]\n"
+                 "                   [--partition N] [--acks 1|-1] [--record-size BYTES] [--records-per-batch N]\n"
+                 "                   [--fetch-max-bytes BYTES]\n"
+                 "APIs: ApiVersions, DescribeTopicPartitions, Metadata, Produce, Fetch, ListOffsets (default ApiVersions=1)\n"
+                 "Every API but ApiVersions needs --topic with an existing topic\n";
+    exit(EXIT_FAILURE);
+}
+
+template <typename T>
+T parseNumber(std::string_view text)
+{
+    T value{};
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end != text.data() + text.size())
+    {
+        std::cerr << "Invalid number " << text << "\n";
+        usage();
+    }
+    return value;
+}
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y)
+                                              { return std::tolower(x) == std::tolower(y); });
+}
+
+std::array<uint32_t, BENCH_APIS> parseMix(std::string_view mix)
+{
+    std::array<uint32_t, BENCH_APIS> weights{};
+    while (!mix.empty())
+    {
+        const size_t comma = mix.find(',');
+        std::string_view entry = mix.substr(0, comma);
+        mix = comma == std::string_view::npos ? std::string_view() : mix.substr(comma + 1);
+
+        const size_t equals = entry.find('=');
+        std::string_view name = entry.substr(0, equals);
+        const uint32_t weight = equals == std::string_view::npos ? 1 : parseNumber<uint32_t>(entry.substr(equals + 1));
+
+        size_t api = 0;
+        while (api < BENCH_APIS && !equalsIgnoreCase(apiName(BENCH_API_INFO[api].api_key), name))
+            api++;
+        if (api == BENCH_APIS)
+        {
+            std::cerr << "Unknown API " << name << "\n";
+            usage();
+        }
+        weights[api] = weight;
+    }
+
+    if (std::accumulate(weights.begin(), weights.end(), uint64_t(0)) == 0)
+    {
+        std::cerr << "The mix has no requests\n";
+        usage();
+    }
+    return weights;
+}
+
+Options parseOptions(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view flag = argv[i];
+        if (i + 1 >= argc)
+            usage();
+        std::string_view value = argv[++i];
+
+        if (flag == "--host")
+            options.host = value;
+        else if (flag == "--port")
+            options.port = parseNumber<uint16_t>(value);
+        else if (flag == "--connections")
+            options.connections = parseNumber<size_t>(value);
+        else if (flag == "--threads")
+            options.threads = parseNumber<size_t>(value);
+        else if (flag == "--pipeline")
+            options.pipeline = parseNumber<size_t>(value);
+        else if (flag == "--duration")
+            options.duration_s = parseNumber<double>(value);
+        else if (flag == "--warmup")
+            options.warmup_s = parseNumber<double>(value);
+        else if (flag == "--mix")
+            options.weights = parseMix(value);
+        else if (flag == "--topic")
+            options.topic = value;
+        else if (flag == "--partition")
+            options.partition = parseNumber<int32_t>(value);
+        else if (flag == "--acks")
+            options.acks = parseNumber<int16_t>(value);
+        else if (flag == "--record-size")
+            options.record_size = parseNumber<size_t>(value);
+        else if (flag == "--records-per-batch")
+            options.records_per_batch = parseNumber<size_t>(value);
+        else if (flag == "--fetch-max-bytes")
+            options.fetch_max_bytes = parseNumber<int32_t>(value);
+        else
+            usage();
+    }
+
+    // acks=0 produces get no response, which would break matching responses by order
+    if (options.connections == 0 || options.pipeline == 0 || options.records_per_batch == 0 || (options.acks != 1 && options.acks != -1))
+        usage();
+
+    for (size_t api = 0; api < BENCH_APIS; api++)
+        if (options.weights[api] > 0 && BENCH_API_INFO[api].needs_topic && options.topic.empty())
+            usage();
+
+    if (options.threads == 0)
+        options.threads = std::max<size_t>(1, std::thread::hardware_concurrency() / 2);
+    options.threads = std::min(options.threads, options.connections);
+    return options;
+}
+
+// Request encoding, Kafka's compact types on top of WireWriter
+
+void writeCompactString(WireWriter &writer, std::string_view str)
+{
+    writer.writeUnsignedVarint(str.size() + 1);
+    writer.write(str.data(), str.size());
+}
+
+// Uncompressed v2 RecordBatch of records_per_batch records with record_size byte values
+std::vector<char> encodeRecordBatch(const Options &options)
+{
+    WireWriter records;
+    const std::string value(options.record_size, 'x');
+    for (size_t i = 0; i < options.records_per_batch; i++)
+    {
+        WireWriter record;
+        const char attributes = 0;
+        record.write(&attributes, 1);
+        record.writeVarint(0);  // timestampDelta
+        record.writeVarint(i);  // offsetDelta
+        record.writeVarint(-1); // Null key
+        record.writeVarint(value.size());
+        record.write(value.data(), value.size());
+        record.writeVarint(0); // No headers
+
+        records.writeVarint(record.size());
+        records.write(record.bytes(), record.size());
+    }
+
+    const int64_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    // Everything the CRC covers, from attributes to the end
+    WireWriter crc_covered;
+    crc_covered.writeBigEndian<int16_t>(0); // attributes
+    crc_covered.writeBigEndian<int32_t>(options.records_per_batch - 1);
+    crc_covered.writeBigEndian<int64_t>(timestamp);
+    crc_covered.writeBigEndian<int64_t>(timestamp);
+    crc_covered.writeBigEndian<int64_t>(-1); // producer_id
+    crc_covered.writeBigEndian<int16_t>(-1); // producer_epoch
+    crc_covered.writeBigEndian<int32_t>(-1); // base_sequence
+    crc_covered.writeBigEndian<int32_t>(options.records_per_batch);
+    crc_covered.write(records.bytes(), records.size());
+
+    WireWriter batch;
+    batch.writeBigEndian<int64_t>(0); // base_offset, assigned by the broker
+    batch.writeBigEndian<int32_t>(4 + 1 + 4 + crc_covered.size()); // partition_leader_epoch + magic + crc + rest
+    batch.writeBigEndian<int32_t>(-1);
+    const char magic = 2;
+    batch.write(&magic, 1);
+    batch.writeBigEndian<uint32_t>(crc32c(crc_covered.bytes(), crc_covered.size()));
+    batch.write(crc_covered.bytes(), crc_covered.size());
+
+    return {batch.bytes(), batch.bytes() + batch.size()};
+}
+
+void encodeBody(WireWriter &writer, BenchApi api, const Options &options, const UUID &topic_id, const std::vector<char> &record_batch)
+{
+    switch (api)
+    {
+    case API_VERSIONS:
+        writeCompactString(writer, "kafka-bench");
+        writeCompactString(writer, "1.0");
+        writer.writeUnsignedVarint(0);
+        break;
+
+    case DESCRIBE_TOPIC_PARTITIONS:
+        writer.writeUnsignedVarint(1 + 1);
+        writeCompactString(writer, options.topic);
+        writer.writeUnsignedVarint(0);
+        writer.writeBigEndian<int32_t>(2000); // response_partition_limit
+        writer.write("\xff", 1);        // No cursor
+        writer.writeUnsignedVarint(0);
+        break;
+
+    case METADATA:
+        writer.writeUnsignedVarint(1 + 1);
+        writer.write(UUID{}.data(), UUID{}.size()); // Looked up by name
+        writeCompactString(writer, options.topic);
+        writer.writeUnsignedVarint(0);
+        writer.write("\x00\x00", 2); // No auto creation, no authorized operations
+        writer.writeUnsignedVarint(0);
+        break;
+
+    case PRODUCE:
+        writer.writeUnsignedVarint(0); // Null transactional_id
+        writer.writeBigEndian<int16_t>(options.acks);
+        writer.writeBigEndian<int32_t>(30000);
+        writer.writeUnsignedVarint(1 + 1);
+        writeCompactString(writer, options.topic);
+        writer.writeUnsignedVarint(1 + 1);
+        writer.writeBigEndian<int32_t>(options.partition);
+        writer.writeUnsignedVarint(record_batch.size() + 1);
+        writer.write(record_batch.data(), record_batch.size());
+        writer.writeUnsignedVarint(0);
+        writer.writeUnsignedVarint(0);
+        writer.writeUnsignedVarint(0);
+        break;
+
+    case FETCH:
+        writer.writeBigEndian<int32_t>(0); // max_wait_ms, answered right away
+        writer.writeBigEndian<int32_t>(1); // min_bytes
+        writer.writeBigEndian<int32_t>(options.fetch_max_bytes);
+        writer.write("\x00", 1); // isolation_level
+        writer.writeBigEndian<int32_t>(0);  // session_id
+        writer.writeBigEndian<int32_t>(-1); // session_epoch
+        writer.writeUnsignedVarint(1 + 1);
+        writer.write(topic_id.data(), topic_id.size());
+        writer.writeUnsignedVarint(1 + 1);
+        writer.writeBigEndian<int32_t>(options.partition);
+        writer.writeBigEndian<int32_t>(-1); // current_leader_epoch
+        writer.writeBigEndian<int64_t>(0);  // fetch_offset, the same data every time
+        writer.writeBigEndian<int32_t>(-1); // last_fetched_epoch
+        writer.writeBigEndian<int64_t>(-1); // log_start_offset
+        writer.writeBigEndian<int32_t>(options.fetch_max_bytes);
+        writer.writeUnsignedVarint(0);
+        writer.writeUnsignedVarint(0);
+        writer.writeUnsignedVarint(1); // No forgotten topics
+        writeCompactString(writer, "");
+        writer.writeUnsignedVarint(0);
+        break;
+
+    case LIST_OFFSETS:
+        writer.writeBigEndian<int32_t>(-1); // replica_id
+        writer.write("\x00", 1);      // isolation_level
+        writer.writeUnsignedVarint(1 + 1);
+        writeCompactString(writer, options.topic);
+        writer.writeUnsignedVarint(1 + 1);
+        writer.writeBigEndian<int32_t>(options.partition);
+        writer.writeBigEndian<int32_t>(-1); // current_leader_epoch
+        writer.writeBigEndian<int64_t>(-1); // Latest offset
+        writer.writeUnsignedVarint(0);
+        writer.writeUnsignedVarint(0);
+        writer.writeUnsignedVarint(0);
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Whole request frame with correlation id 0, patched in place for every send
+std::vector<char> encodeRequest(BenchApi api, const Options &options, const UUID &topic_id, const std::vector<char> &record_batch)
+{
+    WireWriter frame;
+    frame.writeBigEndian<int32_t>(0); // Size, filled in below
+    frame.writeBigEndian<int16_t>(BENCH_API_INFO[api].api_key);
+    frame.writeBigEndian<int16_t>(BENCH_API_INFO[api].api_version);
+    frame.writeBigEndian<int32_t>(0);
+    frame.writeBigEndian<int16_t>(11);
+    frame.write("kafka-bench", 11);
+    frame.writeUnsignedVarint(0);
+    encodeBody(frame, api, options, topic_id, record_batch);
+
+    std::vector<char> request(frame.bytes(), frame.bytes() + frame.size());
+    const uint32_t size = htobe32(request.size() - sizeof(int32_t));
+    std::memcpy(request.data(), &size, sizeof(size));
+    return request;
+}
+
+constexpr size_t CORRELATION_ID_POS = 8;
+
+int connectTo(const Options &options)
+{
+    struct addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses = nullptr;
+    if (getaddrinfo(options.host.c_str(), std::to_string(options.port).c_str(), &hints, &addresses) != 0 || addresses == nullptr)
+        return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd != -1 && connect(fd, addresses->ai_addr, addresses->ai_addrlen) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+
+    if (fd != -1)
+    {
+        int no_delay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    }
+    return fd;
+}
+
+// One request and its response on a blocking socket, the response frame without its size prefix
+std::optional<std::vector<char>> roundTrip(int fd, const std::vector<char> &request)
+{
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+        return std::nullopt;
+
+    int32_t size;
+    if (recv(fd, &size, sizeof(size), MSG_WAITALL) != sizeof(size))
+        return std::nullopt;
+    size = be32toh(size);
+    if (size < 0)
+        return std::nullopt;
+
+    std::vector<char> response(size);
+    if (size > 0 && recv(fd, response.data(), size, MSG_WAITALL) != size)
+        return std::nullopt;
+    return response;
+}
+
+template <typename T>
+T readBE(WireReader &reader)
+{
+    using U = std::make_unsigned_t<T>;
+    U raw{};
+    reader.read(&raw, sizeof(raw));
+    if constexpr (sizeof(T) == 2)
+        raw = be16toh(raw);
+    else if constexpr (sizeof(T) == 4)
+        raw = be32toh(raw);
+    else if constexpr (sizeof(T) == 8)
+        raw = be64toh(raw);
+    return static_cast<T>(raw);
+}
+
+// Error code of the first partition (or topic) in a response, -2 when the response can't be parsed
+int16_t firstErrorCode(BenchApi api, const std::vector<char> &response)
+{
+    WireReader reader(response.data(), response.size());
+    readBE<int32_t>(reader); // correlation_id
+    if (api != API_VERSIONS)
+        reader.readUnsignedVarint(); // Header tagged fields
+
+    int16_t error_code = 0;
+    switch (api)
+    {
+    case API_VERSIONS:
+        error_code = readBE<int16_t>(reader);
+        break;
+
+    case DESCRIBE_TOPIC_PARTITIONS:
+    case METADATA:
+        if (api == METADATA)
+        {
+            readBE<int32_t>(reader); // throttle_time_ms
+            const uint32_t brokers = reader.readUnsignedVarint();
+            for (uint32_t i = 1; i < brokers; i++)
+            {
+                readBE<int32_t>(reader);
+                reader.skip(reader.readUnsignedVarint() - 1); // host
+                readBE<int32_t>(reader);
+                const uint32_t rack = reader.readUnsignedVarint();
+                reader.skip(rack > 0 ? rack - 1 : 0);
+                reader.readUnsignedVarint();
+            }
+            const uint32_t cluster_id = reader.readUnsignedVarint();
+            reader.skip(cluster_id > 0 ? cluster_id - 1 : 0);
+            readBE<int32_t>(reader); // controller_id
+        }
+        else
+            readBE<int32_t>(reader); // throttle_time_ms
+        reader.readUnsignedVarint();
+        error_code = readBE<int16_t>(reader);
+        break;
+
+    case PRODUCE:
+    case LIST_OFFSETS:
+        if (api == LIST_OFFSETS)
+            readBE<int32_t>(reader); // throttle_time_ms
+        reader.readUnsignedVarint();
+        reader.skip(reader.readUnsignedVarint() - 1); // Topic name
+        reader.readUnsignedVarint();
+        readBE<int32_t>(reader); // partition_index
+        error_code = readBE<int16_t>(reader);
+        break;
+
+    case FETCH:
+        readBE<int32_t>(reader); // throttle_time_ms
+        error_code = readBE<int16_t>(reader);
+        if (error_code != 0)
+            break;
+        readBE<int32_t>(reader); // session_id
+        reader.readUnsignedVarint();
+        reader.skip(16); // topic_id
+        reader.readUnsignedVarint();
+        readBE<int32_t>(reader); // partition_index
+        error_code = readBE<int16_t>(reader);
+        break;
+
+    default:
+        break;
+    }
+
+    return reader.ok() ? error_code : -2;
+}
+
+// Topic id from a DescribeTopicPartitions response, all zeros if the topic is unknown
+UUID topicIdFrom(const std::vector<char> &response)
+{
+    UUID topic_id{};
+    WireReader reader(response.data(), response.size());
+    readBE<int32_t>(reader);
+    reader.readUnsignedVarint();
+    readBE<int32_t>(reader);
+    reader.readUnsignedVarint();
+    if (readBE<int16_t>(reader) != 0)
+        return {};
+    const uint32_t name = reader.readUnsignedVarint();
+    reader.skip(name > 0 ? name - 1 : 0);
+    reader.read(topic_id.data(), topic_id.size());
+    return reader.ok() ? topic_id : UUID{};
+}
+
+struct ThreadStats
+{
+    std::array<LatencyHistogram, BENCH_APIS> latencies;
+    std::array<std::atomic<uint64_t>, BENCH_APIS> request_bytes{};
+    std::array<std::atomic<uint64_t>, BENCH_APIS> response_bytes{};
+    std::atomic<uint64_t> responses = 0; // Including warmup, for progress
+    std::atomic<uint64_t> failed_connections = 0;
+};
+
+// What every connection shares: the encoded requests, the mix and the measurement window
+struct BenchPlan
+{
+    std::array<std::vector<char>, BENCH_APIS> requests;
+    std::vector<BenchApi> weighted_apis; // Each API repeated by its weight, drawn uniformly
+    size_t pipeline;
+    uint64_t measure_from_ns;
+    uint64_t measure_until_ns;
+};
+
+class BenchConnection : public EventHandler, public std::enable_shared_from_this<BenchConnection>
+{
+public:
+    BenchConnection(int fd_, EventLoop &loop_, const BenchPlan &plan_, ThreadStats &stats_, uint64_t seed)
+        : fd(fd_), loop(loop_), plan(plan_), stats(stats_), random(seed), next_correlation_id(0), closed(false), interest(0), sent(0) {}
+
+    ~BenchConnection()
+    {
+        if (!closed)
+            close(fd);
+    }
+
+    void start()
+    {
+        interest = EPOLLIN;
+        loop.addFd(fd, interest, shared_from_this());
+        for (size_t i = 0; i < plan.pipeline; i++)
+            sendNext();
+        flush();
+    }
+
+    void onEvents(uint32_t events) override
+    {
+        if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !receive())
+            return;
+        flush();
+    }
+
+private:
+    struct InFlight
+    {
+        int32_t correlation_id;
+        BenchApi api;
+        uint64_t sent_ns;
+    };
+
+    void sendNext()
+    {
+        const BenchApi api = plan.weighted_apis[random() % plan.weighted_apis.size()];
+        const std::vector<char> &request = plan.requests[api];
+
+        const int32_t correlation_id = next_correlation_id++;
+        const uint32_t correlation_id_be = htobe32(correlation_id);
+        const size_t begin = out.size();
+        out.insert(out.end(), request.begin(), request.end());
+        std::memcpy(out.data() + begin + CORRELATION_ID_POS, &correlation_id_be, sizeof(correlation_id_be));
+
+        in_flight.push_back({correlation_id, api, monotonicNs()});
+    }
+
+    bool receive()
+    {
+        char buffer[64 * 1024];
+        while (true)
+        {
+            ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received == 0 || (received == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            {
+                fail("connection closed by the broker");
+                return false;
+            }
+            if (received == -1)
+                break;
+            in.insert(in.end(), buffer, buffer + received);
+        }
+
+        // Every complete response frees a pipeline slot for the next request
+        size_t begin = 0;
+        const uint64_t now_ns = monotonicNs();
+        while (in.size() - begin >= 8)
+        {
+            int32_t size, correlation_id;
+            std::memcpy(&size, in.data() + begin, sizeof(size));
+            std::memcpy(&correlation_id, in.data() + begin + 4, sizeof(correlation_id));
+            size = be32toh(size);
+            correlation_id = be32toh(correlation_id);
+            if (in.size() - begin < sizeof(size) + size)
+                break;
+
+            if (in_flight.empty() || in_flight.front().correlation_id != correlation_id)
+            {
+                fail("response out of order");
+                return false;
+            }
+
+            const InFlight request = in_flight.front();
+            in_flight.pop_front();
+            if (request.sent_ns >= plan.measure_from_ns && now_ns <= plan.measure_until_ns)
+            {
+                stats.latencies[request.api].record(now_ns - request.sent_ns);
+                bumpCounter(stats.request_bytes[request.api], plan.requests[request.api].size());
+                bumpCounter(stats.response_bytes[request.api], sizeof(size) + size);
+            }
+            bumpCounter(stats.responses);
+
+            begin += sizeof(size) + size;
+            sendNext();
+        }
+        in.erase(in.begin(), in.begin() + begin);
+        return true;
+    }
+
+    void flush()
+    {
+        while (sent < out.size())
+        {
+            ssize_t result = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+            if (result == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    fail("send failed");
+                break;
+            }
+            sent += result;
+        }
+
+        if (closed)
+            return;
+        if (sent == out.size())
+        {
+            out.clear();
+            sent = 0;
+        }
+
+        const uint32_t wanted = sent < out.size() ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        if (wanted != interest)
+        {
+            interest = wanted;
+            loop.modifyFd(fd, interest);
+        }
+    }
+
+    void fail(const char *reason)
+    {
+        if (closed)
+            return;
+        closed = true;
+        std::cerr << "Connection lost: " << reason << "\n";
+        bumpCounter(stats.failed_connections);
+        loop.removeFd(fd);
+        close(fd);
+    }
+
+    int fd;
+    EventLoop &loop;
+    const BenchPlan &plan;
+    ThreadStats &stats;
+    std::minstd_rand random;
+    int32_t next_correlation_id;
+    bool closed;
+    uint32_t interest;
+
+    std::deque<InFlight> in_flight;
+    std::vector<char> in;
+    std::vector<char> out;
+    size_t sent;
+};
+
+void report(const std::vector<std::unique_ptr<ThreadStats>> &stats, double measured_s)
+{
+    auto micros = [](uint64_t ns)
+    { return ns / 1000.0; };
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::left << std::setw(26) << "api" << std::right << std::setw(12) << "requests" << std::setw(12) << "req/s"
+              << std::setw(10) << "MB/s out" << std::setw(10) << "MB/s in" << std::setw(10) << "p50 us" << std::setw(10) << "p99 us"
+              << std::setw(10) << "p999 us" << std::setw(10) << "max us" << "\n";
+
+    HistogramSnapshot all;
+    uint64_t all_request_bytes = 0, all_response_bytes = 0;
+
+    auto line = [&](std::string_view name, const HistogramSnapshot &latency, uint64_t request_bytes, uint64_t response_bytes)
+    {
+        std::cout << std::left << std::setw(26) << name << std::right << std::setw(12) << latency.count() << std::setw(12)
+                  << latency.count() / measured_s << std::setw(10) << request_bytes / measured_s / 1e6 << std::setw(10)
+                  << response_bytes / measured_s / 1e6 << std::setw(10) << micros(latency.percentile(0.5)) << std::setw(10)
+                  << micros(latency.percentile(0.99)) << std::setw(10) << micros(latency.percentile(0.999)) << std::setw(10)
+                  << micros(latency.max()) << "\n";
+    };
+
+    for (size_t api = 0; api < BENCH_APIS; api++)
+    {
+        HistogramSnapshot latency;
+        uint64_t request_bytes = 0, response_bytes = 0;
+        for (auto &thread_stats : stats)
+        {
+            latency.add(thread_stats->latencies[api]);
+            all.add(thread_stats->latencies[api]);
+            request_bytes += thread_stats->request_bytes[api].load();
+            response_bytes += thread_stats->response_bytes[api].load();
+        }
+        if (latency.count() == 0)
+            continue;
+
+        all_request_bytes += request_bytes;
+        all_response_bytes += response_bytes;
+        line(apiName(BENCH_API_INFO[api].api_key), latency, request_bytes, response_bytes);
+    }
+    line("all", all, all_request_bytes, all_response_bytes);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options = parseOptions(argc, argv);
+
+    // Every API in the mix is tried once so a wrong topic shows up now, not as a benchmark of error responses
+    int probe_fd = connectTo(options);
+    if (probe_fd == -1)
+    {
+        std::cerr << "Couldn't connect to " << options.host << ":" << options.port << "\n";
+        return EXIT_FAILURE;
+    }
+
+    UUID topic_id{};
+    const std::vector<char> record_batch = encodeRecordBatch(options);
+    if (options.weights[FETCH] > 0)
+    {
+        auto response = roundTrip(probe_fd, encodeRequest(DESCRIBE_TOPIC_PARTITIONS, options, topic_id, record_batch));
+        topic_id = response ? topicIdFrom(*response) : UUID{};
+        if (topic_id == UUID{})
+        {
+            std::cerr << "Topic " << options.topic << " not found, Fetch needs an existing topic\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    BenchPlan plan{.requests = {}, .weighted_apis = {}, .pipeline = options.pipeline, .measure_from_ns = 0, .measure_until_ns = 0};
+    for (size_t api = 0; api < BENCH_APIS; api++)
+    {
+        if (options.weights[api] == 0)
+            continue;
+
+        plan.requests[api] = encodeRequest(static_cast<BenchApi>(api), options, topic_id, record_batch);
+        plan.weighted_apis.insert(plan.weighted_apis.end(), options.weights[api], static_cast<BenchApi>(api));
+
+        auto response = roundTrip(probe_fd, plan.requests[api]);
+        const int16_t error_code = response ? firstErrorCode(static_cast<BenchApi>(api), *response) : -2;
+        if (error_code != 0)
+        {
+            std::cerr << apiName(BENCH_API_INFO[api].api_key) << " probe failed with error " << error_code << "\n";
+            if (BENCH_API_INFO[api].needs_topic)
+                std::cerr << "Does topic " << options.topic << " partition " << options.partition << " exist?\n";
+            return EXIT_FAILURE;
+        }
+    }
+    close(probe_fd);
+
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    std::vector<std::unique_ptr<ThreadStats>> stats;
+    for (size_t i = 0; i < options.threads; i++)
+    {
+        loops.push_back(std::make_unique<EventLoop>());
+        stats.push_back(std::make_unique<ThreadStats>());
+    }
+
+    for (size_t i = 0; i < options.connections; i++)
+    {
+        int fd = connectTo(options);
+        if (fd == -1)
+        {
+            std::cerr << "Couldn't open connection " << i << "\n";
+            return EXIT_FAILURE;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        EventLoop &loop = *loops[i % loops.size()];
+        ThreadStats &thread_stats = *stats[i % stats.size()];
+        loop.post([fd, &loop, &plan, &thread_stats, i]()
+                  { std::make_shared<BenchConnection>(fd, loop, plan, thread_stats, i + 1)->start(); });
+    }
+
+    // The clock starts once every connection is up, connecting can take a while against a short listen backlog
+    const uint64_t start_ns = monotonicNs();
+    plan.measure_from_ns = start_ns + static_cast<uint64_t>(options.warmup_s * 1e9);
+    plan.measure_until_ns = plan.measure_from_ns + static_cast<uint64_t>(options.duration_s * 1e9);
+
+    std::vector<std::thread> threads;
+    for (auto &loop : loops)
+        threads.emplace_back([&loop]()
+                             { loop->run(); });
+
+    std::cout << "Running " << options.connections << " connections x " << options.pipeline << " pipelined requests on "
+              << options.threads << " threads, " << options.warmup_s << "s warmup + " << options.duration_s << "s\n";
+
+    // Progress once a second, the final numbers only cover the window after warmup
+    uint64_t last_responses = 0;
+    uint64_t last_ns = start_ns;
+    while (monotonicNs() < plan.measure_until_ns)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        uint64_t responses = 0;
+        for (auto &thread_stats : stats)
+            responses += thread_stats->responses.load();
+
+        const uint64_t now_ns = monotonicNs();
+        std::cout << "  " << (now_ns < plan.measure_from_ns ? "warmup " : "") << static_cast<uint64_t>((responses - last_responses) * 1e9 / (now_ns - last_ns))
+                  << " req/s\n";
+        last_responses = responses;
+        last_ns = now_ns;
+    }
+
+    for (auto &loop : loops)
+        loop->stop();
+    for (auto &thread : threads)
+        thread.join();
+
+    report(stats, options.duration_s);
+
+    uint64_t failed = 0;
+    for (auto &thread_stats : stats)
+        failed += thread_stats->failed_connections.load();
+    if (failed > 0)
+    {
+        std::cerr << failed << " connections failed\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,298 @@
+#include <benchmark/benchmark.h>
+
+#include "common.h"
+#include "wire_buffer.h"
+#include "log_parsing.h"
+#include "metadata_index.h"
+#include "metadata_log_writer.h"
+#include "kafka_utils.h"
+#include "broker_config.h"
+
+// Microbenchmarks of the hot paths in isolation: varint decoding, RecordBatch decoding, metadata log loading
+// and response encoding, over synthetic inputs at 10 / 1k / 100k topics and partitions.
+
+namespace
+{
+
+constexpr int64_t VARINTS = 100000;
+
+std::filesystem::path scratch_dir;
+
+UUID topicId(uint32_t topic)
+{
+    UUID topic_id{};
+    topic_id[0] = 0x71;
+    const uint32_t topic_be = htobe32(topic);
+    std::memcpy(topic_id.data() + topic_id.size() - sizeof(topic_be), &topic_be, sizeof(topic_be));
+    return topic_id;
+}
+
+std::string topicName(uint32_t topic)
+{
+    return "topic" + std::to_string(topic);
+}
+
+std::string writeScratchFile(const std::string &name, const WireWriter &contents)
+{
+    const std::string path = scratch_dir / name;
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(contents.bytes(), contents.size());
+    return path;
+}
+
+// Metadata log of topics x partitions (3 replicas each), written once per shape as the only segment of
+// <scratch>/metadata-<topics>-<partitions>/__cluster_metadata-0
+const std::string &metadataLog(int64_t topics, int64_t partitions)
+{
+    static std::map<std::pair<int64_t, int64_t>, std::string> logs;
+
+    std::string &path = logs[{topics, partitions}];
+    if (path.empty())
+    {
+        constexpr std::array<int32_t, 3> REPLICAS = {1, 2, 3};
+
+        MetadataLogWriter writer;
+        writer.addFeatureLevel("metadata.version", 20);
+        for (uint32_t topic = 0; topic < topics; topic++)
+        {
+            writer.addTopic(topicName(topic), topicId(topic));
+            for (int32_t partition = 0; partition < partitions; partition++)
+                writer.addPartition(topicId(topic), partition, REPLICAS[partition % REPLICAS.size()], 0, REPLICAS, REPLICAS);
+        }
+        const std::string partition_dir = "metadata-" + std::to_string(topics) + "-" + std::to_string(partitions) + "/__cluster_metadata-0";
+        std::filesystem::create_directories(scratch_dir / partition_dir);
+        path = writeScratchFile(partition_dir + "/00000000000000000000.log", writer.bytes());
+    }
+    return path;
+}
+
+// Varints that all take `bytes` bytes on the wire, signed ones alternate in sign
+WireWriter varints(int64_t bytes, bool zigzag)
+{
+    WireWriter writer;
+    const uint32_t largest = (uint32_t(1) << (7 * bytes)) - 1;
+    for (int64_t i = 0; i < VARINTS; i++)
+    {
+        if (zigzag)
+        {
+            const int64_t magnitude = (largest >> 1) - (i % 8);
+            writer.writeVarint(i % 2 == 0 ? magnitude : -magnitude);
+        }
+        else
+            writer.writeUnsignedVarint(largest - (i % 8));
+    }
+    return writer;
+}
+
+void BM_VarintReadValue(benchmark::State &state)
+{
+    std::ifstream file(writeScratchFile("varints.bin", varints(state.range(0), true)), std::ios::binary);
+
+    Varint varint;
+    for (auto _ : state)
+    {
+        file.clear();
+        file.seekg(0);
+        for (int64_t i = 0; i < VARINTS; i++)
+        {
+            varint.readValue(file);
+            benchmark::DoNotOptimize(varint.getValue());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * VARINTS);
+}
+BENCHMARK(BM_VarintReadValue)->DenseRange(1, 4);
+
+void BM_UnsignedVarintReadValue(benchmark::State &state)
+{
+    std::ifstream file(writeScratchFile("unsigned_varints.bin", varints(state.range(0), false)), std::ios::binary);
+
+    UnsignedVarint varint;
+    for (auto _ : state)
+    {
+        file.clear();
+        file.seekg(0);
+        for (int64_t i = 0; i < VARINTS; i++)
+        {
+            varint.readValue(file);
+            benchmark::DoNotOptimize(varint.getValue());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * VARINTS);
+}
+BENCHMARK(BM_UnsignedVarintReadValue)->DenseRange(1, 4);
+
+// Request path counterpart of UnsignedVarint, decoding from a buffered frame
+void BM_WireReaderUnsignedVarint(benchmark::State &state)
+{
+    const WireWriter encoded = varints(state.range(0), false);
+
+    for (auto _ : state)
+    {
+        WireReader reader(encoded.bytes(), encoded.size());
+        for (int64_t i = 0; i < VARINTS; i++)
+            benchmark::DoNotOptimize(reader.readUnsignedVarint());
+    }
+    state.SetItemsProcessed(state.iterations() * VARINTS);
+}
+BENCHMARK(BM_WireReaderUnsignedVarint)->DenseRange(1, 4);
+
+// One batch of range(0) records, a TopicRecord and a PartitionRecord per topic
+void BM_RecordBatchDecode(benchmark::State &state)
+{
+    const int64_t records = state.range(0);
+    constexpr std::array<int32_t, 3> REPLICAS = {1, 2, 3};
+
+    MetadataLogWriter writer(records);
+    for (uint32_t topic = 0; topic < records / 2; topic++)
+    {
+        writer.addTopic(topicName(topic), topicId(topic));
+        writer.addPartition(topicId(topic), 0, 1, 0, REPLICAS, REPLICAS);
+    }
+    const WireWriter &batch = writer.bytes();
+    std::ifstream file(writeScratchFile("batch-" + std::to_string(records) + ".log", batch), std::ios::binary);
+
+    for (auto _ : state)
+    {
+        file.clear();
+        file.seekg(0);
+        RecordBatch record_batch(file);
+        benchmark::DoNotOptimize(&record_batch);
+    }
+    state.SetItemsProcessed(state.iterations() * records);
+    state.SetBytesProcessed(state.iterations() * batch.size());
+}
+BENCHMARK(BM_RecordBatchDecode)->Arg(10)->Arg(1000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+// Whole metadata log into a MetadataImage, what a broker does at startup and on every metadata change
+void BM_LoadMetadataImage(benchmark::State &state)
+{
+    const std::string &path = metadataLog(state.range(0), state.range(1));
+
+    for (auto _ : state)
+    {
+        MetadataImage image;
+        LogParser log_parser(path);
+        log_parser.loadMetadataImage(image);
+        image.finalize();
+        benchmark::DoNotOptimize(image.partitionCount());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * (1 + state.range(1)));
+    state.SetBytesProcessed(state.iterations() * std::filesystem::file_size(path));
+}
+BENCHMARK(BM_LoadMetadataImage)->ArgNames({"topics", "partitions"})->Args({10, 1})->Args({1000, 1})->Args({100000, 1})->Args({1000, 100})->Unit(benchmark::kMillisecond);
+
+// Points the request handlers at the metadata log of that shape
+void useMetadataLog(int64_t topics, int64_t partitions)
+{
+    BrokerConfig config;
+    config.metadata_log_dir = std::filesystem::path(metadataLog(topics, partitions)).parent_path().parent_path();
+    setBrokerConfig(std::move(config));
+    MetadataImage::reload();
+}
+
+// Encoded request frame with a v2 header
+template <typename RequestBodyT>
+std::pair<RequestHeaderV2, RequestBodyT> decodeRequest(int16_t api_key, int16_t api_version, const WireWriter &body)
+{
+    WireWriter frame;
+    frame.writeBigEndian<int32_t>(2 + 2 + 4 + 2 + 4 + 1 + body.size());
+    frame.writeBigEndian(api_key);
+    frame.writeBigEndian(api_version);
+    frame.writeBigEndian<int32_t>(1);
+    frame.writeBigEndian<int16_t>(4);
+    frame.write("mbch", 4);
+    frame.writeUnsignedVarint(0);
+    frame.write(body.bytes(), body.size());
+
+    WireReader reader(frame.bytes(), frame.size());
+    std::pair<RequestHeaderV2, RequestBodyT> request;
+    request.first.receive(reader);
+    request.second.receive(reader);
+    return request;
+}
+
+template <typename ProcessT>
+size_t encodeResponse(ProcessT &&process)
+{
+    auto [response_header, response_body] = process();
+    WireWriter writer;
+    response_header->respond(writer);
+    response_body->respond(writer);
+    return writer.size();
+}
+
+// DescribeTopicPartitions of range(1) topics spread over an image of range(0) topics
+void BM_DescribeTopicPartitionsResponse(benchmark::State &state)
+{
+    const int64_t image_topics = state.range(0);
+    const int64_t requested = state.range(1);
+    useMetadataLog(image_topics, 1);
+
+    WireWriter body;
+    body.writeUnsignedVarint(requested + 1);
+    for (int64_t i = 0; i < requested; i++)
+    {
+        const std::string name = topicName(i * image_topics / requested);
+        body.writeUnsignedVarint(name.size() + 1);
+        body.write(name.data(), name.size());
+        body.writeUnsignedVarint(0);
+    }
+    body.writeBigEndian<int32_t>(2000);
+    body.write("\xff", 1);
+    body.writeUnsignedVarint(0);
+    auto [header, request] = decodeRequest<DescribeTopicPartitionsRequestBodyV0>(75, 0, body);
+
+    auto process = [&]()
+    { return processDescribeTopicPartitions(header, request); };
+    size_t response_size = encodeResponse(process); // Builds the image outside the measurement
+    for (auto _ : state)
+        response_size = encodeResponse(process);
+    state.SetItemsProcessed(state.iterations() * requested);
+    state.SetBytesProcessed(state.iterations() * response_size);
+}
+BENCHMARK(BM_DescribeTopicPartitionsResponse)->ArgNames({"image_topics", "requested"})->Args({10, 10})->Args({1000, 10})->Args({100000, 10})->Args({1000, 1000})->Unit(benchmark::kMicrosecond);
+
+// Metadata for every topic (null topic list) of a range(0) x range(1) image
+void BM_MetadataResponse(benchmark::State &state)
+{
+    useMetadataLog(state.range(0), state.range(1));
+
+    WireWriter body;
+    body.writeUnsignedVarint(0); // All topics
+    body.write("\x00\x00", 2);
+    body.writeUnsignedVarint(0);
+    auto [header, request] = decodeRequest<MetadataRequestBodyV12>(3, 12, body);
+
+    auto process = [&]()
+    { return processMetadata(header, request); };
+    size_t response_size = encodeResponse(process); // Builds the image outside the measurement
+    for (auto _ : state)
+        response_size = encodeResponse(process);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * response_size);
+}
+BENCHMARK(BM_MetadataResponse)->ArgNames({"topics", "partitions"})->Args({10, 1})->Args({1000, 1})->Args({100000, 1})->Args({1000, 100})->Unit(benchmark::kMicrosecond);
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return EXIT_FAILURE;
+
+    char dir_template[] = "/tmp/kafka_microbench.XXXXXX";
+    if (mkdtemp(dir_template) == nullptr)
+    {
+        std::perror("Error occured");
+        return EXIT_FAILURE;
+    }
+    scratch_dir = dir_template;
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    std::filesystem::remove_all(scratch_dir);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#include "admission.h"
+#include "broker_config.h"
+
+static std::atomic<int64_t> connection_count = 0;
+static std::atomic<int64_t> queued_bytes = 0;
+
+// Only kept with max.connections.per.ip set
+static std::mutex per_ip_mutex;
+static std::unordered_map<in_addr_t, int32_t> per_ip_connections;
+
+bool AdmissionControl::connectionsFull()
+{
+    return connection_count.load(std::memory_order_relaxed) >= brokerConfig().max_connections;
+}
+
+bool AdmissionControl::admitConnection(in_addr_t addr)
+{
+    const int32_t max_per_ip = brokerConfig().max_connections_per_ip;
+    if (max_per_ip != INT32_MAX)
+    {
+        std::lock_guard<std::mutex> lock(per_ip_mutex);
+        int32_t &count = per_ip_connections[addr];
+        if (count >= max_per_ip)
+            return false;
+        count++;
+    }
+    connection_count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void AdmissionControl::releaseConnection(in_addr_t addr)
+{
+    connection_count.fetch_sub(1, std::memory_order_relaxed);
+    if (brokerConfig().max_connections_per_ip == INT32_MAX)
+        return;
+
+    std::lock_guard<std::mutex> lock(per_ip_mutex);
+    auto it = per_ip_connections.find(addr);
+    if (it != per_ip_connections.end() && --it->second == 0)
+        per_ip_connections.erase(it);
+}
+
+void AdmissionControl::addQueuedBytes(int64_t delta)
+{
+    queued_bytes.fetch_add(delta, std::memory_order_relaxed);
+}
+
+bool AdmissionControl::queuedBytesFull()
+{
+    const int64_t max_bytes = brokerConfig().queued_max_request_bytes;
+    return max_bytes > 0 && queued_bytes.load(std::memory_order_relaxed) >= max_bytes;
+}
+
+int64_t AdmissionControl::connections()
+{
+    return connection_count.load(std::memory_order_relaxed);
+}
+
+int64_t AdmissionControl::queuedBytes()
+{
+    return queued_bytes.load(std::memory_order_relaxed);
+}
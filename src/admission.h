@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common.h"
+
+// Broker-wide limits on what clients can make the broker hold: connections (max.connections, and per address
+// max.connections.per.ip) and bytes of received requests not processed yet (queued.max.request.bytes). At a limit
+// the broker stops accepting or stops reading, overload backs up into the clients' sockets instead of memory.
+class AdmissionControl
+{
+public:
+    static constexpr int64_t RETRY_MS = 10; // How often paused accepts and reads look again
+
+    // Whether max.connections is reached, accepting waits for connections to close
+    static bool connectionsFull();
+    // Counts a connection from addr, false (nothing counted) when addr is at max.connections.per.ip
+    static bool admitConnection(in_addr_t addr);
+    static void releaseConnection(in_addr_t addr);
+
+    // Received request bytes waiting to be processed, over every connection
+    static void addQueuedBytes(int64_t delta);
+    static bool queuedBytesFull();
+
+    static int64_t connections();
+    static int64_t queuedBytes();
+};
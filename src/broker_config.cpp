@@ -0,0 +1,377 @@
+#include "broker_config.h"
+
+static BrokerConfig broker_config;
+
+const BrokerConfig &brokerConfig()
+{
+    return broker_config;
+}
+
+void setBrokerConfig(BrokerConfig config)
+{
+    broker_config = std::move(config);
+}
+
+static std::string_view trim(std::string_view str)
+{
+    const size_t begin = str.find_first_not_of(" \t\r");
+    if (begin == std::string_view::npos)
+        return {};
+    return str.substr(begin, str.find_last_not_of(" \t\r") - begin + 1);
+}
+
+static std::vector<std::string_view> splitList(std::string_view list)
+{
+    std::vector<std::string_view> items;
+    while (!list.empty())
+    {
+        const size_t comma = list.find(',');
+        if (std::string_view item = trim(list.substr(0, comma)); !item.empty())
+            items.push_back(item);
+        list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+    }
+    return items;
+}
+
+template <typename T>
+static bool parseNumber(std::string_view key, std::string_view value, T &number)
+{
+    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+    if (error != std::errc() || end != value.data() + value.size())
+    {
+        std::cerr << "Invalid value " << value << " for " << key << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <typename T>
+static bool parsePositive(std::string_view key, std::string_view value, T &number)
+{
+    if (!parseNumber(key, value, number))
+        return false;
+    if (number <= 0)
+    {
+        std::cerr << key << " must be at least 1" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool parseBool(std::string_view key, std::string_view value, bool &flag)
+{
+    if (value != "true" && value != "false")
+    {
+        std::cerr << "Invalid value " << value << " for " << key << std::endl;
+        return false;
+    }
+    flag = value == "true";
+    return true;
+}
+
+std::optional<uint8_t> parseCleanupPolicy(std::string_view value)
+{
+    uint8_t policy = 0;
+    for (std::string_view item : splitList(value))
+    {
+        if (item == "delete")
+            policy |= CLEANUP_DELETE;
+        else if (item == "compact")
+            policy |= CLEANUP_COMPACT;
+        else
+            return std::nullopt;
+    }
+    if (policy == 0)
+        return std::nullopt;
+    return policy;
+}
+
+struct Listener
+{
+    std::string_view name;
+    std::string_view host;
+    uint16_t port;
+};
+
+// NAME://host:port entries, IPv6 hosts in brackets
+static std::optional<std::vector<Listener>> parseListeners(std::string_view key, std::string_view value)
+{
+    std::vector<Listener> listeners;
+    for (std::string_view entry : splitList(value))
+    {
+        const size_t scheme_end = entry.find("://");
+        const size_t port_begin = entry.rfind(':');
+        if (scheme_end == std::string_view::npos || port_begin <= scheme_end)
+        {
+            std::cerr << "Invalid listener " << entry << " in " << key << std::endl;
+            return std::nullopt;
+        }
+
+        Listener listener{.name = entry.substr(0, scheme_end), .host = entry.substr(scheme_end + 3, port_begin - scheme_end - 3), .port = 0};
+        if (listener.host.size() >= 2 && listener.host.front() == '[' && listener.host.back() == ']')
+            listener.host = listener.host.substr(1, listener.host.size() - 2);
+        if (!parseNumber(key, entry.substr(port_begin + 1), listener.port))
+            return std::nullopt;
+        listeners.push_back(listener);
+    }
+    return listeners;
+}
+
+bool BrokerConfig::set(std::string_view key, std::string_view value)
+{
+    if (key == "node.id")
+        return parseNumber(key, value, node_id);
+    if (key == "listeners" || key == "advertised.listeners")
+    {
+        if (!parseListeners(key, value))
+            return false;
+        (key == "listeners" ? listeners : advertised_listeners) = value;
+        return true;
+    }
+    if (key == "controller.listener.names")
+    {
+        controller_listener_names.clear();
+        for (std::string_view name : splitList(value))
+            controller_listener_names.emplace_back(name);
+        return true;
+    }
+    if (key == "log.dirs" || key == "log.dir")
+    {
+        log_dirs.clear();
+        for (std::string_view dir : splitList(value))
+            log_dirs.emplace_back(dir);
+        if (log_dirs.empty())
+        {
+            std::cerr << "No directory in " << key << std::endl;
+            return false;
+        }
+        return true;
+    }
+    if (key == "metadata.log.dir")
+    {
+        metadata_log_dir = value;
+        return true;
+    }
+    if (key == "num.network.threads")
+        return parsePositive(key, value, num_network_threads);
+    if (key == "shard.count")
+        return parseNumber(key, value, shard_count);
+    if (key == "socket.listen.backlog.size")
+        return parseNumber(key, value, socket_listen_backlog_size);
+    if (key == "socket.send.buffer.bytes")
+        return parseNumber(key, value, socket_send_buffer_bytes);
+    if (key == "socket.receive.buffer.bytes")
+        return parseNumber(key, value, socket_receive_buffer_bytes);
+    if (key == "socket.request.max.bytes")
+        return parseNumber(key, value, socket_request_max_bytes);
+    if (key == "connections.max.idle.ms")
+        return parseNumber(key, value, connections_max_idle_ms);
+    if (key == "max.connections")
+        return parsePositive(key, value, max_connections);
+    if (key == "max.connections.per.ip")
+        return parsePositive(key, value, max_connections_per_ip);
+    if (key == "queued.max.request.bytes")
+        return parseNumber(key, value, queued_max_request_bytes);
+    if (key == "connection.max.in.flight.requests")
+        return parsePositive(key, value, connection_max_in_flight_requests);
+    if (key == "shutdown.drain.timeout.ms")
+        return parseNumber(key, value, shutdown_drain_timeout_ms);
+    if (key == "quota.producer.default")
+        return parsePositive(key, value, quota_producer_default);
+    if (key == "quota.consumer.default")
+        return parsePositive(key, value, quota_consumer_default);
+    if (key == "quota.request.rate.default")
+        return parsePositive(key, value, quota_request_rate_default);
+    if (key == "log.segment.bytes")
+        return parseNumber(key, value, log_segment_bytes);
+    if (key == "compression.type")
+    {
+        if (value == "producer")
+        {
+            compression_type.reset();
+            return true;
+        }
+        compression_type = compressionCodecByName(value);
+        if (!compression_type || !compressionSupported(*compression_type))
+        {
+            std::cerr << "Unsupported compression.type " << value << std::endl;
+            return false;
+        }
+        return true;
+    }
+    if (key == "log.flush.interval.messages")
+        return parseNumber(key, value, log_flush_interval_messages);
+    if (key == "log.flush.interval.ms")
+        return parsePositive(key, value, log_flush_interval_ms);
+    if (key == "log.retention.ms" || key == "log.retention.minutes" || key == "log.retention.hours")
+    {
+        const int unit = key == "log.retention.ms" ? 3 : key == "log.retention.minutes" ? 2 : 1;
+        int64_t retention;
+        if (!parseNumber(key, value, retention))
+            return false;
+        if (unit < log_retention_unit)
+            return true;
+
+        constexpr int64_t UNIT_MS[] = {0, 60 * 60 * 1000, 60 * 1000, 1};
+        log_retention_ms = retention < 0 ? -1 : retention * UNIT_MS[unit];
+        log_retention_unit = unit;
+        return true;
+    }
+    if (key == "log.retention.bytes")
+        return parseNumber(key, value, log_retention_bytes);
+    if (key == "log.retention.check.interval.ms")
+        return parsePositive(key, value, log_retention_check_interval_ms);
+    if (key == "log.cleanup.policy")
+    {
+        auto policy = parseCleanupPolicy(value);
+        if (!policy)
+        {
+            std::cerr << "Invalid value " << value << " for " << key << std::endl;
+            return false;
+        }
+        log_cleanup_policy = *policy;
+        return true;
+    }
+    if (key == "log.cleaner.enable")
+        return parseBool(key, value, log_cleaner_enable);
+    if (key == "log.cleaner.backoff.ms")
+        return parsePositive(key, value, log_cleaner_backoff_ms);
+    if (key == "log.cleaner.dedupe.buffer.size")
+        return parsePositive(key, value, log_cleaner_dedupe_buffer_size);
+    if (key == "log.cleaner.min.cleanable.ratio")
+    {
+        if (!parseNumber(key, value, log_cleaner_min_cleanable_ratio))
+            return false;
+        if (log_cleaner_min_cleanable_ratio < 0 || log_cleaner_min_cleanable_ratio > 1)
+        {
+            std::cerr << key << " must be between 0 and 1" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    if (key == "log.cleaner.delete.retention.ms")
+        return parseNumber(key, value, log_cleaner_delete_retention_ms);
+    if (key == "metadata.log.compaction.enable")
+        return parseBool(key, value, metadata_log_compaction_enable);
+    if (key == "group.initial.rebalance.delay.ms")
+        return parseNumber(key, value, group_initial_rebalance_delay_ms);
+    if (key == "group.min.session.timeout.ms")
+        return parseNumber(key, value, group_min_session_timeout_ms);
+    if (key == "group.max.session.timeout.ms")
+        return parseNumber(key, value, group_max_session_timeout_ms);
+    if (key == "offset.metadata.max.bytes")
+        return parseNumber(key, value, offset_metadata_max_bytes);
+    if (key == "offsets.snapshot.interval.ms")
+        return parsePositive(key, value, offsets_snapshot_interval_ms);
+    if (key == "metrics.port")
+        return parseNumber(key, value, metrics_port);
+
+    return true;
+}
+
+bool BrokerConfig::load(const std::string &path)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Couldn't open " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::string_view entry = trim(line);
+        if (entry.empty() || entry.front() == '#' || entry.front() == '!')
+            continue;
+
+        const size_t separator = entry.find_first_of("=:");
+        if (separator == std::string_view::npos)
+        {
+            std::cerr << "Invalid line " << entry << " in " << path << std::endl;
+            return false;
+        }
+
+        if (!set(trim(entry.substr(0, separator)), trim(entry.substr(separator + 1))))
+            return false;
+    }
+    return true;
+}
+
+static std::optional<Listener> brokerListener(std::string_view key, std::string_view value, const std::vector<std::string> &controller_listener_names)
+{
+    auto listeners = parseListeners(key, value);
+    if (!listeners)
+        return std::nullopt;
+
+    auto listener = std::find_if(listeners->begin(), listeners->end(), [](const Listener &l)
+                                 { return l.name == "PLAINTEXT"; });
+    if (listener == listeners->end())
+        listener = std::find_if(listeners->begin(), listeners->end(), [&](const Listener &l)
+                                { return std::find(controller_listener_names.begin(), controller_listener_names.end(), l.name) == controller_listener_names.end(); });
+    if (listener == listeners->end())
+    {
+        std::cerr << "No broker listener in " << key << std::endl;
+        return std::nullopt;
+    }
+    return *listener;
+}
+
+bool BrokerConfig::resolveListeners()
+{
+    auto listener = brokerListener("listeners", listeners, controller_listener_names);
+    if (!listener)
+        return false;
+    listener_host = listener->host;
+    listener_port = listener->port;
+
+    if (advertised_listeners.empty())
+    {
+        advertised_host = listener_host.empty() || listener_host == "0.0.0.0" ? "localhost" : listener_host;
+        advertised_port = listener_port;
+        return true;
+    }
+
+    auto advertised = brokerListener("advertised.listeners", advertised_listeners, controller_listener_names);
+    if (!advertised)
+        return false;
+    advertised_host = advertised->host.empty() ? "localhost" : advertised->host;
+    advertised_port = advertised->port;
+    return true;
+}
+
+std::string BrokerConfig::metadataPartitionDir() const
+{
+    return (metadata_log_dir.empty() ? log_dirs.front() : metadata_log_dir) + "/__cluster_metadata-0";
+}
+
+std::optional<BrokerConfig> BrokerConfig::fromCommandLine(int argc, char *argv[])
+{
+    BrokerConfig config;
+
+    int arg = 1;
+    if (arg < argc && std::string_view(argv[arg]) != "--override")
+    {
+        if (!config.load(argv[arg]))
+            return std::nullopt;
+        arg++;
+    }
+
+    for (; arg < argc; arg += 2)
+    {
+        const std::string_view override = arg + 1 < argc ? argv[arg + 1] : "";
+        const size_t separator = override.find('=');
+        if (std::string_view(argv[arg]) != "--override" || separator == std::string_view::npos)
+        {
+            std::cerr << "Usage: " << argv[0] << " [server.properties] [--override key=value]..." << std::endl;
+            return std::nullopt;
+        }
+
+        if (!config.set(trim(override.substr(0, separator)), trim(override.substr(separator + 1))))
+            return std::nullopt;
+    }
+
+    if (!config.resolveListeners())
+        return std::nullopt;
+    return config;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "common.h"
+#include "compression.h"
+
+// cleanup.policy bits, of a topic or the log.cleanup.policy default
+enum CleanupPolicy : uint8_t
+{
+    CLEANUP_DELETE = 1,
+    CLEANUP_COMPACT = 2
+};
+
+// "delete", "compact" or both comma separated, nullopt for anything else
+std::optional<uint8_t> parseCleanupPolicy(std::string_view value);
+
+// Broker settings, read from a server.properties file with Kafka's property names and defaults
+// (unless noted) and overridden from the command line
+struct BrokerConfig
+{
+    int32_t node_id = 1;
+
+    std::string listeners = "PLAINTEXT://:9092";
+    std::string advertised_listeners; // The listener (localhost for an empty host) when empty
+    std::vector<std::string> controller_listener_names = {"CONTROLLER"};
+
+    // Broker listener picked from the lists above by resolveListeners(), an empty host binds every interface
+    std::string listener_host;
+    uint16_t listener_port = 9092;
+    std::string advertised_host = "localhost";
+    uint16_t advertised_port = 9092;
+
+    std::vector<std::string> log_dirs = {"/tmp/kraft-combined-logs"};
+    std::string metadata_log_dir; // metadata.log.dir, the first of log_dirs when empty
+
+    size_t num_network_threads = 3;
+    // shard.count, not a Kafka property. 0 serves connections on the num.network.threads pool, otherwise that many
+    // shards, each a reactor thread pinned to a CPU owning its own connections and partitions (see ShardSet)
+    size_t shard_count = 0;
+    int socket_listen_backlog_size = 50;
+    int socket_send_buffer_bytes = 100 * 1024; // -1 keeps the OS default
+    int socket_receive_buffer_bytes = 100 * 1024;
+    int32_t socket_request_max_bytes = 100 * 1024 * 1024;
+    int64_t connections_max_idle_ms = 10 * 60 * 1000;
+    int32_t max_connections = INT32_MAX; // Accepting pauses at this many connections
+    int32_t max_connections_per_ip = INT32_MAX; // Connections from an address past this are closed right away
+    int64_t queued_max_request_bytes = -1; // Received and unprocessed request bytes before reads pause, -1 for no limit
+    // connection.max.in.flight.requests, not a Kafka property. Requests of a connection decoded and not yet answered
+    // before it stops reading
+    size_t connection_max_in_flight_requests = 500;
+    // shutdown.drain.timeout.ms, not a Kafka property. How long a shutdown waits for connections to answer and send
+    // what they have in flight before the rest are cut off
+    int64_t shutdown_drain_timeout_ms = 5000;
+    // Default quota of every client id per second: produce request bytes, fetch response bytes and requests of any
+    // kind. quota.producer.default and quota.consumer.default are Kafka's old static defaults, quota.request.rate.default
+    // isn't a Kafka property. A client over quota gets a throttle_time_ms and its connection is muted that long.
+    int64_t quota_producer_default = INT64_MAX;
+    int64_t quota_consumer_default = INT64_MAX;
+    int64_t quota_request_rate_default = INT64_MAX;
+
+    uint64_t log_segment_bytes = 1024 * 1024 * 1024;
+    // compression.type, nullopt is "producer": batches are stored with the codec they were produced with
+    std::optional<CompressionCodec> compression_type;
+    // Data is left to the page cache unless one of these is set, like Kafka
+    int64_t log_flush_interval_messages = INT64_MAX;
+    int64_t log_flush_interval_ms = INT64_MAX;
+    // Closed segments are deleted once older than log.retention.ms (or .minutes, .hours, the finest unit set wins)
+    // or no longer needed to keep a partition within log.retention.bytes, -1 disables either
+    int64_t log_retention_ms = 7 * 24 * 60 * 60 * 1000LL;
+    int64_t log_retention_bytes = -1;
+    int64_t log_retention_check_interval_ms = 5 * 60 * 1000;
+
+    uint8_t log_cleanup_policy = CLEANUP_DELETE; // Of topics without a cleanup.policy of their own
+    bool log_cleaner_enable = true;
+    int64_t log_cleaner_backoff_ms = 15 * 1000;
+    size_t log_cleaner_dedupe_buffer_size = 128 * 1024 * 1024; // Bounds the key -> offset map of a cleaning
+    double log_cleaner_min_cleanable_ratio = 0.5;              // Dirty share of the closed segments before a log is cleaned
+    int64_t log_cleaner_delete_retention_ms = 24 * 60 * 60 * 1000; // How long cleaned tombstones stay readable
+    // metadata.log.compaction.enable, not a Kafka property. Compacts the closed segments of __cluster_metadata
+    // (latest FeatureLevel, Topic and PartitionRecord of each feature, topic name and partition) with the cleaner. Off by
+    // default, the log belongs to the controller.
+    bool metadata_log_compaction_enable = false;
+
+    int64_t group_initial_rebalance_delay_ms = 3000; // An empty group waits this long for more members before its first rebalance
+    int32_t group_min_session_timeout_ms = 6000;
+    int32_t group_max_session_timeout_ms = 30 * 60 * 1000;
+    size_t offset_metadata_max_bytes = 4096;
+    // offsets.snapshot.interval.ms, not a Kafka property. How often the committed offsets are snapshotted next to
+    // __consumer_offsets, a restart replays only the log after the snapshot
+    int64_t offsets_snapshot_interval_ms = 60 * 1000;
+
+    uint16_t metrics_port = 0; // metrics.port, not a Kafka property. Prometheus endpoint, 0 disables it
+
+    // Unit log_retention_ms was last set with, 0 (default) hours minutes ms
+    int log_retention_unit = 0;
+
+    // Applies one property, unknown keys are ignored. False (after printing why) on a malformed value.
+    bool set(std::string_view key, std::string_view value);
+    // key=value or key: value lines, # and ! start comments
+    bool load(const std::string &path);
+
+    // Picks the PLAINTEXT listener, or the first that isn't a controller listener
+    bool resolveListeners();
+    // Directory of the __cluster_metadata partition, its segments make up the metadata log
+    std::string metadataPartitionDir() const;
+
+    // kafka [server.properties] [--override key=value]..., nullopt (after printing why) on bad arguments
+    static std::optional<BrokerConfig> fromCommandLine(int argc, char *argv[]);
+};
+
+// Process-wide configuration, only replaced before the broker starts serving requests
+const BrokerConfig &brokerConfig();
+void setBrokerConfig(BrokerConfig config);
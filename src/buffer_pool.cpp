@@ -0,0 +1,126 @@
+#include "buffer_pool.h"
+
+struct alignas(64) NodeFreeList
+{
+    std::mutex mutex;
+    std::vector<char *> chunks;
+};
+
+static std::array<NodeFreeList, BufferPool::MAX_NODES> node_lists;
+static std::atomic<size_t> allocated_chunks = 0;
+static std::atomic<size_t> pooled_chunks = 0;
+
+static NodeFreeList &currentNodeList()
+{
+    unsigned cpu = 0, node = 0;
+    if (getcpu(&cpu, &node) != 0)
+        node = 0;
+    return node_lists[node % BufferPool::MAX_NODES];
+}
+
+// Free chunks of one thread, handed back to its node when the thread exits
+struct ThreadCache
+{
+    std::vector<char *> chunks;
+
+    ~ThreadCache()
+    {
+        if (chunks.empty())
+            return;
+        NodeFreeList &list = currentNodeList();
+        std::lock_guard<std::mutex> lock(list.mutex);
+        list.chunks.insert(list.chunks.end(), chunks.begin(), chunks.end());
+        pooled_chunks += chunks.size();
+    }
+};
+
+static thread_local ThreadCache thread_cache;
+
+static void refill(std::vector<char *> &cache)
+{
+    NodeFreeList &list = currentNodeList();
+    {
+        std::lock_guard<std::mutex> lock(list.mutex);
+        const size_t taken = std::min(list.chunks.size(), BufferPool::BATCH_CHUNKS);
+        cache.insert(cache.end(), list.chunks.end() - taken, list.chunks.end());
+        list.chunks.resize(list.chunks.size() - taken);
+        pooled_chunks -= taken;
+    }
+    if (!cache.empty())
+        return;
+
+    // Pages are only backed once written, by the thread about to use the chunks
+    const size_t slab_bytes = BufferPool::SLAB_CHUNKS * BufferPool::CHUNK_SIZE;
+    void *slab = mmap(nullptr, slab_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab == MAP_FAILED)
+    {
+        std::perror("Error occured");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = BufferPool::SLAB_CHUNKS; i > 0; i--)
+        cache.push_back(static_cast<char *>(slab) + (i - 1) * BufferPool::CHUNK_SIZE);
+    allocated_chunks += BufferPool::SLAB_CHUNKS;
+}
+
+char *BufferPool::acquire()
+{
+    std::vector<char *> &cache = thread_cache.chunks;
+    if (cache.empty())
+        refill(cache);
+    char *chunk = cache.back();
+    cache.pop_back();
+    return chunk;
+}
+
+void BufferPool::release(char *chunk)
+{
+    std::vector<char *> &cache = thread_cache.chunks;
+    cache.push_back(chunk);
+    if (cache.size() <= CACHED_CHUNKS)
+        return;
+
+    NodeFreeList &list = currentNodeList();
+    std::lock_guard<std::mutex> lock(list.mutex);
+    list.chunks.insert(list.chunks.end(), cache.end() - BATCH_CHUNKS, cache.end());
+    cache.resize(cache.size() - BATCH_CHUNKS);
+    pooled_chunks += BATCH_CHUNKS;
+}
+
+size_t BufferPool::allocatedChunks()
+{
+    return allocated_chunks.load(std::memory_order_relaxed);
+}
+
+size_t BufferPool::pooledChunks()
+{
+    return pooled_chunks.load(std::memory_order_relaxed);
+}
+
+void PooledBuffer::reserve(size_t capacity, size_t keep)
+{
+    if (capacity <= capacity_)
+        return;
+
+    if (capacity <= BufferPool::CHUNK_SIZE)
+    {
+        // Only ever empty here, a held chunk already covers anything up to CHUNK_SIZE
+        chunk = BufferPool::acquire();
+        capacity_ = BufferPool::CHUNK_SIZE;
+        return;
+    }
+
+    std::unique_ptr<char[]> grown(new char[capacity]);
+    std::memcpy(grown.get(), data(), keep);
+    reset();
+    large = std::move(grown);
+    capacity_ = capacity;
+}
+
+void PooledBuffer::reset()
+{
+    if (chunk != nullptr)
+        BufferPool::release(chunk);
+    chunk = nullptr;
+    large.reset();
+    capacity_ = 0;
+}
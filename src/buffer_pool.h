@@ -0,0 +1,48 @@
+#pragma once
+
+#include "common.h"
+
+// Fixed-size chunks for connection buffers, recycled instead of going back to the heap. Each thread keeps a small
+// cache of free chunks, so acquire() and release() are a vector push or pop; the cache refills from and spills to
+// the free list of the NUMA node the thread runs on, in batches. Chunks are carved from mmap()ed slabs and first
+// touched by the thread that needs them, so their pages are local to its node and stay on that node's list.
+// Memory is never handed back to the OS, the pool holds on to the peak.
+class BufferPool
+{
+public:
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+    static constexpr size_t SLAB_CHUNKS = 32;   // Chunks mapped at a time
+    static constexpr size_t BATCH_CHUNKS = 16;  // Moved between a thread cache and its node's list at a time
+    static constexpr size_t CACHED_CHUNKS = 64; // Free chunks a thread keeps before giving a batch back
+    static constexpr size_t MAX_NODES = 16;
+
+    static char *acquire();
+    static void release(char *chunk);
+
+    // Chunks ever mapped, and those free on the node lists (thread caches not counted)
+    static size_t allocatedChunks();
+    static size_t pooledChunks();
+};
+
+// Contiguous buffer borrowing a pool chunk while it fits in one, and its own allocation past that. reset() gives
+// the memory back, a buffer that holds nothing costs nothing.
+class PooledBuffer
+{
+public:
+    PooledBuffer() : chunk(nullptr), capacity_(0) {}
+    ~PooledBuffer() { reset(); }
+    PooledBuffer(const PooledBuffer &) = delete;
+    PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+    char *data() { return chunk != nullptr ? chunk : large.get(); }
+    size_t capacity() const { return capacity_; }
+
+    // At least capacity bytes, keeping the first keep bytes
+    void reserve(size_t capacity, size_t keep);
+    void reset();
+
+private:
+    char *chunk;
+    std::unique_ptr<char[]> large; // Frames larger than a chunk
+    size_t capacity_;
+};
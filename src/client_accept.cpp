@@ -1,39 +1,379 @@
 #include "client_accept.h"
+#include "group_coordinator.h"
+#include "purgatory.h"
+#include "broker_config.h"
+#include "admission.h"
 
-Client::Client(int client_fd_) : client_fd(client_fd_)
+Client::Client(int client_fd_, EventLoop &loop_, in_addr_t peer_addr_)
+    : client_fd(client_fd_), loop(loop_), peer_addr(peer_addr_), closed(false), interest(0), request_begin(0), request_end(0), frame_start_ns(0), last_recv_ns(0),
+      response_sent(0), delayed_fetch(false), metrics(nullptr),
+      last_active_ms(loop_.nowMs()), idle_timer([this]()
+                                                { onIdleTimeout(); }),
+      request_timer([this]()
+                    { onRequestTimeout(); }),
+      throttled(false), shutting_down(false), throttle_timer([this]()
+                                       { onThrottleEnd(); }),
+      admission_timer([this]()
+                      { updateInterest(); })
 {
-    handleClient();
 }
 
-std::unique_ptr<RequestHeader> Client::recvRequestHeader()
+Client::~Client()
+{
+    // Only reached without closeConnection() when the loop itself is torn down
+    if (!closed)
+    {
+        loop.cancel(idle_timer);
+        loop.cancel(request_timer);
+        loop.cancel(throttle_timer);
+        loop.cancel(admission_timer);
+        assert(delayed_operation == nullptr); // A suspended serveRequest() holds a reference to this Client
+        AdmissionControl::addQueuedBytes(-static_cast<int64_t>(request_end - request_begin));
+        AdmissionControl::releaseConnection(peer_addr);
+        close(client_fd);
+    }
+}
+
+void Client::start()
+{
+    metrics = &BrokerMetrics::local();
+    metrics->add(Counter::CONNECTIONS_ACCEPTED);
+
+    interest = EPOLLIN;
+    loop.addFd(client_fd, interest, shared_from_this());
+    loop.schedule(idle_timer, brokerConfig().connections_max_idle_ms);
+}
+
+void Client::onEvents(uint32_t events)
+{
+    if ((events & EPOLLOUT) && !sendResponseFrames())
+    {
+        closeConnection();
+        return;
+    }
+
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !recvRequestFrames())
+    {
+        closeConnection();
+        return;
+    }
+
+    processRequestFrames();
+    if (closed)
+        return;
+
+    updateTimers();
+    updateInterest();
+}
+
+void Client::onShutdown()
+{
+    shutting_down = true;
+    if (delayed_operation != nullptr && delayed_fetch)
+        delayed_operation->forceComplete(); // As if max_wait_ms ran out, produces and group requests are waited for
+    updateTimers();
+    updateInterest();
+}
+
+bool Client::recvRequestFrames()
+{
+    // Whole frames are buffered so varints and strings are decoded from memory, not one recv per field
+
+    if (request_begin == request_end)
+        request_begin = request_end = 0;
+
+    // Room for the rest of the current frame in one go, a pool chunk covers any frame up to its size
+    size_t wanted = MIN_RECEIVE_SIZE;
+    if (request_end - request_begin >= sizeof(int32_t))
+    {
+        int32_t request_msg_size;
+        std::memcpy(&request_msg_size, request_buffer.data() + request_begin, sizeof(request_msg_size));
+        convertBE32toH(request_msg_size);
+        if (request_msg_size >= 0 && request_msg_size <= brokerConfig().socket_request_max_bytes)
+            wanted = std::max(wanted, sizeof(request_msg_size) + request_msg_size - (request_end - request_begin));
+    }
+
+    if (request_buffer.capacity() - request_end < wanted)
+    {
+        // Compact first, grow only for frames larger than the buffer
+        if (request_end > request_begin)
+            std::memmove(request_buffer.data(), request_buffer.data() + request_begin, request_end - request_begin);
+        request_end -= request_begin;
+        request_begin = 0;
+        request_buffer.reserve(request_end + wanted, request_end);
+    }
+
+    const bool frame_started = request_end > request_begin;
+    ssize_t received = recv(client_fd, request_buffer.data() + request_end, request_buffer.capacity() - request_end, 0);
+    if (received == 0)
+        return false; // Peer closed the connection
+    if (received == -1)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+    request_end += received;
+    AdmissionControl::addQueuedBytes(received);
+    last_active_ms = loop.nowMs();
+    last_recv_ns = monotonicNs();
+    if (!frame_started)
+        frame_start_ns = last_recv_ns;
+    return true;
+}
+
+void Client::processRequestFrames()
+{
+    // Pipelined requests are answered in order, stopping at a delayed one or when responses pile up unsent. Responses
+    // that go out right away can make room for more of the requests already buffered.
+    bool stalled = true;
+    while (stalled)
+    {
+        stalled = false;
+        while (!closed)
+        {
+            if (!acceptingRequests())
+            {
+                stalled = true;
+                break;
+            }
+
+            const size_t buffered = request_end - request_begin;
+
+            int32_t request_msg_size;
+            if (buffered < sizeof(request_msg_size))
+                break;
+
+            std::memcpy(&request_msg_size, request_buffer.data() + request_begin, sizeof(request_msg_size));
+            convertBE32toH(request_msg_size);
+            if (request_msg_size < 0 || request_msg_size > brokerConfig().socket_request_max_bytes)
+            {
+                closeConnection();
+                return;
+            }
+
+            const size_t frame_size = sizeof(request_msg_size) + request_msg_size;
+            if (buffered < frame_size)
+                break;
+
+            const uint64_t decode_start_ns = monotonicNs();
+            WireReader reader(request_buffer.data() + request_begin, frame_size);
+            auto request_header = recvRequestHeader(reader);
+            auto request_body = recvRequestBody(reader, request_header->getAPIKey(), request_header->getAPIVersion());
+            if (request_body == nullptr || !reader.ok())
+            {
+                closeConnection(); // Unknown API, unsupported version or malformed request, Kafka closes the connection as well
+                return;
+            }
+            request_begin += frame_size;
+            AdmissionControl::addQueuedBytes(-static_cast<int64_t>(frame_size));
+
+            const std::string_view client_id = request_header->getClientId();
+            if (!quota_client_id || *quota_client_id != client_id)
+            {
+                quota_client_id = std::string(client_id);
+                quota = ClientQuota::forClient(client_id);
+            }
+
+            // EPOLLIN is off while requests wait in the buffer, so the last recv() is the one that completed this frame
+            const int16_t api_key = request_header->getAPIKey();
+            ApiMetrics &api_metrics = metrics->api(api_key);
+            api_metrics.record(RequestStage::RECEIVE, last_recv_ns - frame_start_ns);
+            api_metrics.record(RequestStage::DECODE, monotonicNs() - decode_start_ns);
+            bumpCounter(api_metrics.requests);
+            bumpCounter(api_metrics.request_bytes, frame_size);
+            metrics->add(Gauge::IN_FLIGHT_REQUESTS, 1);
+            const RequestTiming timing = {.api_key = api_key, .request_bytes = frame_size, .received_ns = last_recv_ns, .queued_ns = 0, .response_end = 0};
+            frame_start_ns = last_recv_ns; // Whatever follows came in with that recv() too
+
+            handleRequest({std::move(request_header), std::move(request_body)}, timing);
+        }
+
+        if (request_begin == request_end)
+        {
+            // Nothing buffered, an idle connection holds no receive memory
+            request_begin = request_end = 0;
+            request_buffer.reset();
+        }
+
+        if (!closed && !sendResponseFrames())
+            closeConnection();
+        stalled = stalled && !closed && acceptingRequests();
+    }
+}
+
+std::unique_ptr<RequestHeader> Client::recvRequestHeader(WireReader &reader)
 {
     std::unique_ptr<RequestHeader> request_header = std::make_unique<RequestHeaderV2>();
-    request_header->receive(client_fd);
+    request_header->receive(reader);
     return request_header;
 }
 
-std::unique_ptr<RequestBody> Client::recvRequestBody(int16_t api_key)
+std::unique_ptr<RequestBody> Client::recvRequestBody(WireReader &reader, int16_t api_key, int16_t api_version)
 {
     std::unique_ptr<RequestBody> request_body = nullptr;
 
+    // Each body has one layout, a version outside its advertised range is never decoded. ApiVersions answers any version.
+    if (api_key != 18 && !isSupportedVersion(api_key, api_version))
+        return nullptr;
+
     switch (api_key)
     {
     case 18: // APIVersions
-        request_body = std::make_unique<APIVersionsRequestBodyV4>();
+        request_body = std::make_unique<APIVersionsRequestBodyV4>(api_version);
         break;
 
     case 75: // DescribeTopicPartitions
         request_body = std::make_unique<DescribeTopicPartitionsRequestBodyV0>();
         break;
 
-    default:
-        assert(true); // No handling of unknown API keys
+    case 3: // Metadata
+        request_body = std::make_unique<MetadataRequestBodyV12>();
+        break;
+
+    case 1: // Fetch
+        request_body = std::make_unique<FetchRequestBodyV16>();
+        break;
+
+    case 0: // Produce
+        request_body = std::make_unique<ProduceRequestBodyV11>();
+        break;
+
+    case 2: // ListOffsets
+        request_body = std::make_unique<ListOffsetsRequestBodyV9>();
+        break;
+
+    case 10: // FindCoordinator
+        request_body = std::make_unique<FindCoordinatorRequestBodyV4>();
+        break;
+
+    case 11: // JoinGroup
+        request_body = std::make_unique<JoinGroupRequestBodyV9>();
+        break;
+
+    case 14: // SyncGroup
+        request_body = std::make_unique<SyncGroupRequestBodyV5>();
         break;
+
+    case 12: // Heartbeat
+        request_body = std::make_unique<HeartbeatRequestBodyV4>();
+        break;
+
+    case 13: // LeaveGroup
+        request_body = std::make_unique<LeaveGroupRequestBodyV5>();
+        break;
+
+    case 8: // OffsetCommit
+        request_body = std::make_unique<OffsetCommitRequestBodyV8>();
+        break;
+
+    case 9: // OffsetFetch
+        request_body = std::make_unique<OffsetFetchRequestBodyV8>();
+        break;
+
+    default:
+        return nullptr; // No handling of unknown API keys
     }
-    request_body->receive(client_fd);
+    request_body->receive(reader);
     return request_body;
 }
 
+void Client::handleRequest(RequestMessage request_message, RequestTiming timing)
+{
+    spawn(serveRequest(shared_from_this(), std::move(request_message), timing));
+}
+
+Task<> Client::serveRequest([[maybe_unused]] std::shared_ptr<Client> self, RequestMessage request_message, RequestTiming timing)
+{
+    // self keeps the connection alive while the request is suspended
+    uint64_t handle_start_ns = monotonicNs();
+
+    auto completed = std::make_shared<LoopEvent>(loop);
+    std::shared_ptr<DelayedOperation> operation = delayRequest(request_message, completed->notifier());
+    if (operation != nullptr)
+    {
+        delayed_operation = operation;
+        delayed_fetch = timing.api_key == 1;
+        metrics->add(Gauge::DELAYED_REQUESTS, 1);
+
+        co_await *completed;
+        if (closed)
+            co_return; // Forced to complete by closeConnection(), nobody left to answer
+
+        loop.cancel(*operation);
+        delayed_operation.reset();
+        metrics->add(Gauge::DELAYED_REQUESTS, -1);
+
+        const uint64_t resumed_ns = monotonicNs();
+        metrics->api(timing.api_key).record(RequestStage::DELAY, resumed_ns - handle_start_ns);
+        handle_start_ns = resumed_ns;
+    }
+
+    ResponseMessage response_message = processMessage(std::move(request_message));
+    metrics->api(timing.api_key).record(RequestStage::HANDLE, monotonicNs() - handle_start_ns);
+    queueResponse(std::move(response_message), timing);
+
+    if (operation != nullptr)
+    {
+        // Requests that arrived while the connection was muted
+        processRequestFrames();
+        if (closed)
+            co_return;
+
+        updateTimers();
+        updateInterest();
+    }
+}
+
+std::shared_ptr<DelayedOperation> Client::delayRequest(const RequestMessage &request_message, std::function<void()> on_complete)
+{
+    // Fetches wait for data to arrive or max_wait_ms to pass, produces for their appends on the log directory I/O threads,
+    // group requests for the group coordinator thread. The connection is muted meanwhile.
+    std::shared_ptr<DelayedOperation> operation;
+    switch (request_message.first->getAPIKey())
+    {
+    case 1: // Fetch
+    {
+        auto &request_body = dynamic_cast<const FetchRequestBodyV16 &>(*request_message.second);
+        if (!isFetchSatisfied(request_body))
+            operation = delayFetch(request_body, loop, on_complete);
+        break;
+    }
+
+    case 0: // Produce
+        produce_appends = std::make_shared<ProduceAppends>();
+        operation = appendProduce(dynamic_cast<const ProduceRequestBodyV11 &>(*request_message.second), produce_appends, on_complete);
+        break;
+
+    case 11: // JoinGroup
+        group_result = std::make_shared<GroupResult>();
+        operation = delayJoinGroup(dynamic_cast<const RequestHeaderV2 &>(*request_message.first), dynamic_cast<const JoinGroupRequestBodyV9 &>(*request_message.second), group_result, on_complete);
+        break;
+
+    case 14: // SyncGroup
+        group_result = std::make_shared<GroupResult>();
+        operation = delaySyncGroup(dynamic_cast<const SyncGroupRequestBodyV5 &>(*request_message.second), group_result, on_complete);
+        break;
+
+    case 12: // Heartbeat
+        group_result = std::make_shared<GroupResult>();
+        operation = delayHeartbeat(dynamic_cast<const HeartbeatRequestBodyV4 &>(*request_message.second), group_result, on_complete);
+        break;
+
+    case 13: // LeaveGroup
+        group_result = std::make_shared<GroupResult>();
+        operation = delayLeaveGroup(dynamic_cast<const LeaveGroupRequestBodyV5 &>(*request_message.second), group_result, on_complete);
+        break;
+
+    case 8: // OffsetCommit
+        group_result = std::make_shared<GroupResult>();
+        operation = delayOffsetCommit(dynamic_cast<const OffsetCommitRequestBodyV8 &>(*request_message.second), group_result, on_complete);
+        break;
+
+    default:
+        break;
+    }
+
+    return operation;
+}
+
 ResponseMessage Client::processMessage(RequestMessage request_message)
 {
     auto [request_header, request_body] = std::move(request_message);
@@ -49,6 +389,56 @@ ResponseMessage Client::processMessage(RequestMessage request_message)
         response_message = processDescribeTopicPartitions(dynamic_cast<const RequestHeaderV2 &>(*request_header), dynamic_cast<const DescribeTopicPartitionsRequestBodyV0 &>(*request_body));
         break;
 
+    case 3: // Metadata
+        response_message = processMetadata(dynamic_cast<const RequestHeaderV2 &>(*request_header), dynamic_cast<const MetadataRequestBodyV12 &>(*request_body));
+        break;
+
+    case 1: // Fetch
+        response_message = processFetch(dynamic_cast<const RequestHeaderV2 &>(*request_header), dynamic_cast<const FetchRequestBodyV16 &>(*request_body));
+        break;
+
+    case 0: // Produce
+        response_message = processProduce(dynamic_cast<const RequestHeaderV2 &>(*request_header), dynamic_cast<const ProduceRequestBodyV11 &>(*request_body), *produce_appends);
+        produce_appends.reset();
+        break;
+
+    case 2: // ListOffsets
+        response_message = processListOffsets(dynamic_cast<const RequestHeaderV2 &>(*request_header), dynamic_cast<const ListOffsetsRequestBodyV9 &>(*request_body));
+        break;
+
+    case 10: // FindCoordinator
+        response_message = processFindCoordinator(dynamic_cast<const RequestHeaderV2 &>(*request_header), dynamic_cast<const FindCoordinatorRequestBodyV4 &>(*request_body));
+        break;
+
+    case 11: // JoinGroup
+        response_message = processJoinGroup(dynamic_cast<const RequestHeaderV2 &>(*request_header), *group_result);
+        group_result.reset();
+        break;
+
+    case 14: // SyncGroup
+        response_message = processSyncGroup(dynamic_cast<const RequestHeaderV2 &>(*request_header), *group_result);
+        group_result.reset();
+        break;
+
+    case 12: // Heartbeat
+        response_message = processHeartbeat(dynamic_cast<const RequestHeaderV2 &>(*request_header), *group_result);
+        group_result.reset();
+        break;
+
+    case 13: // LeaveGroup
+        response_message = processLeaveGroup(dynamic_cast<const RequestHeaderV2 &>(*request_header), dynamic_cast<const LeaveGroupRequestBodyV5 &>(*request_body), *group_result);
+        group_result.reset();
+        break;
+
+    case 8: // OffsetCommit
+        response_message = processOffsetCommit(dynamic_cast<const RequestHeaderV2 &>(*request_header), dynamic_cast<const OffsetCommitRequestBodyV8 &>(*request_body), *group_result);
+        group_result.reset();
+        break;
+
+    case 9: // OffsetFetch
+        response_message = processOffsetFetch(dynamic_cast<const RequestHeaderV2 &>(*request_header), dynamic_cast<const OffsetFetchRequestBodyV8 &>(*request_body));
+        break;
+
     default:
         assert(true); // No handling of unknown API keys
         break;
@@ -57,29 +447,229 @@ ResponseMessage Client::processMessage(RequestMessage request_message)
     return response_message;
 }
 
-void Client::sendResponseHeader(std::unique_ptr<ResponseHeader> response_header)
+void Client::queueResponse(ResponseMessage response_message, RequestTiming timing)
 {
-    response_header->respond(client_fd);
+    ApiMetrics &api_metrics = metrics->api(timing.api_key);
+
+    auto [response_header, response_body] = std::move(response_message);
+    int32_t throttle_ms = 0;
+    if (quota != nullptr)
+        throttle_ms = quota->record(timing.api_key, timing.request_bytes, response_header != nullptr ? response_header->getMessageSize() : 0);
+
+    if (response_header == nullptr)
+    {
+        // Request without a response (acks=0 produce), done once handled
+        api_metrics.record(RequestStage::TOTAL, monotonicNs() - timing.received_ns);
+        metrics->add(Gauge::IN_FLIGHT_REQUESTS, -1);
+        throttle(throttle_ms);
+        return;
+    }
+    response_body->setThrottleTime(throttle_ms);
+
+    const uint64_t encode_start_ns = monotonicNs();
+    const size_t response_begin = response_buffer.size();
+    sendResponseHeader(response_buffer, std::move(response_header));
+    sendResponseBody(response_buffer, std::move(response_body));
+
+    timing.queued_ns = monotonicNs();
+    timing.response_end = response_buffer.size();
+    api_metrics.record(RequestStage::ENCODE, timing.queued_ns - encode_start_ns);
+    bumpCounter(api_metrics.response_bytes, timing.response_end - response_begin);
+    metrics->add(Gauge::UNSENT_RESPONSE_BYTES, timing.response_end - response_begin);
+    unsent_responses.push_back(timing);
+    throttle(throttle_ms);
+}
+
+void Client::throttle(int32_t throttle_ms)
+{
+    if (throttle_ms <= 0)
+        return;
+    metrics->add(Counter::THROTTLED_RESPONSES);
+    metrics->add(Counter::THROTTLE_TIME_MS, throttle_ms);
+
+    // Requests already buffered wait as well, the connection is read again once the longest throttle is over
+    if (throttled && throttle_timer.expirationMs() >= loop.nowMs() + throttle_ms)
+        return;
+    if (throttled)
+        loop.cancel(throttle_timer);
+    throttled = true;
+    loop.schedule(throttle_timer, throttle_ms);
 }
 
-void Client::sendResponseBody(std::unique_ptr<ResponseBody> response_body)
+void Client::onThrottleEnd()
 {
-    response_body->respond(client_fd);
+    throttled = false;
+    processRequestFrames();
+    if (closed)
+        return;
+
+    updateTimers();
+    updateInterest();
+}
+
+void Client::sendResponseHeader(WireWriter &writer, std::unique_ptr<ResponseHeader> response_header)
+{
+    response_header->respond(writer);
 }
 
-void Client::handleClient()
+void Client::sendResponseBody(WireWriter &writer, std::unique_ptr<ResponseBody> response_body)
 {
-    int32_t request_corr_id;
-    int16_t request_api_ver;
+    response_body->respond(writer);
+}
 
-    while (server_running.load())
+bool Client::sendResponseFrames()
+{
+    // Every queued response goes out in as few sendmsg()s as the socket buffer allows, straight from the chunks
+    bool ok = true;
+    while (response_sent < response_buffer.size())
     {
-        auto request_header = recvRequestHeader();
-        auto request_body = recvRequestBody(request_header->getAPIKey());
-        auto [response_header, response_body] = processMessage({std::move(request_header), std::move(request_body)});
-        sendResponseHeader(std::move(response_header));
-        sendResponseBody(std::move(response_body));
+        iovec iov[MAX_SEND_IOVECS];
+        msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = response_buffer.gather(response_sent, iov, MAX_SEND_IOVECS);
+        ssize_t sent = sendmsg(client_fd, &msg, MSG_NOSIGNAL);
+        if (sent == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            ok = errno == EAGAIN || errno == EWOULDBLOCK; // Rest goes out on EPOLLOUT
+            break;
+        }
+        response_sent += sent;
+        response_buffer.release(response_sent);
+        last_active_ms = loop.nowMs();
+        metrics->add(Gauge::UNSENT_RESPONSE_BYTES, -sent);
+    }
+
+    recordSentResponses();
+
+    if (response_sent == response_buffer.size())
+    {
+        response_buffer.clear();
+        response_sent = 0;
+    }
+    return ok;
+}
+
+void Client::recordSentResponses()
+{
+    if (unsent_responses.empty() || unsent_responses.front().response_end > response_sent)
+        return;
+
+    const uint64_t now_ns = monotonicNs();
+    while (!unsent_responses.empty() && unsent_responses.front().response_end <= response_sent)
+    {
+        const RequestTiming &timing = unsent_responses.front();
+        ApiMetrics &api_metrics = metrics->api(timing.api_key);
+        api_metrics.record(RequestStage::SEND, now_ns - timing.queued_ns);
+        api_metrics.record(RequestStage::TOTAL, now_ns - timing.received_ns);
+        unsent_responses.pop_front();
+        metrics->add(Gauge::IN_FLIGHT_REQUESTS, -1);
+    }
+}
+
+bool Client::inTransfer() const
+{
+    // Partially received request we are reading, or a response the peer has not taken yet
+    return (request_end > request_begin && delayed_operation == nullptr) || response_sent < response_buffer.size();
+}
+
+void Client::updateTimers()
+{
+    if (inTransfer() && !request_timer.isScheduled())
+        loop.schedule(request_timer, REQUEST_TIMEOUT_MS);
+    else if (!inTransfer() && request_timer.isScheduled())
+        loop.cancel(request_timer);
+}
+
+bool Client::acceptingRequests() const
+{
+    return !shutting_down && !throttled && delayed_operation == nullptr && unsent_responses.size() < brokerConfig().connection_max_in_flight_requests &&
+           response_buffer.size() - response_sent < MAX_PENDING_RESPONSE_BYTES;
+}
+
+void Client::updateInterest()
+{
+    if (shutting_down && delayed_operation == nullptr && unsent_responses.empty())
+    {
+        closeConnection(); // Everything in flight answered and sent
+        return;
+    }
+
+    uint32_t wanted = 0;
+    if (acceptingRequests())
+    {
+        // Between frames reads wait while the broker holds queued.max.request.bytes, a started frame is read to the end
+        if (request_end > request_begin || !AdmissionControl::queuedBytesFull())
+            wanted |= EPOLLIN;
+        else if (!admission_timer.isScheduled())
+            loop.schedule(admission_timer, AdmissionControl::RETRY_MS);
+    }
+    if (response_sent < response_buffer.size())
+        wanted |= EPOLLOUT;
+
+    if (wanted != interest)
+    {
+        interest = wanted;
+        loop.modifyFd(client_fd, interest);
+    }
+}
+
+void Client::onIdleTimeout()
+{
+    // Activity doesn't touch the timer, it is only re-armed here for whatever is left of the idle period
+    const int64_t idle_ms = loop.nowMs() - last_active_ms;
+    if (idle_ms >= brokerConfig().connections_max_idle_ms && delayed_operation == nullptr)
+    {
+        closeConnection();
+        return;
+    }
+    loop.schedule(idle_timer, std::max<int64_t>(brokerConfig().connections_max_idle_ms - idle_ms, 1));
+}
+
+void Client::onRequestTimeout()
+{
+    // Only a transfer that made no progress at all for REQUEST_TIMEOUT_MS is given up on
+    if (!inTransfer())
+        return;
+
+    const int64_t stalled_ms = loop.nowMs() - last_active_ms;
+    if (stalled_ms >= REQUEST_TIMEOUT_MS)
+    {
+        closeConnection();
+        return;
+    }
+    loop.schedule(request_timer, REQUEST_TIMEOUT_MS - stalled_ms);
+}
+
+void Client::closeConnection()
+{
+    if (closed)
+        return;
+    closed = true;
+
+    loop.cancel(idle_timer);
+    loop.cancel(request_timer);
+    loop.cancel(throttle_timer);
+    loop.cancel(admission_timer);
+    AdmissionControl::addQueuedBytes(-static_cast<int64_t>(request_end - request_begin));
+    AdmissionControl::releaseConnection(peer_addr);
+
+    // Requests that will never be answered
+    metrics->add(Counter::CONNECTIONS_CLOSED);
+    metrics->add(Gauge::IN_FLIGHT_REQUESTS, -static_cast<int64_t>(unsent_responses.size() + (delayed_operation != nullptr ? 1 : 0)));
+    metrics->add(Gauge::UNSENT_RESPONSE_BYTES, -static_cast<int64_t>(response_buffer.size() - response_sent));
+    unsent_responses.clear();
+
+    if (delayed_operation != nullptr)
+    {
+        metrics->add(Gauge::DELAYED_REQUESTS, -1);
+
+        // Drops out of the purgatory on its next sweep, the operation itself lives as long as this Client
+        loop.cancel(*delayed_operation);
+        delayed_operation->forceComplete();
     }
 
+    loop.removeFd(client_fd);
     close(client_fd);
 }
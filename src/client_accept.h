@@ -2,19 +2,101 @@
 
 #include "common.h"
 #include "kafka_utils.h"
+#include "event_loop.h"
+#include "metrics.h"
+#include "task.h"
+#include "quota.h"
 
-class Client
+class DelayedOperation;
+
+// One broker connection, driven by the EventLoop it was assigned to. Requests are answered one at a time
+// in arrival order, a request that has to wait (a delayed fetch, a group request) mutes the connection until it completes.
+class Client : public EventHandler, public std::enable_shared_from_this<Client>
 {
 public:
-    Client(int client_fd_);
-    void handleClient();
+    // Timestamps of a request on its way through the connection, recorded per RequestStage
+    struct RequestTiming
+    {
+        int16_t api_key;
+        size_t request_bytes; // Whole request frame
+        uint64_t received_ns; // Last byte of the request frame read
+        uint64_t queued_ns;   // Response encoded into response_buffer
+        size_t response_end;  // Offset just past the response in response_buffer
+    };
+
+    // The connection is already counted by AdmissionControl, it is released on close
+    Client(int client_fd_, EventLoop &loop_, in_addr_t peer_addr_);
+    ~Client();
+    void start();
+    void onEvents(uint32_t events) override;
+    // Stops reading, the connection closes once its in-flight requests are answered
+    void onShutdown() override;
 
-    std::unique_ptr<RequestHeader> recvRequestHeader();
-    std::unique_ptr<RequestBody> recvRequestBody(int16_t api_key);
+    bool recvRequestFrames();
+    std::unique_ptr<RequestHeader> recvRequestHeader(WireReader &reader);
+    std::unique_ptr<RequestBody> recvRequestBody(WireReader &reader, int16_t api_key, int16_t api_version);
+    void handleRequest(RequestMessage request_message, RequestTiming timing);
+    // Answers one request, suspended while a delayed one waits for its DelayedOperation
+    Task<> serveRequest([[maybe_unused]] std::shared_ptr<Client> self, RequestMessage request_message, RequestTiming timing);
+    // The DelayedOperation a request has to wait for, nullptr when it can be answered right away
+    std::shared_ptr<DelayedOperation> delayRequest(const RequestMessage &request_message, std::function<void()> on_complete);
     ResponseMessage processMessage(RequestMessage request_message);
-    void sendResponseHeader(std::unique_ptr<ResponseHeader> response_header);
-    void sendResponseBody(std::unique_ptr<ResponseBody> response_body);
+    void sendResponseHeader(WireWriter &writer, std::unique_ptr<ResponseHeader> response_header);
+    void sendResponseBody(WireWriter &writer, std::unique_ptr<ResponseBody> response_body);
+    bool sendResponseFrames();
 
 private:
+    static constexpr size_t MIN_RECEIVE_SIZE = 4 * 1024; // Free space a recv() gets at least
+    static constexpr size_t MAX_SEND_IOVECS = 64;
+    static constexpr size_t MAX_PENDING_RESPONSE_BYTES = 1024 * 1024; // Stop reading requests while this much is unsent
+    static constexpr int64_t REQUEST_TIMEOUT_MS = 30 * 1000; // Same as Kafka request.timeout.ms default
+
+    void processRequestFrames();
+    // Whether the next buffered request can be decoded, reads stop while it can't
+    bool acceptingRequests() const;
+    void queueResponse(ResponseMessage response_message, RequestTiming timing);
+    void recordSentResponses();
+    bool inTransfer() const;
+    void updateTimers();
+    void updateInterest();
+    void onIdleTimeout();
+    void onRequestTimeout();
+    void onThrottleEnd();
+    // Mutes the connection for throttle_ms, as Kafka does after sending a throttled response
+    void throttle(int32_t throttle_ms);
+    void closeConnection();
+
     int client_fd;
+    EventLoop &loop;
+    in_addr_t peer_addr;
+    bool closed;
+    uint32_t interest; // epoll events currently registered
+
+    PooledBuffer request_buffer; // Received bytes, request frames (including the 4 byte size prefix) are decoded in place
+    size_t request_begin;
+    size_t request_end;
+    uint64_t frame_start_ns; // First byte of the frame at request_begin read
+    uint64_t last_recv_ns;
+
+    WireWriter response_buffer{true}; // Encoded responses not yet written to the socket, in pool chunks
+    size_t response_sent;
+    std::deque<RequestTiming> unsent_responses; // In response_buffer order
+
+    std::shared_ptr<DelayedOperation> delayed_operation; // Of the suspended request
+    bool delayed_fetch;                              // Of a Fetch, completed early on shutdown
+    std::shared_ptr<ProduceAppends> produce_appends; // Of the delayed Produce request
+    std::shared_ptr<GroupResult> group_result;       // Of the delayed group coordinator request
+
+    ThreadMetrics *metrics; // Of the loop's thread
+
+    int64_t last_active_ms;
+    CallbackTimer idle_timer;    // Reaps connections without traffic for connections.max.idle.ms
+    CallbackTimer request_timer; // Closes connections making no progress on a partial request or an unsent response
+
+    std::optional<std::string> quota_client_id; // Client id of the last request, quota belongs to it
+    std::shared_ptr<ClientQuota> quota;         // nullptr without quotas
+    bool throttled;                             // Muted until throttle_timer fires
+    bool shutting_down;
+    CallbackTimer throttle_timer;
+    CallbackTimer admission_timer; // Looks again at reads paused by queued.max.request.bytes
 };
@@ -30,6 +30,31 @@
 #include <stack>
 #include <sstream>
 #include <filesystem>
+#include <string_view>
+#include <span>
+#include <mutex>
+#include <deque>
+#include <chrono>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <netinet/tcp.h>
+#include <shared_mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <charconv>
+#include <bit>
+#include <climits>
+#include <cmath>
+#include <iomanip>
+#include <optional>
+#include <random>
+#include <spanstream>
+#include <coroutine>
 
 inline void convertBE16toH(int16_t &first)
 {
@@ -99,6 +124,18 @@ inline void convertH64toBE(int64_t &first, auto &...rest)
 }
 
 
+// Starts a thread with every signal blocked, signals are left to the main thread
+template <typename F>
+std::thread spawnWorkerThread(F &&function)
+{
+    sigset_t all_signals, previous;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &previous);
+    std::thread thread(std::forward<F>(function));
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    return thread;
+}
+
 extern std::atomic_bool server_running;
 
 using UUID = std::array<uint8_t, 16>;
\ No newline at end of file
@@ -0,0 +1,324 @@
+#include "compression.h"
+
+#ifdef KAFKA_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef KAFKA_HAVE_SNAPPY
+#include <snappy-c.h>
+#endif
+#ifdef KAFKA_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef KAFKA_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Guards against decompression bombs, far more than a batch within socket.request.max.bytes holds in practice
+static constexpr size_t MAX_DECOMPRESSED_SIZE = 1024 * 1024 * 1024;
+
+// Chunk the output grows by while streaming, inputs usually compress a few times over
+static size_t outputChunk(size_t input_size)
+{
+    return std::max<size_t>(input_size * 4, 64 * 1024);
+}
+
+#ifdef KAFKA_HAVE_ZLIB
+// windowBits 15 + 32 detects gzip and zlib headers, + 16 writes a gzip header
+static bool gzipDecompress(std::span<const char> input, std::vector<char> &output)
+{
+    z_stream stream{};
+    if (inflateInit2(&stream, 15 + 32) != Z_OK)
+        return false;
+
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    stream.avail_in = input.size();
+
+    int result = Z_OK;
+    while (result == Z_OK && output.size() < MAX_DECOMPRESSED_SIZE)
+    {
+        const size_t produced = output.size();
+        output.resize(produced + outputChunk(input.size()));
+        stream.next_out = reinterpret_cast<Bytef *>(output.data() + produced);
+        stream.avail_out = output.size() - produced;
+
+        result = inflate(&stream, Z_NO_FLUSH);
+        output.resize(output.size() - stream.avail_out);
+    }
+
+    inflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+static bool gzipCompress(std::span<const char> input, std::vector<char> &output)
+{
+    z_stream stream{};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    output.resize(deflateBound(&stream, input.size()));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    stream.avail_in = input.size();
+    stream.next_out = reinterpret_cast<Bytef *>(output.data());
+    stream.avail_out = output.size();
+
+    const int result = deflate(&stream, Z_FINISH);
+    output.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+#endif
+
+#ifdef KAFKA_HAVE_SNAPPY
+// Java clients write snappy through xerial's SnappyOutputStream: this header, then blocks each prefixed by
+// their big-endian compressed length
+static constexpr std::array<char, 8> XERIAL_MAGIC = {'\x82', 'S', 'N', 'A', 'P', 'P', 'Y', '\0'};
+static constexpr size_t XERIAL_HEADER_SIZE = XERIAL_MAGIC.size() + 2 * sizeof(int32_t); // Magic, version, compatible version
+static constexpr size_t XERIAL_BLOCK_SIZE = 32 * 1024;
+
+static bool snappyBlockDecompress(const char *input, size_t input_size, std::vector<char> &output)
+{
+    size_t block_size;
+    if (snappy_uncompressed_length(input, input_size, &block_size) != SNAPPY_OK || output.size() + block_size > MAX_DECOMPRESSED_SIZE)
+        return false;
+
+    const size_t produced = output.size();
+    output.resize(produced + block_size);
+    return snappy_uncompress(input, input_size, output.data() + produced, &block_size) == SNAPPY_OK;
+}
+
+static bool snappyDecompress(std::span<const char> input, std::vector<char> &output)
+{
+    if (input.size() < XERIAL_HEADER_SIZE || !std::equal(XERIAL_MAGIC.begin(), XERIAL_MAGIC.end(), input.begin()))
+        return snappyBlockDecompress(input.data(), input.size(), output);
+
+    size_t position = XERIAL_HEADER_SIZE;
+    while (position < input.size())
+    {
+        uint32_t block_length;
+        if (input.size() - position < sizeof(block_length))
+            return false;
+        std::memcpy(&block_length, input.data() + position, sizeof(block_length));
+        block_length = be32toh(block_length);
+        position += sizeof(block_length);
+
+        if (block_length > input.size() - position || !snappyBlockDecompress(input.data() + position, block_length, output))
+            return false;
+        position += block_length;
+    }
+    return true;
+}
+
+static bool snappyCompress(std::span<const char> input, std::vector<char> &output)
+{
+    output.assign(XERIAL_MAGIC.begin(), XERIAL_MAGIC.end());
+    for (uint32_t version : {1, 1})
+    {
+        const uint32_t version_be = htobe32(version);
+        output.insert(output.end(), reinterpret_cast<const char *>(&version_be), reinterpret_cast<const char *>(&version_be) + sizeof(version_be));
+    }
+
+    for (size_t position = 0; position < input.size(); position += XERIAL_BLOCK_SIZE)
+    {
+        const size_t block_size = std::min(XERIAL_BLOCK_SIZE, input.size() - position);
+        size_t compressed_size = snappy_max_compressed_length(block_size);
+
+        const size_t block_start = output.size();
+        output.resize(block_start + sizeof(uint32_t) + compressed_size);
+        if (snappy_compress(input.data() + position, block_size, output.data() + block_start + sizeof(uint32_t), &compressed_size) != SNAPPY_OK)
+            return false;
+
+        const uint32_t compressed_size_be = htobe32(compressed_size);
+        std::memcpy(output.data() + block_start, &compressed_size_be, sizeof(compressed_size_be));
+        output.resize(block_start + sizeof(uint32_t) + compressed_size);
+    }
+    return true;
+}
+#endif
+
+#ifdef KAFKA_HAVE_LZ4
+static bool lz4Decompress(std::span<const char> input, std::vector<char> &output)
+{
+    LZ4F_dctx *context;
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&context, LZ4F_VERSION)))
+        return false;
+
+    size_t position = 0;
+    size_t hint = 1; // Bytes the decoder still expects, 0 once the frame is complete
+    while (hint != 0 && output.size() < MAX_DECOMPRESSED_SIZE)
+    {
+        const size_t produced = output.size();
+        output.resize(produced + outputChunk(input.size()));
+
+        size_t output_size = output.size() - produced;
+        size_t input_size = input.size() - position;
+        hint = LZ4F_decompress(context, output.data() + produced, &output_size, input.data() + position, &input_size, nullptr);
+        output.resize(produced + output_size);
+        position += input_size;
+
+        // No progress left to make, the frame is truncated
+        if (LZ4F_isError(hint) || (input_size == 0 && output_size == 0))
+            break;
+    }
+
+    LZ4F_freeDecompressionContext(context);
+    return hint == 0;
+}
+
+static bool lz4Compress(std::span<const char> input, std::vector<char> &output)
+{
+    // Independent 64KB blocks, what Kafka's own LZ4 stream writes and all its readers handle
+    LZ4F_preferences_t preferences{};
+    preferences.frameInfo.blockSizeID = LZ4F_max64KB;
+    preferences.frameInfo.blockMode = LZ4F_blockIndependent;
+
+    output.resize(LZ4F_compressFrameBound(input.size(), &preferences));
+    const size_t compressed_size = LZ4F_compressFrame(output.data(), output.size(), input.data(), input.size(), &preferences);
+    if (LZ4F_isError(compressed_size))
+        return false;
+    output.resize(compressed_size);
+    return true;
+}
+#endif
+
+#ifdef KAFKA_HAVE_ZSTD
+static bool zstdDecompress(std::span<const char> input, std::vector<char> &output)
+{
+    // Streamed, producers don't always record the content size in the frame header
+    ZSTD_DStream *stream = ZSTD_createDStream();
+    if (stream == nullptr)
+        return false;
+
+    ZSTD_inBuffer in = {input.data(), input.size(), 0};
+    size_t hint = 1;
+    while (hint != 0 && output.size() < MAX_DECOMPRESSED_SIZE)
+    {
+        const size_t produced = output.size();
+        output.resize(produced + outputChunk(input.size()));
+
+        ZSTD_outBuffer out = {output.data() + produced, output.size() - produced, 0};
+        hint = ZSTD_decompressStream(stream, &out, &in);
+        output.resize(produced + out.pos);
+
+        // Input used up without finishing the frame
+        if (ZSTD_isError(hint) || (hint != 0 && in.pos == in.size && out.pos < out.size))
+            break;
+    }
+
+    ZSTD_freeDStream(stream);
+    return hint == 0;
+}
+
+static bool zstdCompress(std::span<const char> input, std::vector<char> &output)
+{
+    constexpr int ZSTD_LEVEL = 3; // Same as Kafka compression.zstd.level default
+
+    output.resize(ZSTD_compressBound(input.size()));
+    const size_t compressed_size = ZSTD_compress(output.data(), output.size(), input.data(), input.size(), ZSTD_LEVEL);
+    if (ZSTD_isError(compressed_size))
+        return false;
+    output.resize(compressed_size);
+    return true;
+}
+#endif
+
+bool compressionSupported(CompressionCodec codec)
+{
+    switch (codec)
+    {
+    case CompressionCodec::NONE:
+        return true;
+#ifdef KAFKA_HAVE_ZLIB
+    case CompressionCodec::GZIP:
+        return true;
+#endif
+#ifdef KAFKA_HAVE_SNAPPY
+    case CompressionCodec::SNAPPY:
+        return true;
+#endif
+#ifdef KAFKA_HAVE_LZ4
+    case CompressionCodec::LZ4:
+        return true;
+#endif
+#ifdef KAFKA_HAVE_ZSTD
+    case CompressionCodec::ZSTD:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+bool decompress(CompressionCodec codec, std::span<const char> input, std::vector<char> &output)
+{
+    output.clear();
+
+    switch (codec)
+    {
+    case CompressionCodec::NONE:
+        output.assign(input.begin(), input.end());
+        return true;
+#ifdef KAFKA_HAVE_ZLIB
+    case CompressionCodec::GZIP:
+        return gzipDecompress(input, output);
+#endif
+#ifdef KAFKA_HAVE_SNAPPY
+    case CompressionCodec::SNAPPY:
+        return snappyDecompress(input, output);
+#endif
+#ifdef KAFKA_HAVE_LZ4
+    case CompressionCodec::LZ4:
+        return lz4Decompress(input, output);
+#endif
+#ifdef KAFKA_HAVE_ZSTD
+    case CompressionCodec::ZSTD:
+        return zstdDecompress(input, output);
+#endif
+    default:
+        return false;
+    }
+}
+
+bool compress(CompressionCodec codec, std::span<const char> input, std::vector<char> &output)
+{
+    output.clear();
+
+    switch (codec)
+    {
+    case CompressionCodec::NONE:
+        output.assign(input.begin(), input.end());
+        return true;
+#ifdef KAFKA_HAVE_ZLIB
+    case CompressionCodec::GZIP:
+        return gzipCompress(input, output);
+#endif
+#ifdef KAFKA_HAVE_SNAPPY
+    case CompressionCodec::SNAPPY:
+        return snappyCompress(input, output);
+#endif
+#ifdef KAFKA_HAVE_LZ4
+    case CompressionCodec::LZ4:
+        return lz4Compress(input, output);
+#endif
+#ifdef KAFKA_HAVE_ZSTD
+    case CompressionCodec::ZSTD:
+        return zstdCompress(input, output);
+#endif
+    default:
+        return false;
+    }
+}
+
+std::optional<CompressionCodec> compressionCodecByName(std::string_view name)
+{
+    constexpr std::array<std::pair<std::string_view, CompressionCodec>, 5> CODECS = {{{"uncompressed", CompressionCodec::NONE},
+                                                                                       {"gzip", CompressionCodec::GZIP},
+                                                                                       {"snappy", CompressionCodec::SNAPPY},
+                                                                                       {"lz4", CompressionCodec::LZ4},
+                                                                                       {"zstd", CompressionCodec::ZSTD}}};
+    for (auto &[codec_name, codec] : CODECS)
+    {
+        if (codec_name == name)
+            return codec;
+    }
+    return std::nullopt;
+}
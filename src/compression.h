@@ -0,0 +1,24 @@
+#pragma once
+
+#include "common.h"
+
+// Compression codec of a v2 RecordBatch, the low 3 bits of its attributes
+enum class CompressionCodec : int8_t
+{
+    NONE = 0,
+    GZIP = 1,
+    SNAPPY = 2,
+    LZ4 = 3,
+    ZSTD = 4
+};
+
+// Whether the broker was built with the library of codec, NONE always is
+bool compressionSupported(CompressionCodec codec);
+
+// Framing is what Kafka's clients produce: gzip streams, xerial framed snappy (raw snappy is accepted too),
+// LZ4 frames and zstd frames. False on corrupt input or a codec that isn't supported.
+bool decompress(CompressionCodec codec, std::span<const char> input, std::vector<char> &output);
+bool compress(CompressionCodec codec, std::span<const char> input, std::vector<char> &output);
+
+// Codec of a compression.type value ("uncompressed", "gzip", ...), nullopt for anything else
+std::optional<CompressionCodec> compressionCodecByName(std::string_view name);
@@ -0,0 +1,24 @@
+#include "crc32c.h"
+
+static constexpr uint32_t CRC32C_POLYNOMIAL = 0x82F63B78; // Reversed
+
+static constexpr std::array<uint32_t, 256> CRC32C_TABLE = []()
+{
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < table.size(); i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0 - (crc & 1)));
+        table[i] = crc;
+    }
+    return table;
+}();
+
+uint32_t crc32c(const char *data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++)
+        crc = CRC32C_TABLE[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFF;
+}
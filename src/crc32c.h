@@ -0,0 +1,6 @@
+#pragma once
+
+#include "common.h"
+
+// CRC-32C (Castagnoli), the checksum of v2 RecordBatches from the attributes field to the end
+uint32_t crc32c(const char *data, size_t size);
@@ -0,0 +1,159 @@
+#include "event_loop.h"
+
+EventLoop::EventLoop() : epoll_fd(epoll_create1(EPOLL_CLOEXEC)), wakeup_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+                         stopping(false), now_ms(TimerWheel::nowMs()), timer_wheel(now_ms),
+                         pending_tasks(0)
+{
+    if (epoll_fd == -1 || wakeup_fd == -1)
+    {
+        std::perror("Error occured");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = wakeup_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &event);
+}
+
+EventLoop::~EventLoop()
+{
+    // Handlers may still cancel timers or post while they are destroyed
+    removed_handlers.clear();
+    handlers.clear();
+
+    close(wakeup_fd);
+    close(epoll_fd);
+}
+
+void EventLoop::run()
+{
+    std::array<struct epoll_event, MAX_EVENTS> events;
+    std::vector<TimerTask *> expired;
+
+    while (!stopping.load())
+    {
+        // Sleep until the next socket event, posted task or timer, whichever comes first
+        const int64_t next_tick = timer_wheel.nextTickMs();
+        const int timeout_ms = next_tick == INT64_MAX ? -1 : static_cast<int>(std::clamp<int64_t>(next_tick - TimerWheel::nowMs(), 0, INT_MAX));
+
+        int ready = epoll_wait(epoll_fd, events.data(), events.size(), timeout_ms);
+        if (ready == -1)
+        {
+            if (errno != EINTR)
+                std::perror("Error occured");
+            ready = 0;
+        }
+
+        now_ms = TimerWheel::nowMs();
+
+        for (int i = 0; i < ready; i++)
+        {
+            if (events[i].data.fd == wakeup_fd)
+            {
+                uint64_t count;
+                while (read(wakeup_fd, &count, sizeof(count)) > 0)
+                    ;
+                continue;
+            }
+
+            // Handler may have been removed by an earlier event of this batch
+            auto it = handlers.find(events[i].data.fd);
+            if (it != handlers.end())
+                it->second->onEvents(events[i].events);
+        }
+
+        runPostedTasks();
+
+        expired.clear();
+        timer_wheel.advance(TimerWheel::nowMs(), expired);
+        for (TimerTask *task : expired)
+            task->onExpire();
+
+        removed_handlers.clear();
+    }
+}
+
+void EventLoop::beginShutdown()
+{
+    // Copied first, handlers remove themselves
+    std::vector<std::shared_ptr<EventHandler>> registered;
+    registered.reserve(handlers.size());
+    for (auto &[fd, handler] : handlers)
+        registered.push_back(handler);
+    for (auto &handler : registered)
+        handler->onShutdown();
+}
+
+void EventLoop::stop()
+{
+    stopping = true;
+    post([]() {});
+}
+
+void EventLoop::post(std::function<void()> task)
+{
+    bool was_empty;
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex);
+        was_empty = posted_tasks.empty();
+        posted_tasks.push_back(std::move(task));
+        pending_tasks.store(posted_tasks.size(), std::memory_order_relaxed);
+    }
+
+    // A non-empty queue means a wakeup is already on its way
+    if (was_empty)
+    {
+        uint64_t count = 1;
+        if (write(wakeup_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+            std::perror("Error occured");
+    }
+}
+
+void EventLoop::runPostedTasks()
+{
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex);
+        tasks.swap(posted_tasks);
+        pending_tasks.store(0, std::memory_order_relaxed);
+    }
+
+    for (auto &task : tasks)
+        task();
+}
+
+void EventLoop::addFd(int fd, uint32_t events, std::shared_ptr<EventHandler> handler)
+{
+    struct epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        std::perror("Error occured");
+        return;
+    }
+    handlers[fd] = std::move(handler);
+}
+
+void EventLoop::modifyFd(int fd, uint32_t events)
+{
+    struct epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1)
+        std::perror("Error occured");
+}
+
+void EventLoop::removeFd(int fd)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+
+    auto it = handlers.find(fd);
+    if (it == handlers.end())
+        return;
+
+    // The handler may be the one currently running
+    removed_handlers.push_back(std::move(it->second));
+    handlers.erase(it);
+}
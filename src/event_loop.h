@@ -0,0 +1,72 @@
+#pragma once
+
+#include "common.h"
+#include "timer_wheel.h"
+
+// Something registered with an EventLoop for readiness events on a file descriptor
+class EventHandler
+{
+public:
+    virtual ~EventHandler() {}
+    virtual void onEvents(uint32_t events) = 0;
+    // The broker is shutting down, a handler finishes what it is doing and removes itself
+    virtual void onShutdown() {}
+};
+
+// TimerTask running a callback, for owners that need several independent timers
+class CallbackTimer : public TimerTask
+{
+public:
+    explicit CallbackTimer(std::function<void()> callback_) : callback(std::move(callback_)) {}
+    void onExpire() override { callback(); }
+
+private:
+    std::function<void()> callback;
+};
+
+// One network thread: epoll for socket readiness, a TimerWheel for everything time based (idle connections,
+// request timeouts, delayed operations) and a queue for work handed over by other threads.
+// Everything except post() and stop() must be called from the loop thread.
+class EventLoop
+{
+public:
+    EventLoop();
+    ~EventLoop();
+
+    void run();
+    void stop();
+    void post(std::function<void()> task);
+
+    void addFd(int fd, uint32_t events, std::shared_ptr<EventHandler> handler);
+    void modifyFd(int fd, uint32_t events);
+    void removeFd(int fd);
+    // onShutdown() of every registered handler, on the loop thread
+    void beginShutdown();
+
+    void schedule(TimerTask &task, int64_t delay_ms) { timer_wheel.schedule(task, TimerWheel::nowMs() + delay_ms); }
+    void cancel(TimerTask &task) { timer_wheel.cancel(task); }
+
+    // Time at the start of the current iteration, cheap enough to read per request
+    int64_t nowMs() const { return now_ms; }
+
+    // Posted tasks not run yet, readable from any thread
+    size_t pendingTasks() const { return pending_tasks.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr int MAX_EVENTS = 256;
+
+    void runPostedTasks();
+
+    int epoll_fd;
+    int wakeup_fd; // eventfd, written when tasks are posted to an idle loop
+    std::atomic_bool stopping;
+    int64_t now_ms;
+    TimerWheel timer_wheel;
+
+    std::mutex posted_mutex;
+    std::vector<std::function<void()>> posted_tasks;
+    std::atomic<size_t> pending_tasks;
+
+    std::unordered_map<int, std::shared_ptr<EventHandler>> handlers;
+    std::vector<std::shared_ptr<EventHandler>> removed_handlers; // Kept alive until the current iteration is over
+};
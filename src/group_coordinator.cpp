@@ -0,0 +1,947 @@
+#include "group_coordinator.h"
+#include "purgatory.h"
+#include "log_cleaner.h"
+#include "broker_config.h"
+#include "crc32c.h"
+#include "metrics.h"
+
+static constexpr int32_t MAX_RECORDS_PER_BATCH = 1000;
+static constexpr size_t REPLAY_READ_BYTES = 1024 * 1024;
+
+// Error codes of the group APIs
+static constexpr int16_t OFFSET_METADATA_TOO_LARGE = 12;
+static constexpr int16_t COORDINATOR_NOT_AVAILABLE = 15;
+static constexpr int16_t ILLEGAL_GENERATION = 22;
+static constexpr int16_t INCONSISTENT_GROUP_PROTOCOL = 23;
+static constexpr int16_t INVALID_GROUP_ID = 24;
+static constexpr int16_t UNKNOWN_MEMBER_ID = 25;
+static constexpr int16_t INVALID_SESSION_TIMEOUT = 26;
+static constexpr int16_t REBALANCE_IN_PROGRESS = 27;
+
+// int16 length prefixed, -1 is a null string
+static std::string readString(WireReader &reader)
+{
+    const int16_t len = reader.readBigEndian<int16_t>();
+    std::string str(std::min<size_t>(std::max<int16_t>(len, 0), reader.remaining()), '\0');
+    reader.read(str.data(), str.size());
+    return str;
+}
+
+static void writeString(WireWriter &writer, std::string_view str)
+{
+    writer.writeBigEndian<int16_t>(str.size());
+    writer.write(str.data(), str.size());
+}
+
+// Kafka's OffsetCommitKey, version 1
+static void writeOffsetKey(WireWriter &key, std::string_view group_id, std::string_view topic, int32_t partition)
+{
+    key.writeBigEndian<int16_t>(1);
+    writeString(key, group_id);
+    writeString(key, topic);
+    key.writeBigEndian(partition);
+}
+
+// Kafka's OffsetCommitValue, version 3
+static void writeOffsetValue(WireWriter &value, const CommittedOffset &committed)
+{
+    value.writeBigEndian<int16_t>(3);
+    value.writeBigEndian(committed.offset);
+    value.writeBigEndian(committed.leader_epoch);
+    writeString(value, committed.metadata);
+    value.writeBigEndian(committed.commit_timestamp);
+}
+
+static void writeRecord(WireWriter &records, int32_t offset_delta, const WireWriter &key, const WireWriter &value)
+{
+    WireWriter record;
+    record.write("\0", 1);      // attributes
+    record.writeVarint(0);      // timestamp_delta
+    record.writeVarint(offset_delta);
+    record.writeVarint(key.size());
+    record.write(key.bytes(), key.size());
+    record.writeVarint(value.size());
+    record.write(value.bytes(), value.size());
+    record.writeUnsignedVarint(0); // No headers
+
+    records.writeVarint(record.size());
+    records.write(record.bytes(), record.size());
+}
+
+// Appends a v2 batch of record_count records to log, its offsets are assigned by PartitionLog::append()
+static void writeBatch(std::vector<char> &log, const WireWriter &records, int32_t record_count, int64_t timestamp)
+{
+    WireWriter crc_covered;
+    crc_covered.writeBigEndian<int16_t>(0); // attributes
+    crc_covered.writeBigEndian<int32_t>(record_count - 1);
+    crc_covered.writeBigEndian(timestamp);
+    crc_covered.writeBigEndian(timestamp);
+    crc_covered.writeBigEndian<int64_t>(-1); // producer_id
+    crc_covered.writeBigEndian<int16_t>(-1); // producer_epoch
+    crc_covered.writeBigEndian<int32_t>(-1); // base_sequence
+    crc_covered.writeBigEndian(record_count);
+    crc_covered.write(records.bytes(), records.size());
+
+    WireWriter batch;
+    batch.writeBigEndian<int64_t>(0);
+    batch.writeBigEndian<int32_t>(sizeof(int32_t) + 1 + sizeof(uint32_t) + crc_covered.size());
+    batch.writeBigEndian<int32_t>(0); // partition_leader_epoch
+    batch.write("\x02", 1);           // magic
+    batch.writeBigEndian(crc32c(crc_covered.bytes(), crc_covered.size()));
+    batch.write(crc_covered.bytes(), crc_covered.size());
+
+    log.insert(log.end(), batch.bytes(), batch.bytes() + batch.size());
+}
+
+static void complete(const GroupCoordinator::PendingRequest &pending, int16_t error_code)
+{
+    pending.result->error_code = error_code;
+    pending.operation->forceComplete();
+}
+
+GroupCoordinator &GroupCoordinator::instance()
+{
+    // Never destroyed, like the LogManager it appends through
+    static GroupCoordinator &coordinator = *new GroupCoordinator();
+    return coordinator;
+}
+
+GroupCoordinator::GroupCoordinator()
+    : loop(std::make_unique<EventLoop>()), group_count(0), random(std::random_device{}()), append_in_flight(false), offset_count(0),
+      applied_end_offset(0), snapshot_end_offset(-1), snapshot_timer([this]()
+                                                                     {
+                                                                         writeSnapshot();
+                                                                         loop->schedule(snapshot_timer, brokerConfig().offsets_snapshot_interval_ms); }),
+      stopped(nullptr)
+{
+    load();
+
+    spawnWorkerThread([&loop = *loop]()
+                      { loop.run(); })
+        .detach();
+
+    loop->post([this]()
+               { loop->schedule(snapshot_timer, brokerConfig().offsets_snapshot_interval_ms); });
+
+    BrokerMetrics::registerGauge({.name = "kafka_group_coordinator_groups", .help = "Consumer groups the coordinator has seen", .labels = "", .value = [this]()
+                                  { return static_cast<double>(group_count.load()); }});
+    BrokerMetrics::registerGauge({.name = "kafka_group_coordinator_offsets", .help = "Committed offsets held by the coordinator", .labels = "", .value = [this]()
+                                  { return static_cast<double>(offset_count.load()); }});
+}
+
+void GroupCoordinator::joinGroup(JoinRequest request, PendingRequest pending)
+{
+    loop->post([this, request = std::move(request), pending = std::move(pending)]() mutable
+               { onJoinGroup(request, pending); });
+}
+
+void GroupCoordinator::syncGroup(SyncRequest request, PendingRequest pending)
+{
+    loop->post([this, request = std::move(request), pending = std::move(pending)]() mutable
+               { onSyncGroup(request, pending); });
+}
+
+void GroupCoordinator::heartbeat(std::string group_id, int32_t generation_id, std::string member_id, PendingRequest pending)
+{
+    loop->post([this, group_id = std::move(group_id), generation_id, member_id = std::move(member_id), pending = std::move(pending)]() mutable
+               { onHeartbeat(group_id, generation_id, member_id, pending); });
+}
+
+void GroupCoordinator::leaveGroup(std::string group_id, std::vector<std::string> member_ids, PendingRequest pending)
+{
+    loop->post([this, group_id = std::move(group_id), member_ids = std::move(member_ids), pending = std::move(pending)]() mutable
+               { onLeaveGroup(group_id, member_ids, pending); });
+}
+
+void GroupCoordinator::commitOffsets(std::string group_id, int32_t generation_id, std::string member_id, std::vector<OffsetCommit> commits, PendingRequest pending)
+{
+    loop->post([this, group_id = std::move(group_id), generation_id, member_id = std::move(member_id), commits = std::move(commits), pending = std::move(pending)]() mutable
+               { onCommitOffsets(group_id, generation_id, member_id, commits, pending); });
+}
+
+std::optional<CommittedOffset> GroupCoordinator::committedOffset(std::string_view group_id, std::string_view topic, int32_t partition) const
+{
+    std::shared_lock<std::shared_mutex> lock(offsets_mutex);
+
+    const uint32_t group_name = names.find(group_id);
+    const uint32_t topic_name = names.find(topic);
+    if (group_name == StringInterner::NOT_FOUND || topic_name == StringInterner::NOT_FOUND)
+        return std::nullopt;
+
+    auto group_offsets = offsets.find(group_name);
+    if (group_offsets == offsets.end())
+        return std::nullopt;
+
+    auto committed = group_offsets->second.find(static_cast<uint64_t>(topic_name) << 32 | static_cast<uint32_t>(partition));
+    if (committed == group_offsets->second.end())
+        return std::nullopt;
+    return committed->second;
+}
+
+std::vector<GroupCoordinator::TopicOffsets> GroupCoordinator::committedOffsets(std::string_view group_id) const
+{
+    std::shared_lock<std::shared_mutex> lock(offsets_mutex);
+
+    std::vector<TopicOffsets> topics;
+    const uint32_t group_name = names.find(group_id);
+    auto group_offsets = group_name != StringInterner::NOT_FOUND ? offsets.find(group_name) : offsets.end();
+    if (group_offsets == offsets.end())
+        return topics;
+
+    std::unordered_map<uint32_t, size_t> topic_index;
+    for (auto &[topic_partition, committed] : group_offsets->second)
+    {
+        const uint32_t topic_name = topic_partition >> 32;
+        auto [index, inserted] = topic_index.try_emplace(topic_name, topics.size());
+        if (inserted)
+            topics.push_back({.topic = std::string(names.view(topic_name)), .partitions = {}});
+        topics[index->second].partitions.push_back({static_cast<int32_t>(topic_partition & UINT32_MAX), committed});
+    }
+
+    std::sort(topics.begin(), topics.end(), [](const TopicOffsets &a, const TopicOffsets &b)
+              { return a.topic < b.topic; });
+    for (auto &topic : topics)
+        std::sort(topic.partitions.begin(), topic.partitions.end(), [](const auto &a, const auto &b)
+                  { return a.first < b.first; });
+    return topics;
+}
+
+GroupCoordinator::Group &GroupCoordinator::getOrCreateGroup(const std::string &group_id)
+{
+    // Map nodes don't move, the timers can hold on to the slot
+    std::unique_ptr<Group> &slot = groups[group_id];
+    if (slot == nullptr)
+    {
+        slot = std::make_unique<Group>([this, &slot]()
+                                       { onRebalanceTimeout(*slot); },
+                                       [this, &slot]()
+                                       { onSessionTimeout(*slot); });
+        group_count++;
+    }
+    return *slot;
+}
+
+GroupCoordinator::Group *GroupCoordinator::findGroup(const std::string &group_id)
+{
+    auto found = groups.find(group_id);
+    return found != groups.end() ? found->second.get() : nullptr;
+}
+
+std::string GroupCoordinator::newMemberId(std::string_view client_id)
+{
+    // The client id and a random UUID, like Kafka
+    const uint64_t high = random();
+    const uint64_t low = random();
+    char uuid[37];
+    std::snprintf(uuid, sizeof(uuid), "%08x-%04x-%04x-%04x-%012llx", static_cast<uint32_t>(high >> 32), static_cast<uint32_t>(high >> 16) & 0xFFFF,
+                  static_cast<uint32_t>(high) & 0xFFFF, static_cast<uint32_t>(low >> 48), static_cast<unsigned long long>(low & 0xFFFFFFFFFFFF));
+    return std::string(client_id) + "-" + uuid;
+}
+
+bool GroupCoordinator::supportsProtocols(const Group &group, const std::vector<Protocol> &protocols)
+{
+    // One of the protocols has to be one every member supports
+    return std::any_of(protocols.begin(), protocols.end(), [&](const Protocol &protocol)
+                       { return std::all_of(group.members.begin(), group.members.end(), [&](const auto &member)
+                                            { return std::any_of(member.second.protocols.begin(), member.second.protocols.end(), [&](const Protocol &p)
+                                                                 { return p.name == protocol.name; }); }); });
+}
+
+std::optional<std::string> GroupCoordinator::selectProtocol(const Group &group)
+{
+    // Candidates are the protocols every member supports, each member votes for the candidate it lists first
+    std::vector<std::string_view> candidates;
+    for (auto &protocol : group.members.begin()->second.protocols)
+    {
+        if (supportsProtocols(group, {protocol}))
+            candidates.push_back(protocol.name);
+    }
+    if (candidates.empty())
+        return std::nullopt;
+
+    std::vector<size_t> votes(candidates.size(), 0);
+    for (auto &[member_id, member] : group.members)
+    {
+        for (auto &protocol : member.protocols)
+        {
+            auto candidate = std::find(candidates.begin(), candidates.end(), protocol.name);
+            if (candidate != candidates.end())
+            {
+                votes[candidate - candidates.begin()]++;
+                break;
+            }
+        }
+    }
+    return std::string(candidates[std::max_element(votes.begin(), votes.end()) - votes.begin()]);
+}
+
+void GroupCoordinator::fillJoinResult(const Group &group, const std::string &member_id, GroupResult &result)
+{
+    result.generation_id = group.generation_id;
+    result.protocol_type = group.protocol_type;
+    result.protocol_name = group.protocol_name;
+    result.leader_id = group.leader_id;
+    result.member_id = member_id;
+    if (member_id != group.leader_id)
+        return;
+
+    // The leader computes the assignment, it gets every member's metadata for the chosen protocol
+    for (auto &[id, member] : group.members)
+    {
+        auto protocol = std::find_if(member.protocols.begin(), member.protocols.end(), [&](const Protocol &p)
+                                     { return p.name == group.protocol_name; });
+        result.members.push_back({.member_id = id, .metadata = protocol != member.protocols.end() ? protocol->metadata : std::vector<char>{}});
+    }
+}
+
+void GroupCoordinator::fillSyncResult(const Group &group, const Member &member, GroupResult &result)
+{
+    result.protocol_type = group.protocol_type;
+    result.protocol_name = group.protocol_name;
+    result.assignment = member.assignment;
+}
+
+void GroupCoordinator::onJoinGroup(JoinRequest &request, PendingRequest &pending)
+{
+    const BrokerConfig &config = brokerConfig();
+
+    if (request.group_id.empty())
+        return complete(pending, INVALID_GROUP_ID);
+    if (request.session_timeout_ms < config.group_min_session_timeout_ms || request.session_timeout_ms > config.group_max_session_timeout_ms)
+        return complete(pending, INVALID_SESSION_TIMEOUT);
+    if (request.protocol_type.empty() || request.protocols.empty())
+        return complete(pending, INCONSISTENT_GROUP_PROTOCOL);
+
+    Group &group = getOrCreateGroup(request.group_id);
+    if (!group.members.empty() && (request.protocol_type != group.protocol_type || !supportsProtocols(group, request.protocols)))
+        return complete(pending, INCONSISTENT_GROUP_PROTOCOL);
+
+    const int64_t now_ms = loop->nowMs();
+    const bool new_member = request.member_id.empty();
+    std::string member_id = request.member_id;
+    if (new_member)
+    {
+        member_id = newMemberId(request.client_id);
+        group.members.emplace(member_id, Member{.client_id = request.client_id, .session_timeout_ms = 0, .rebalance_timeout_ms = 0,
+                                                .protocols = {}, .assignment = {}, .last_heartbeat_ms = now_ms, .pending_join = std::nullopt,
+                                                .pending_sync = std::nullopt});
+    }
+    else
+    {
+        auto found = group.members.find(member_id);
+        if (found == group.members.end())
+            return complete(pending, UNKNOWN_MEMBER_ID);
+
+        // A follower rejoining a settled group with the same protocols just gets the current generation back
+        Member &member = found->second;
+        const bool same_protocols = std::equal(member.protocols.begin(), member.protocols.end(), request.protocols.begin(), request.protocols.end(),
+                                               [](const Protocol &a, const Protocol &b)
+                                               { return a.name == b.name && a.metadata == b.metadata; });
+        if ((group.state == GroupState::STABLE || group.state == GroupState::COMPLETING_REBALANCE) && member_id != group.leader_id && same_protocols)
+        {
+            member.last_heartbeat_ms = now_ms;
+            fillJoinResult(group, member_id, *pending.result);
+            return complete(pending, 0);
+        }
+
+        if (member.pending_join)
+            complete(*member.pending_join, REBALANCE_IN_PROGRESS);
+    }
+
+    Member &member = group.members.at(member_id);
+    member.session_timeout_ms = request.session_timeout_ms;
+    member.rebalance_timeout_ms = request.rebalance_timeout_ms;
+    member.protocols = std::move(request.protocols);
+    member.last_heartbeat_ms = now_ms;
+    member.pending_join = pending;
+    group.protocol_type = request.protocol_type;
+
+    if (group.state != GroupState::PREPARING_REBALANCE)
+    {
+        prepareRebalance(group);
+    }
+    else if (group.initial_rebalance && new_member)
+    {
+        // Every member joining an empty group gives the others another delay, up to the rebalance timeout
+        const int64_t end_ms = std::min(now_ms + config.group_initial_rebalance_delay_ms, group.initial_rebalance_end_ms);
+        loop->cancel(group.rebalance_timer);
+        loop->schedule(group.rebalance_timer, std::max<int64_t>(end_ms - now_ms, 1));
+    }
+    maybeCompleteJoin(group);
+}
+
+void GroupCoordinator::onSyncGroup(SyncRequest &request, PendingRequest &pending)
+{
+    Group *group = findGroup(request.group_id);
+    auto found = group != nullptr ? group->members.find(request.member_id) : decltype(group->members.end()){};
+    if (group == nullptr || found == group->members.end())
+        return complete(pending, UNKNOWN_MEMBER_ID);
+    if (request.generation_id != group->generation_id)
+        return complete(pending, ILLEGAL_GENERATION);
+    if ((request.protocol_type && *request.protocol_type != group->protocol_type) || (request.protocol_name && request.protocol_name != group->protocol_name))
+        return complete(pending, INCONSISTENT_GROUP_PROTOCOL);
+
+    Member &member = found->second;
+    member.last_heartbeat_ms = loop->nowMs();
+
+    switch (group->state)
+    {
+    case GroupState::EMPTY:
+        return complete(pending, UNKNOWN_MEMBER_ID);
+
+    case GroupState::PREPARING_REBALANCE:
+        return complete(pending, REBALANCE_IN_PROGRESS);
+
+    case GroupState::STABLE:
+        fillSyncResult(*group, member, *pending.result);
+        return complete(pending, 0);
+
+    case GroupState::COMPLETING_REBALANCE:
+        if (member.pending_sync)
+            complete(*member.pending_sync, REBALANCE_IN_PROGRESS);
+        member.pending_sync = pending;
+        if (request.member_id != group->leader_id)
+            return;
+
+        // The leader's assignment settles the generation, members it left out get an empty one
+        for (auto &[member_id, assignment] : request.assignments)
+        {
+            auto assigned = group->members.find(member_id);
+            if (assigned != group->members.end())
+                assigned->second.assignment = std::move(assignment);
+        }
+        group->state = GroupState::STABLE;
+        for (auto &[member_id, waiting] : group->members)
+        {
+            if (!waiting.pending_sync)
+                continue;
+            fillSyncResult(*group, waiting, *waiting.pending_sync->result);
+            complete(*waiting.pending_sync, 0);
+            waiting.pending_sync.reset();
+        }
+        return;
+    }
+}
+
+void GroupCoordinator::onHeartbeat(const std::string &group_id, int32_t generation_id, const std::string &member_id, PendingRequest &pending)
+{
+    Group *group = findGroup(group_id);
+    auto found = group != nullptr ? group->members.find(member_id) : decltype(group->members.end()){};
+    if (group == nullptr || found == group->members.end())
+        return complete(pending, UNKNOWN_MEMBER_ID);
+    if (generation_id != group->generation_id)
+        return complete(pending, ILLEGAL_GENERATION);
+
+    found->second.last_heartbeat_ms = loop->nowMs();
+    complete(pending, group->state == GroupState::PREPARING_REBALANCE ? REBALANCE_IN_PROGRESS : 0);
+}
+
+void GroupCoordinator::onLeaveGroup(const std::string &group_id, const std::vector<std::string> &member_ids, PendingRequest &pending)
+{
+    Group *group = findGroup(group_id);
+
+    bool left = false;
+    for (auto &member_id : member_ids)
+    {
+        if (group != nullptr && group->members.contains(member_id))
+        {
+            removeMember(*group, member_id);
+            pending.result->error_codes.push_back(0);
+            left = true;
+        }
+        else
+        {
+            pending.result->error_codes.push_back(UNKNOWN_MEMBER_ID);
+        }
+    }
+
+    if (left)
+        membersChanged(*group);
+    complete(pending, 0);
+}
+
+void GroupCoordinator::onCommitOffsets(const std::string &group_id, int32_t generation_id, const std::string &member_id, std::vector<OffsetCommit> &commits, PendingRequest &pending)
+{
+    Group *group = findGroup(group_id);
+
+    int16_t error_code = 0;
+    if (group_id.empty())
+        error_code = INVALID_GROUP_ID;
+    else if (generation_id < 0 && member_id.empty())
+        error_code = group != nullptr && !group->members.empty() ? UNKNOWN_MEMBER_ID : 0; // Not while members own the partitions
+    else if (group == nullptr || !group->members.contains(member_id))
+        error_code = UNKNOWN_MEMBER_ID;
+    else if (generation_id != group->generation_id)
+        error_code = ILLEGAL_GENERATION;
+    else if (group->state == GroupState::COMPLETING_REBALANCE)
+        error_code = REBALANCE_IN_PROGRESS;
+    else
+        group->members.at(member_id).last_heartbeat_ms = loop->nowMs();
+
+    pending.result->error_codes.assign(commits.size(), error_code);
+    if (error_code != 0)
+        return complete(pending, error_code);
+
+    const int64_t now_ms = wallClockMs();
+    const size_t pending_before = pending_commits.size();
+    for (size_t i = 0; i < commits.size(); i++)
+    {
+        if (commits[i].metadata.size() > brokerConfig().offset_metadata_max_bytes)
+            pending.result->error_codes[i] = OFFSET_METADATA_TOO_LARGE;
+        else
+            pending_commits.push_back({.group_id = group_id, .commit = std::move(commits[i]), .commit_timestamp = now_ms});
+    }
+
+    if (pending_commits.size() == pending_before)
+        return complete(pending, 0);
+
+    pending_commit_requests.push_back(pending);
+    appendCommits();
+}
+
+void GroupCoordinator::prepareRebalance(Group &group)
+{
+    // Members waiting for the old generation's assignment have to rejoin
+    if (group.state == GroupState::COMPLETING_REBALANCE)
+    {
+        for (auto &[member_id, member] : group.members)
+        {
+            if (member.pending_sync)
+            {
+                complete(*member.pending_sync, REBALANCE_IN_PROGRESS);
+                member.pending_sync.reset();
+            }
+        }
+    }
+
+    int64_t rebalance_timeout_ms = 1;
+    for (auto &[member_id, member] : group.members)
+        rebalance_timeout_ms = std::max<int64_t>(rebalance_timeout_ms, member.rebalance_timeout_ms);
+
+    // An empty group waits a little for more members, so a consumer group starting up doesn't rebalance once per member
+    const int64_t delay_ms = brokerConfig().group_initial_rebalance_delay_ms;
+    group.initial_rebalance = group.state == GroupState::EMPTY && delay_ms > 0;
+    group.initial_rebalance_end_ms = loop->nowMs() + rebalance_timeout_ms;
+    group.state = GroupState::PREPARING_REBALANCE;
+
+    loop->cancel(group.rebalance_timer);
+    loop->schedule(group.rebalance_timer, group.initial_rebalance ? std::min(delay_ms, rebalance_timeout_ms) : rebalance_timeout_ms);
+}
+
+void GroupCoordinator::maybeCompleteJoin(Group &group)
+{
+    if (group.state == GroupState::PREPARING_REBALANCE && !group.initial_rebalance &&
+        std::all_of(group.members.begin(), group.members.end(), [](const auto &member)
+                    { return member.second.pending_join.has_value(); }))
+        completeJoin(group);
+}
+
+void GroupCoordinator::completeJoin(Group &group)
+{
+    loop->cancel(group.rebalance_timer);
+    group.initial_rebalance = false;
+    group.generation_id++;
+
+    if (group.members.empty())
+    {
+        group.state = GroupState::EMPTY;
+        group.protocol_name.reset();
+        group.leader_id.clear();
+        return;
+    }
+
+    group.protocol_name = selectProtocol(group);
+    if (!group.members.contains(group.leader_id))
+        group.leader_id = group.members.begin()->first;
+    group.state = GroupState::COMPLETING_REBALANCE;
+
+    const int64_t now_ms = loop->nowMs();
+    int64_t session_deadline_ms = INT64_MAX;
+    for (auto &[member_id, member] : group.members)
+    {
+        member.assignment.clear();
+        member.last_heartbeat_ms = now_ms;
+        session_deadline_ms = std::min(session_deadline_ms, now_ms + member.session_timeout_ms);
+
+        fillJoinResult(group, member_id, *member.pending_join->result);
+        complete(*member.pending_join, 0);
+        member.pending_join.reset();
+    }
+    armSessionTimer(group, session_deadline_ms);
+}
+
+void GroupCoordinator::removeMember(Group &group, const std::string &member_id)
+{
+    auto found = group.members.find(member_id);
+    if (found->second.pending_join)
+        complete(*found->second.pending_join, UNKNOWN_MEMBER_ID);
+    if (found->second.pending_sync)
+        complete(*found->second.pending_sync, UNKNOWN_MEMBER_ID);
+    group.members.erase(found);
+}
+
+void GroupCoordinator::membersChanged(Group &group)
+{
+    switch (group.state)
+    {
+    case GroupState::EMPTY:
+        break;
+
+    case GroupState::PREPARING_REBALANCE:
+        if (group.members.empty())
+            completeJoin(group);
+        else
+            maybeCompleteJoin(group);
+        break;
+
+    case GroupState::COMPLETING_REBALANCE:
+    case GroupState::STABLE:
+        if (group.members.empty())
+            completeJoin(group);
+        else
+            prepareRebalance(group);
+        break;
+    }
+}
+
+void GroupCoordinator::onRebalanceTimeout(Group &group)
+{
+    if (group.state != GroupState::PREPARING_REBALANCE)
+        return;
+
+    // Members that didn't rejoin in time are out of the group
+    std::vector<std::string> missing;
+    for (auto &[member_id, member] : group.members)
+    {
+        if (!member.pending_join)
+            missing.push_back(member_id);
+    }
+    for (auto &member_id : missing)
+        removeMember(group, member_id);
+
+    completeJoin(group);
+}
+
+void GroupCoordinator::onSessionTimeout(Group &group)
+{
+    const int64_t now_ms = loop->nowMs();
+
+    std::vector<std::string> expired;
+    int64_t next_deadline_ms = INT64_MAX;
+    for (auto &[member_id, member] : group.members)
+    {
+        // A member waiting in JoinGroup is bound by the rebalance timeout instead
+        if (member.pending_join)
+            continue;
+
+        const int64_t deadline_ms = member.last_heartbeat_ms + member.session_timeout_ms;
+        if (deadline_ms <= now_ms)
+            expired.push_back(member_id);
+        else
+            next_deadline_ms = std::min(next_deadline_ms, deadline_ms);
+    }
+
+    for (auto &member_id : expired)
+        removeMember(group, member_id);
+    if (!expired.empty())
+        membersChanged(group);
+
+    if (next_deadline_ms != INT64_MAX)
+        armSessionTimer(group, next_deadline_ms);
+}
+
+void GroupCoordinator::armSessionTimer(Group &group, int64_t deadline_ms)
+{
+    if (group.session_timer.isScheduled() && group.session_timer.expirationMs() <= deadline_ms)
+        return;
+
+    loop->cancel(group.session_timer);
+    loop->schedule(group.session_timer, std::max<int64_t>(deadline_ms - loop->nowMs(), 1));
+}
+
+void GroupCoordinator::appendCommits()
+{
+    if (append_in_flight || pending_commits.empty())
+        return;
+
+    // Everything committed while the previous append was in flight goes out in this one
+    appending_commits = std::move(pending_commits);
+    appending_commit_requests = std::move(pending_commit_requests);
+    pending_commits.clear();
+    pending_commit_requests.clear();
+
+    const int64_t timestamp = wallClockMs();
+    std::vector<char> records;
+    WireWriter batch_records, key, value;
+    int32_t batch_count = 0;
+    for (auto &pending : appending_commits)
+    {
+        key.clear();
+        value.clear();
+        writeOffsetKey(key, pending.group_id, pending.commit.topic, pending.commit.partition);
+        writeOffsetValue(value, {.offset = pending.commit.offset, .commit_timestamp = pending.commit_timestamp,
+                                 .leader_epoch = pending.commit.leader_epoch, .metadata = pending.commit.metadata});
+        writeRecord(batch_records, batch_count, key, value);
+
+        if (++batch_count == MAX_RECORDS_PER_BATCH)
+        {
+            writeBatch(records, batch_records, batch_count, timestamp);
+            batch_records.clear();
+            batch_count = 0;
+        }
+    }
+    if (batch_count > 0)
+        writeBatch(records, batch_records, batch_count, timestamp);
+
+    append_in_flight = true;
+    LogManager::instance().appendAsync(CONSUMER_OFFSETS_PARTITION, CONSUMER_OFFSETS_TOPIC, std::move(records),
+                                       [this](int64_t base_offset, PartitionLog &)
+                                       { loop->post([this, base_offset]()
+                                                    { onCommitsAppended(base_offset); }); });
+}
+
+void GroupCoordinator::onCommitsAppended(int64_t base_offset)
+{
+    append_in_flight = false;
+
+    if (base_offset == -1)
+    {
+        for (auto &pending : appending_commit_requests)
+        {
+            std::replace(pending.result->error_codes.begin(), pending.result->error_codes.end(), int16_t(0), COORDINATOR_NOT_AVAILABLE);
+            complete(pending, COORDINATOR_NOT_AVAILABLE);
+        }
+    }
+    else
+    {
+        // Only visible to OffsetFetch once in the log
+        {
+            std::unique_lock<std::shared_mutex> lock(offsets_mutex);
+            for (auto &pending : appending_commits)
+                applyCommit(pending.group_id, pending.commit.topic, pending.commit.partition,
+                            CommittedOffset{.offset = pending.commit.offset, .commit_timestamp = pending.commit_timestamp,
+                                            .leader_epoch = pending.commit.leader_epoch, .metadata = std::move(pending.commit.metadata)});
+        }
+        applied_end_offset = base_offset + appending_commits.size();
+        BrokerMetrics::local().add(Counter::OFFSET_COMMITS, appending_commits.size());
+
+        for (auto &pending : appending_commit_requests)
+            complete(pending, 0);
+    }
+
+    appending_commits.clear();
+    appending_commit_requests.clear();
+    appendCommits();
+    stopIfIdle();
+}
+
+void GroupCoordinator::applyCommit(std::string_view group_id, std::string_view topic, int32_t partition, std::optional<CommittedOffset> committed)
+{
+    GroupOffsets &group_offsets = offsets[names.intern(group_id)];
+    const uint64_t topic_partition = static_cast<uint64_t>(names.intern(topic)) << 32 | static_cast<uint32_t>(partition);
+
+    if (committed)
+    {
+        if (group_offsets.insert_or_assign(topic_partition, std::move(*committed)).second)
+            offset_count++;
+    }
+    else if (group_offsets.erase(topic_partition) > 0)
+    {
+        offset_count--;
+    }
+}
+
+void GroupCoordinator::applyRecord(std::span<const char> key, std::optional<std::span<const char>> value)
+{
+    // Key versions 0 and 1 are offset commits, 2 is group metadata which isn't kept: members rejoin after a restart
+    WireReader key_reader(key.data(), key.size());
+    if (key_reader.readBigEndian<int16_t>() > 1)
+        return;
+    const std::string group_id = readString(key_reader);
+    const std::string topic = readString(key_reader);
+    const int32_t partition = key_reader.readBigEndian<int32_t>();
+    if (!key_reader.ok())
+        return;
+
+    if (!value)
+    {
+        applyCommit(group_id, topic, partition, std::nullopt);
+        return;
+    }
+
+    // Value versions 0 to 3: offset, leader epoch (3), metadata, commit timestamp (and expire timestamp in 1)
+    WireReader value_reader(value->data(), value->size());
+    const int16_t version = value_reader.readBigEndian<int16_t>();
+    CommittedOffset committed{.offset = value_reader.readBigEndian<int64_t>(), .commit_timestamp = -1, .leader_epoch = -1, .metadata = {}};
+    if (version >= 3)
+        committed.leader_epoch = value_reader.readBigEndian<int32_t>();
+    committed.metadata = readString(value_reader);
+    committed.commit_timestamp = value_reader.readBigEndian<int64_t>();
+    if (value_reader.ok())
+        applyCommit(group_id, topic, partition, std::move(committed));
+}
+
+void GroupCoordinator::load()
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    PartitionLog &log = LogManager::instance().getLog(CONSUMER_OFFSETS_PARTITION, CONSUMER_OFFSETS_TOPIC);
+    snapshot_path = log.path() + "/offsets.snapshot";
+
+    const int64_t end_offset = log.highWatermark();
+    const int64_t snapshot_offset = loadSnapshot(end_offset);
+    snapshot_end_offset = snapshot_offset;
+
+    // Replay what was appended after the snapshot, batch by batch
+    int64_t next_offset = std::max(snapshot_offset, log.logStartOffset());
+    size_t replayed = 0;
+    std::vector<char> records, buffer;
+    while (next_offset < end_offset)
+    {
+        if (log.read(next_offset, REPLAY_READ_BYTES, true, records) != 0 || records.empty())
+        {
+            std::cerr << "Couldn't replay " << log.path() << " from offset " << next_offset << std::endl;
+            break;
+        }
+
+        for (size_t position = 0; position + RecordBatchHeader::SIZE <= records.size();)
+        {
+            const char *batch = records.data() + position;
+            const size_t batch_size = RecordBatchHeader::LOG_OVERHEAD + readBE32(batch + RecordBatchHeader::BATCH_LENGTH_POS);
+            if (position + batch_size > records.size())
+                break;
+
+            const int64_t base_offset = readBE64(batch + RecordBatchHeader::BASE_OFFSET_POS);
+            forEachRecord(base_offset, batchRecords({batch, batch_size}, buffer), [&](const CleanerRecord &record, std::span<const char>)
+                          {
+                              if (record.offset >= next_offset && record.key)
+                              {
+                                  applyRecord(*record.key, record.value);
+                                  replayed++;
+                              } });
+            next_offset = std::max(next_offset, base_offset + readBE32(batch + RecordBatchHeader::LAST_OFFSET_DELTA_POS) + 1);
+            position += batch_size;
+        }
+    }
+    applied_end_offset = next_offset;
+
+    const auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Loaded " << offset_count.load() << " committed offsets of " << offsets.size() << " groups from " << log.path()
+              << " (snapshot up to offset " << std::max<int64_t>(snapshot_offset, 0) << ", " << replayed << " records replayed) in " << elapsed_ms << " ms" << std::endl;
+}
+
+// offsets.snapshot: version (int16) and the log offset it is up to date with (int64), then the int32 size prefixed key
+// and value of every committed offset as they are in the log, then a CRC-32C of all of it
+int64_t GroupCoordinator::loadSnapshot(int64_t log_end_offset)
+{
+    std::ifstream file(snapshot_path, std::ios::binary);
+    if (!file.is_open())
+        return 0;
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    constexpr size_t HEADER_SIZE = sizeof(int16_t) + sizeof(int64_t);
+    if (data.size() < HEADER_SIZE + sizeof(uint32_t) ||
+        crc32c(data.data(), data.size() - sizeof(uint32_t)) != static_cast<uint32_t>(readBE32(data.data() + data.size() - sizeof(uint32_t))))
+    {
+        std::cerr << "Ignoring corrupt " << snapshot_path << std::endl;
+        return 0;
+    }
+
+    WireReader reader(data.data(), data.size() - sizeof(uint32_t));
+    const int16_t version = reader.readBigEndian<int16_t>();
+    const int64_t end_offset = reader.readBigEndian<int64_t>();
+    // The log is what counts, it can be behind the snapshot after losing its unflushed tail in a crash
+    if (version != 0 || end_offset > log_end_offset)
+    {
+        std::cerr << "Ignoring " << snapshot_path << ", it is ahead of the log" << std::endl;
+        return 0;
+    }
+
+    std::vector<char> key, value;
+    while (reader.remaining() > 0 && reader.ok())
+    {
+        key.resize(std::min<size_t>(std::max(reader.readBigEndian<int32_t>(), 0), reader.remaining()));
+        reader.read(key.data(), key.size());
+        value.resize(std::min<size_t>(std::max(reader.readBigEndian<int32_t>(), 0), reader.remaining()));
+        reader.read(value.data(), value.size());
+        applyRecord(key, std::span<const char>(value));
+    }
+    return end_offset;
+}
+
+void GroupCoordinator::shutdown()
+{
+    std::promise<void> done;
+    loop->post([this, &done]()
+               {
+                   stopped = &done;
+                   appendCommits();
+                   stopIfIdle(); });
+    done.get_future().wait();
+}
+
+void GroupCoordinator::stopIfIdle()
+{
+    if (stopped == nullptr || append_in_flight)
+        return;
+
+    loop->cancel(snapshot_timer);
+    writeSnapshot();
+    loop->stop();
+    std::exchange(stopped, nullptr)->set_value();
+}
+
+void GroupCoordinator::writeSnapshot()
+{
+    if (applied_end_offset == snapshot_end_offset)
+        return;
+
+    // Only this thread changes the offsets, reading them here needs no lock
+    WireWriter snapshot, key, value;
+    snapshot.writeBigEndian<int16_t>(0);
+    snapshot.writeBigEndian(applied_end_offset);
+    for (auto &[group_name, group_offsets] : offsets)
+    {
+        for (auto &[topic_partition, committed] : group_offsets)
+        {
+            key.clear();
+            value.clear();
+            writeOffsetKey(key, names.view(group_name), names.view(topic_partition >> 32), static_cast<int32_t>(topic_partition & UINT32_MAX));
+            writeOffsetValue(value, committed);
+            snapshot.writeBigEndian<int32_t>(key.size());
+            snapshot.write(key.bytes(), key.size());
+            snapshot.writeBigEndian<int32_t>(value.size());
+            snapshot.write(value.bytes(), value.size());
+        }
+    }
+    snapshot.writeBigEndian(crc32c(snapshot.bytes(), snapshot.size()));
+
+    // Written aside and renamed over the old one, a crash leaves one or the other
+    const std::string temp_path = snapshot_path + ".tmp";
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        std::perror("Error occured");
+        return;
+    }
+
+    bool ok = true;
+    for (size_t written = 0; ok && written < snapshot.size();)
+    {
+        const ssize_t bytes = write(fd, snapshot.bytes() + written, snapshot.size() - written);
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        ok = bytes > 0;
+        written += ok ? bytes : 0;
+    }
+    ok = ok && fdatasync(fd) == 0;
+    close(fd);
+
+    if (!ok || rename(temp_path.c_str(), snapshot_path.c_str()) != 0)
+    {
+        std::perror("Error occured");
+        unlink(temp_path.c_str());
+        return;
+    }
+    snapshot_end_offset = applied_end_offset;
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "common.h"
+#include "event_loop.h"
+#include "partition_log.h"
+#include "metadata_index.h"
+
+class DelayedOperation;
+
+// __consumer_offsets isn't in the metadata log, its one partition is keyed by the reserved all-zero topic id
+inline const TopicPartition CONSUMER_OFFSETS_PARTITION = {.topic_id = {}, .partition = 0};
+inline constexpr std::string_view CONSUMER_OFFSETS_TOPIC = "__consumer_offsets";
+
+// Outcome of a JoinGroup, SyncGroup, Heartbeat, LeaveGroup or OffsetCommit request, filled in on the coordinator
+// thread before the request's DelayedOperation completes. Each response reads the fields it has.
+struct GroupResult
+{
+    struct Member
+    {
+        std::string member_id;
+        std::vector<char> metadata;
+    };
+
+    int16_t error_code = 0;
+    int32_t generation_id = -1;
+    std::string protocol_type;
+    std::optional<std::string> protocol_name;
+    std::string leader_id;
+    std::string member_id;
+    std::vector<Member> members;      // JoinGroup, only the leader gets them
+    std::vector<char> assignment;     // SyncGroup
+    std::vector<int16_t> error_codes; // OffsetCommit per partition, LeaveGroup per member, in request order
+};
+
+struct CommittedOffset
+{
+    int64_t offset;
+    int64_t commit_timestamp;
+    int32_t leader_epoch;
+    std::string metadata;
+};
+
+// Coordinates every consumer group (this broker is the coordinator of all of them) with the classic group
+// protocol, and keeps their committed offsets. Group state only lives on the coordinator thread: requests are
+// posted to it and answered by completing their DelayedOperation. Committed offsets are kept per group keyed
+// by interned topic name and partition, and written to the compacted __consumer_offsets-0 log as Kafka's offset
+// commit records; commits that arrive while an append is in flight go out together in the next one. The offsets
+// are snapshotted every offsets.snapshot.interval.ms, a restart loads the snapshot and replays the log after it.
+class GroupCoordinator
+{
+public:
+    struct Protocol
+    {
+        std::string name;
+        std::vector<char> metadata;
+    };
+
+    struct JoinRequest
+    {
+        std::string group_id;
+        std::string member_id; // Empty for a member joining for the first time
+        std::string client_id;
+        int32_t session_timeout_ms;
+        int32_t rebalance_timeout_ms;
+        std::string protocol_type;
+        std::vector<Protocol> protocols;
+    };
+
+    struct SyncRequest
+    {
+        std::string group_id;
+        int32_t generation_id;
+        std::string member_id;
+        std::optional<std::string> protocol_type;
+        std::optional<std::string> protocol_name;
+        std::vector<std::pair<std::string, std::vector<char>>> assignments; // Member id -> assignment, from the leader
+    };
+
+    struct OffsetCommit
+    {
+        std::string topic;
+        int32_t partition;
+        int64_t offset;
+        int32_t leader_epoch;
+        std::string metadata;
+    };
+
+    // Request waiting for the coordinator, result is filled in before operation is completed
+    struct PendingRequest
+    {
+        std::shared_ptr<GroupResult> result;
+        std::shared_ptr<DelayedOperation> operation;
+    };
+
+    struct TopicOffsets
+    {
+        std::string topic;
+        std::vector<std::pair<int32_t, CommittedOffset>> partitions;
+    };
+
+    static GroupCoordinator &instance();
+
+    void joinGroup(JoinRequest request, PendingRequest pending);
+    void syncGroup(SyncRequest request, PendingRequest pending);
+    void heartbeat(std::string group_id, int32_t generation_id, std::string member_id, PendingRequest pending);
+    void leaveGroup(std::string group_id, std::vector<std::string> member_ids, PendingRequest pending);
+    // A negative generation_id with an empty member_id commits for a group without members (an admin or a
+    // consumer with manual assignment)
+    void commitOffsets(std::string group_id, int32_t generation_id, std::string member_id, std::vector<OffsetCommit> commits, PendingRequest pending);
+
+    // Read from any thread, without going through the coordinator thread
+    std::optional<CommittedOffset> committedOffset(std::string_view group_id, std::string_view topic, int32_t partition) const;
+    std::vector<TopicOffsets> committedOffsets(std::string_view group_id) const;
+
+    // Waits for the offset append in flight, snapshots the offsets so the next start replays nothing and stops the
+    // coordinator thread. Appends still need the log directory I/O threads (or the shards) running.
+    void shutdown();
+
+private:
+    enum class GroupState
+    {
+        EMPTY,
+        PREPARING_REBALANCE,   // Waiting for the members to (re)join
+        COMPLETING_REBALANCE,  // Joined, waiting for the leader's assignment
+        STABLE
+    };
+
+    struct Member
+    {
+        std::string client_id;
+        int32_t session_timeout_ms;
+        int32_t rebalance_timeout_ms;
+        std::vector<Protocol> protocols;
+        std::vector<char> assignment;
+        int64_t last_heartbeat_ms;
+        std::optional<PendingRequest> pending_join;
+        std::optional<PendingRequest> pending_sync;
+    };
+
+    struct Group
+    {
+        GroupState state;
+        int32_t generation_id;
+        std::string protocol_type;
+        std::optional<std::string> protocol_name;
+        std::string leader_id;
+        std::unordered_map<std::string, Member> members;
+        bool initial_rebalance;           // Waiting group.initial.rebalance.delay.ms for more members of an empty group
+        int64_t initial_rebalance_end_ms; // Latest the delay can be extended to
+        CallbackTimer rebalance_timer;    // Ends the join phase
+        CallbackTimer session_timer;      // At the earliest session expiry, heartbeats don't touch it
+
+        Group(std::function<void()> on_rebalance_timeout, std::function<void()> on_session_timeout)
+            : state(GroupState::EMPTY), generation_id(0), initial_rebalance(false), initial_rebalance_end_ms(0),
+              rebalance_timer(std::move(on_rebalance_timeout)), session_timer(std::move(on_session_timeout)) {}
+    };
+
+    struct PendingCommit
+    {
+        std::string group_id;
+        OffsetCommit commit;
+        int64_t commit_timestamp;
+    };
+
+    // Committed offsets of one group, keyed by topic name id << 32 | partition
+    using GroupOffsets = std::unordered_map<uint64_t, CommittedOffset>;
+
+    GroupCoordinator();
+
+    void onJoinGroup(JoinRequest &request, PendingRequest &pending);
+    void onSyncGroup(SyncRequest &request, PendingRequest &pending);
+    void onHeartbeat(const std::string &group_id, int32_t generation_id, const std::string &member_id, PendingRequest &pending);
+    void onLeaveGroup(const std::string &group_id, const std::vector<std::string> &member_ids, PendingRequest &pending);
+    void onCommitOffsets(const std::string &group_id, int32_t generation_id, const std::string &member_id, std::vector<OffsetCommit> &commits, PendingRequest &pending);
+
+    Group &getOrCreateGroup(const std::string &group_id);
+    Group *findGroup(const std::string &group_id);
+    std::string newMemberId(std::string_view client_id);
+    static bool supportsProtocols(const Group &group, const std::vector<Protocol> &protocols);
+    static std::optional<std::string> selectProtocol(const Group &group);
+    static void fillJoinResult(const Group &group, const std::string &member_id, GroupResult &result);
+    static void fillSyncResult(const Group &group, const Member &member, GroupResult &result);
+    void prepareRebalance(Group &group);
+    void maybeCompleteJoin(Group &group);
+    void completeJoin(Group &group);
+    void removeMember(Group &group, const std::string &member_id);
+    void membersChanged(Group &group);
+    void onRebalanceTimeout(Group &group);
+    void onSessionTimeout(Group &group);
+    void armSessionTimer(Group &group, int64_t deadline_ms);
+
+    void appendCommits();
+    void onCommitsAppended(int64_t base_offset);
+    void applyCommit(std::string_view group_id, std::string_view topic, int32_t partition, std::optional<CommittedOffset> committed);
+    void applyRecord(std::span<const char> key, std::optional<std::span<const char>> value);
+
+    void load();
+    int64_t loadSnapshot(int64_t log_end_offset);
+    void writeSnapshot();
+    void stopIfIdle();
+
+    std::unique_ptr<EventLoop> loop;
+    std::unordered_map<std::string, std::unique_ptr<Group>> groups; // Never erased, timers point at them
+    std::atomic<size_t> group_count;
+    std::mt19937_64 random;
+
+    std::vector<PendingCommit> pending_commits;     // Not appended yet
+    std::vector<PendingRequest> pending_commit_requests;
+    std::vector<PendingCommit> appending_commits;   // In the append in flight
+    std::vector<PendingRequest> appending_commit_requests;
+    bool append_in_flight;
+
+    mutable std::shared_mutex offsets_mutex; // Offsets change on the coordinator thread, OffsetFetch reads them anywhere
+    StringInterner names;                    // Group ids and topic names
+    std::unordered_map<uint32_t, GroupOffsets> offsets; // By group id name id
+    std::atomic<size_t> offset_count;
+
+    std::string snapshot_path;
+    int64_t applied_end_offset;  // Log offset the offsets are up to date with
+    int64_t snapshot_end_offset; // Offset the snapshot on disk is up to date with
+    CallbackTimer snapshot_timer;
+    std::promise<void> *stopped; // Set by shutdown()
+};
@@ -1,77 +1,87 @@
 #include "kafka_utils.h"
-#include "log_parsing.h"
+#include "metadata_index.h"
+#include "partition_log.h"
+#include "purgatory.h"
+#include "broker_config.h"
+#include "group_coordinator.h"
 
-static void recvNullableString(int client_fd, int8_t &len, std::vector<char> &str)
+static void recvNullableString(WireReader &reader, int16_t &len, std::vector<char> &str)
 {
-    recv(client_fd, &len, sizeof(len), 0);
-    str.resize(len);
-    recv(client_fd, str.data(), len, 0);
+    reader.read(&len, sizeof(len));
+    convertBE16toH(len);
+    str.resize(std::max<int16_t>(len, 0)); // -1 is a null string
+    reader.read(str.data(), str.size());
 }
 
-static void recvNullableString(int client_fd, int16_t &len, std::vector<char> &str)
+void recvCompactString(WireReader &reader, uint32_t &len, std::vector<char> &str)
 {
-    recv(client_fd, &len, sizeof(len), 0);
-    convertBE16toH(len);
-    str.resize(len);
-    recv(client_fd, str.data(), len, 0);
+    len = reader.readUnsignedVarint();
+    const size_t size = len > 0 ? len - 1 : 0; // 0 is a null string
+    if (size > reader.remaining())
+    {
+        reader.skip(size); // Runs past the frame, the request fails without allocating the claimed length
+        str.clear();
+        return;
+    }
+    str.resize(size);
+    reader.read(str.data(), str.size());
 }
 
-static void recvCompactString(int client_fd, int8_t &len, std::vector<char> &str)
+void recvTaggedFields(WireReader &reader, uint32_t &tag_buffer)
 {
-    recv(client_fd, &len, sizeof(len), 0);
-    str.resize(len - 1);
-    recv(client_fd, str.data(), len - 1, 0);
+    // None of the tagged fields we receive are interpreted, skip over them
+    tag_buffer = reader.readUnsignedVarint();
+    for (uint32_t i = 0; i < tag_buffer && reader.ok(); i++)
+    {
+        reader.readUnsignedVarint(); // Tag
+        reader.skip(reader.readUnsignedVarint());
+    }
 }
 
-static void recvCompactString(int client_fd, int16_t &len, std::vector<char> &str)
+void sendCompactString(WireWriter &writer, uint32_t len, const std::vector<char> &str)
 {
-    recv(client_fd, &len, sizeof(len), 0);
-    convertBE16toH(len);
-    str.resize(len - 1);
-    recv(client_fd, str.data(), len - 1, 0);
+    writer.writeUnsignedVarint(len);
+    writer.write(str.data(), str.size());
 }
 
-static void sendNullableString(int client_fd, int8_t &len, std::vector<char> &str)
+void sendCompactArray(WireWriter &writer, uint32_t len, const std::vector<int32_t> &arr)
 {
-    send(client_fd, &len, sizeof(len), 0);
-    send(client_fd, str.data(), len, 0);
+    writer.writeUnsignedVarint(len);
+    writer.write(arr.data(), arr.size() * sizeof(int32_t));
 }
 
-static void sendNullableString(int client_fd, int16_t &len, std::vector<char> &str)
+void sendTaggedFields(WireWriter &writer, uint32_t tag_buffer)
 {
-    send(client_fd, &len, sizeof(len), 0);
-    convertBE16toH(len);
-    send(client_fd, str.data(), len, 0);
+    writer.writeUnsignedVarint(tag_buffer);
 }
 
-static void sendCompactString(int client_fd, int8_t &len, std::vector<char> &str)
+void RequestHeaderV2::receive(WireReader &reader)
 {
-    send(client_fd, &len, sizeof(len), 0);
-    send(client_fd, str.data(), len - 1, 0);
+    reader.read(&request_msg_size, sizeof(request_msg_size));
+    reader.read(&request_api_key, sizeof(request_api_key));
+    reader.read(&request_api_ver, sizeof(request_api_ver));
+    reader.read(&request_corr_id, sizeof(request_corr_id));
+    convertBEToH();
+
+    recvNullableString(reader, client_id_len, client_id_contents);
+    tag_buffer = 0;
+    if (request_api_key != 18 || request_api_ver >= APIVersionsRequestBodyV4::FIRST_FLEXIBLE_VERSION)
+        recvTaggedFields(reader, tag_buffer);
 }
 
-static void sendCompactString(int client_fd, int16_t &len, std::vector<char> &str)
+int16_t RequestHeaderV2::getAPIKey()
 {
-    send(client_fd, &len, sizeof(len), 0);
-    convertBE16toH(len);
-    send(client_fd, str.data(), len - 1, 0);
+    return request_api_key;
 }
 
-void RequestHeaderV2::receive(int client_fd)
+int16_t RequestHeaderV2::getAPIVersion()
 {
-    recv(client_fd, &request_msg_size, sizeof(request_msg_size), 0);
-    recv(client_fd, &request_api_key, sizeof(request_api_key), 0);
-    recv(client_fd, &request_api_ver, sizeof(request_api_ver), 0);
-    recv(client_fd, &request_corr_id, sizeof(request_corr_id), 0);
-    recvNullableString(client_fd, client_id_len, client_id_contents);
-    recv(client_fd, &tag_buffer, sizeof(tag_buffer), 0);
-
-    convertBEToH();
+    return request_api_ver;
 }
 
-int16_t RequestHeaderV2::getAPIKey()
+std::string_view RequestHeaderV2::getClientId()
 {
-    return request_api_key;
+    return std::string_view(client_id_contents.data(), client_id_contents.size());
 }
 
 void RequestHeaderV2::convertBEToH()
@@ -80,11 +90,19 @@ void RequestHeaderV2::convertBEToH()
     convertBE32toH(request_msg_size, request_corr_id);
 }
 
-void APIVersionsRequestBodyV4::receive(int client_fd)
+void APIVersionsRequestBodyV4::receive(WireReader &reader)
 {
-    recvCompactString(client_fd, client_id_len, client_id_contents);
-    recvCompactString(client_fd, client_software_version_len, client_software_version_contents);
-    recv(client_fd, &tag_buffer, sizeof(tag_buffer), 0);
+    if (api_version < FIRST_FLEXIBLE_VERSION)
+        return;
+    if (api_version > MAX_VERSION)
+    {
+        reader.skip(reader.remaining()); // Answered with UNSUPPORTED_VERSION, like Kafka the body isn't parsed
+        return;
+    }
+
+    recvCompactString(reader, client_id_len, client_id_contents);
+    recvCompactString(reader, client_software_version_len, client_software_version_contents);
+    recvTaggedFields(reader, tag_buffer);
 
     convertBEToH();
 }
@@ -93,33 +111,403 @@ void APIVersionsRequestBodyV4::convertBEToH()
 {
 }
 
-void DescribeTopicPartitionsRequestBodyV0::receive(int client_fd)
+void DescribeTopicPartitionsRequestBodyV0::receive(WireReader &reader)
 {
-    recv(client_fd, &topics_array_len, sizeof(topics_array_len), 0);
-    topics_array.resize(topics_array_len - 1);
-    for (int i = 0; i < topics_array_len - 1; i++)
+    topics_array_len = reader.readUnsignedVarint();
+    // Every topic takes at least 2 bytes, don't trust the length prefix beyond what the frame can hold
+    topics_array.resize(topics_array_len > 0 ? std::min<size_t>(topics_array_len - 1, reader.remaining() / 2) : 0);
+    for (auto &topics_elem : topics_array)
+    {
+        recvCompactString(reader, topics_elem.topic_name_len, topics_elem.topic_name);
+        recvTaggedFields(reader, topics_elem.tag_buffer);
+    }
+    reader.read(&response_part_limit, sizeof(response_part_limit));
+    reader.read(&cursor_present, sizeof(cursor_present));
+    if (cursor_present != -1)
     {
-        recvCompactString(client_fd, topics_array[i].topic_name_len, topics_array[i].topic_name);
-        recv(client_fd, &topics_array[i].tag_buffer, sizeof(topics_array[i].tag_buffer), 0);
+        recvCompactString(reader, cursor.topic_name_len, cursor.topic_name);
+        reader.read(&cursor.partition_index, sizeof(cursor.partition_index));
+        recvTaggedFields(reader, cursor.tag_buffer);
     }
-    recv(client_fd, &response_part_limit, sizeof(response_part_limit), 0);
-    recv(client_fd, &cursor, sizeof(cursor), 0);
-    recv(client_fd, &tag_buffer, sizeof(tag_buffer), 0);
+    recvTaggedFields(reader, tag_buffer);
 
     convertBEToH();
 }
 
 void DescribeTopicPartitionsRequestBodyV0::convertBEToH()
 {
-    convertBE32toH(response_part_limit);
+    convertBE32toH(response_part_limit, cursor.partition_index);
+}
+
+void MetadataRequestBodyV12::receive(WireReader &reader)
+{
+    topics_array_len = reader.readUnsignedVarint();
+    // Every topic takes at least 18 bytes, don't trust the length prefix beyond what the frame can hold
+    topics_array.resize(topics_array_len > 0 ? std::min<size_t>(topics_array_len - 1, reader.remaining() / 18) : 0);
+    for (auto &topics_elem : topics_array)
+    {
+        reader.read(topics_elem.topic_id.data(), topics_elem.topic_id.size());
+        recvCompactString(reader, topics_elem.topic_name_len, topics_elem.topic_name);
+        recvTaggedFields(reader, topics_elem.tag_buffer);
+    }
+    reader.read(&allow_auto_topic_creation, sizeof(allow_auto_topic_creation));
+    reader.read(&include_topic_authorized_ops, sizeof(include_topic_authorized_ops));
+    recvTaggedFields(reader, tag_buffer);
+
+    convertBEToH();
+}
+
+void MetadataRequestBodyV12::convertBEToH()
+{
+}
+
+void FetchRequestBodyV16::receive(WireReader &reader)
+{
+    reader.read(&max_wait_ms, sizeof(max_wait_ms));
+    reader.read(&min_bytes, sizeof(min_bytes));
+    reader.read(&max_bytes, sizeof(max_bytes));
+    reader.read(&isolation_level, sizeof(isolation_level));
+    reader.read(&session_id, sizeof(session_id));
+    reader.read(&session_epoch, sizeof(session_epoch));
+    topics_array_len = reader.readUnsignedVarint();
+    // Every topic takes at least 18 bytes and every partition 33, don't trust the length prefixes beyond what the frame can hold
+    topics_array.resize(topics_array_len > 0 ? std::min<size_t>(topics_array_len - 1, reader.remaining() / 18) : 0);
+    for (auto &topics_elem : topics_array)
+    {
+        reader.read(topics_elem.topic_id.data(), topics_elem.topic_id.size());
+        topics_elem.partitions_array_len = reader.readUnsignedVarint();
+        topics_elem.partitions_array.resize(topics_elem.partitions_array_len > 0 ? std::min<size_t>(topics_elem.partitions_array_len - 1, reader.remaining() / 33) : 0);
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            reader.read(&partitions_elem.partition, sizeof(partitions_elem.partition));
+            reader.read(&partitions_elem.current_leader_epoch, sizeof(partitions_elem.current_leader_epoch));
+            reader.read(&partitions_elem.fetch_offset, sizeof(partitions_elem.fetch_offset));
+            reader.read(&partitions_elem.last_fetched_epoch, sizeof(partitions_elem.last_fetched_epoch));
+            reader.read(&partitions_elem.log_start_offset, sizeof(partitions_elem.log_start_offset));
+            reader.read(&partitions_elem.partition_max_bytes, sizeof(partitions_elem.partition_max_bytes));
+            recvTaggedFields(reader, partitions_elem.tag_buffer);
+        }
+        recvTaggedFields(reader, topics_elem.tag_buffer);
+    }
+    forgotten_topics_array_len = reader.readUnsignedVarint();
+    forgotten_topics_array.resize(forgotten_topics_array_len > 0 ? std::min<size_t>(forgotten_topics_array_len - 1, reader.remaining() / 18) : 0);
+    for (auto &forgotten_topics_elem : forgotten_topics_array)
+    {
+        reader.read(forgotten_topics_elem.topic_id.data(), forgotten_topics_elem.topic_id.size());
+        forgotten_topics_elem.partitions_array_len = reader.readUnsignedVarint();
+        forgotten_topics_elem.partitions_array.resize(forgotten_topics_elem.partitions_array_len > 0 ? std::min<size_t>(forgotten_topics_elem.partitions_array_len - 1, reader.remaining() / 4) : 0);
+        reader.read(forgotten_topics_elem.partitions_array.data(), forgotten_topics_elem.partitions_array.size() * sizeof(int32_t));
+        recvTaggedFields(reader, forgotten_topics_elem.tag_buffer);
+    }
+    recvCompactString(reader, rack_id_len, rack_id);
+    recvTaggedFields(reader, tag_buffer);
+
+    convertBEToH();
+}
+
+void FetchRequestBodyV16::convertBEToH()
+{
+    convertBE32toH(max_wait_ms, min_bytes, max_bytes, session_id, session_epoch);
+
+    for (auto &topics_elem : topics_array)
+    {
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            convertBE32toH(partitions_elem.partition, partitions_elem.current_leader_epoch, partitions_elem.last_fetched_epoch, partitions_elem.partition_max_bytes);
+            convertBE64toH(partitions_elem.fetch_offset, partitions_elem.log_start_offset);
+        }
+    }
+
+    for (auto &forgotten_topics_elem : forgotten_topics_array)
+    {
+        for (auto &partition : forgotten_topics_elem.partitions_array)
+        {
+            convertBE32toH(partition);
+        }
+    }
+}
+
+void ProduceRequestBodyV11::receive(WireReader &reader)
+{
+    recvCompactString(reader, transactional_id_len, transactional_id);
+    reader.read(&acks, sizeof(acks));
+    reader.read(&timeout_ms, sizeof(timeout_ms));
+    topics_array_len = reader.readUnsignedVarint();
+    // Every topic takes at least 3 bytes and every partition 6, don't trust the length prefixes beyond what the frame can hold
+    topics_array.resize(topics_array_len > 0 ? std::min<size_t>(topics_array_len - 1, reader.remaining() / 3) : 0);
+    for (auto &topics_elem : topics_array)
+    {
+        recvCompactString(reader, topics_elem.name_len, topics_elem.name);
+        topics_elem.partitions_array_len = reader.readUnsignedVarint();
+        topics_elem.partitions_array.resize(topics_elem.partitions_array_len > 0 ? std::min<size_t>(topics_elem.partitions_array_len - 1, reader.remaining() / 6) : 0);
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            reader.read(&partitions_elem.index, sizeof(partitions_elem.index));
+            recvCompactString(reader, partitions_elem.records_len, partitions_elem.records);
+            recvTaggedFields(reader, partitions_elem.tag_buffer);
+        }
+        recvTaggedFields(reader, topics_elem.tag_buffer);
+    }
+    recvTaggedFields(reader, tag_buffer);
+
+    convertBEToH();
+}
+
+void ProduceRequestBodyV11::convertBEToH()
+{
+    convertBE16toH(acks);
+    convertBE32toH(timeout_ms);
+
+    for (auto &topics_elem : topics_array)
+    {
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            convertBE32toH(partitions_elem.index);
+        }
+    }
+}
+
+void ListOffsetsRequestBodyV9::receive(WireReader &reader)
+{
+    reader.read(&replica_id, sizeof(replica_id));
+    reader.read(&isolation_level, sizeof(isolation_level));
+    topics_array_len = reader.readUnsignedVarint();
+    // Every topic takes at least 3 bytes and every partition 17, don't trust the length prefixes beyond what the frame can hold
+    topics_array.resize(topics_array_len > 0 ? std::min<size_t>(topics_array_len - 1, reader.remaining() / 3) : 0);
+    for (auto &topics_elem : topics_array)
+    {
+        recvCompactString(reader, topics_elem.name_len, topics_elem.name);
+        topics_elem.partitions_array_len = reader.readUnsignedVarint();
+        topics_elem.partitions_array.resize(topics_elem.partitions_array_len > 0 ? std::min<size_t>(topics_elem.partitions_array_len - 1, reader.remaining() / 17) : 0);
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            reader.read(&partitions_elem.partition_index, sizeof(partitions_elem.partition_index));
+            reader.read(&partitions_elem.current_leader_epoch, sizeof(partitions_elem.current_leader_epoch));
+            reader.read(&partitions_elem.timestamp, sizeof(partitions_elem.timestamp));
+            recvTaggedFields(reader, partitions_elem.tag_buffer);
+        }
+        recvTaggedFields(reader, topics_elem.tag_buffer);
+    }
+    recvTaggedFields(reader, tag_buffer);
+
+    convertBEToH();
+}
+
+void ListOffsetsRequestBodyV9::convertBEToH()
+{
+    convertBE32toH(replica_id);
+
+    for (auto &topics_elem : topics_array)
+    {
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            convertBE32toH(partitions_elem.partition_index, partitions_elem.current_leader_epoch);
+            convertBE64toH(partitions_elem.timestamp);
+        }
+    }
+}
+
+void FindCoordinatorRequestBodyV4::receive(WireReader &reader)
+{
+    reader.read(&key_type, sizeof(key_type));
+    coordinator_keys_array_len = reader.readUnsignedVarint();
+    // Every key takes at least 1 byte, don't trust the length prefix beyond what the frame can hold
+    coordinator_keys_array.resize(coordinator_keys_array_len > 0 ? std::min<size_t>(coordinator_keys_array_len - 1, reader.remaining()) : 0);
+    for (auto &coordinator_keys_elem : coordinator_keys_array)
+    {
+        recvCompactString(reader, coordinator_keys_elem.key_len, coordinator_keys_elem.key);
+    }
+    recvTaggedFields(reader, tag_buffer);
+
+    convertBEToH();
+}
+
+void FindCoordinatorRequestBodyV4::convertBEToH()
+{
+}
+
+void JoinGroupRequestBodyV9::receive(WireReader &reader)
+{
+    recvCompactString(reader, group_id_len, group_id);
+    reader.read(&session_timeout_ms, sizeof(session_timeout_ms));
+    reader.read(&rebalance_timeout_ms, sizeof(rebalance_timeout_ms));
+    recvCompactString(reader, member_id_len, member_id);
+    recvCompactString(reader, group_instance_id_len, group_instance_id);
+    recvCompactString(reader, protocol_type_len, protocol_type);
+    protocols_array_len = reader.readUnsignedVarint();
+    // Every protocol takes at least 3 bytes, don't trust the length prefix beyond what the frame can hold
+    protocols_array.resize(protocols_array_len > 0 ? std::min<size_t>(protocols_array_len - 1, reader.remaining() / 3) : 0);
+    for (auto &protocols_elem : protocols_array)
+    {
+        recvCompactString(reader, protocols_elem.name_len, protocols_elem.name);
+        recvCompactString(reader, protocols_elem.metadata_len, protocols_elem.metadata);
+        recvTaggedFields(reader, protocols_elem.tag_buffer);
+    }
+    recvCompactString(reader, reason_len, reason);
+    recvTaggedFields(reader, tag_buffer);
+
+    convertBEToH();
+}
+
+void JoinGroupRequestBodyV9::convertBEToH()
+{
+    convertBE32toH(session_timeout_ms, rebalance_timeout_ms);
+}
+
+void SyncGroupRequestBodyV5::receive(WireReader &reader)
+{
+    recvCompactString(reader, group_id_len, group_id);
+    reader.read(&generation_id, sizeof(generation_id));
+    recvCompactString(reader, member_id_len, member_id);
+    recvCompactString(reader, group_instance_id_len, group_instance_id);
+    recvCompactString(reader, protocol_type_len, protocol_type);
+    recvCompactString(reader, protocol_name_len, protocol_name);
+    assignments_array_len = reader.readUnsignedVarint();
+    // Every assignment takes at least 3 bytes, don't trust the length prefix beyond what the frame can hold
+    assignments_array.resize(assignments_array_len > 0 ? std::min<size_t>(assignments_array_len - 1, reader.remaining() / 3) : 0);
+    for (auto &assignments_elem : assignments_array)
+    {
+        recvCompactString(reader, assignments_elem.member_id_len, assignments_elem.member_id);
+        recvCompactString(reader, assignments_elem.assignment_len, assignments_elem.assignment);
+        recvTaggedFields(reader, assignments_elem.tag_buffer);
+    }
+    recvTaggedFields(reader, tag_buffer);
+
+    convertBEToH();
+}
+
+void SyncGroupRequestBodyV5::convertBEToH()
+{
+    convertBE32toH(generation_id);
+}
+
+void HeartbeatRequestBodyV4::receive(WireReader &reader)
+{
+    recvCompactString(reader, group_id_len, group_id);
+    reader.read(&generation_id, sizeof(generation_id));
+    recvCompactString(reader, member_id_len, member_id);
+    recvCompactString(reader, group_instance_id_len, group_instance_id);
+    recvTaggedFields(reader, tag_buffer);
+
+    convertBEToH();
+}
+
+void HeartbeatRequestBodyV4::convertBEToH()
+{
+    convertBE32toH(generation_id);
+}
+
+void LeaveGroupRequestBodyV5::receive(WireReader &reader)
+{
+    recvCompactString(reader, group_id_len, group_id);
+    members_array_len = reader.readUnsignedVarint();
+    // Every member takes at least 4 bytes, don't trust the length prefix beyond what the frame can hold
+    members_array.resize(members_array_len > 0 ? std::min<size_t>(members_array_len - 1, reader.remaining() / 4) : 0);
+    for (auto &members_elem : members_array)
+    {
+        recvCompactString(reader, members_elem.member_id_len, members_elem.member_id);
+        recvCompactString(reader, members_elem.group_instance_id_len, members_elem.group_instance_id);
+        recvCompactString(reader, members_elem.reason_len, members_elem.reason);
+        recvTaggedFields(reader, members_elem.tag_buffer);
+    }
+    recvTaggedFields(reader, tag_buffer);
+
+    convertBEToH();
+}
+
+void LeaveGroupRequestBodyV5::convertBEToH()
+{
+}
+
+void OffsetCommitRequestBodyV8::receive(WireReader &reader)
+{
+    recvCompactString(reader, group_id_len, group_id);
+    reader.read(&generation_id_or_member_epoch, sizeof(generation_id_or_member_epoch));
+    recvCompactString(reader, member_id_len, member_id);
+    recvCompactString(reader, group_instance_id_len, group_instance_id);
+    topics_array_len = reader.readUnsignedVarint();
+    // Every topic takes at least 3 bytes and every partition 18, don't trust the length prefixes beyond what the frame can hold
+    topics_array.resize(topics_array_len > 0 ? std::min<size_t>(topics_array_len - 1, reader.remaining() / 3) : 0);
+    for (auto &topics_elem : topics_array)
+    {
+        recvCompactString(reader, topics_elem.name_len, topics_elem.name);
+        topics_elem.partitions_array_len = reader.readUnsignedVarint();
+        topics_elem.partitions_array.resize(topics_elem.partitions_array_len > 0 ? std::min<size_t>(topics_elem.partitions_array_len - 1, reader.remaining() / 18) : 0);
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            reader.read(&partitions_elem.partition_index, sizeof(partitions_elem.partition_index));
+            reader.read(&partitions_elem.committed_offset, sizeof(partitions_elem.committed_offset));
+            reader.read(&partitions_elem.committed_leader_epoch, sizeof(partitions_elem.committed_leader_epoch));
+            recvCompactString(reader, partitions_elem.committed_metadata_len, partitions_elem.committed_metadata);
+            recvTaggedFields(reader, partitions_elem.tag_buffer);
+        }
+        recvTaggedFields(reader, topics_elem.tag_buffer);
+    }
+    recvTaggedFields(reader, tag_buffer);
+
+    convertBEToH();
+}
+
+void OffsetCommitRequestBodyV8::convertBEToH()
+{
+    convertBE32toH(generation_id_or_member_epoch);
+
+    for (auto &topics_elem : topics_array)
+    {
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            convertBE32toH(partitions_elem.partition_index, partitions_elem.committed_leader_epoch);
+            convertBE64toH(partitions_elem.committed_offset);
+        }
+    }
+}
+
+void OffsetFetchRequestBodyV8::receive(WireReader &reader)
+{
+    groups_array_len = reader.readUnsignedVarint();
+    // Every group and topic takes at least 3 bytes and every partition 4, don't trust the length prefixes beyond what the frame can hold
+    groups_array.resize(groups_array_len > 0 ? std::min<size_t>(groups_array_len - 1, reader.remaining() / 3) : 0);
+    for (auto &groups_elem : groups_array)
+    {
+        recvCompactString(reader, groups_elem.group_id_len, groups_elem.group_id);
+        groups_elem.topics_array_len = reader.readUnsignedVarint();
+        groups_elem.topics_array.resize(groups_elem.topics_array_len > 0 ? std::min<size_t>(groups_elem.topics_array_len - 1, reader.remaining() / 3) : 0);
+        for (auto &topics_elem : groups_elem.topics_array)
+        {
+            recvCompactString(reader, topics_elem.name_len, topics_elem.name);
+            topics_elem.partition_indexes_array_len = reader.readUnsignedVarint();
+            topics_elem.partition_indexes_array.resize(topics_elem.partition_indexes_array_len > 0 ? std::min<size_t>(topics_elem.partition_indexes_array_len - 1, reader.remaining() / 4) : 0);
+            reader.read(topics_elem.partition_indexes_array.data(), topics_elem.partition_indexes_array.size() * sizeof(int32_t));
+            recvTaggedFields(reader, topics_elem.tag_buffer);
+        }
+        recvTaggedFields(reader, groups_elem.tag_buffer);
+    }
+    reader.read(&require_stable, sizeof(require_stable));
+    recvTaggedFields(reader, tag_buffer);
+
+    convertBEToH();
+}
+
+void OffsetFetchRequestBodyV8::convertBEToH()
+{
+    for (auto &groups_elem : groups_array)
+    {
+        for (auto &topics_elem : groups_elem.topics_array)
+        {
+            for (auto &partition_index : topics_elem.partition_indexes_array)
+            {
+                convertBE32toH(partition_index);
+            }
+        }
+    }
 }
 
-void ResponseHeaderV0::respond(int client_fd)
+void ResponseHeaderV0::respond(WireWriter &writer)
 {
     convertHToBE();
 
-    send(client_fd, &response_msg_size, sizeof(response_msg_size), 0);
-    send(client_fd, &response_corr_id, sizeof(response_corr_id), 0);
+    writer.write(&response_msg_size, sizeof(response_msg_size));
+    writer.write(&response_corr_id, sizeof(response_corr_id));
 }
 
 void ResponseHeaderV0::convertHToBE()
@@ -127,13 +515,13 @@ void ResponseHeaderV0::convertHToBE()
     convertH32toBE(response_msg_size, response_corr_id);
 }
 
-void ResponseHeaderV1::respond(int client_fd)
+void ResponseHeaderV1::respond(WireWriter &writer)
 {
     convertHToBE();
 
-    send(client_fd, &response_msg_size, sizeof(response_msg_size), 0);
-    send(client_fd, &response_corr_id, sizeof(response_corr_id), 0);
-    send(client_fd, &tag_buffer, sizeof(tag_buffer), 0);
+    writer.write(&response_msg_size, sizeof(response_msg_size));
+    writer.write(&response_corr_id, sizeof(response_corr_id));
+    sendTaggedFields(writer, tag_buffer);
 }
 
 void ResponseHeaderV1::convertHToBE()
@@ -141,21 +529,35 @@ void ResponseHeaderV1::convertHToBE()
     convertH32toBE(response_msg_size, response_corr_id);
 }
 
-void APIVersionsResponseBodyV4::respond(int client_fd)
+void APIVersionsResponseBodyV4::respond(WireWriter &writer)
 {
     convertHToBE();
 
-    send(client_fd, &error_code, sizeof(error_code), 0);
-    send(client_fd, &api_versions_array_len, sizeof(api_versions_array_len), 0);
+    const bool flexible = api_version >= APIVersionsRequestBodyV4::FIRST_FLEXIBLE_VERSION;
+
+    writer.write(&error_code, sizeof(error_code));
+    if (flexible)
+    {
+        writer.writeUnsignedVarint(api_versions_array_len);
+    }
+    else
+    {
+        int32_t array_len = api_versions_array.size();
+        convertH32toBE(array_len);
+        writer.write(&array_len, sizeof(array_len));
+    }
     for (auto &api_versions_elem : api_versions_array)
     {
-        send(client_fd, &api_versions_elem.api_key, sizeof(api_versions_elem.api_key), 0);
-        send(client_fd, &api_versions_elem.api_min_ver, sizeof(api_versions_elem.api_min_ver), 0);
-        send(client_fd, &api_versions_elem.api_max_ver, sizeof(api_versions_elem.api_max_ver), 0);
-        send(client_fd, &api_versions_elem.tag_buffer, sizeof(api_versions_elem.tag_buffer), 0);
+        writer.write(&api_versions_elem.api_key, sizeof(api_versions_elem.api_key));
+        writer.write(&api_versions_elem.api_min_ver, sizeof(api_versions_elem.api_min_ver));
+        writer.write(&api_versions_elem.api_max_ver, sizeof(api_versions_elem.api_max_ver));
+        if (flexible)
+            sendTaggedFields(writer, api_versions_elem.tag_buffer);
     }
-    send(client_fd, &throttle_time, sizeof(throttle_time), 0);
-    send(client_fd, &tag_buffer, sizeof(tag_buffer), 0);
+    if (api_version >= 1)
+        writer.write(&throttle_time, sizeof(throttle_time));
+    if (flexible)
+        sendTaggedFields(writer, tag_buffer);
 }
 
 void APIVersionsResponseBodyV4::convertHToBE()
@@ -169,62 +571,48 @@ void APIVersionsResponseBodyV4::convertHToBE()
     }
 }
 
-void DescribeTopicPartitionsResponseBodyV0::respond(int client_fd)
+void DescribeTopicPartitionsResponseBodyV0::respond(WireWriter &writer)
 {
     convertHToBE();
 
-    send(client_fd, &throttle_time, sizeof(throttle_time), 0);
-    send(client_fd, &topics_array_len, sizeof(topics_array_len), 0);
+    writer.write(&throttle_time, sizeof(throttle_time));
+    writer.writeUnsignedVarint(topics_array_len);
     for (auto &topics_elem : topics_array)
     {
-        send(client_fd, &topics_elem.error_code, sizeof(topics_elem.error_code), 0);
-        sendCompactString(client_fd, topics_elem.topic_name_len, topics_elem.topic_name);
-        send(client_fd, topics_elem.topic_id.data(), topics_elem.topic_id.size(), 0);
-        send(client_fd, &topics_elem.is_internal, sizeof(topics_elem.is_internal), 0);
-        send(client_fd, &topics_elem.partitions_array_len, sizeof(topics_elem.partitions_array_len), 0);
+        writer.write(&topics_elem.error_code, sizeof(topics_elem.error_code));
+        sendCompactString(writer, topics_elem.topic_name_len, topics_elem.topic_name);
+        writer.write(topics_elem.topic_id.data(), topics_elem.topic_id.size());
+        writer.write(&topics_elem.is_internal, sizeof(topics_elem.is_internal));
+        writer.writeUnsignedVarint(topics_elem.partitions_array_len);
         for (auto &partitions_elem : topics_elem.partitions_array)
         {
-            send(client_fd, &partitions_elem.error_code, sizeof(partitions_elem.error_code), 0);
-            send(client_fd, &partitions_elem.partition_index, sizeof(partitions_elem.partition_index), 0);
-            send(client_fd, &partitions_elem.leader_id, sizeof(partitions_elem.leader_id), 0);
-            send(client_fd, &partitions_elem.leader_epoch, sizeof(partitions_elem.leader_epoch), 0);
-            send(client_fd, &partitions_elem.replica_nodes_array_len, sizeof(partitions_elem.replica_nodes_array_len), 0);
-            for (auto &replica_node : partitions_elem.replica_nodes_array)
-            {
-                send(client_fd, &replica_node, sizeof(replica_node), 0);
-            }
-            send(client_fd, &partitions_elem.isr_nodes_array_len, sizeof(partitions_elem.isr_nodes_array_len), 0);
-            for (auto &isr_node : partitions_elem.isr_nodes_array)
-            {
-                send(client_fd, &isr_node, sizeof(isr_node), 0);
-            }
-            send(client_fd, &partitions_elem.elr_nodes_array_len, sizeof(partitions_elem.elr_nodes_array_len), 0);
-            for (auto &elr_node : partitions_elem.elr_nodes_array)
-            {
-                send(client_fd, &elr_node, sizeof(elr_node), 0);
-            }
-            send(client_fd, &partitions_elem.last_known_elr_nodes_array_len, sizeof(partitions_elem.last_known_elr_nodes_array_len), 0);
-            for (auto &last_known_elr_node : partitions_elem.last_known_elr_nodes_array)
-            {
-                send(client_fd, &last_known_elr_node, sizeof(last_known_elr_node), 0);
-            }
-            send(client_fd, &partitions_elem.offline_replica_nodes_array_len, sizeof(partitions_elem.offline_replica_nodes_array_len), 0);
-            for (auto &offline_replica_node : partitions_elem.offline_replica_nodes_array)
-            {
-                send(client_fd, &offline_replica_node, sizeof(offline_replica_node), 0);
-            }
-            send(client_fd, &partitions_elem.tag_buffer, sizeof(partitions_elem.tag_buffer), 0);
+            writer.write(&partitions_elem.error_code, sizeof(partitions_elem.error_code));
+            writer.write(&partitions_elem.partition_index, sizeof(partitions_elem.partition_index));
+            writer.write(&partitions_elem.leader_id, sizeof(partitions_elem.leader_id));
+            writer.write(&partitions_elem.leader_epoch, sizeof(partitions_elem.leader_epoch));
+            sendCompactArray(writer, partitions_elem.replica_nodes_array_len, partitions_elem.replica_nodes_array);
+            sendCompactArray(writer, partitions_elem.isr_nodes_array_len, partitions_elem.isr_nodes_array);
+            sendCompactArray(writer, partitions_elem.elr_nodes_array_len, partitions_elem.elr_nodes_array);
+            sendCompactArray(writer, partitions_elem.last_known_elr_nodes_array_len, partitions_elem.last_known_elr_nodes_array);
+            sendCompactArray(writer, partitions_elem.offline_replica_nodes_array_len, partitions_elem.offline_replica_nodes_array);
+            sendTaggedFields(writer, partitions_elem.tag_buffer);
         }
-        send(client_fd, &topics_elem.topic_authorized_ops, sizeof(topics_elem.topic_authorized_ops), 0);
-        send(client_fd, &topics_elem.tag_buffer, sizeof(topics_elem.tag_buffer), 0);
+        writer.write(&topics_elem.topic_authorized_ops, sizeof(topics_elem.topic_authorized_ops));
+        sendTaggedFields(writer, topics_elem.tag_buffer);
     }
-    send(client_fd, &next_cursor, sizeof(next_cursor), 0);
-    send(client_fd, &tag_buffer, sizeof(tag_buffer), 0);
+    writer.write(&next_cursor_present, sizeof(next_cursor_present));
+    if (next_cursor_present != -1)
+    {
+        sendCompactString(writer, next_cursor.topic_name_len, next_cursor.topic_name);
+        writer.write(&next_cursor.partition_index, sizeof(next_cursor.partition_index));
+        sendTaggedFields(writer, next_cursor.tag_buffer);
+    }
+    sendTaggedFields(writer, tag_buffer);
 }
 
 void DescribeTopicPartitionsResponseBodyV0::convertHToBE()
 {
-    convertH32toBE(throttle_time);
+    convertH32toBE(throttle_time, next_cursor.partition_index);
 
     for (auto &topics_elem : topics_array)
     {
@@ -264,59 +652,616 @@ void DescribeTopicPartitionsResponseBodyV0::convertHToBE()
     }
 }
 
-ResponseMessage processAPIVersions(const RequestHeaderV2 &request_header, const APIVersionsRequestBodyV4 &request_body)
+void MetadataResponseBodyV12::respond(WireWriter &writer)
 {
-    // Move these into a new processing module
-    constexpr size_t API_VERSIONS_SIZE = 3;
-    std::vector<int16_t> supported_api_versions = {0, 1, 2, 3, 4};
-    std::vector<std::array<int16_t, API_VERSIONS_SIZE>> api_key_versions;
-    api_key_versions.push_back({1, 0, 16}); // Fetch
-    api_key_versions.push_back({18, 0, 4}); // APIVersions
-    api_key_versions.push_back({75, 0, 4}); // DescribeTopicPartitions
-
-    // Response message
-
-    auto response_header = std::make_unique<ResponseHeaderV0>();
-    auto response_body = std::make_unique<APIVersionsResponseBodyV4>();
-
-    int32_t response_size = 0;
+    convertHToBE();
 
-    // Process bottom-up - Response Body -> Response Header
+    writer.write(&throttle_time, sizeof(throttle_time));
+    writer.writeUnsignedVarint(brokers_array_len);
+    for (auto &brokers_elem : brokers_array)
+    {
+        writer.write(&brokers_elem.node_id, sizeof(brokers_elem.node_id));
+        sendCompactString(writer, brokers_elem.host_len, brokers_elem.host);
+        writer.write(&brokers_elem.port, sizeof(brokers_elem.port));
+        sendCompactString(writer, brokers_elem.rack_len, brokers_elem.rack);
+        sendTaggedFields(writer, brokers_elem.tag_buffer);
+    }
+    sendCompactString(writer, cluster_id_len, cluster_id);
+    writer.write(&controller_id, sizeof(controller_id));
+    writer.writeUnsignedVarint(topics_array_len);
+    for (auto &topics_elem : topics_array)
+    {
+        writer.write(topics_elem.fragment->bytes(), topics_elem.fragment->size());
+        writer.write(&topics_elem.topic_authorized_ops, sizeof(topics_elem.topic_authorized_ops));
+        sendTaggedFields(writer, topics_elem.tag_buffer);
+    }
+    sendTaggedFields(writer, tag_buffer);
+}
 
-    // Response Body
+void MetadataResponseBodyV12::convertHToBE()
+{
+    convertH32toBE(throttle_time, controller_id);
 
-    // Supported API versions is actually part of request header but we use here
+    for (auto &brokers_elem : brokers_array)
+    {
+        convertH32toBE(brokers_elem.node_id, brokers_elem.port);
+    }
 
-    if (std::find(supported_api_versions.begin(), supported_api_versions.end(), request_header.request_api_ver) != supported_api_versions.end())
+    for (auto &topics_elem : topics_array)
     {
-        response_body->error_code = 0;
-        response_size += sizeof(response_body->error_code);
+        convertH32toBE(topics_elem.topic_authorized_ops);
+    }
+}
 
-        response_body->api_versions_array_len = api_key_versions.size() + 1;
-        response_size += sizeof(response_body->api_versions_array_len);
+void FetchResponseBodyV16::respond(WireWriter &writer)
+{
+    convertHToBE();
 
-        for (auto &api_versions_elem : api_key_versions)
+    writer.write(&throttle_time, sizeof(throttle_time));
+    writer.write(&error_code, sizeof(error_code));
+    writer.write(&session_id, sizeof(session_id));
+    writer.writeUnsignedVarint(topics_array_len);
+    for (auto &topics_elem : topics_array)
+    {
+        writer.write(topics_elem.topic_id.data(), topics_elem.topic_id.size());
+        writer.writeUnsignedVarint(topics_elem.partitions_array_len);
+        for (auto &partitions_elem : topics_elem.partitions_array)
         {
-            APIVersionsResponseBodyV4::APIVersion api_version = {.api_key = api_versions_elem[0],
-                                                                 .api_min_ver = api_versions_elem[1],
-                                                                 .api_max_ver = api_versions_elem[2],
-                                                                 .tag_buffer = 0};
-
-            response_body->api_versions_array.push_back(api_version);
-            response_size += api_version.size();
+            writer.write(&partitions_elem.partition_index, sizeof(partitions_elem.partition_index));
+            writer.write(&partitions_elem.error_code, sizeof(partitions_elem.error_code));
+            writer.write(&partitions_elem.high_watermark, sizeof(partitions_elem.high_watermark));
+            writer.write(&partitions_elem.last_stable_offset, sizeof(partitions_elem.last_stable_offset));
+            writer.write(&partitions_elem.log_start_offset, sizeof(partitions_elem.log_start_offset));
+            writer.writeUnsignedVarint(partitions_elem.aborted_transactions_array_len);
+            writer.write(&partitions_elem.preferred_read_replica, sizeof(partitions_elem.preferred_read_replica));
+            sendCompactString(writer, partitions_elem.records_len, partitions_elem.records);
+            sendTaggedFields(writer, partitions_elem.tag_buffer);
         }
+        sendTaggedFields(writer, topics_elem.tag_buffer);
+    }
+    sendTaggedFields(writer, tag_buffer);
+}
 
-        response_body->throttle_time = 0;
-        response_size += sizeof(response_body->throttle_time);
+void FetchResponseBodyV16::convertHToBE()
+{
+    convertH16toBE(error_code);
+    convertH32toBE(throttle_time, session_id);
 
-        response_body->tag_buffer = 0;
-        response_size += sizeof(response_body->tag_buffer);
-    }
-    else
+    for (auto &topics_elem : topics_array)
     {
-        response_body->error_code = 35;
-        response_size += sizeof(response_body->error_code);
-    }
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            convertH16toBE(partitions_elem.error_code);
+            convertH32toBE(partitions_elem.partition_index, partitions_elem.preferred_read_replica);
+            convertH64toBE(partitions_elem.high_watermark, partitions_elem.last_stable_offset, partitions_elem.log_start_offset);
+        }
+    }
+}
+
+void ProduceResponseBodyV11::respond(WireWriter &writer)
+{
+    convertHToBE();
+
+    writer.writeUnsignedVarint(topics_array_len);
+    for (auto &topics_elem : topics_array)
+    {
+        sendCompactString(writer, topics_elem.name_len, topics_elem.name);
+        writer.writeUnsignedVarint(topics_elem.partitions_array_len);
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            writer.write(&partitions_elem.index, sizeof(partitions_elem.index));
+            writer.write(&partitions_elem.error_code, sizeof(partitions_elem.error_code));
+            writer.write(&partitions_elem.base_offset, sizeof(partitions_elem.base_offset));
+            writer.write(&partitions_elem.log_append_time, sizeof(partitions_elem.log_append_time));
+            writer.write(&partitions_elem.log_start_offset, sizeof(partitions_elem.log_start_offset));
+            writer.writeUnsignedVarint(partitions_elem.record_errors_array_len);
+            sendCompactString(writer, partitions_elem.error_message_len, partitions_elem.error_message);
+            sendTaggedFields(writer, partitions_elem.tag_buffer);
+        }
+        sendTaggedFields(writer, topics_elem.tag_buffer);
+    }
+    writer.write(&throttle_time, sizeof(throttle_time));
+    sendTaggedFields(writer, tag_buffer);
+}
+
+void ProduceResponseBodyV11::convertHToBE()
+{
+    convertH32toBE(throttle_time);
+
+    for (auto &topics_elem : topics_array)
+    {
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            convertH16toBE(partitions_elem.error_code);
+            convertH32toBE(partitions_elem.index);
+            convertH64toBE(partitions_elem.base_offset, partitions_elem.log_append_time, partitions_elem.log_start_offset);
+        }
+    }
+}
+
+void ListOffsetsResponseBodyV9::respond(WireWriter &writer)
+{
+    convertHToBE();
+
+    writer.write(&throttle_time, sizeof(throttle_time));
+    writer.writeUnsignedVarint(topics_array_len);
+    for (auto &topics_elem : topics_array)
+    {
+        sendCompactString(writer, topics_elem.name_len, topics_elem.name);
+        writer.writeUnsignedVarint(topics_elem.partitions_array_len);
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            writer.write(&partitions_elem.partition_index, sizeof(partitions_elem.partition_index));
+            writer.write(&partitions_elem.error_code, sizeof(partitions_elem.error_code));
+            writer.write(&partitions_elem.timestamp, sizeof(partitions_elem.timestamp));
+            writer.write(&partitions_elem.offset, sizeof(partitions_elem.offset));
+            writer.write(&partitions_elem.leader_epoch, sizeof(partitions_elem.leader_epoch));
+            sendTaggedFields(writer, partitions_elem.tag_buffer);
+        }
+        sendTaggedFields(writer, topics_elem.tag_buffer);
+    }
+    sendTaggedFields(writer, tag_buffer);
+}
+
+void ListOffsetsResponseBodyV9::convertHToBE()
+{
+    convertH32toBE(throttle_time);
+
+    for (auto &topics_elem : topics_array)
+    {
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            convertH16toBE(partitions_elem.error_code);
+            convertH32toBE(partitions_elem.partition_index, partitions_elem.leader_epoch);
+            convertH64toBE(partitions_elem.timestamp, partitions_elem.offset);
+        }
+    }
+}
+
+void FindCoordinatorResponseBodyV4::respond(WireWriter &writer)
+{
+    convertHToBE();
+
+    writer.write(&throttle_time, sizeof(throttle_time));
+    writer.writeUnsignedVarint(coordinators_array_len);
+    for (auto &coordinators_elem : coordinators_array)
+    {
+        sendCompactString(writer, coordinators_elem.key_len, coordinators_elem.key);
+        writer.write(&coordinators_elem.node_id, sizeof(coordinators_elem.node_id));
+        sendCompactString(writer, coordinators_elem.host_len, coordinators_elem.host);
+        writer.write(&coordinators_elem.port, sizeof(coordinators_elem.port));
+        writer.write(&coordinators_elem.error_code, sizeof(coordinators_elem.error_code));
+        sendCompactString(writer, coordinators_elem.error_message_len, coordinators_elem.error_message);
+        sendTaggedFields(writer, coordinators_elem.tag_buffer);
+    }
+    sendTaggedFields(writer, tag_buffer);
+}
+
+void FindCoordinatorResponseBodyV4::convertHToBE()
+{
+    convertH32toBE(throttle_time);
+
+    for (auto &coordinators_elem : coordinators_array)
+    {
+        convertH16toBE(coordinators_elem.error_code);
+        convertH32toBE(coordinators_elem.node_id, coordinators_elem.port);
+    }
+}
+
+void JoinGroupResponseBodyV9::respond(WireWriter &writer)
+{
+    convertHToBE();
+
+    writer.write(&throttle_time, sizeof(throttle_time));
+    writer.write(&error_code, sizeof(error_code));
+    writer.write(&generation_id, sizeof(generation_id));
+    sendCompactString(writer, protocol_type_len, protocol_type);
+    sendCompactString(writer, protocol_name_len, protocol_name);
+    sendCompactString(writer, leader_len, leader);
+    writer.write(&skip_assignment, sizeof(skip_assignment));
+    sendCompactString(writer, member_id_len, member_id);
+    writer.writeUnsignedVarint(members_array_len);
+    for (auto &members_elem : members_array)
+    {
+        sendCompactString(writer, members_elem.member_id_len, members_elem.member_id);
+        sendCompactString(writer, members_elem.group_instance_id_len, members_elem.group_instance_id);
+        sendCompactString(writer, members_elem.metadata_len, members_elem.metadata);
+        sendTaggedFields(writer, members_elem.tag_buffer);
+    }
+    sendTaggedFields(writer, tag_buffer);
+}
+
+void JoinGroupResponseBodyV9::convertHToBE()
+{
+    convertH16toBE(error_code);
+    convertH32toBE(throttle_time, generation_id);
+}
+
+void SyncGroupResponseBodyV5::respond(WireWriter &writer)
+{
+    convertHToBE();
+
+    writer.write(&throttle_time, sizeof(throttle_time));
+    writer.write(&error_code, sizeof(error_code));
+    sendCompactString(writer, protocol_type_len, protocol_type);
+    sendCompactString(writer, protocol_name_len, protocol_name);
+    sendCompactString(writer, assignment_len, assignment);
+    sendTaggedFields(writer, tag_buffer);
+}
+
+void SyncGroupResponseBodyV5::convertHToBE()
+{
+    convertH16toBE(error_code);
+    convertH32toBE(throttle_time);
+}
+
+void HeartbeatResponseBodyV4::respond(WireWriter &writer)
+{
+    convertHToBE();
+
+    writer.write(&throttle_time, sizeof(throttle_time));
+    writer.write(&error_code, sizeof(error_code));
+    sendTaggedFields(writer, tag_buffer);
+}
+
+void HeartbeatResponseBodyV4::convertHToBE()
+{
+    convertH16toBE(error_code);
+    convertH32toBE(throttle_time);
+}
+
+void LeaveGroupResponseBodyV5::respond(WireWriter &writer)
+{
+    convertHToBE();
+
+    writer.write(&throttle_time, sizeof(throttle_time));
+    writer.write(&error_code, sizeof(error_code));
+    writer.writeUnsignedVarint(members_array_len);
+    for (auto &members_elem : members_array)
+    {
+        sendCompactString(writer, members_elem.member_id_len, members_elem.member_id);
+        sendCompactString(writer, members_elem.group_instance_id_len, members_elem.group_instance_id);
+        writer.write(&members_elem.error_code, sizeof(members_elem.error_code));
+        sendTaggedFields(writer, members_elem.tag_buffer);
+    }
+    sendTaggedFields(writer, tag_buffer);
+}
+
+void LeaveGroupResponseBodyV5::convertHToBE()
+{
+    convertH16toBE(error_code);
+    convertH32toBE(throttle_time);
+
+    for (auto &members_elem : members_array)
+    {
+        convertH16toBE(members_elem.error_code);
+    }
+}
+
+void OffsetCommitResponseBodyV8::respond(WireWriter &writer)
+{
+    convertHToBE();
+
+    writer.write(&throttle_time, sizeof(throttle_time));
+    writer.writeUnsignedVarint(topics_array_len);
+    for (auto &topics_elem : topics_array)
+    {
+        sendCompactString(writer, topics_elem.name_len, topics_elem.name);
+        writer.writeUnsignedVarint(topics_elem.partitions_array_len);
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            writer.write(&partitions_elem.partition_index, sizeof(partitions_elem.partition_index));
+            writer.write(&partitions_elem.error_code, sizeof(partitions_elem.error_code));
+            sendTaggedFields(writer, partitions_elem.tag_buffer);
+        }
+        sendTaggedFields(writer, topics_elem.tag_buffer);
+    }
+    sendTaggedFields(writer, tag_buffer);
+}
+
+void OffsetCommitResponseBodyV8::convertHToBE()
+{
+    convertH32toBE(throttle_time);
+
+    for (auto &topics_elem : topics_array)
+    {
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            convertH16toBE(partitions_elem.error_code);
+            convertH32toBE(partitions_elem.partition_index);
+        }
+    }
+}
+
+void OffsetFetchResponseBodyV8::respond(WireWriter &writer)
+{
+    convertHToBE();
+
+    writer.write(&throttle_time, sizeof(throttle_time));
+    writer.writeUnsignedVarint(groups_array_len);
+    for (auto &groups_elem : groups_array)
+    {
+        sendCompactString(writer, groups_elem.group_id_len, groups_elem.group_id);
+        writer.writeUnsignedVarint(groups_elem.topics_array_len);
+        for (auto &topics_elem : groups_elem.topics_array)
+        {
+            sendCompactString(writer, topics_elem.name_len, topics_elem.name);
+            writer.writeUnsignedVarint(topics_elem.partitions_array_len);
+            for (auto &partitions_elem : topics_elem.partitions_array)
+            {
+                writer.write(&partitions_elem.partition_index, sizeof(partitions_elem.partition_index));
+                writer.write(&partitions_elem.committed_offset, sizeof(partitions_elem.committed_offset));
+                writer.write(&partitions_elem.committed_leader_epoch, sizeof(partitions_elem.committed_leader_epoch));
+                sendCompactString(writer, partitions_elem.metadata_len, partitions_elem.metadata);
+                writer.write(&partitions_elem.error_code, sizeof(partitions_elem.error_code));
+                sendTaggedFields(writer, partitions_elem.tag_buffer);
+            }
+            sendTaggedFields(writer, topics_elem.tag_buffer);
+        }
+        writer.write(&groups_elem.error_code, sizeof(groups_elem.error_code));
+        sendTaggedFields(writer, groups_elem.tag_buffer);
+    }
+    sendTaggedFields(writer, tag_buffer);
+}
+
+void OffsetFetchResponseBodyV8::convertHToBE()
+{
+    convertH32toBE(throttle_time);
+
+    for (auto &groups_elem : groups_array)
+    {
+        convertH16toBE(groups_elem.error_code);
+        for (auto &topics_elem : groups_elem.topics_array)
+        {
+            for (auto &partitions_elem : topics_elem.partitions_array)
+            {
+                convertH16toBE(partitions_elem.error_code);
+                convertH32toBE(partitions_elem.partition_index, partitions_elem.committed_leader_epoch);
+                convertH64toBE(partitions_elem.committed_offset);
+            }
+        }
+    }
+}
+
+static void sendNodeArray(WireWriter &writer, std::span<const int32_t> nodes)
+{
+    writer.writeUnsignedVarint(nodes.size() + 1);
+    for (int32_t node : nodes)
+    {
+        convertH32toBE(node);
+        writer.write(&node, sizeof(node));
+    }
+}
+
+static void encodeMetadataTopic(const MetadataImage &metadata_image, const TopicMetadata &topic, WireWriter &writer)
+{
+    // Everything up to topic_authorized_ops, which depends on the request and is written per response
+
+    std::string_view topic_name = metadata_image.topicName(topic);
+    auto partitions = metadata_image.topicPartitions(topic);
+
+    int16_t error_code = 0;
+    int8_t is_internal = topic_name == "__consumer_offsets" || topic_name == "__transaction_state";
+
+    convertH16toBE(error_code);
+    writer.write(&error_code, sizeof(error_code));
+    writer.writeUnsignedVarint(topic_name.size() + 1);
+    writer.write(topic_name.data(), topic_name.size());
+    writer.write(topic.topic_id.data(), topic.topic_id.size());
+    writer.write(&is_internal, sizeof(is_internal));
+    writer.writeUnsignedVarint(partitions.size() + 1);
+    for (auto &partition : partitions)
+    {
+        int16_t partition_error_code = 0;
+        int32_t partition_index = partition.partition_index;
+        int32_t leader_id = partition.leader_id;
+        int32_t leader_epoch = partition.leader_epoch;
+
+        convertH16toBE(partition_error_code);
+        convertH32toBE(partition_index, leader_id, leader_epoch);
+
+        writer.write(&partition_error_code, sizeof(partition_error_code));
+        writer.write(&partition_index, sizeof(partition_index));
+        writer.write(&leader_id, sizeof(leader_id));
+        writer.write(&leader_epoch, sizeof(leader_epoch));
+        sendNodeArray(writer, metadata_image.replicaNodes(partition));
+        sendNodeArray(writer, metadata_image.isrNodes(partition));
+        sendNodeArray(writer, {}); // Offline replicas
+        sendTaggedFields(writer, 0);
+    }
+}
+
+static void encodeUnknownMetadataTopic(int16_t error_code, const MetadataRequestBodyV12::Topic &request_topic, WireWriter &writer)
+{
+    int8_t is_internal = 0;
+
+    convertH16toBE(error_code);
+    writer.write(&error_code, sizeof(error_code));
+    sendCompactString(writer, request_topic.topic_name_len, request_topic.topic_name);
+    writer.write(request_topic.topic_id.data(), request_topic.topic_id.size());
+    writer.write(&is_internal, sizeof(is_internal));
+    sendNodeArray(writer, {}); // Partitions
+}
+
+static DescribeTopicPartitionsResponseBodyV0::Topic describeTopic(const MetadataImage &metadata_image, std::string_view topic_name,
+                                                                   int32_t first_partition_index, size_t &partition_budget, int32_t &next_partition_index)
+{
+    // Default Topic Not Found error response
+    DescribeTopicPartitionsResponseBodyV0::Topic response_topic = {.error_code = 3, // Introduce macros for error codes
+                                                                   .topic_name_len = static_cast<uint32_t>(topic_name.size() + 1),
+                                                                   .topic_name = {topic_name.begin(), topic_name.end()},
+                                                                   .topic_id = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+                                                                   .is_internal = 0,
+                                                                   .partitions_array_len = 1,
+                                                                   .topic_authorized_ops = 0,
+                                                                   .tag_buffer = 0};
+    next_partition_index = -1;
+
+    const TopicMetadata *topic = metadata_image.findTopic(topic_name);
+    if (topic == nullptr)
+        return response_topic;
+
+    response_topic.error_code = 0;
+    response_topic.topic_id = topic->topic_id;
+
+    // Partitions are sorted by index, resume from the cursor and stop once the page budget is used up
+    auto partitions = metadata_image.topicPartitions(*topic);
+    auto first = std::lower_bound(partitions.begin(), partitions.end(), first_partition_index, [](const PartitionMetadata &partition, int32_t index)
+                                  { return partition.partition_index < index; });
+    auto last = first + std::min<size_t>(partition_budget, partitions.end() - first);
+
+    if (last != partitions.end())
+        next_partition_index = last->partition_index;
+    partition_budget -= last - first;
+
+    response_topic.partitions_array.reserve(last - first);
+
+    for (auto &partition : std::span(first, last))
+    {
+        auto replica_nodes = metadata_image.replicaNodes(partition);
+        auto isr_nodes = metadata_image.isrNodes(partition);
+
+        DescribeTopicPartitionsResponseBodyV0::Topic::Partition response_partition = {.error_code = 0, // Introduce macros for error codes
+                                                                                      .partition_index = partition.partition_index,
+                                                                                      .leader_id = partition.leader_id,
+                                                                                      .leader_epoch = partition.leader_epoch,
+                                                                                      .replica_nodes_array_len = static_cast<uint32_t>(replica_nodes.size() + 1),
+                                                                                      .replica_nodes_array = {replica_nodes.begin(), replica_nodes.end()},
+                                                                                      .isr_nodes_array_len = static_cast<uint32_t>(isr_nodes.size() + 1),
+                                                                                      .isr_nodes_array = {isr_nodes.begin(), isr_nodes.end()},
+                                                                                      .elr_nodes_array_len = 1,
+                                                                                      .last_known_elr_nodes_array_len = 1,
+                                                                                      .offline_replica_nodes_array_len = 1,
+                                                                                      .tag_buffer = 0};
+
+        response_topic.partitions_array_len += 1;
+        response_topic.partitions_array.push_back(std::move(response_partition));
+    }
+
+    return response_topic;
+}
+
+std::string_view apiName(int16_t api_key)
+{
+    switch (api_key)
+    {
+    case 0:
+        return "Produce";
+    case 1:
+        return "Fetch";
+    case 2:
+        return "ListOffsets";
+    case 3:
+        return "Metadata";
+    case 8:
+        return "OffsetCommit";
+    case 9:
+        return "OffsetFetch";
+    case 10:
+        return "FindCoordinator";
+    case 11:
+        return "JoinGroup";
+    case 12:
+        return "Heartbeat";
+    case 13:
+        return "LeaveGroup";
+    case 14:
+        return "SyncGroup";
+    case 18:
+        return "ApiVersions";
+    case 75:
+        return "DescribeTopicPartitions";
+    default:
+        return "Unknown";
+    }
+}
+
+// Every API the broker serves, each decoded in one layout that is the same for all versions of its range. ApiVersions
+// advertises these and requests outside of them are refused before their body is read.
+struct ApiVersionRange
+{
+    int16_t api_key;
+    int16_t min_version;
+    int16_t max_version;
+};
+
+static constexpr ApiVersionRange SUPPORTED_API_VERSIONS[] = {
+    {0, 11, 11}, // Produce
+    {1, 16, 16}, // Fetch
+    {2, 6, 9}, // ListOffsets
+    {3, 11, 12}, // Metadata
+    {8, 8, 8}, // OffsetCommit
+    {9, 8, 8}, // OffsetFetch
+    {10, 4, 4}, // FindCoordinator
+    {11, 9, 9}, // JoinGroup
+    {12, 4, 4}, // Heartbeat
+    {13, 5, 5}, // LeaveGroup
+    {14, 5, 5}, // SyncGroup
+    {18, 0, APIVersionsRequestBodyV4::MAX_VERSION}, // APIVersions
+    {75, 0, 0}, // DescribeTopicPartitions
+};
+
+bool isSupportedVersion(int16_t api_key, int16_t api_version)
+{
+    for (auto &range : SUPPORTED_API_VERSIONS)
+    {
+        if (range.api_key == api_key)
+            return api_version >= range.min_version && api_version <= range.max_version;
+    }
+    return false;
+}
+
+ResponseMessage processAPIVersions(const RequestHeaderV2 &request_header, const APIVersionsRequestBodyV4 &request_body)
+{
+    // Move these into a new processing module
+    std::vector<ApiVersionRange> api_key_versions(std::begin(SUPPORTED_API_VERSIONS), std::end(SUPPORTED_API_VERSIONS));
+
+    // Response message
+
+    auto response_header = std::make_unique<ResponseHeaderV0>();
+    auto response_body = std::make_unique<APIVersionsResponseBodyV4>();
+
+    int32_t response_size = 0;
+
+    // Process bottom-up - Response Body -> Response Header
+
+    // Response Body
+
+    // Supported API versions is actually part of request header but we use here
+
+    // An unsupported version is answered in v0, the one every client can read, with the versions of ApiVersions
+    // itself so the client can retry with one of them
+    const bool supported = isSupportedVersion(18, request_header.request_api_ver);
+    if (!supported)
+        std::erase_if(api_key_versions, [](const ApiVersionRange &range)
+                      { return range.api_key != 18; });
+    response_body->api_version = supported ? request_header.request_api_ver : 0;
+    const bool flexible = response_body->api_version >= APIVersionsRequestBodyV4::FIRST_FLEXIBLE_VERSION;
+
+    response_body->error_code = supported ? 0 : 35; // UNSUPPORTED_VERSION
+    response_size += sizeof(response_body->error_code);
+
+    response_body->api_versions_array_len = api_key_versions.size() + 1;
+    response_size += flexible ? unsignedVarintSize(response_body->api_versions_array_len) : sizeof(int32_t);
+
+    for (auto &api_versions_elem : api_key_versions)
+    {
+        APIVersionsResponseBodyV4::APIVersion api_version = {.api_key = api_versions_elem.api_key,
+                                                             .api_min_ver = api_versions_elem.min_version,
+                                                             .api_max_ver = api_versions_elem.max_version,
+                                                             .tag_buffer = 0};
+
+        response_body->api_versions_array.push_back(api_version);
+        response_size += flexible ? api_version.size() : api_version.size() - unsignedVarintSize(api_version.tag_buffer);
+    }
+
+    response_body->throttle_time = 0;
+    if (response_body->api_version >= 1)
+        response_size += sizeof(response_body->throttle_time);
+
+    response_body->tag_buffer = 0;
+    if (flexible)
+        response_size += unsignedVarintSize(response_body->tag_buffer);
 
     // Response Header
 
@@ -330,6 +1275,9 @@ ResponseMessage processAPIVersions(const RequestHeaderV2 &request_header, const
 
 ResponseMessage processDescribeTopicPartitions(const RequestHeaderV2 &request_header, const DescribeTopicPartitionsRequestBodyV0 &request_body)
 {
+    // Upper bound on partitions per response regardless of what the client asks for, as Kafka's max.request.partition.size.limit
+    constexpr size_t MAX_RESPONSE_PARTITION_LIMIT = 2000;
+
     // Response message
 
     auto response_header = std::make_unique<ResponseHeaderV1>();
@@ -346,28 +1294,82 @@ ResponseMessage processDescribeTopicPartitions(const RequestHeaderV2 &request_he
     response_body->throttle_time = 0;
     response_size += sizeof(response_body->throttle_time);
 
-    response_body->topics_array_len = request_body.topics_array_len;
-    response_size += sizeof(response_body->topics_array_len);
-
-    // This is where we use the LogParser for checking log files for the topics
+    // Topics are looked up in the cached metadata image instead of re-reading the log files
 
-    LogParser log_parser("/tmp/kraft-combined-logs/__cluster_metadata-0/00000000000000000000.log"); // Hard-coded filename is not good
+    auto metadata_image = MetadataImage::current();
 
-    // KISS
+    // Pages walk the topics in name order, an empty topic list means every topic in the image
 
+    std::vector<std::string_view> topic_names;
     for (auto &topics_elem : request_body.topics_array)
     {
-        auto topic = log_parser.extractTopicPartitionRecords(topics_elem.topic_name_len, topics_elem.topic_name);
+        topic_names.emplace_back(topics_elem.topic_name.data(), topics_elem.topic_name.size());
+    }
+    std::sort(topic_names.begin(), topic_names.end());
+    topic_names.erase(std::unique(topic_names.begin(), topic_names.end()), topic_names.end());
+
+    std::string_view cursor_topic_name;
+    int32_t cursor_partition_index = 0;
+    if (request_body.cursor_present != -1)
+    {
+        cursor_topic_name = std::string_view(request_body.cursor.topic_name.data(), request_body.cursor.topic_name.size());
+        cursor_partition_index = request_body.cursor.partition_index;
+    }
+
+    size_t partition_budget = MAX_RESPONSE_PARTITION_LIMIT;
+    if (request_body.response_part_limit > 0)
+        partition_budget = std::min<size_t>(request_body.response_part_limit, MAX_RESPONSE_PARTITION_LIMIT);
+
+    response_body->next_cursor_present = -1;
+
+    const bool describe_all_topics = topic_names.empty();
+    const size_t topic_count = describe_all_topics ? metadata_image->topicCount() : topic_names.size();
+    size_t topic_rank = describe_all_topics ? metadata_image->topicRankLowerBound(cursor_topic_name)
+                                            : std::lower_bound(topic_names.begin(), topic_names.end(), cursor_topic_name) - topic_names.begin();
+
+    for (; topic_rank < topic_count; topic_rank++)
+    {
+        std::string_view topic_name = describe_all_topics ? metadata_image->topicName(metadata_image->topicByRank(topic_rank)) : topic_names[topic_rank];
+        int32_t first_partition_index = topic_name == cursor_topic_name ? cursor_partition_index : 0;
+
+        if (partition_budget == 0 && metadata_image->findTopic(topic_name) != nullptr)
+        {
+            // Page is full, the next one starts with this topic
+            response_body->next_cursor = {.topic_name_len = static_cast<uint32_t>(topic_name.size() + 1),
+                                          .topic_name = {topic_name.begin(), topic_name.end()},
+                                          .partition_index = first_partition_index,
+                                          .tag_buffer = 0};
+            response_body->next_cursor_present = 1;
+            break;
+        }
+
+        int32_t next_partition_index;
+        auto topic = describeTopic(*metadata_image, topic_name, first_partition_index, partition_budget, next_partition_index);
 
-        response_body->topics_array.push_back(topic);
         response_size += topic.size();
+        response_body->topics_array.push_back(std::move(topic));
+
+        if (next_partition_index != -1)
+        {
+            // Page is full in the middle of this topic
+            response_body->next_cursor = {.topic_name_len = static_cast<uint32_t>(topic_name.size() + 1),
+                                          .topic_name = {topic_name.begin(), topic_name.end()},
+                                          .partition_index = next_partition_index,
+                                          .tag_buffer = 0};
+            response_body->next_cursor_present = 1;
+            break;
+        }
     }
 
-    response_body->next_cursor = 0xFF;
-    response_size += sizeof(response_body->next_cursor);
+    response_body->topics_array_len = response_body->topics_array.size() + 1;
+    response_size += unsignedVarintSize(response_body->topics_array_len);
+
+    response_size += sizeof(response_body->next_cursor_present);
+    if (response_body->next_cursor_present != -1)
+        response_size += response_body->next_cursor.size();
 
     response_body->tag_buffer = 0;
-    response_size += sizeof(response_body->tag_buffer);
+    response_size += unsignedVarintSize(response_body->tag_buffer);
 
     // Response Header
 
@@ -375,9 +1377,1088 @@ ResponseMessage processDescribeTopicPartitions(const RequestHeaderV2 &request_he
     response_size += sizeof(response_header->response_corr_id);
 
     response_header->tag_buffer = 0;
-    response_size += sizeof(response_header->tag_buffer);
+    response_size += unsignedVarintSize(response_header->tag_buffer);
 
     response_header->response_msg_size = response_size;
 
     return {std::move(response_header), std::move(response_body)};
-}
\ No newline at end of file
+}
+
+ResponseMessage processMetadata(const RequestHeaderV2 &request_header, const MetadataRequestBodyV12 &request_body)
+{
+    // Single broker cluster, this node is the only broker and the controller
+    const BrokerConfig &config = brokerConfig();
+    const std::string &broker_host = config.advertised_host;
+
+    // No authorizer, every topic operation is allowed (READ .. ALTER_CONFIGS bits of AclOperation)
+    constexpr int32_t ALL_TOPIC_OPERATIONS = (1 << 3) | (1 << 4) | (1 << 5) | (1 << 6) | (1 << 7) | (1 << 8) | (1 << 10) | (1 << 11);
+    constexpr int32_t OMITTED_AUTHORIZED_OPERATIONS = INT32_MIN;
+
+    // Response message
+
+    auto response_header = std::make_unique<ResponseHeaderV1>();
+    auto response_body = std::make_unique<MetadataResponseBodyV12>();
+
+    int32_t response_size = 0;
+
+    // Process bottom-up - Response Body -> Response Header
+
+    // Response Body
+
+    response_body->throttle_time = 0;
+    response_size += sizeof(response_body->throttle_time);
+
+    MetadataResponseBodyV12::Broker broker = {.node_id = config.node_id,
+                                              .host_len = static_cast<uint32_t>(broker_host.size() + 1),
+                                              .host = {broker_host.begin(), broker_host.end()},
+                                              .port = config.advertised_port,
+                                              .rack_len = 0,
+                                              .tag_buffer = 0};
+    response_size += broker.size();
+    response_body->brokers_array.push_back(std::move(broker));
+
+    response_body->brokers_array_len = response_body->brokers_array.size() + 1;
+    response_size += unsignedVarintSize(response_body->brokers_array_len);
+
+    response_body->cluster_id_len = 0;
+    response_size += unsignedVarintSize(response_body->cluster_id_len);
+
+    response_body->controller_id = config.node_id;
+    response_size += sizeof(response_body->controller_id);
+
+    // Topic entries come pre-encoded from the metadata image, only authorized operations differ between requests
+
+    response_body->metadata_image = MetadataImage::current();
+    const MetadataImage &metadata_image = *response_body->metadata_image;
+
+    const int32_t topic_authorized_ops = request_body.include_topic_authorized_ops ? ALL_TOPIC_OPERATIONS : OMITTED_AUTHORIZED_OPERATIONS;
+
+    auto add_topic = [&](const WireWriter &fragment)
+    {
+        MetadataResponseBodyV12::Topic topic = {.fragment = &fragment, .topic_authorized_ops = topic_authorized_ops, .tag_buffer = 0};
+        response_size += topic.size();
+        response_body->topics_array.push_back(topic);
+    };
+
+    auto encode_topic = [&](const TopicMetadata &topic)
+    {
+        return [&](WireWriter &writer)
+        { encodeMetadataTopic(metadata_image, topic, writer); };
+    };
+
+    if (request_body.topics_array_len == 0)
+    {
+        // Null topics array asks for every topic
+        response_body->topics_array.reserve(metadata_image.topicCount());
+        for (size_t topic_rank = 0; topic_rank < metadata_image.topicCount(); topic_rank++)
+        {
+            const TopicMetadata &topic = metadata_image.topicByRank(topic_rank);
+            add_topic(metadata_image.encodedTopic(topic, encode_topic(topic)));
+        }
+    }
+    else
+    {
+        response_body->topics_array.reserve(request_body.topics_array.size());
+        for (auto &topics_elem : request_body.topics_array)
+        {
+            const bool by_name = topics_elem.topic_name_len != 0;
+            const TopicMetadata *topic = by_name ? metadata_image.findTopic(std::string_view(topics_elem.topic_name.data(), topics_elem.topic_name.size()))
+                                                 : metadata_image.findTopic(topics_elem.topic_id);
+
+            if (topic != nullptr)
+            {
+                add_topic(metadata_image.encodedTopic(*topic, encode_topic(*topic)));
+                continue;
+            }
+
+            auto &fragment = response_body->unknown_topic_fragments.emplace_back();
+            encodeUnknownMetadataTopic(by_name ? 3 : 100, topics_elem, fragment); // UNKNOWN_TOPIC_OR_PARTITION / UNKNOWN_TOPIC_ID
+            add_topic(fragment);
+        }
+    }
+
+    response_body->topics_array_len = response_body->topics_array.size() + 1;
+    response_size += unsignedVarintSize(response_body->topics_array_len);
+
+    response_body->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_body->tag_buffer);
+
+    // Response Header
+
+    response_header->response_corr_id = request_header.request_corr_id;
+    response_size += sizeof(response_header->response_corr_id);
+
+    response_header->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_header->tag_buffer);
+
+    response_header->response_msg_size = response_size;
+
+    return {std::move(response_header), std::move(response_body)};
+}
+
+bool isFetchSatisfied(const FetchRequestBodyV16 &request_body)
+{
+    if (request_body.max_wait_ms <= 0 || request_body.min_bytes <= 0)
+        return true;
+
+    auto metadata_image = MetadataImage::current();
+
+    // Errors are answered right away, they won't go away by waiting
+    int64_t accumulated_bytes = 0;
+    for (auto &topics_elem : request_body.topics_array)
+    {
+        const TopicMetadata *topic = metadata_image->findTopic(topics_elem.topic_id);
+        if (topic == nullptr)
+            return true;
+
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            if (metadata_image->findPartition(*topic, partitions_elem.partition) == nullptr)
+                return true;
+
+            PartitionLog &log = LogManager::instance().getLog({topics_elem.topic_id, partitions_elem.partition}, metadata_image->topicName(*topic));
+            const int64_t available = log.bytesAvailable(partitions_elem.fetch_offset);
+            if (available < 0)
+                return true;
+
+            accumulated_bytes += std::min<int64_t>(available, std::max(partitions_elem.partition_max_bytes, 0));
+            if (accumulated_bytes >= request_body.min_bytes)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+std::shared_ptr<DelayedOperation> delayFetch(const FetchRequestBodyV16 &request_body, EventLoop &loop, std::function<void()> on_complete)
+{
+    auto operation = std::make_shared<DelayedOperation>([&request_body]()
+                                                        { return isFetchSatisfied(request_body); },
+                                                        std::move(on_complete));
+
+    // Woken up by produce requests appending to any of the fetched partitions
+    std::vector<TopicPartition> keys;
+    for (auto &topics_elem : request_body.topics_array)
+    {
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            keys.push_back({topics_elem.topic_id, partitions_elem.partition});
+        }
+    }
+
+    if (!fetchPurgatory().tryCompleteElseWatch(operation, keys))
+        loop.schedule(*operation, request_body.max_wait_ms);
+
+    return operation;
+}
+
+ResponseMessage processFetch(const RequestHeaderV2 &request_header, const FetchRequestBodyV16 &request_body)
+{
+    // Response message
+
+    auto response_header = std::make_unique<ResponseHeaderV1>();
+    auto response_body = std::make_unique<FetchResponseBodyV16>();
+
+    int32_t response_size = 0;
+
+    // Process bottom-up - Response Body -> Response Header
+
+    // Response Body
+
+    response_body->throttle_time = 0;
+    response_size += sizeof(response_body->throttle_time);
+
+    response_body->error_code = 0;
+    response_size += sizeof(response_body->error_code);
+
+    response_body->session_id = 0; // No incremental fetch sessions, every fetch is a full one
+    response_size += sizeof(response_body->session_id);
+
+    auto metadata_image = MetadataImage::current();
+
+    // The first partition with data returns at least one batch even past max_bytes, so an oversized batch can't stall the consumer
+    size_t bytes_budget = std::max(request_body.max_bytes, 0);
+    bool min_one_batch = true;
+
+    response_body->topics_array.reserve(request_body.topics_array.size());
+    for (auto &topics_elem : request_body.topics_array)
+    {
+        FetchResponseBodyV16::Topic response_topic = {.topic_id = topics_elem.topic_id, .partitions_array_len = 1, .tag_buffer = 0};
+        const TopicMetadata *topic = metadata_image->findTopic(topics_elem.topic_id);
+
+        response_topic.partitions_array.reserve(topics_elem.partitions_array.size());
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            FetchResponseBodyV16::Topic::Partition response_partition = {.partition_index = partitions_elem.partition,
+                                                                         .error_code = 0,
+                                                                         .high_watermark = -1,
+                                                                         .last_stable_offset = -1,
+                                                                         .log_start_offset = -1,
+                                                                         .aborted_transactions_array_len = 1,
+                                                                         .preferred_read_replica = -1,
+                                                                         .records_len = 1,
+                                                                         .tag_buffer = 0};
+
+            if (topic == nullptr)
+            {
+                response_partition.error_code = 100; // UNKNOWN_TOPIC_ID
+            }
+            else if (metadata_image->findPartition(*topic, partitions_elem.partition) == nullptr)
+            {
+                response_partition.error_code = 3; // UNKNOWN_TOPIC_OR_PARTITION
+            }
+            else
+            {
+                PartitionLog &log = LogManager::instance().getLog({topics_elem.topic_id, partitions_elem.partition}, metadata_image->topicName(*topic));
+                const size_t max_bytes = std::min<size_t>(std::max(partitions_elem.partition_max_bytes, 0), bytes_budget);
+
+                response_partition.error_code = log.read(partitions_elem.fetch_offset, max_bytes, min_one_batch, response_partition.records);
+                response_partition.high_watermark = log.highWatermark();
+                response_partition.last_stable_offset = response_partition.high_watermark; // No transactions
+                response_partition.log_start_offset = log.logStartOffset();
+                response_partition.records_len = response_partition.records.size() + 1;
+
+                bytes_budget -= std::min(bytes_budget, response_partition.records.size());
+                if (!response_partition.records.empty())
+                    min_one_batch = false;
+            }
+
+            response_topic.partitions_array_len += 1;
+            response_topic.partitions_array.push_back(std::move(response_partition));
+        }
+
+        response_size += response_topic.size();
+        response_body->topics_array.push_back(std::move(response_topic));
+    }
+
+    response_body->topics_array_len = response_body->topics_array.size() + 1;
+    response_size += unsignedVarintSize(response_body->topics_array_len);
+
+    response_body->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_body->tag_buffer);
+
+    // Response Header
+
+    response_header->response_corr_id = request_header.request_corr_id;
+    response_size += sizeof(response_header->response_corr_id);
+
+    response_header->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_header->tag_buffer);
+
+    response_header->response_msg_size = response_size;
+
+    return {std::move(response_header), std::move(response_body)};
+}
+
+std::shared_ptr<DelayedOperation> appendProduce(const ProduceRequestBodyV11 &request_body, std::shared_ptr<ProduceAppends> appends, std::function<void()> on_complete)
+{
+    auto operation = std::make_shared<DelayedOperation>([appends]()
+                                                        { return appends->remaining.load() == 0; },
+                                                        std::move(on_complete));
+
+    auto metadata_image = MetadataImage::current();
+
+    size_t partitions = 0;
+    for (auto &topics_elem : request_body.topics_array)
+        partitions += topics_elem.partitions_array.size();
+    appends->results.assign(partitions, {.error_code = 0, .base_offset = -1, .log_start_offset = -1});
+    appends->remaining = partitions;
+
+    // Counts down as appends finish, the one that reaches zero completes the operation
+    auto append_done = [appends, operation]()
+    {
+        if (appends->remaining.fetch_sub(1) == 1)
+            operation->maybeComplete();
+    };
+
+    size_t result_index = 0;
+    for (auto &topics_elem : request_body.topics_array)
+    {
+        const TopicMetadata *topic = metadata_image->findTopic(std::string_view(topics_elem.name.data(), topics_elem.name.size()));
+
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            ProduceAppends::Result &result = appends->results[result_index++];
+
+            if (topic == nullptr || metadata_image->findPartition(*topic, partitions_elem.index) == nullptr)
+            {
+                result.error_code = 3; // UNKNOWN_TOPIC_OR_PARTITION
+                append_done();
+                continue;
+            }
+
+            // Records are copied, append() assigns offsets in place and the request may be gone by the time it runs
+            const TopicPartition topic_partition = {topic->topic_id, partitions_elem.index};
+            LogManager::instance().appendAsync(topic_partition, metadata_image->topicName(*topic), partitions_elem.records,
+                                               [&result, topic_partition, append_done](int64_t base_offset, PartitionLog &log)
+                                               {
+                                                   result.base_offset = base_offset;
+                                                   if (base_offset == -1)
+                                                   {
+                                                       result.error_code = 87; // INVALID_RECORD
+                                                   }
+                                                   else
+                                                   {
+                                                       result.log_start_offset = log.logStartOffset();
+                                                       // High watermark moved, hand the new data to fetches parked on this partition
+                                                       fetchPurgatory().checkAndComplete(topic_partition);
+                                                   }
+                                                   append_done(); });
+        }
+    }
+
+    if (partitions == 0)
+        operation->maybeComplete();
+
+    return operation;
+}
+
+ResponseMessage processProduce(const RequestHeaderV2 &request_header, const ProduceRequestBodyV11 &request_body, const ProduceAppends &appends)
+{
+    // Response message
+
+    auto response_header = std::make_unique<ResponseHeaderV1>();
+    auto response_body = std::make_unique<ProduceResponseBodyV11>();
+
+    int32_t response_size = 0;
+
+    // Process bottom-up - Response Body -> Response Header
+
+    // Response Body
+
+    // The appends already happened in appendProduce(), only their results are reported here
+    size_t result_index = 0;
+    response_body->topics_array.reserve(request_body.topics_array.size());
+    for (auto &topics_elem : request_body.topics_array)
+    {
+        ProduceResponseBodyV11::Topic response_topic = {.name_len = topics_elem.name_len,
+                                                        .name = topics_elem.name,
+                                                        .partitions_array_len = 1,
+                                                        .tag_buffer = 0};
+
+        response_topic.partitions_array.reserve(topics_elem.partitions_array.size());
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            const ProduceAppends::Result &result = appends.results[result_index++];
+            ProduceResponseBodyV11::Topic::Partition response_partition = {.index = partitions_elem.index,
+                                                                           .error_code = result.error_code,
+                                                                           .base_offset = result.base_offset,
+                                                                           .log_append_time = -1, // CreateTime, the producer's timestamps are kept
+                                                                           .log_start_offset = result.log_start_offset,
+                                                                           .record_errors_array_len = 1,
+                                                                           .error_message_len = 0,
+                                                                           .tag_buffer = 0};
+
+            response_topic.partitions_array_len += 1;
+            response_topic.partitions_array.push_back(std::move(response_partition));
+        }
+
+        response_size += response_topic.size();
+        response_body->topics_array.push_back(std::move(response_topic));
+    }
+
+    // Fire and forget, the producer doesn't read a response
+    if (request_body.acks == 0)
+        return {nullptr, nullptr};
+
+    response_body->topics_array_len = response_body->topics_array.size() + 1;
+    response_size += unsignedVarintSize(response_body->topics_array_len);
+
+    response_body->throttle_time = 0;
+    response_size += sizeof(response_body->throttle_time);
+
+    response_body->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_body->tag_buffer);
+
+    // Response Header
+
+    response_header->response_corr_id = request_header.request_corr_id;
+    response_size += sizeof(response_header->response_corr_id);
+
+    response_header->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_header->tag_buffer);
+
+    response_header->response_msg_size = response_size;
+
+    return {std::move(response_header), std::move(response_body)};
+}
+
+ResponseMessage processListOffsets(const RequestHeaderV2 &request_header, const ListOffsetsRequestBodyV9 &request_body)
+{
+    // Special timestamps of ListOffsets, anything else negative is rejected
+    constexpr int64_t LATEST_TIMESTAMP = -1;
+    constexpr int64_t EARLIEST_TIMESTAMP = -2;
+    constexpr int64_t MAX_TIMESTAMP = -3;
+    constexpr int64_t EARLIEST_LOCAL_TIMESTAMP = -4;
+    constexpr int64_t LATEST_TIERED_TIMESTAMP = -5;
+
+    // Response message
+
+    auto response_header = std::make_unique<ResponseHeaderV1>();
+    auto response_body = std::make_unique<ListOffsetsResponseBodyV9>();
+
+    int32_t response_size = 0;
+
+    // Process bottom-up - Response Body -> Response Header
+
+    // Response Body
+
+    response_body->throttle_time = 0;
+    response_size += sizeof(response_body->throttle_time);
+
+    auto metadata_image = MetadataImage::current();
+
+    response_body->topics_array.reserve(request_body.topics_array.size());
+    for (auto &topics_elem : request_body.topics_array)
+    {
+        ListOffsetsResponseBodyV9::Topic response_topic = {.name_len = topics_elem.name_len,
+                                                           .name = topics_elem.name,
+                                                           .partitions_array_len = 1,
+                                                           .tag_buffer = 0};
+        const TopicMetadata *topic = metadata_image->findTopic(std::string_view(topics_elem.name.data(), topics_elem.name.size()));
+
+        response_topic.partitions_array.reserve(topics_elem.partitions_array.size());
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            ListOffsetsResponseBodyV9::Topic::Partition response_partition = {.partition_index = partitions_elem.partition_index,
+                                                                              .error_code = 0,
+                                                                              .timestamp = -1,
+                                                                              .offset = -1,
+                                                                              .leader_epoch = -1,
+                                                                              .tag_buffer = 0};
+
+            const PartitionMetadata *partition = topic != nullptr ? metadata_image->findPartition(*topic, partitions_elem.partition_index) : nullptr;
+            if (partition == nullptr)
+            {
+                response_partition.error_code = 3; // UNKNOWN_TOPIC_OR_PARTITION
+            }
+            else
+            {
+                // Earliest and latest come from in-memory segment bounds, timestamps from the time index
+                PartitionLog &log = LogManager::instance().getLog({topic->topic_id, partitions_elem.partition_index}, metadata_image->topicName(*topic));
+                TimestampAndOffset found = {-1, -1};
+
+                switch (partitions_elem.timestamp)
+                {
+                case LATEST_TIMESTAMP:
+                    found.offset = log.highWatermark();
+                    break;
+
+                case EARLIEST_TIMESTAMP:
+                case EARLIEST_LOCAL_TIMESTAMP:
+                    found.offset = log.logStartOffset();
+                    break;
+
+                case MAX_TIMESTAMP:
+                    found = log.offsetOfMaxTimestamp();
+                    break;
+
+                case LATEST_TIERED_TIMESTAMP:
+                    break; // No tiered storage, nothing is ever tiered
+
+                default:
+                    if (partitions_elem.timestamp >= 0)
+                        found = log.offsetForTimestamp(partitions_elem.timestamp);
+                    else
+                        response_partition.error_code = 42; // INVALID_REQUEST
+                    break;
+                }
+
+                response_partition.timestamp = found.timestamp;
+                response_partition.offset = found.offset;
+                if (found.offset != -1)
+                    response_partition.leader_epoch = partition->leader_epoch;
+            }
+
+            response_topic.partitions_array_len += 1;
+            response_topic.partitions_array.push_back(std::move(response_partition));
+        }
+
+        response_size += response_topic.size();
+        response_body->topics_array.push_back(std::move(response_topic));
+    }
+
+    response_body->topics_array_len = response_body->topics_array.size() + 1;
+    response_size += unsignedVarintSize(response_body->topics_array_len);
+
+    response_body->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_body->tag_buffer);
+
+    // Response Header
+
+    response_header->response_corr_id = request_header.request_corr_id;
+    response_size += sizeof(response_header->response_corr_id);
+
+    response_header->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_header->tag_buffer);
+
+    response_header->response_msg_size = response_size;
+
+    return {std::move(response_header), std::move(response_body)};
+}
+
+// Compact string (or bytes) field holding str, len is N+1
+static void fillCompactString(uint32_t &len, std::vector<char> &field, std::string_view str)
+{
+    len = static_cast<uint32_t>(str.size() + 1);
+    field.assign(str.begin(), str.end());
+}
+
+// Compact nullable string field, len 0 is null
+static void fillCompactNullableString(uint32_t &len, std::vector<char> &field, const std::optional<std::string> &str)
+{
+    if (str)
+        fillCompactString(len, field, *str);
+    else
+        len = 0;
+}
+
+ResponseMessage processFindCoordinator(const RequestHeaderV2 &request_header, const FindCoordinatorRequestBodyV4 &request_body)
+{
+    constexpr int8_t GROUP_KEY_TYPE = 0;
+    constexpr int8_t TRANSACTION_KEY_TYPE = 1;
+
+    // Response message
+
+    auto response_header = std::make_unique<ResponseHeaderV1>();
+    auto response_body = std::make_unique<FindCoordinatorResponseBodyV4>();
+
+    int32_t response_size = 0;
+
+    // Process bottom-up - Response Body -> Response Header
+
+    // Response Body
+
+    response_body->throttle_time = 0;
+    response_size += sizeof(response_body->throttle_time);
+
+    // This broker coordinates every group, there is no transaction coordinator
+    const BrokerConfig &config = brokerConfig();
+    response_body->coordinators_array.reserve(request_body.coordinator_keys_array.size());
+    for (auto &coordinator_keys_elem : request_body.coordinator_keys_array)
+    {
+        FindCoordinatorResponseBodyV4::Coordinator coordinator = {.key_len = coordinator_keys_elem.key_len,
+                                                                  .key = coordinator_keys_elem.key,
+                                                                  .node_id = -1,
+                                                                  .host_len = 1,
+                                                                  .host = {},
+                                                                  .port = -1,
+                                                                  .error_code = 0,
+                                                                  .error_message_len = 0,
+                                                                  .error_message = {},
+                                                                  .tag_buffer = 0};
+
+        if (request_body.key_type == GROUP_KEY_TYPE)
+        {
+            coordinator.node_id = config.node_id;
+            fillCompactString(coordinator.host_len, coordinator.host, config.advertised_host);
+            coordinator.port = config.advertised_port;
+        }
+        else
+        {
+            coordinator.error_code = request_body.key_type == TRANSACTION_KEY_TYPE ? 15 : 42; // COORDINATOR_NOT_AVAILABLE, INVALID_REQUEST
+        }
+
+        response_size += coordinator.size();
+        response_body->coordinators_array.push_back(std::move(coordinator));
+    }
+
+    response_body->coordinators_array_len = response_body->coordinators_array.size() + 1;
+    response_size += unsignedVarintSize(response_body->coordinators_array_len);
+
+    response_body->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_body->tag_buffer);
+
+    // Response Header
+
+    response_header->response_corr_id = request_header.request_corr_id;
+    response_size += sizeof(response_header->response_corr_id);
+
+    response_header->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_header->tag_buffer);
+
+    response_header->response_msg_size = response_size;
+
+    return {std::move(response_header), std::move(response_body)};
+}
+
+std::shared_ptr<DelayedOperation> delayJoinGroup(const RequestHeaderV2 &request_header, const JoinGroupRequestBodyV9 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete)
+{
+    // Only the coordinator completes it
+    auto operation = std::make_shared<DelayedOperation>([]()
+                                                        { return false; },
+                                                        std::move(on_complete));
+
+    GroupCoordinator::JoinRequest request = {.group_id = {request_body.group_id.begin(), request_body.group_id.end()},
+                                             .member_id = {request_body.member_id.begin(), request_body.member_id.end()},
+                                             .client_id = {request_header.client_id_contents.begin(), request_header.client_id_contents.end()},
+                                             .session_timeout_ms = request_body.session_timeout_ms,
+                                             .rebalance_timeout_ms = request_body.rebalance_timeout_ms,
+                                             .protocol_type = {request_body.protocol_type.begin(), request_body.protocol_type.end()},
+                                             .protocols = {}};
+    request.protocols.reserve(request_body.protocols_array.size());
+    for (auto &protocols_elem : request_body.protocols_array)
+        request.protocols.push_back({.name = {protocols_elem.name.begin(), protocols_elem.name.end()}, .metadata = protocols_elem.metadata});
+
+    GroupCoordinator::instance().joinGroup(std::move(request), {.result = std::move(result), .operation = operation});
+    return operation;
+}
+
+ResponseMessage processJoinGroup(const RequestHeaderV2 &request_header, const GroupResult &result)
+{
+    // Response message
+
+    auto response_header = std::make_unique<ResponseHeaderV1>();
+    auto response_body = std::make_unique<JoinGroupResponseBodyV9>();
+
+    int32_t response_size = 0;
+
+    // Process bottom-up - Response Body -> Response Header
+
+    // Response Body
+
+    // The coordinator already answered the request in delayJoinGroup(), only its result is encoded here
+    response_body->throttle_time = 0;
+    response_size += sizeof(response_body->throttle_time);
+
+    response_body->error_code = result.error_code;
+    response_size += sizeof(response_body->error_code);
+
+    response_body->generation_id = result.generation_id;
+    response_size += sizeof(response_body->generation_id);
+
+    fillCompactNullableString(response_body->protocol_type_len, response_body->protocol_type,
+                              result.protocol_type.empty() ? std::nullopt : std::optional<std::string>(result.protocol_type));
+    response_size += unsignedVarintSize(response_body->protocol_type_len) + response_body->protocol_type.size();
+
+    fillCompactNullableString(response_body->protocol_name_len, response_body->protocol_name, result.protocol_name);
+    response_size += unsignedVarintSize(response_body->protocol_name_len) + response_body->protocol_name.size();
+
+    fillCompactString(response_body->leader_len, response_body->leader, result.leader_id);
+    response_size += unsignedVarintSize(response_body->leader_len) + response_body->leader.size();
+
+    response_body->skip_assignment = 0;
+    response_size += sizeof(response_body->skip_assignment);
+
+    fillCompactString(response_body->member_id_len, response_body->member_id, result.member_id);
+    response_size += unsignedVarintSize(response_body->member_id_len) + response_body->member_id.size();
+
+    response_body->members_array.reserve(result.members.size());
+    for (auto &member : result.members)
+    {
+        JoinGroupResponseBodyV9::Member response_member = {.member_id_len = 0,
+                                                           .member_id = {},
+                                                           .group_instance_id_len = 0,
+                                                           .group_instance_id = {},
+                                                           .metadata_len = static_cast<uint32_t>(member.metadata.size() + 1),
+                                                           .metadata = member.metadata,
+                                                           .tag_buffer = 0};
+        fillCompactString(response_member.member_id_len, response_member.member_id, member.member_id);
+
+        response_size += response_member.size();
+        response_body->members_array.push_back(std::move(response_member));
+    }
+
+    response_body->members_array_len = response_body->members_array.size() + 1;
+    response_size += unsignedVarintSize(response_body->members_array_len);
+
+    response_body->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_body->tag_buffer);
+
+    // Response Header
+
+    response_header->response_corr_id = request_header.request_corr_id;
+    response_size += sizeof(response_header->response_corr_id);
+
+    response_header->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_header->tag_buffer);
+
+    response_header->response_msg_size = response_size;
+
+    return {std::move(response_header), std::move(response_body)};
+}
+
+std::shared_ptr<DelayedOperation> delaySyncGroup(const SyncGroupRequestBodyV5 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete)
+{
+    // Only the coordinator completes it
+    auto operation = std::make_shared<DelayedOperation>([]()
+                                                        { return false; },
+                                                        std::move(on_complete));
+
+    GroupCoordinator::SyncRequest request = {.group_id = {request_body.group_id.begin(), request_body.group_id.end()},
+                                             .generation_id = request_body.generation_id,
+                                             .member_id = {request_body.member_id.begin(), request_body.member_id.end()},
+                                             .protocol_type = std::nullopt,
+                                             .protocol_name = std::nullopt,
+                                             .assignments = {}};
+    if (request_body.protocol_type_len > 0)
+        request.protocol_type.emplace(request_body.protocol_type.begin(), request_body.protocol_type.end());
+    if (request_body.protocol_name_len > 0)
+        request.protocol_name.emplace(request_body.protocol_name.begin(), request_body.protocol_name.end());
+    request.assignments.reserve(request_body.assignments_array.size());
+    for (auto &assignments_elem : request_body.assignments_array)
+        request.assignments.push_back({{assignments_elem.member_id.begin(), assignments_elem.member_id.end()}, assignments_elem.assignment});
+
+    GroupCoordinator::instance().syncGroup(std::move(request), {.result = std::move(result), .operation = operation});
+    return operation;
+}
+
+ResponseMessage processSyncGroup(const RequestHeaderV2 &request_header, const GroupResult &result)
+{
+    // Response message
+
+    auto response_header = std::make_unique<ResponseHeaderV1>();
+    auto response_body = std::make_unique<SyncGroupResponseBodyV5>();
+
+    int32_t response_size = 0;
+
+    // Process bottom-up - Response Body -> Response Header
+
+    // Response Body
+
+    response_body->throttle_time = 0;
+    response_size += sizeof(response_body->throttle_time);
+
+    response_body->error_code = result.error_code;
+    response_size += sizeof(response_body->error_code);
+
+    fillCompactNullableString(response_body->protocol_type_len, response_body->protocol_type,
+                              result.protocol_type.empty() ? std::nullopt : std::optional<std::string>(result.protocol_type));
+    response_size += unsignedVarintSize(response_body->protocol_type_len) + response_body->protocol_type.size();
+
+    fillCompactNullableString(response_body->protocol_name_len, response_body->protocol_name, result.protocol_name);
+    response_size += unsignedVarintSize(response_body->protocol_name_len) + response_body->protocol_name.size();
+
+    response_body->assignment_len = result.assignment.size() + 1;
+    response_body->assignment = result.assignment;
+    response_size += unsignedVarintSize(response_body->assignment_len) + response_body->assignment.size();
+
+    response_body->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_body->tag_buffer);
+
+    // Response Header
+
+    response_header->response_corr_id = request_header.request_corr_id;
+    response_size += sizeof(response_header->response_corr_id);
+
+    response_header->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_header->tag_buffer);
+
+    response_header->response_msg_size = response_size;
+
+    return {std::move(response_header), std::move(response_body)};
+}
+
+std::shared_ptr<DelayedOperation> delayHeartbeat(const HeartbeatRequestBodyV4 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete)
+{
+    // Only the coordinator completes it
+    auto operation = std::make_shared<DelayedOperation>([]()
+                                                        { return false; },
+                                                        std::move(on_complete));
+
+    GroupCoordinator::instance().heartbeat({request_body.group_id.begin(), request_body.group_id.end()}, request_body.generation_id,
+                                           {request_body.member_id.begin(), request_body.member_id.end()}, {.result = std::move(result), .operation = operation});
+    return operation;
+}
+
+ResponseMessage processHeartbeat(const RequestHeaderV2 &request_header, const GroupResult &result)
+{
+    // Response message
+
+    auto response_header = std::make_unique<ResponseHeaderV1>();
+    auto response_body = std::make_unique<HeartbeatResponseBodyV4>();
+
+    int32_t response_size = 0;
+
+    // Process bottom-up - Response Body -> Response Header
+
+    // Response Body
+
+    response_body->throttle_time = 0;
+    response_size += sizeof(response_body->throttle_time);
+
+    response_body->error_code = result.error_code;
+    response_size += sizeof(response_body->error_code);
+
+    response_body->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_body->tag_buffer);
+
+    // Response Header
+
+    response_header->response_corr_id = request_header.request_corr_id;
+    response_size += sizeof(response_header->response_corr_id);
+
+    response_header->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_header->tag_buffer);
+
+    response_header->response_msg_size = response_size;
+
+    return {std::move(response_header), std::move(response_body)};
+}
+
+std::shared_ptr<DelayedOperation> delayLeaveGroup(const LeaveGroupRequestBodyV5 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete)
+{
+    // Only the coordinator completes it
+    auto operation = std::make_shared<DelayedOperation>([]()
+                                                        { return false; },
+                                                        std::move(on_complete));
+
+    std::vector<std::string> member_ids;
+    member_ids.reserve(request_body.members_array.size());
+    for (auto &members_elem : request_body.members_array)
+        member_ids.emplace_back(members_elem.member_id.begin(), members_elem.member_id.end());
+
+    GroupCoordinator::instance().leaveGroup({request_body.group_id.begin(), request_body.group_id.end()}, std::move(member_ids),
+                                            {.result = std::move(result), .operation = operation});
+    return operation;
+}
+
+ResponseMessage processLeaveGroup(const RequestHeaderV2 &request_header, const LeaveGroupRequestBodyV5 &request_body, const GroupResult &result)
+{
+    // Response message
+
+    auto response_header = std::make_unique<ResponseHeaderV1>();
+    auto response_body = std::make_unique<LeaveGroupResponseBodyV5>();
+
+    int32_t response_size = 0;
+
+    // Process bottom-up - Response Body -> Response Header
+
+    // Response Body
+
+    response_body->throttle_time = 0;
+    response_size += sizeof(response_body->throttle_time);
+
+    response_body->error_code = result.error_code;
+    response_size += sizeof(response_body->error_code);
+
+    // One result per member, in request order
+    response_body->members_array.reserve(request_body.members_array.size());
+    for (size_t i = 0; i < request_body.members_array.size(); i++)
+    {
+        auto &members_elem = request_body.members_array[i];
+        LeaveGroupResponseBodyV5::Member response_member = {.member_id_len = members_elem.member_id_len,
+                                                            .member_id = members_elem.member_id,
+                                                            .group_instance_id_len = members_elem.group_instance_id_len,
+                                                            .group_instance_id = members_elem.group_instance_id,
+                                                            .error_code = i < result.error_codes.size() ? result.error_codes[i] : result.error_code,
+                                                            .tag_buffer = 0};
+
+        response_size += response_member.size();
+        response_body->members_array.push_back(std::move(response_member));
+    }
+
+    response_body->members_array_len = response_body->members_array.size() + 1;
+    response_size += unsignedVarintSize(response_body->members_array_len);
+
+    response_body->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_body->tag_buffer);
+
+    // Response Header
+
+    response_header->response_corr_id = request_header.request_corr_id;
+    response_size += sizeof(response_header->response_corr_id);
+
+    response_header->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_header->tag_buffer);
+
+    response_header->response_msg_size = response_size;
+
+    return {std::move(response_header), std::move(response_body)};
+}
+
+std::shared_ptr<DelayedOperation> delayOffsetCommit(const OffsetCommitRequestBodyV8 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete)
+{
+    // Only the coordinator completes it, once the commits are in __consumer_offsets
+    auto operation = std::make_shared<DelayedOperation>([]()
+                                                        { return false; },
+                                                        std::move(on_complete));
+
+    std::vector<GroupCoordinator::OffsetCommit> commits;
+    for (auto &topics_elem : request_body.topics_array)
+    {
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            commits.push_back({.topic = {topics_elem.name.begin(), topics_elem.name.end()},
+                               .partition = partitions_elem.partition_index,
+                               .offset = partitions_elem.committed_offset,
+                               .leader_epoch = partitions_elem.committed_leader_epoch,
+                               .metadata = {partitions_elem.committed_metadata.begin(), partitions_elem.committed_metadata.end()}});
+        }
+    }
+
+    GroupCoordinator::instance().commitOffsets({request_body.group_id.begin(), request_body.group_id.end()}, request_body.generation_id_or_member_epoch,
+                                               {request_body.member_id.begin(), request_body.member_id.end()}, std::move(commits),
+                                               {.result = std::move(result), .operation = operation});
+    return operation;
+}
+
+ResponseMessage processOffsetCommit(const RequestHeaderV2 &request_header, const OffsetCommitRequestBodyV8 &request_body, const GroupResult &result)
+{
+    // Response message
+
+    auto response_header = std::make_unique<ResponseHeaderV1>();
+    auto response_body = std::make_unique<OffsetCommitResponseBodyV8>();
+
+    int32_t response_size = 0;
+
+    // Process bottom-up - Response Body -> Response Header
+
+    // Response Body
+
+    response_body->throttle_time = 0;
+    response_size += sizeof(response_body->throttle_time);
+
+    // One error code per partition, in request order
+    size_t result_index = 0;
+    response_body->topics_array.reserve(request_body.topics_array.size());
+    for (auto &topics_elem : request_body.topics_array)
+    {
+        OffsetCommitResponseBodyV8::Topic response_topic = {.name_len = topics_elem.name_len,
+                                                            .name = topics_elem.name,
+                                                            .partitions_array_len = 1,
+                                                            .tag_buffer = 0};
+
+        response_topic.partitions_array.reserve(topics_elem.partitions_array.size());
+        for (auto &partitions_elem : topics_elem.partitions_array)
+        {
+            const size_t index = result_index++;
+            OffsetCommitResponseBodyV8::Topic::Partition response_partition = {.partition_index = partitions_elem.partition_index,
+                                                                               .error_code = index < result.error_codes.size() ? result.error_codes[index] : result.error_code,
+                                                                               .tag_buffer = 0};
+
+            response_topic.partitions_array_len += 1;
+            response_topic.partitions_array.push_back(std::move(response_partition));
+        }
+
+        response_size += response_topic.size();
+        response_body->topics_array.push_back(std::move(response_topic));
+    }
+
+    response_body->topics_array_len = response_body->topics_array.size() + 1;
+    response_size += unsignedVarintSize(response_body->topics_array_len);
+
+    response_body->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_body->tag_buffer);
+
+    // Response Header
+
+    response_header->response_corr_id = request_header.request_corr_id;
+    response_size += sizeof(response_header->response_corr_id);
+
+    response_header->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_header->tag_buffer);
+
+    response_header->response_msg_size = response_size;
+
+    return {std::move(response_header), std::move(response_body)};
+}
+
+static OffsetFetchResponseBodyV8::Group::Topic::Partition offsetFetchPartition(int32_t partition_index, const std::optional<CommittedOffset> &committed)
+{
+    OffsetFetchResponseBodyV8::Group::Topic::Partition response_partition = {.partition_index = partition_index,
+                                                                             .committed_offset = -1,
+                                                                             .committed_leader_epoch = -1,
+                                                                             .metadata_len = 1,
+                                                                             .metadata = {},
+                                                                             .error_code = 0,
+                                                                             .tag_buffer = 0};
+    if (committed)
+    {
+        response_partition.committed_offset = committed->offset;
+        response_partition.committed_leader_epoch = committed->leader_epoch;
+        fillCompactString(response_partition.metadata_len, response_partition.metadata, committed->metadata);
+    }
+    return response_partition;
+}
+
+ResponseMessage processOffsetFetch(const RequestHeaderV2 &request_header, const OffsetFetchRequestBodyV8 &request_body)
+{
+    // Response message
+
+    auto response_header = std::make_unique<ResponseHeaderV1>();
+    auto response_body = std::make_unique<OffsetFetchResponseBodyV8>();
+
+    int32_t response_size = 0;
+
+    // Process bottom-up - Response Body -> Response Header
+
+    // Response Body
+
+    response_body->throttle_time = 0;
+    response_size += sizeof(response_body->throttle_time);
+
+    // Read straight from the coordinator's offset store, commits are there once they are in the log
+    GroupCoordinator &coordinator = GroupCoordinator::instance();
+    response_body->groups_array.reserve(request_body.groups_array.size());
+    for (auto &groups_elem : request_body.groups_array)
+    {
+        const std::string_view group_id(groups_elem.group_id.data(), groups_elem.group_id.size());
+        OffsetFetchResponseBodyV8::Group response_group = {.group_id_len = groups_elem.group_id_len,
+                                                           .group_id = groups_elem.group_id,
+                                                           .topics_array_len = 1,
+                                                           .topics_array = {},
+                                                           .error_code = 0,
+                                                           .tag_buffer = 0};
+
+        if (group_id.empty())
+        {
+            response_group.error_code = 24; // INVALID_GROUP_ID
+        }
+        else if (groups_elem.topics_array_len == 0)
+        {
+            // Null topics, every offset the group committed
+            for (auto &topic_offsets : coordinator.committedOffsets(group_id))
+            {
+                OffsetFetchResponseBodyV8::Group::Topic response_topic = {.name_len = 0, .name = {}, .partitions_array_len = 1, .tag_buffer = 0};
+                fillCompactString(response_topic.name_len, response_topic.name, topic_offsets.topic);
+                for (auto &[partition, committed] : topic_offsets.partitions)
+                {
+                    response_topic.partitions_array_len += 1;
+                    response_topic.partitions_array.push_back(offsetFetchPartition(partition, committed));
+                }
+                response_group.topics_array_len += 1;
+                response_group.topics_array.push_back(std::move(response_topic));
+            }
+        }
+        else
+        {
+            for (auto &topics_elem : groups_elem.topics_array)
+            {
+                const std::string_view topic_name(topics_elem.name.data(), topics_elem.name.size());
+                OffsetFetchResponseBodyV8::Group::Topic response_topic = {.name_len = topics_elem.name_len,
+                                                                          .name = topics_elem.name,
+                                                                          .partitions_array_len = 1,
+                                                                          .tag_buffer = 0};
+                for (int32_t partition_index : topics_elem.partition_indexes_array)
+                {
+                    response_topic.partitions_array_len += 1;
+                    response_topic.partitions_array.push_back(offsetFetchPartition(partition_index, coordinator.committedOffset(group_id, topic_name, partition_index)));
+                }
+                response_group.topics_array_len += 1;
+                response_group.topics_array.push_back(std::move(response_topic));
+            }
+        }
+
+        response_size += response_group.size();
+        response_body->groups_array.push_back(std::move(response_group));
+    }
+
+    response_body->groups_array_len = response_body->groups_array.size() + 1;
+    response_size += unsignedVarintSize(response_body->groups_array_len);
+
+    response_body->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_body->tag_buffer);
+
+    // Response Header
+
+    response_header->response_corr_id = request_header.request_corr_id;
+    response_size += sizeof(response_header->response_corr_id);
+
+    response_header->tag_buffer = 0;
+    response_size += unsignedVarintSize(response_header->tag_buffer);
+
+    response_header->response_msg_size = response_size;
+
+    return {std::move(response_header), std::move(response_body)};
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "common.h"
+#include "wire_buffer.h"
+#include "event_loop.h"
 
 // Request Header classes
 class RequestHeader;
@@ -10,6 +12,17 @@ class RequestHeaderV2;
 class RequestBody;
 class APIVersionsRequestBodyV4;
 class DescribeTopicPartitionsRequestBodyV0;
+class MetadataRequestBodyV12;
+class FetchRequestBodyV16;
+class ProduceRequestBodyV11;
+class ListOffsetsRequestBodyV9;
+class FindCoordinatorRequestBodyV4;
+class JoinGroupRequestBodyV9;
+class SyncGroupRequestBodyV5;
+class HeartbeatRequestBodyV4;
+class LeaveGroupRequestBodyV5;
+class OffsetCommitRequestBodyV8;
+class OffsetFetchRequestBodyV8;
 
 // Response Header classes
 class ResponseHeader;
@@ -20,16 +33,42 @@ class ResponseHeaderV1;
 class ResponseBody;
 class APIVersionsResponseBodyV4;
 class DescribeTopicPartitionsResponseBodyV0;
+class MetadataResponseBodyV12;
+class FetchResponseBodyV16;
+class ProduceResponseBodyV11;
+class ListOffsetsResponseBodyV9;
+class FindCoordinatorResponseBodyV4;
+class JoinGroupResponseBodyV9;
+class SyncGroupResponseBodyV5;
+class HeartbeatResponseBodyV4;
+class LeaveGroupResponseBodyV5;
+class OffsetCommitResponseBodyV8;
+class OffsetFetchResponseBodyV8;
+
+class MetadataImage;
+class DelayedOperation;
+struct ProduceAppends;
+struct GroupResult;
 
 using RequestMessage = std::pair<std::unique_ptr<RequestHeader>, std::unique_ptr<RequestBody>>;
 using ResponseMessage = std::pair<std::unique_ptr<ResponseHeader>, std::unique_ptr<ResponseBody>>;
 
+// Fields of the flexible versions. Compact strings and arrays carry their length + 1 as an unsigned varint, 0 is
+// null. Tagged fields received are skipped, none are sent.
+void recvCompactString(WireReader &reader, uint32_t &len, std::vector<char> &str);
+void recvTaggedFields(WireReader &reader, uint32_t &tag_buffer);
+void sendCompactString(WireWriter &writer, uint32_t len, const std::vector<char> &str);
+void sendCompactArray(WireWriter &writer, uint32_t len, const std::vector<int32_t> &arr);
+void sendTaggedFields(WireWriter &writer, uint32_t tag_buffer);
+
 class RequestHeader
 {
 public:
     virtual ~RequestHeader() {}
-    virtual void receive(int client_fd) = 0;
+    virtual void receive(WireReader &reader) = 0;
     virtual int16_t getAPIKey() = 0;
+    virtual int16_t getAPIVersion() = 0;
+    virtual std::string_view getClientId() = 0;
 
 private:
     virtual void convertBEToH() = 0;
@@ -39,8 +78,11 @@ class RequestHeaderV2 : public RequestHeader
 {
 public:
     RequestHeaderV2() = default;
-    void receive(int client_fd) override;
+    // Also reads the non-flexible v1 header (no tagged fields) of ApiVersions v0-v2
+    void receive(WireReader &reader) override;
     int16_t getAPIKey() override;
+    int16_t getAPIVersion() override;
+    std::string_view getClientId() override;
 
 private:
     void convertBEToH() override;
@@ -51,17 +93,29 @@ private:
     int32_t request_corr_id;
     int16_t client_id_len;
     std::vector<char> client_id_contents; // Kafka Nullable string (N)
-    int8_t tag_buffer;
+    uint32_t tag_buffer; // Kafka Tagged fields
 
     friend ResponseMessage processAPIVersions(const RequestHeaderV2 &request_header, const APIVersionsRequestBodyV4 &request_body);
     friend ResponseMessage processDescribeTopicPartitions(const RequestHeaderV2 &request_header, const DescribeTopicPartitionsRequestBodyV0 &request_body);
+    friend ResponseMessage processMetadata(const RequestHeaderV2 &request_header, const MetadataRequestBodyV12 &request_body);
+    friend ResponseMessage processFetch(const RequestHeaderV2 &request_header, const FetchRequestBodyV16 &request_body);
+    friend ResponseMessage processProduce(const RequestHeaderV2 &request_header, const ProduceRequestBodyV11 &request_body, const ProduceAppends &appends);
+    friend ResponseMessage processListOffsets(const RequestHeaderV2 &request_header, const ListOffsetsRequestBodyV9 &request_body);
+    friend ResponseMessage processFindCoordinator(const RequestHeaderV2 &request_header, const FindCoordinatorRequestBodyV4 &request_body);
+    friend ResponseMessage processJoinGroup(const RequestHeaderV2 &request_header, const GroupResult &result);
+    friend ResponseMessage processSyncGroup(const RequestHeaderV2 &request_header, const GroupResult &result);
+    friend ResponseMessage processHeartbeat(const RequestHeaderV2 &request_header, const GroupResult &result);
+    friend ResponseMessage processLeaveGroup(const RequestHeaderV2 &request_header, const LeaveGroupRequestBodyV5 &request_body, const GroupResult &result);
+    friend ResponseMessage processOffsetCommit(const RequestHeaderV2 &request_header, const OffsetCommitRequestBodyV8 &request_body, const GroupResult &result);
+    friend ResponseMessage processOffsetFetch(const RequestHeaderV2 &request_header, const OffsetFetchRequestBodyV8 &request_body);
+    friend std::shared_ptr<DelayedOperation> delayJoinGroup(const RequestHeaderV2 &request_header, const JoinGroupRequestBodyV9 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete);
 };
 
 class RequestBody
 {
 public:
     virtual ~RequestBody() {}
-    virtual void receive(int client_fd) = 0;
+    virtual void receive(WireReader &reader) = 0;
 
 private:
     virtual void convertBEToH() = 0;
@@ -70,17 +124,22 @@ private:
 class APIVersionsRequestBodyV4 : public RequestBody
 {
 public:
-    APIVersionsRequestBodyV4() = default;
-    void receive(int client_fd) override;
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 3;
+    static constexpr int16_t MAX_VERSION = 4;
+
+    explicit APIVersionsRequestBodyV4(int16_t api_version_) : api_version(api_version_) {}
+    // v0-v2 have no fields, a version past MAX_VERSION is skipped unread so it can still be answered
+    void receive(WireReader &reader) override;
 
 private:
     void convertBEToH() override;
 
-    int8_t client_id_len;
+    int16_t api_version;
+    uint32_t client_id_len = 0;
     std::vector<char> client_id_contents; // Kafka Compact string (N+1)
-    int8_t client_software_version_len;
+    uint32_t client_software_version_len = 0;
     std::vector<char> client_software_version_contents; // Kafka Compact string (N+1)
-    int8_t tag_buffer;
+    uint32_t tag_buffer = 0; // Kafka Tagged fields
 
     friend ResponseMessage processAPIVersions(const RequestHeaderV2 &request_header, const APIVersionsRequestBodyV4 &request_body);
 };
@@ -89,33 +148,433 @@ class DescribeTopicPartitionsRequestBodyV0 : public RequestBody
 {
 public:
     DescribeTopicPartitionsRequestBodyV0() = default;
-    void receive(int client_fd) override;
+    void receive(WireReader &reader) override;
 
 public:
     struct Topic
     {
-        int8_t topic_name_len;
+        uint32_t topic_name_len;
+        std::vector<char> topic_name; // Kafka Compact string (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+    };
+
+    struct Cursor
+    {
+        uint32_t topic_name_len;
         std::vector<char> topic_name; // Kafka Compact string (N+1)
-        int8_t tag_buffer;
+        int32_t partition_index;
+        uint32_t tag_buffer; // Kafka Tagged fields
     };
 
 private:
     void convertBEToH() override;
 
-    int8_t topics_array_len;
+    uint32_t topics_array_len;
     std::vector<Topic> topics_array; // Kafka Compact arry (N+1)
     int32_t response_part_limit;
-    int8_t cursor;
-    int8_t tag_buffer;
+    int8_t cursor_present; // Kafka Nullable struct marker (-1 is null)
+    Cursor cursor;
+    uint32_t tag_buffer; // Kafka Tagged fields
 
     friend ResponseMessage processDescribeTopicPartitions(const RequestHeaderV2 &request_header, const DescribeTopicPartitionsRequestBodyV0 &request_body);
 };
 
+class MetadataRequestBodyV12 : public RequestBody
+{
+public:
+    MetadataRequestBodyV12() = default;
+    void receive(WireReader &reader) override;
+
+public:
+    struct Topic
+    {
+        UUID topic_id;
+        uint32_t topic_name_len;
+        std::vector<char> topic_name; // Kafka Compact nullable string (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+    };
+
+private:
+    void convertBEToH() override;
+
+    uint32_t topics_array_len;
+    std::vector<Topic> topics_array; // Kafka Compact nullable arry (N+1), null means all topics
+    int8_t allow_auto_topic_creation;
+    int8_t include_topic_authorized_ops;
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processMetadata(const RequestHeaderV2 &request_header, const MetadataRequestBodyV12 &request_body);
+};
+
+class FetchRequestBodyV16 : public RequestBody
+{
+public:
+    FetchRequestBodyV16() = default;
+    void receive(WireReader &reader) override;
+
+public:
+    struct Topic
+    {
+        struct Partition
+        {
+            int32_t partition;
+            int32_t current_leader_epoch;
+            int64_t fetch_offset;
+            int32_t last_fetched_epoch;
+            int64_t log_start_offset;
+            int32_t partition_max_bytes;
+            uint32_t tag_buffer; // Kafka Tagged fields
+        };
+
+        UUID topic_id;
+        uint32_t partitions_array_len;
+        std::vector<Partition> partitions_array; // Kafka Compact arry (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+    };
+
+    struct ForgottenTopic
+    {
+        UUID topic_id;
+        uint32_t partitions_array_len;
+        std::vector<int32_t> partitions_array; // Kafka Compact arry (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+    };
+
+private:
+    void convertBEToH() override;
+
+    int32_t max_wait_ms;
+    int32_t min_bytes;
+    int32_t max_bytes;
+    int8_t isolation_level;
+    int32_t session_id;
+    int32_t session_epoch;
+    uint32_t topics_array_len;
+    std::vector<Topic> topics_array; // Kafka Compact arry (N+1)
+    uint32_t forgotten_topics_array_len;
+    std::vector<ForgottenTopic> forgotten_topics_array; // Kafka Compact arry (N+1)
+    uint32_t rack_id_len;
+    std::vector<char> rack_id; // Kafka Compact string (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processFetch(const RequestHeaderV2 &request_header, const FetchRequestBodyV16 &request_body);
+    friend bool isFetchSatisfied(const FetchRequestBodyV16 &request_body);
+    friend std::shared_ptr<DelayedOperation> delayFetch(const FetchRequestBodyV16 &request_body, EventLoop &loop, std::function<void()> on_complete);
+};
+
+class ProduceRequestBodyV11 : public RequestBody
+{
+public:
+    ProduceRequestBodyV11() = default;
+    void receive(WireReader &reader) override;
+
+public:
+    struct Topic
+    {
+        struct Partition
+        {
+            int32_t index;
+            uint32_t records_len;
+            std::vector<char> records; // Kafka Compact nullable bytes (N+1)
+            uint32_t tag_buffer; // Kafka Tagged fields
+        };
+
+        uint32_t name_len;
+        std::vector<char> name; // Kafka Compact string (N+1)
+        uint32_t partitions_array_len;
+        std::vector<Partition> partitions_array; // Kafka Compact arry (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+    };
+
+private:
+    void convertBEToH() override;
+
+    uint32_t transactional_id_len;
+    std::vector<char> transactional_id; // Kafka Compact nullable string (N+1)
+    int16_t acks;
+    int32_t timeout_ms;
+    uint32_t topics_array_len;
+    std::vector<Topic> topics_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processProduce(const RequestHeaderV2 &request_header, const ProduceRequestBodyV11 &request_body, const ProduceAppends &appends);
+    friend std::shared_ptr<DelayedOperation> appendProduce(const ProduceRequestBodyV11 &request_body, std::shared_ptr<ProduceAppends> appends, std::function<void()> on_complete);
+};
+
+// Versions 6 to 9 share this layout, later ones only add special timestamps
+class ListOffsetsRequestBodyV9 : public RequestBody
+{
+public:
+    ListOffsetsRequestBodyV9() = default;
+    void receive(WireReader &reader) override;
+
+public:
+    struct Topic
+    {
+        struct Partition
+        {
+            int32_t partition_index;
+            int32_t current_leader_epoch;
+            int64_t timestamp;
+            uint32_t tag_buffer; // Kafka Tagged fields
+        };
+
+        uint32_t name_len;
+        std::vector<char> name; // Kafka Compact string (N+1)
+        uint32_t partitions_array_len;
+        std::vector<Partition> partitions_array; // Kafka Compact arry (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+    };
+
+private:
+    void convertBEToH() override;
+
+    int32_t replica_id;
+    int8_t isolation_level;
+    uint32_t topics_array_len;
+    std::vector<Topic> topics_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processListOffsets(const RequestHeaderV2 &request_header, const ListOffsetsRequestBodyV9 &request_body);
+};
+
+class FindCoordinatorRequestBodyV4 : public RequestBody
+{
+public:
+    FindCoordinatorRequestBodyV4() = default;
+    void receive(WireReader &reader) override;
+
+public:
+    struct CoordinatorKey
+    {
+        uint32_t key_len;
+        std::vector<char> key; // Kafka Compact string (N+1)
+    };
+
+private:
+    void convertBEToH() override;
+
+    int8_t key_type; // 0 group, 1 transaction
+    uint32_t coordinator_keys_array_len;
+    std::vector<CoordinatorKey> coordinator_keys_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processFindCoordinator(const RequestHeaderV2 &request_header, const FindCoordinatorRequestBodyV4 &request_body);
+};
+
+class JoinGroupRequestBodyV9 : public RequestBody
+{
+public:
+    JoinGroupRequestBodyV9() = default;
+    void receive(WireReader &reader) override;
+
+public:
+    struct Protocol
+    {
+        uint32_t name_len;
+        std::vector<char> name; // Kafka Compact string (N+1)
+        uint32_t metadata_len;
+        std::vector<char> metadata; // Kafka Compact bytes (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+    };
+
+private:
+    void convertBEToH() override;
+
+    uint32_t group_id_len;
+    std::vector<char> group_id; // Kafka Compact string (N+1)
+    int32_t session_timeout_ms;
+    int32_t rebalance_timeout_ms;
+    uint32_t member_id_len;
+    std::vector<char> member_id; // Kafka Compact string (N+1)
+    uint32_t group_instance_id_len;
+    std::vector<char> group_instance_id; // Kafka Compact nullable string (N+1)
+    uint32_t protocol_type_len;
+    std::vector<char> protocol_type; // Kafka Compact string (N+1)
+    uint32_t protocols_array_len;
+    std::vector<Protocol> protocols_array; // Kafka Compact arry (N+1)
+    uint32_t reason_len;
+    std::vector<char> reason; // Kafka Compact nullable string (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend std::shared_ptr<DelayedOperation> delayJoinGroup(const RequestHeaderV2 &request_header, const JoinGroupRequestBodyV9 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete);
+};
+
+class SyncGroupRequestBodyV5 : public RequestBody
+{
+public:
+    SyncGroupRequestBodyV5() = default;
+    void receive(WireReader &reader) override;
+
+public:
+    struct Assignment
+    {
+        uint32_t member_id_len;
+        std::vector<char> member_id; // Kafka Compact string (N+1)
+        uint32_t assignment_len;
+        std::vector<char> assignment; // Kafka Compact bytes (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+    };
+
+private:
+    void convertBEToH() override;
+
+    uint32_t group_id_len;
+    std::vector<char> group_id; // Kafka Compact string (N+1)
+    int32_t generation_id;
+    uint32_t member_id_len;
+    std::vector<char> member_id; // Kafka Compact string (N+1)
+    uint32_t group_instance_id_len;
+    std::vector<char> group_instance_id; // Kafka Compact nullable string (N+1)
+    uint32_t protocol_type_len;
+    std::vector<char> protocol_type; // Kafka Compact nullable string (N+1)
+    uint32_t protocol_name_len;
+    std::vector<char> protocol_name; // Kafka Compact nullable string (N+1)
+    uint32_t assignments_array_len;
+    std::vector<Assignment> assignments_array; // Kafka Compact arry (N+1), only the leader's has assignments
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend std::shared_ptr<DelayedOperation> delaySyncGroup(const SyncGroupRequestBodyV5 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete);
+};
+
+class HeartbeatRequestBodyV4 : public RequestBody
+{
+public:
+    HeartbeatRequestBodyV4() = default;
+    void receive(WireReader &reader) override;
+
+private:
+    void convertBEToH() override;
+
+    uint32_t group_id_len;
+    std::vector<char> group_id; // Kafka Compact string (N+1)
+    int32_t generation_id;
+    uint32_t member_id_len;
+    std::vector<char> member_id; // Kafka Compact string (N+1)
+    uint32_t group_instance_id_len;
+    std::vector<char> group_instance_id; // Kafka Compact nullable string (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend std::shared_ptr<DelayedOperation> delayHeartbeat(const HeartbeatRequestBodyV4 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete);
+};
+
+class LeaveGroupRequestBodyV5 : public RequestBody
+{
+public:
+    LeaveGroupRequestBodyV5() = default;
+    void receive(WireReader &reader) override;
+
+public:
+    struct Member
+    {
+        uint32_t member_id_len;
+        std::vector<char> member_id; // Kafka Compact string (N+1)
+        uint32_t group_instance_id_len;
+        std::vector<char> group_instance_id; // Kafka Compact nullable string (N+1)
+        uint32_t reason_len;
+        std::vector<char> reason; // Kafka Compact nullable string (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+    };
+
+private:
+    void convertBEToH() override;
+
+    uint32_t group_id_len;
+    std::vector<char> group_id; // Kafka Compact string (N+1)
+    uint32_t members_array_len;
+    std::vector<Member> members_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processLeaveGroup(const RequestHeaderV2 &request_header, const LeaveGroupRequestBodyV5 &request_body, const GroupResult &result);
+    friend std::shared_ptr<DelayedOperation> delayLeaveGroup(const LeaveGroupRequestBodyV5 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete);
+};
+
+class OffsetCommitRequestBodyV8 : public RequestBody
+{
+public:
+    OffsetCommitRequestBodyV8() = default;
+    void receive(WireReader &reader) override;
+
+public:
+    struct Topic
+    {
+        struct Partition
+        {
+            int32_t partition_index;
+            int64_t committed_offset;
+            int32_t committed_leader_epoch;
+            uint32_t committed_metadata_len;
+            std::vector<char> committed_metadata; // Kafka Compact nullable string (N+1)
+            uint32_t tag_buffer; // Kafka Tagged fields
+        };
+
+        uint32_t name_len;
+        std::vector<char> name; // Kafka Compact string (N+1)
+        uint32_t partitions_array_len;
+        std::vector<Partition> partitions_array; // Kafka Compact arry (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+    };
+
+private:
+    void convertBEToH() override;
+
+    uint32_t group_id_len;
+    std::vector<char> group_id; // Kafka Compact string (N+1)
+    int32_t generation_id_or_member_epoch;
+    uint32_t member_id_len;
+    std::vector<char> member_id; // Kafka Compact string (N+1)
+    uint32_t group_instance_id_len;
+    std::vector<char> group_instance_id; // Kafka Compact nullable string (N+1)
+    uint32_t topics_array_len;
+    std::vector<Topic> topics_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processOffsetCommit(const RequestHeaderV2 &request_header, const OffsetCommitRequestBodyV8 &request_body, const GroupResult &result);
+    friend std::shared_ptr<DelayedOperation> delayOffsetCommit(const OffsetCommitRequestBodyV8 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete);
+};
+
+class OffsetFetchRequestBodyV8 : public RequestBody
+{
+public:
+    OffsetFetchRequestBodyV8() = default;
+    void receive(WireReader &reader) override;
+
+public:
+    struct Group
+    {
+        struct Topic
+        {
+            uint32_t name_len;
+            std::vector<char> name; // Kafka Compact string (N+1)
+            uint32_t partition_indexes_array_len;
+            std::vector<int32_t> partition_indexes_array; // Kafka Compact arry (N+1)
+            uint32_t tag_buffer; // Kafka Tagged fields
+        };
+
+        uint32_t group_id_len;
+        std::vector<char> group_id; // Kafka Compact string (N+1)
+        uint32_t topics_array_len;
+        std::vector<Topic> topics_array; // Kafka Compact nullable arry (N+1), null fetches every committed offset
+        uint32_t tag_buffer; // Kafka Tagged fields
+    };
+
+private:
+    void convertBEToH() override;
+
+    uint32_t groups_array_len;
+    std::vector<Group> groups_array; // Kafka Compact arry (N+1)
+    int8_t require_stable;
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processOffsetFetch(const RequestHeaderV2 &request_header, const OffsetFetchRequestBodyV8 &request_body);
+};
+
 class ResponseHeader
 {
 public:
     virtual ~ResponseHeader() {}
-    virtual void respond(int client_fd) = 0;
+    virtual void respond(WireWriter &writer) = 0;
+    virtual int32_t getMessageSize() = 0;
 
 private:
     virtual void convertHToBE() = 0;
@@ -125,7 +584,8 @@ class ResponseHeaderV0 : public ResponseHeader
 {
 public:
     ResponseHeaderV0() = default;
-    void respond(int client_fd) override;
+    void respond(WireWriter &writer) override;
+    int32_t getMessageSize() override { return response_msg_size; }
 
 private:
     void convertHToBE() override;
@@ -140,23 +600,39 @@ class ResponseHeaderV1 : public ResponseHeader
 {
 public:
     ResponseHeaderV1() = default;
-    void respond(int client_fd) override;
+    void respond(WireWriter &writer) override;
+    int32_t getMessageSize() override { return response_msg_size; }
 
 private:
     void convertHToBE() override;
 
     int32_t response_msg_size;
     int32_t response_corr_id;
-    int8_t tag_buffer;
+    uint32_t tag_buffer; // Kafka Tagged fields
 
     friend ResponseMessage processDescribeTopicPartitions(const RequestHeaderV2 &request_header, const DescribeTopicPartitionsRequestBodyV0 &request_body);
+    friend ResponseMessage processMetadata(const RequestHeaderV2 &request_header, const MetadataRequestBodyV12 &request_body);
+    friend ResponseMessage processFetch(const RequestHeaderV2 &request_header, const FetchRequestBodyV16 &request_body);
+    friend ResponseMessage processProduce(const RequestHeaderV2 &request_header, const ProduceRequestBodyV11 &request_body, const ProduceAppends &appends);
+    friend ResponseMessage processListOffsets(const RequestHeaderV2 &request_header, const ListOffsetsRequestBodyV9 &request_body);
+    friend ResponseMessage processFindCoordinator(const RequestHeaderV2 &request_header, const FindCoordinatorRequestBodyV4 &request_body);
+    friend ResponseMessage processJoinGroup(const RequestHeaderV2 &request_header, const GroupResult &result);
+    friend ResponseMessage processSyncGroup(const RequestHeaderV2 &request_header, const GroupResult &result);
+    friend ResponseMessage processHeartbeat(const RequestHeaderV2 &request_header, const GroupResult &result);
+    friend ResponseMessage processLeaveGroup(const RequestHeaderV2 &request_header, const LeaveGroupRequestBodyV5 &request_body, const GroupResult &result);
+    friend ResponseMessage processOffsetCommit(const RequestHeaderV2 &request_header, const OffsetCommitRequestBodyV8 &request_body, const GroupResult &result);
+    friend ResponseMessage processOffsetFetch(const RequestHeaderV2 &request_header, const OffsetFetchRequestBodyV8 &request_body);
 };
 
 class ResponseBody
 {
 public:
     virtual ~ResponseBody() {}
-    virtual void respond(int client_fd) = 0;
+    virtual void respond(WireWriter &writer) = 0;
+    void setThrottleTime(int32_t throttle_time_ms) { throttle_time = throttle_time_ms; }
+
+protected:
+    int32_t throttle_time = 0; // Every response has one, filled in by the connection's quota check
 
 private:
     virtual void convertHToBE() = 0;
@@ -166,7 +642,7 @@ class APIVersionsResponseBodyV4 : public ResponseBody
 {
 public:
     APIVersionsResponseBodyV4() = default;
-    void respond(int client_fd) override;
+    void respond(WireWriter &writer) override;
 
 public:
     struct APIVersion
@@ -174,19 +650,19 @@ public:
         int16_t api_key;
         int16_t api_min_ver;
         int16_t api_max_ver;
-        int8_t tag_buffer;
+        uint32_t tag_buffer; // Kafka Tagged fields
 
-        static constexpr size_t size() { return sizeof(api_key) + sizeof(api_min_ver) + sizeof(api_max_ver) + sizeof(tag_buffer); }
+        size_t size() const { return sizeof(api_key) + sizeof(api_min_ver) + sizeof(api_max_ver) + unsignedVarintSize(tag_buffer); }
     };
 
 private:
     void convertHToBE() override;
 
+    int16_t api_version; // v0-v2 are encoded without compact arrays and tagged fields, v0 without throttle_time
     int16_t error_code;
-    int8_t api_versions_array_len;
-    std::vector<APIVersion> api_versions_array; // Kafka Compact arry (N+1)
-    int32_t throttle_time;
-    int8_t tag_buffer;
+    uint32_t api_versions_array_len;
+    std::vector<APIVersion> api_versions_array; // Kafka Compact arry (N+1), Kafka Array (N) before v3
+    uint32_t tag_buffer; // Kafka Tagged fields
 
     friend ResponseMessage processAPIVersions(const RequestHeaderV2 &request_header, const APIVersionsRequestBodyV4 &request_body);
 };
@@ -195,7 +671,7 @@ class DescribeTopicPartitionsResponseBodyV0 : public ResponseBody
 {
 public:
     DescribeTopicPartitionsResponseBodyV0() = default;
-    void respond(int client_fd) override;
+    void respond(WireWriter &writer) override;
 
 public:
     struct Topic
@@ -206,58 +682,565 @@ public:
             int32_t partition_index;
             int32_t leader_id;
             int32_t leader_epoch;
-            int8_t replica_nodes_array_len;
+            uint32_t replica_nodes_array_len;
             std::vector<int32_t> replica_nodes_array; // Kafka Compact arry (N+1)
-            int8_t isr_nodes_array_len;
+            uint32_t isr_nodes_array_len;
             std::vector<int32_t> isr_nodes_array; // Kafka Compact arry (N+1)
-            int8_t elr_nodes_array_len;
+            uint32_t elr_nodes_array_len;
             std::vector<int32_t> elr_nodes_array; // Kafka Compact arry (N+1)
-            int8_t last_known_elr_nodes_array_len;
+            uint32_t last_known_elr_nodes_array_len;
             std::vector<int32_t> last_known_elr_nodes_array; // Kafka Compact arry (N+1)
-            int8_t offline_replica_nodes_array_len;
+            uint32_t offline_replica_nodes_array_len;
             std::vector<int32_t> offline_replica_nodes_array; // Kafka Compact arry (N+1)
-            int8_t tag_buffer;
+            uint32_t tag_buffer; // Kafka Tagged fields
 
             size_t size() const { return sizeof(error_code) + sizeof(partition_index) + sizeof(leader_id) + sizeof(leader_epoch) +
-                                         sizeof(replica_nodes_array_len) + replica_nodes_array.size() * sizeof(int32_t) +
-                                         sizeof(isr_nodes_array_len) + isr_nodes_array.size() * sizeof(int32_t) +
-                                         sizeof(elr_nodes_array_len) + elr_nodes_array.size() * sizeof(int32_t) +
-                                         sizeof(last_known_elr_nodes_array_len) + last_known_elr_nodes_array.size() * sizeof(int32_t) +
-                                         sizeof(offline_replica_nodes_array_len) + offline_replica_nodes_array.size() * sizeof(int32_t) +
-                                         sizeof(tag_buffer); }
+                                         unsignedVarintSize(replica_nodes_array_len) + replica_nodes_array.size() * sizeof(int32_t) +
+                                         unsignedVarintSize(isr_nodes_array_len) + isr_nodes_array.size() * sizeof(int32_t) +
+                                         unsignedVarintSize(elr_nodes_array_len) + elr_nodes_array.size() * sizeof(int32_t) +
+                                         unsignedVarintSize(last_known_elr_nodes_array_len) + last_known_elr_nodes_array.size() * sizeof(int32_t) +
+                                         unsignedVarintSize(offline_replica_nodes_array_len) + offline_replica_nodes_array.size() * sizeof(int32_t) +
+                                         unsignedVarintSize(tag_buffer); }
         };
 
         int16_t error_code;
-        int8_t topic_name_len;
+        uint32_t topic_name_len;
         std::vector<char> topic_name; // Kafka Compact string (N+1)
         UUID topic_id;
         int8_t is_internal;
-        int8_t partitions_array_len;
+        uint32_t partitions_array_len;
         std::vector<Partition> partitions_array; // Kafka Compact arry (N+1)
         int32_t topic_authorized_ops;
-        int8_t tag_buffer;
+        uint32_t tag_buffer; // Kafka Tagged fields
 
         size_t size() const
         {
-            return sizeof(error_code) + sizeof(topic_name_len) + topic_name.size() +
-                   sizeof(topic_id) + sizeof(is_internal) + sizeof(partitions_array_len) +
-                   std::accumulate(partitions_array.begin(), partitions_array.end(), 0, [](size_t sum, const Partition &p)
+            return sizeof(error_code) + unsignedVarintSize(topic_name_len) + topic_name.size() +
+                   sizeof(topic_id) + sizeof(is_internal) + unsignedVarintSize(partitions_array_len) +
+                   std::accumulate(partitions_array.begin(), partitions_array.end(), size_t(0), [](size_t sum, const Partition &p)
                                    { return sum + p.size(); }) +
-                   sizeof(topic_authorized_ops) + sizeof(tag_buffer);
+                   sizeof(topic_authorized_ops) + unsignedVarintSize(tag_buffer);
         }
     };
 
+    struct Cursor
+    {
+        uint32_t topic_name_len;
+        std::vector<char> topic_name; // Kafka Compact string (N+1)
+        int32_t partition_index;
+        uint32_t tag_buffer; // Kafka Tagged fields
+
+        size_t size() const { return unsignedVarintSize(topic_name_len) + topic_name.size() + sizeof(partition_index) + unsignedVarintSize(tag_buffer); }
+    };
+
 private:
     void convertHToBE() override;
 
-    int32_t throttle_time;
-    int8_t topics_array_len;
+    uint32_t topics_array_len;
     std::vector<Topic> topics_array; // Kafka Compact arry (N+1)
-    int8_t next_cursor;
-    int8_t tag_buffer;
+    int8_t next_cursor_present; // Kafka Nullable struct marker (-1 is null)
+    Cursor next_cursor;
+    uint32_t tag_buffer; // Kafka Tagged fields
 
     friend ResponseMessage processDescribeTopicPartitions(const RequestHeaderV2 &request_header, const DescribeTopicPartitionsRequestBodyV0 &request_body);
 };
 
+class MetadataResponseBodyV12 : public ResponseBody
+{
+public:
+    MetadataResponseBodyV12() = default;
+    void respond(WireWriter &writer) override;
+
+public:
+    struct Broker
+    {
+        int32_t node_id;
+        uint32_t host_len;
+        std::vector<char> host; // Kafka Compact string (N+1)
+        int32_t port;
+        uint32_t rack_len;
+        std::vector<char> rack; // Kafka Compact nullable string (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+
+        size_t size() const { return sizeof(node_id) + unsignedVarintSize(host_len) + host.size() + sizeof(port) +
+                                     unsignedVarintSize(rack_len) + rack.size() + unsignedVarintSize(tag_buffer); }
+    };
+
+    struct Topic
+    {
+        const WireWriter *fragment; // Encoded error_code .. partitions, shared by every response built from the same metadata image
+        int32_t topic_authorized_ops;
+        uint32_t tag_buffer; // Kafka Tagged fields
+
+        size_t size() const { return fragment->size() + sizeof(topic_authorized_ops) + unsignedVarintSize(tag_buffer); }
+    };
+
+private:
+    void convertHToBE() override;
+
+    uint32_t brokers_array_len;
+    std::vector<Broker> brokers_array; // Kafka Compact arry (N+1)
+    uint32_t cluster_id_len;
+    std::vector<char> cluster_id; // Kafka Compact nullable string (N+1)
+    int32_t controller_id;
+    uint32_t topics_array_len;
+    std::vector<Topic> topics_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    std::shared_ptr<const MetadataImage> metadata_image; // Keeps the cached topic fragments alive
+    std::deque<WireWriter> unknown_topic_fragments;
+
+    friend ResponseMessage processMetadata(const RequestHeaderV2 &request_header, const MetadataRequestBodyV12 &request_body);
+};
+
+class FetchResponseBodyV16 : public ResponseBody
+{
+public:
+    FetchResponseBodyV16() = default;
+    void respond(WireWriter &writer) override;
+
+public:
+    struct Topic
+    {
+        struct Partition
+        {
+            int32_t partition_index;
+            int16_t error_code;
+            int64_t high_watermark;
+            int64_t last_stable_offset;
+            int64_t log_start_offset;
+            uint32_t aborted_transactions_array_len; // Kafka Compact nullable arry (N+1), always empty
+            int32_t preferred_read_replica;
+            uint32_t records_len;
+            std::vector<char> records; // Kafka Compact nullable bytes (N+1)
+            uint32_t tag_buffer; // Kafka Tagged fields
+
+            size_t size() const { return sizeof(partition_index) + sizeof(error_code) + sizeof(high_watermark) + sizeof(last_stable_offset) +
+                                         sizeof(log_start_offset) + unsignedVarintSize(aborted_transactions_array_len) + sizeof(preferred_read_replica) +
+                                         unsignedVarintSize(records_len) + records.size() + unsignedVarintSize(tag_buffer); }
+        };
+
+        UUID topic_id;
+        uint32_t partitions_array_len;
+        std::vector<Partition> partitions_array; // Kafka Compact arry (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+
+        size_t size() const
+        {
+            return sizeof(topic_id) + unsignedVarintSize(partitions_array_len) +
+                   std::accumulate(partitions_array.begin(), partitions_array.end(), size_t(0), [](size_t sum, const Partition &p)
+                                   { return sum + p.size(); }) +
+                   unsignedVarintSize(tag_buffer);
+        }
+    };
+
+private:
+    void convertHToBE() override;
+
+    int16_t error_code;
+    int32_t session_id;
+    uint32_t topics_array_len;
+    std::vector<Topic> topics_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processFetch(const RequestHeaderV2 &request_header, const FetchRequestBodyV16 &request_body);
+};
+
+class ProduceResponseBodyV11 : public ResponseBody
+{
+public:
+    ProduceResponseBodyV11() = default;
+    void respond(WireWriter &writer) override;
+
+public:
+    struct Topic
+    {
+        struct Partition
+        {
+            int32_t index;
+            int16_t error_code;
+            int64_t base_offset;
+            int64_t log_append_time;
+            int64_t log_start_offset;
+            uint32_t record_errors_array_len; // Kafka Compact arry (N+1), always empty
+            uint32_t error_message_len;
+            std::vector<char> error_message; // Kafka Compact nullable string (N+1)
+            uint32_t tag_buffer; // Kafka Tagged fields
+
+            size_t size() const { return sizeof(index) + sizeof(error_code) + sizeof(base_offset) + sizeof(log_append_time) + sizeof(log_start_offset) +
+                                         unsignedVarintSize(record_errors_array_len) + unsignedVarintSize(error_message_len) + error_message.size() +
+                                         unsignedVarintSize(tag_buffer); }
+        };
+
+        uint32_t name_len;
+        std::vector<char> name; // Kafka Compact string (N+1)
+        uint32_t partitions_array_len;
+        std::vector<Partition> partitions_array; // Kafka Compact arry (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+
+        size_t size() const
+        {
+            return unsignedVarintSize(name_len) + name.size() + unsignedVarintSize(partitions_array_len) +
+                   std::accumulate(partitions_array.begin(), partitions_array.end(), size_t(0), [](size_t sum, const Partition &p)
+                                   { return sum + p.size(); }) +
+                   unsignedVarintSize(tag_buffer);
+        }
+    };
+
+private:
+    void convertHToBE() override;
+
+    uint32_t topics_array_len;
+    std::vector<Topic> topics_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processProduce(const RequestHeaderV2 &request_header, const ProduceRequestBodyV11 &request_body, const ProduceAppends &appends);
+};
+
+class ListOffsetsResponseBodyV9 : public ResponseBody
+{
+public:
+    ListOffsetsResponseBodyV9() = default;
+    void respond(WireWriter &writer) override;
+
+public:
+    struct Topic
+    {
+        struct Partition
+        {
+            int32_t partition_index;
+            int16_t error_code;
+            int64_t timestamp;
+            int64_t offset;
+            int32_t leader_epoch;
+            uint32_t tag_buffer; // Kafka Tagged fields
+
+            size_t size() const { return sizeof(partition_index) + sizeof(error_code) + sizeof(timestamp) + sizeof(offset) + sizeof(leader_epoch) +
+                                         unsignedVarintSize(tag_buffer); }
+        };
+
+        uint32_t name_len;
+        std::vector<char> name; // Kafka Compact string (N+1)
+        uint32_t partitions_array_len;
+        std::vector<Partition> partitions_array; // Kafka Compact arry (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+
+        size_t size() const
+        {
+            return unsignedVarintSize(name_len) + name.size() + unsignedVarintSize(partitions_array_len) +
+                   std::accumulate(partitions_array.begin(), partitions_array.end(), size_t(0), [](size_t sum, const Partition &p)
+                                   { return sum + p.size(); }) +
+                   unsignedVarintSize(tag_buffer);
+        }
+    };
+
+private:
+    void convertHToBE() override;
+
+    uint32_t topics_array_len;
+    std::vector<Topic> topics_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processListOffsets(const RequestHeaderV2 &request_header, const ListOffsetsRequestBodyV9 &request_body);
+};
+
+class FindCoordinatorResponseBodyV4 : public ResponseBody
+{
+public:
+    FindCoordinatorResponseBodyV4() = default;
+    void respond(WireWriter &writer) override;
+
+public:
+    struct Coordinator
+    {
+        uint32_t key_len;
+        std::vector<char> key; // Kafka Compact string (N+1)
+        int32_t node_id;
+        uint32_t host_len;
+        std::vector<char> host; // Kafka Compact string (N+1)
+        int32_t port;
+        int16_t error_code;
+        uint32_t error_message_len;
+        std::vector<char> error_message; // Kafka Compact nullable string (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+
+        size_t size() const { return unsignedVarintSize(key_len) + key.size() + sizeof(node_id) + unsignedVarintSize(host_len) + host.size() + sizeof(port) +
+                                     sizeof(error_code) + unsignedVarintSize(error_message_len) + error_message.size() + unsignedVarintSize(tag_buffer); }
+    };
+
+private:
+    void convertHToBE() override;
+
+    uint32_t coordinators_array_len;
+    std::vector<Coordinator> coordinators_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processFindCoordinator(const RequestHeaderV2 &request_header, const FindCoordinatorRequestBodyV4 &request_body);
+};
+
+class JoinGroupResponseBodyV9 : public ResponseBody
+{
+public:
+    JoinGroupResponseBodyV9() = default;
+    void respond(WireWriter &writer) override;
+
+public:
+    struct Member
+    {
+        uint32_t member_id_len;
+        std::vector<char> member_id; // Kafka Compact string (N+1)
+        uint32_t group_instance_id_len;
+        std::vector<char> group_instance_id; // Kafka Compact nullable string (N+1)
+        uint32_t metadata_len;
+        std::vector<char> metadata; // Kafka Compact bytes (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+
+        size_t size() const { return unsignedVarintSize(member_id_len) + member_id.size() + unsignedVarintSize(group_instance_id_len) + group_instance_id.size() +
+                                     unsignedVarintSize(metadata_len) + metadata.size() + unsignedVarintSize(tag_buffer); }
+    };
+
+private:
+    void convertHToBE() override;
+
+    int16_t error_code;
+    int32_t generation_id;
+    uint32_t protocol_type_len;
+    std::vector<char> protocol_type; // Kafka Compact nullable string (N+1)
+    uint32_t protocol_name_len;
+    std::vector<char> protocol_name; // Kafka Compact nullable string (N+1)
+    uint32_t leader_len;
+    std::vector<char> leader; // Kafka Compact string (N+1)
+    int8_t skip_assignment;
+    uint32_t member_id_len;
+    std::vector<char> member_id; // Kafka Compact string (N+1)
+    uint32_t members_array_len;
+    std::vector<Member> members_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processJoinGroup(const RequestHeaderV2 &request_header, const GroupResult &result);
+};
+
+class SyncGroupResponseBodyV5 : public ResponseBody
+{
+public:
+    SyncGroupResponseBodyV5() = default;
+    void respond(WireWriter &writer) override;
+
+private:
+    void convertHToBE() override;
+
+    int16_t error_code;
+    uint32_t protocol_type_len;
+    std::vector<char> protocol_type; // Kafka Compact nullable string (N+1)
+    uint32_t protocol_name_len;
+    std::vector<char> protocol_name; // Kafka Compact nullable string (N+1)
+    uint32_t assignment_len;
+    std::vector<char> assignment; // Kafka Compact bytes (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processSyncGroup(const RequestHeaderV2 &request_header, const GroupResult &result);
+};
+
+class HeartbeatResponseBodyV4 : public ResponseBody
+{
+public:
+    HeartbeatResponseBodyV4() = default;
+    void respond(WireWriter &writer) override;
+
+private:
+    void convertHToBE() override;
+
+    int16_t error_code;
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processHeartbeat(const RequestHeaderV2 &request_header, const GroupResult &result);
+};
+
+class LeaveGroupResponseBodyV5 : public ResponseBody
+{
+public:
+    LeaveGroupResponseBodyV5() = default;
+    void respond(WireWriter &writer) override;
+
+public:
+    struct Member
+    {
+        uint32_t member_id_len;
+        std::vector<char> member_id; // Kafka Compact string (N+1)
+        uint32_t group_instance_id_len;
+        std::vector<char> group_instance_id; // Kafka Compact nullable string (N+1)
+        int16_t error_code;
+        uint32_t tag_buffer; // Kafka Tagged fields
+
+        size_t size() const { return unsignedVarintSize(member_id_len) + member_id.size() + unsignedVarintSize(group_instance_id_len) + group_instance_id.size() +
+                                     sizeof(error_code) + unsignedVarintSize(tag_buffer); }
+    };
+
+private:
+    void convertHToBE() override;
+
+    int16_t error_code;
+    uint32_t members_array_len;
+    std::vector<Member> members_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processLeaveGroup(const RequestHeaderV2 &request_header, const LeaveGroupRequestBodyV5 &request_body, const GroupResult &result);
+};
+
+class OffsetCommitResponseBodyV8 : public ResponseBody
+{
+public:
+    OffsetCommitResponseBodyV8() = default;
+    void respond(WireWriter &writer) override;
+
+public:
+    struct Topic
+    {
+        struct Partition
+        {
+            int32_t partition_index;
+            int16_t error_code;
+            uint32_t tag_buffer; // Kafka Tagged fields
+
+            size_t size() const { return sizeof(partition_index) + sizeof(error_code) + unsignedVarintSize(tag_buffer); }
+        };
+
+        uint32_t name_len;
+        std::vector<char> name; // Kafka Compact string (N+1)
+        uint32_t partitions_array_len;
+        std::vector<Partition> partitions_array; // Kafka Compact arry (N+1)
+        uint32_t tag_buffer; // Kafka Tagged fields
+
+        size_t size() const
+        {
+            return unsignedVarintSize(name_len) + name.size() + unsignedVarintSize(partitions_array_len) +
+                   std::accumulate(partitions_array.begin(), partitions_array.end(), size_t(0), [](size_t sum, const Partition &p)
+                                   { return sum + p.size(); }) +
+                   unsignedVarintSize(tag_buffer);
+        }
+    };
+
+private:
+    void convertHToBE() override;
+
+    uint32_t topics_array_len;
+    std::vector<Topic> topics_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processOffsetCommit(const RequestHeaderV2 &request_header, const OffsetCommitRequestBodyV8 &request_body, const GroupResult &result);
+};
+
+class OffsetFetchResponseBodyV8 : public ResponseBody
+{
+public:
+    OffsetFetchResponseBodyV8() = default;
+    void respond(WireWriter &writer) override;
+
+public:
+    struct Group
+    {
+        struct Topic
+        {
+            struct Partition
+            {
+                int32_t partition_index;
+                int64_t committed_offset;
+                int32_t committed_leader_epoch;
+                uint32_t metadata_len;
+                std::vector<char> metadata; // Kafka Compact nullable string (N+1)
+                int16_t error_code;
+                uint32_t tag_buffer; // Kafka Tagged fields
+
+                size_t size() const { return sizeof(partition_index) + sizeof(committed_offset) + sizeof(committed_leader_epoch) + unsignedVarintSize(metadata_len) +
+                                             metadata.size() + sizeof(error_code) + unsignedVarintSize(tag_buffer); }
+            };
+
+            uint32_t name_len;
+            std::vector<char> name; // Kafka Compact string (N+1)
+            uint32_t partitions_array_len;
+            std::vector<Partition> partitions_array; // Kafka Compact arry (N+1)
+            uint32_t tag_buffer; // Kafka Tagged fields
+
+            size_t size() const
+            {
+                return unsignedVarintSize(name_len) + name.size() + unsignedVarintSize(partitions_array_len) +
+                       std::accumulate(partitions_array.begin(), partitions_array.end(), size_t(0), [](size_t sum, const Partition &p)
+                                       { return sum + p.size(); }) +
+                       unsignedVarintSize(tag_buffer);
+            }
+        };
+
+        uint32_t group_id_len;
+        std::vector<char> group_id; // Kafka Compact string (N+1)
+        uint32_t topics_array_len;
+        std::vector<Topic> topics_array; // Kafka Compact arry (N+1)
+        int16_t error_code;
+        uint32_t tag_buffer; // Kafka Tagged fields
+
+        size_t size() const
+        {
+            return unsignedVarintSize(group_id_len) + group_id.size() + unsignedVarintSize(topics_array_len) +
+                   std::accumulate(topics_array.begin(), topics_array.end(), size_t(0), [](size_t sum, const Topic &t)
+                                   { return sum + t.size(); }) +
+                   sizeof(error_code) + unsignedVarintSize(tag_buffer);
+        }
+    };
+
+private:
+    void convertHToBE() override;
+
+    uint32_t groups_array_len;
+    std::vector<Group> groups_array; // Kafka Compact arry (N+1)
+    uint32_t tag_buffer; // Kafka Tagged fields
+
+    friend ResponseMessage processOffsetFetch(const RequestHeaderV2 &request_header, const OffsetFetchRequestBodyV8 &request_body);
+};
+
+// Outcome of the appends of a Produce request, one result per partition in request order
+struct ProduceAppends
+{
+    struct Result
+    {
+        int16_t error_code;
+        int64_t base_offset;
+        int64_t log_start_offset;
+    };
+
+    std::vector<Result> results;
+    std::atomic<size_t> remaining = 0; // Appends still running on the I/O threads
+};
+
+// Kafka name of api_key, "Unknown" for APIs the broker doesn't serve
+std::string_view apiName(int16_t api_key);
+// Whether the broker serves api_version of api_key, the ranges ApiVersions advertises
+bool isSupportedVersion(int16_t api_key, int16_t api_version);
+
 ResponseMessage processAPIVersions(const RequestHeaderV2 &request_header, const APIVersionsRequestBodyV4 &request_body);
-ResponseMessage processDescribeTopicPartitions(const RequestHeaderV2 &request_header, const DescribeTopicPartitionsRequestBodyV0 &request_body);
\ No newline at end of file
+ResponseMessage processDescribeTopicPartitions(const RequestHeaderV2 &request_header, const DescribeTopicPartitionsRequestBodyV0 &request_body);
+ResponseMessage processMetadata(const RequestHeaderV2 &request_header, const MetadataRequestBodyV12 &request_body);
+ResponseMessage processFetch(const RequestHeaderV2 &request_header, const FetchRequestBodyV16 &request_body);
+ResponseMessage processProduce(const RequestHeaderV2 &request_header, const ProduceRequestBodyV11 &request_body, const ProduceAppends &appends);
+ResponseMessage processListOffsets(const RequestHeaderV2 &request_header, const ListOffsetsRequestBodyV9 &request_body);
+ResponseMessage processFindCoordinator(const RequestHeaderV2 &request_header, const FindCoordinatorRequestBodyV4 &request_body);
+ResponseMessage processJoinGroup(const RequestHeaderV2 &request_header, const GroupResult &result);
+ResponseMessage processSyncGroup(const RequestHeaderV2 &request_header, const GroupResult &result);
+ResponseMessage processHeartbeat(const RequestHeaderV2 &request_header, const GroupResult &result);
+ResponseMessage processLeaveGroup(const RequestHeaderV2 &request_header, const LeaveGroupRequestBodyV5 &request_body, const GroupResult &result);
+ResponseMessage processOffsetCommit(const RequestHeaderV2 &request_header, const OffsetCommitRequestBodyV8 &request_body, const GroupResult &result);
+ResponseMessage processOffsetFetch(const RequestHeaderV2 &request_header, const OffsetFetchRequestBodyV8 &request_body);
+
+// Whether a fetch can be answered now: it does not wait, one of its partitions has an error, or min_bytes are available
+bool isFetchSatisfied(const FetchRequestBodyV16 &request_body);
+// Parks a fetch that isn't satisfied yet in the fetch purgatory and on loop's timer wheel, on_complete() runs (on any thread)
+// once it is satisfied or max_wait_ms passed. The caller keeps request_body alive until then.
+std::shared_ptr<DelayedOperation> delayFetch(const FetchRequestBodyV16 &request_body, EventLoop &loop, std::function<void()> on_complete);
+// Hands every partition of a Produce request to the I/O thread of its log directory, on_complete() runs (on any thread)
+// once all results are in appends. Nothing refers to request_body after this returns.
+std::shared_ptr<DelayedOperation> appendProduce(const ProduceRequestBodyV11 &request_body, std::shared_ptr<ProduceAppends> appends, std::function<void()> on_complete);
+// Hand a group request to the group coordinator thread, on_complete() runs (on that thread) once it filled in result.
+// Nothing refers to request_body after these return.
+std::shared_ptr<DelayedOperation> delayJoinGroup(const RequestHeaderV2 &request_header, const JoinGroupRequestBodyV9 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete);
+std::shared_ptr<DelayedOperation> delaySyncGroup(const SyncGroupRequestBodyV5 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete);
+std::shared_ptr<DelayedOperation> delayHeartbeat(const HeartbeatRequestBodyV4 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete);
+std::shared_ptr<DelayedOperation> delayLeaveGroup(const LeaveGroupRequestBodyV5 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete);
+std::shared_ptr<DelayedOperation> delayOffsetCommit(const OffsetCommitRequestBodyV8 &request_body, std::shared_ptr<GroupResult> result, std::function<void()> on_complete);
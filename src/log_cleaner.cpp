@@ -0,0 +1,280 @@
+#include "log_cleaner.h"
+#include "metadata_index.h"
+#include "broker_config.h"
+#include "metrics.h"
+
+OffsetMap::OffsetMap(size_t max_keys, size_t memory_bytes) : entries(0)
+{
+    // Smallest power of two keeping max_keys under the load factor, unless memory_bytes caps it first
+    size_t slot_count = 16;
+    while (slot_count * 3 / 4 < max_keys && slot_count * 2 * ENTRY_BYTES <= memory_bytes)
+        slot_count *= 2;
+    slots.assign(slot_count, Entry{.key_hash = 0, .offset = -1});
+}
+
+void OffsetMap::put(uint64_t key_hash, int64_t offset)
+{
+    const size_t mask = slots.size() - 1;
+    size_t slot = key_hash & mask;
+    while (slots[slot].offset != -1 && slots[slot].key_hash != key_hash)
+        slot = (slot + 1) & mask;
+
+    if (slots[slot].offset == -1)
+        entries++;
+    slots[slot] = {.key_hash = key_hash, .offset = offset};
+}
+
+int64_t OffsetMap::get(uint64_t key_hash) const
+{
+    const size_t mask = slots.size() - 1;
+    for (size_t slot = key_hash & mask; slots[slot].offset != -1; slot = (slot + 1) & mask)
+    {
+        if (slots[slot].key_hash == key_hash)
+            return slots[slot].offset;
+    }
+    return -1;
+}
+
+// Control and transactional batches are copied as they are, their markers aren't keyed records
+static constexpr int16_t TRANSACTIONAL_OR_CONTROL = 0x30;
+
+// Batches of a segment file one after another
+class SegmentBatches
+{
+public:
+    explicit SegmentBatches(const std::string &path) : file(path, std::ios::binary) {}
+
+    bool isOpen() const { return file.is_open(); }
+
+    bool next(std::vector<char> &batch)
+    {
+        batch.resize(RecordBatchHeader::SIZE);
+        if (!file.read(batch.data(), RecordBatchHeader::SIZE))
+            return false;
+
+        const int32_t batch_length = readBE32(batch.data() + RecordBatchHeader::BATCH_LENGTH_POS);
+        if (batch_length < static_cast<int32_t>(RecordBatchHeader::SIZE - RecordBatchHeader::LOG_OVERHEAD))
+            return false;
+
+        batch.resize(RecordBatchHeader::LOG_OVERHEAD + batch_length);
+        return static_cast<bool>(file.read(batch.data() + RecordBatchHeader::SIZE, batch.size() - RecordBatchHeader::SIZE));
+    }
+
+private:
+    std::ifstream file;
+};
+
+static bool decodable(std::span<const char> batch)
+{
+    return (readBE16(batch.data() + RecordBatchHeader::ATTRIBUTES_POS) & TRANSACTIONAL_OR_CONTROL) == 0 && compressionSupported(batchCodec(batch));
+}
+
+static void removeFiles(const std::vector<std::string> &paths)
+{
+    for (const std::string &path : paths)
+        unlink(path.c_str());
+}
+
+std::optional<LogCleaner::Stats> LogCleaner::clean(PartitionLog &log, RecordKeyFunction record_key, int64_t now_ms)
+{
+    const BrokerConfig &config = brokerConfig();
+
+    const std::vector<PartitionLog::SegmentInfo> segments = log.segmentInfos();
+    if (segments.size() < 2)
+        return std::nullopt;
+    const size_t closed_segments = segments.size() - 1;
+
+    // Retention may have deleted what used to be dirty
+    int64_t &first_dirty_offset = first_dirty_offsets.try_emplace(log.path(), segments.front().base_offset).first->second;
+    first_dirty_offset = std::max(first_dirty_offset, segments.front().base_offset);
+
+    uint64_t closed_bytes = 0, dirty_bytes = 0;
+    for (size_t i = 0; i < closed_segments; i++)
+    {
+        closed_bytes += segments[i].size;
+        if (segments[i + 1].base_offset > first_dirty_offset)
+            dirty_bytes += segments[i].size;
+    }
+    if (dirty_bytes == 0 || dirty_bytes < config.log_cleaner_min_cleanable_ratio * closed_bytes)
+        return std::nullopt;
+
+    // Offset map over the dirty segments, ending at a batch boundary once it is full
+
+    OffsetMap offset_map(segments.back().base_offset - first_dirty_offset, config.log_cleaner_dedupe_buffer_size);
+    int64_t map_end_offset = first_dirty_offset;
+    std::vector<char> batch, buffer;
+    bool map_full = false;
+    for (size_t i = 0; i < closed_segments && !map_full; i++)
+    {
+        if (segments[i + 1].base_offset <= first_dirty_offset)
+            continue;
+
+        SegmentBatches batches(segments[i].path);
+        if (!batches.isOpen())
+            return std::nullopt; // Deleted by retention since
+        while (batches.next(batch))
+        {
+            const int64_t base_offset = readBE64(batch.data() + RecordBatchHeader::BASE_OFFSET_POS);
+            const int64_t last_offset = base_offset + readBE32(batch.data() + RecordBatchHeader::LAST_OFFSET_DELTA_POS);
+            if (last_offset < first_dirty_offset)
+                continue;
+
+            if (offset_map.size() + readBE32(batch.data() + RecordBatchHeader::RECORDS_COUNT_POS) > offset_map.capacity())
+            {
+                map_full = true;
+                break;
+            }
+
+            if (decodable(batch))
+            {
+                forEachRecord(base_offset, batchRecords(batch, buffer), [&](const CleanerRecord &record, std::span<const char>)
+                              {
+                                  if (auto key = record_key(record))
+                                      offset_map.put(*key, record.offset); });
+            }
+            map_end_offset = last_offset + 1;
+        }
+
+        if (!map_full)
+            map_end_offset = segments[i + 1].base_offset;
+    }
+
+    if (map_end_offset == first_dirty_offset)
+    {
+        std::cerr << "log.cleaner.dedupe.buffer.size can't hold the keys of a single batch of " << log.path() << std::endl;
+        return std::nullopt;
+    }
+
+    // Copies of every closed segment up to the end of the map, without superseded records and expired tombstones
+
+    const int64_t tombstone_deadline = now_ms - config.log_cleaner_delete_retention_ms;
+    std::vector<PartitionLog::SegmentInfo> replaced;
+    std::vector<std::string> cleaned_paths;
+    Stats stats{.segments = 0, .bytes_before = 0, .bytes_after = 0};
+    std::vector<char> output, retained_records;
+
+    for (size_t i = 0; i < closed_segments && segments[i].base_offset < map_end_offset; i++)
+    {
+        SegmentBatches batches(segments[i].path);
+        if (!batches.isOpen())
+        {
+            removeFiles(cleaned_paths);
+            return std::nullopt;
+        }
+
+        output.clear();
+        while (batches.next(batch))
+        {
+            const std::span<const char> records = decodable(batch) ? batchRecords(batch, buffer) : std::span<const char>();
+            if (records.empty())
+            {
+                output.insert(output.end(), batch.begin(), batch.end());
+                continue;
+            }
+
+            // Tombstones of the part cleaned before can go once the batch is older than the retention, the records
+            // they deleted are gone by then
+            const int64_t base_offset = readBE64(batch.data() + RecordBatchHeader::BASE_OFFSET_POS);
+            const bool tombstones_expired = readBE64(batch.data() + RecordBatchHeader::MAX_TIMESTAMP_POS) < tombstone_deadline;
+            const int32_t records_count = readBE32(batch.data() + RecordBatchHeader::RECORDS_COUNT_POS);
+
+            int32_t retained_count = 0;
+            retained_records.clear();
+            const bool well_formed = forEachRecord(base_offset, records, [&](const CleanerRecord &record, std::span<const char> raw)
+                                                   {
+                                                       if (auto key = record_key(record))
+                                                       {
+                                                           if (offset_map.get(*key) > record.offset)
+                                                               return;
+                                                           if (!record.value && tombstones_expired && record.offset < first_dirty_offset)
+                                                               return;
+                                                       }
+                                                       retained_records.insert(retained_records.end(), raw.begin(), raw.end());
+                                                       retained_count++; });
+
+            // Offsets and timestamps are left alone, records keep their deltas from the batch base
+            if (!well_formed || retained_count == records_count)
+                output.insert(output.end(), batch.begin(), batch.end());
+            else if (retained_count > 0 && !encodeBatch(batch, retained_records, retained_count, batchCodec(batch), output))
+                output.insert(output.end(), batch.begin(), batch.end());
+        }
+
+        const std::string cleaned_path = segments[i].path + ".cleaned";
+        std::ofstream cleaned(cleaned_path, std::ios::binary | std::ios::trunc);
+        cleaned.write(output.data(), output.size());
+        cleaned.close();
+        cleaned_paths.push_back(cleaned_path);
+
+        int fd = open(cleaned_path.c_str(), O_RDONLY);
+        if (cleaned.fail() || fd == -1 || fdatasync(fd) != 0)
+        {
+            std::perror("Error occured");
+            if (fd != -1)
+                close(fd);
+            removeFiles(cleaned_paths);
+            return std::nullopt;
+        }
+
+        // Time based retention falls back to the modification time, the copy keeps the original's
+        struct stat segment_stat{};
+        if (stat(segments[i].path.c_str(), &segment_stat) == 0)
+        {
+            const timespec times[2] = {segment_stat.st_atim, segment_stat.st_mtim};
+            futimens(fd, times);
+        }
+        close(fd);
+
+        replaced.push_back(segments[i]);
+        stats.segments++;
+        stats.bytes_before += segments[i].size;
+        stats.bytes_after += output.size();
+    }
+
+    if (!log.replaceSegments(replaced, cleaned_paths))
+        return std::nullopt;
+
+    first_dirty_offset = map_end_offset;
+    BrokerMetrics::local().add(Counter::LOG_CLEANER_REMOVED_BYTES, stats.bytes_before - stats.bytes_after);
+    return stats;
+}
+
+std::optional<uint64_t> LogCleaner::recordKey(const CleanerRecord &record)
+{
+    if (!record.key)
+        return std::nullopt;
+    return hashBytes(record.key->data(), record.key->size());
+}
+
+std::optional<uint64_t> LogCleaner::metadataRecordKey(const CleanerRecord &record)
+{
+    // Value: frame_version, type, version, then the record's fields
+    if (!record.value || record.value->size() < 3)
+        return std::nullopt;
+
+    const char *field = record.value->data() + 3;
+    const char *end = record.value->data() + record.value->size();
+    const int8_t type = (*record.value)[1];
+
+    std::string identity(1, static_cast<char>(type));
+    switch (type)
+    {
+    case 2:  // TopicRecord, name
+    case 12: // FeatureLevelRecord, name
+    {
+        uint32_t name_length;
+        if (!readUnsignedVarint(field, end, name_length) || name_length == 0 || name_length - 1 > static_cast<size_t>(end - field))
+            return std::nullopt;
+        identity.append(field, name_length - 1);
+        break;
+    }
+    case 3: // PartitionRecord, partition_id then topic_id
+        if (end - field < static_cast<ptrdiff_t>(sizeof(int32_t) + sizeof(UUID)))
+            return std::nullopt;
+        identity.append(field, sizeof(int32_t) + sizeof(UUID));
+        break;
+    default:
+        return std::nullopt;
+    }
+
+    return hashBytes(identity.data(), identity.size());
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "common.h"
+#include "partition_log.h"
+
+// Latest offset of every key in the part of a log being cleaned, in one open addressing table allocated up front.
+// Keys are stored as 64-bit hashes like Kafka stores their MD5: a collision would make the older key's records
+// look superseded, at odds of about n^2 / 2^65 for n keys.
+class OffsetMap
+{
+public:
+    static constexpr size_t ENTRY_BYTES = 2 * sizeof(int64_t);
+
+    // Room for max_keys, in at most memory_bytes
+    OffsetMap(size_t max_keys, size_t memory_bytes);
+
+    // Keys it takes before put() has to stop, keeps probe sequences short
+    size_t capacity() const { return slots.size() * 3 / 4; }
+    size_t size() const { return entries; }
+
+    void put(uint64_t key_hash, int64_t offset);
+    // Offset put last for key_hash, -1 when there is none
+    int64_t get(uint64_t key_hash) const;
+
+private:
+    struct Entry
+    {
+        uint64_t key_hash;
+        int64_t offset; // -1 for an empty slot
+    };
+
+    std::vector<Entry> slots;
+    size_t entries;
+};
+
+// One record of a batch being cleaned
+struct CleanerRecord
+{
+    int64_t offset;
+    std::optional<std::span<const char>> key;
+    std::optional<std::span<const char>> value; // nullopt for a tombstone
+};
+
+// Calls on_record with every record of a decoded batch and its raw bytes, false when the records are malformed
+template <typename OnRecord>
+bool forEachRecord(int64_t base_offset, std::span<const char> records, OnRecord &&on_record)
+{
+    const char *record = records.data();
+    const char *end = records.data() + records.size();
+    while (record < end)
+    {
+        const char *record_start = record;
+        int64_t length, timestamp_delta, offset_delta, key_length, value_length;
+        if (!readVarlong(record, end, length) || length <= 0 || length > end - record)
+            return false;
+
+        // Record: length, attributes, timestamp delta, offset delta, key, value, headers
+        const char *next_record = record + length;
+        const char *field = record + sizeof(int8_t);
+        if (!readVarlong(field, next_record, timestamp_delta) || !readVarlong(field, next_record, offset_delta) ||
+            !readVarlong(field, next_record, key_length) || key_length > next_record - field)
+            return false;
+
+        CleanerRecord cleaner_record{.offset = base_offset + offset_delta, .key = std::nullopt, .value = std::nullopt};
+        if (key_length >= 0)
+        {
+            cleaner_record.key = std::span<const char>(field, key_length);
+            field += key_length;
+        }
+
+        if (!readVarlong(field, next_record, value_length) || value_length > next_record - field)
+            return false;
+        if (value_length >= 0)
+            cleaner_record.value = std::span<const char>(field, value_length);
+
+        on_record(cleaner_record, std::span<const char>(record_start, next_record));
+        record = next_record;
+    }
+    return true;
+}
+
+// Identity records are compacted by, nullopt for a record that is always kept
+using RecordKeyFunction = std::optional<uint64_t> (*)(const CleanerRecord &record);
+
+// Compacts logs like Kafka's log cleaner: the key -> latest offset map is built over the dirty part of the log
+// (written since it was last cleaned), then every closed segment up to the end of what the map covers is copied
+// keeping only records no later record of their key supersedes, and swapped in. Tombstones stay for
+// log.cleaner.delete.retention.ms once cleaned. Only one thread runs a LogCleaner.
+class LogCleaner
+{
+public:
+    struct Stats
+    {
+        size_t segments;
+        uint64_t bytes_before;
+        uint64_t bytes_after;
+    };
+
+    // Cleans the closed segments of log once at least log.cleaner.min.cleanable.ratio of them are dirty,
+    // nullopt when it didn't
+    std::optional<Stats> clean(PartitionLog &log, RecordKeyFunction record_key, int64_t now_ms);
+
+    // The record key, for topics with cleanup.policy=compact
+    static std::optional<uint64_t> recordKey(const CleanerRecord &record);
+    // What a __cluster_metadata record describes: FeatureLevelRecords by feature name, TopicRecords by topic name
+    // and PartitionRecords by topic id and partition. The metadata image keeps the latest of each, every other
+    // record type is kept as is.
+    static std::optional<uint64_t> metadataRecordKey(const CleanerRecord &record);
+
+private:
+    // Start of the dirty part of each log (by directory), the log start before a log was first cleaned
+    std::unordered_map<std::string, int64_t> first_dirty_offsets;
+};
@@ -1,13 +1,15 @@
 #include "log_parsing.h"
+#include "partition_log.h"
+#include "compression.h"
 
-static void readCompactString(std::ifstream &file, UnsignedVarint &len, std::vector<char> &str)
+static void readCompactString(std::istream &file, UnsignedVarint &len, std::vector<char> &str)
 {
     len.readValue(file);
     str.resize(len.getValue() - 1);
     file.read(str.data(), len.getValue() - 1);
 }
 
-FeatureLevelRecord::FeatureLevelRecord(std::ifstream &file, int8_t frame_version_, int8_t type_, int8_t version_) : RecordValue(frame_version_, type_, version_)
+FeatureLevelRecord::FeatureLevelRecord(std::istream &file, int8_t frame_version_, int8_t type_, int8_t version_) : RecordValue(frame_version_, type_, version_)
 {
     readCompactString(file, name_length, name);
     file.read(reinterpret_cast<char *>(&feature_level), sizeof(feature_level));
@@ -16,14 +18,14 @@ FeatureLevelRecord::FeatureLevelRecord(std::ifstream &file, int8_t frame_version
     convertBE16toH(feature_level);
 }
 
-TopicRecord::TopicRecord(std::ifstream &file, int8_t frame_version_, int8_t type_, int8_t version_) : RecordValue(frame_version_, type_, version_)
+TopicRecord::TopicRecord(std::istream &file, int8_t frame_version_, int8_t type_, int8_t version_) : RecordValue(frame_version_, type_, version_)
 {
     readCompactString(file, name_length, topic_name);
     file.read(reinterpret_cast<char *>(topic_id.data()), topic_id.size());
     tagged_fields_count.readValue(file);
 }
 
-PartitionRecord::PartitionRecord(std::ifstream &file, int8_t frame_version_, int8_t type_, int8_t version_) : RecordValue(frame_version_, type_, version_)
+PartitionRecord::PartitionRecord(std::istream &file, int8_t frame_version_, int8_t type_, int8_t version_) : RecordValue(frame_version_, type_, version_)
 {
     file.read(reinterpret_cast<char *>(&partition_id), sizeof(partition_id));
     file.read(reinterpret_cast<char *>(topic_id.data()), topic_id.size());
@@ -81,7 +83,22 @@ PartitionRecord::PartitionRecord(std::ifstream &file, int8_t frame_version_, int
     convertBE32toH(partition_id, leader, leader_epoch, partition_epoch);
 }
 
-std::unique_ptr<RecordValue> RecordValue::parseRecordValue(std::ifstream &file)
+ConfigRecord::ConfigRecord(std::istream &file, int8_t frame_version_, int8_t type_, int8_t version_) : RecordValue(frame_version_, type_, version_)
+{
+    file.read(reinterpret_cast<char *>(&resource_type), sizeof(resource_type));
+    readCompactString(file, resource_name_length, resource_name);
+    readCompactString(file, name_length, name);
+
+    value_length.readValue(file);
+    if (value_length.getValue() > 0)
+    {
+        value.resize(value_length.getValue() - 1);
+        file.read(value.data(), value.size());
+    }
+    tagged_fields_count.readValue(file);
+}
+
+std::unique_ptr<RecordValue> RecordValue::parseRecordValue(std::istream &file)
 {
     int8_t frame_version_, type_, version_;
 
@@ -105,6 +122,10 @@ std::unique_ptr<RecordValue> RecordValue::parseRecordValue(std::ifstream &file)
         record_value = std::make_unique<PartitionRecord>(file, frame_version_, type_, version_);
         break;
 
+    case 4: // ConfigRecord
+        record_value = std::make_unique<ConfigRecord>(file, frame_version_, type_, version_);
+        break;
+
     default:
         assert(true); // No handling of unknown records
         break;
@@ -113,7 +134,7 @@ std::unique_ptr<RecordValue> RecordValue::parseRecordValue(std::ifstream &file)
     return record_value;
 }
 
-Record::Record(std::ifstream &file)
+Record::Record(std::istream &file)
 {
     length.readValue(file);
     file.read(reinterpret_cast<char *>(&attributes), sizeof(attributes));
@@ -132,7 +153,9 @@ Record::Record(std::ifstream &file)
 
     assert(value_length.getValue() >= 3); // Atleast have the first 3 Bytes (frame_version, type, version)
 
+    std::streampos value_start = file.tellg();
     value = RecordValue::parseRecordValue(file);
+    file.seekg(value_start + std::streamoff(value_length.getValue())); // Skips over record types we don't parse
 
     headers_array_count.readValue(file);
 
@@ -141,7 +164,7 @@ Record::Record(std::ifstream &file)
     // value->printDump(); // Will always be valid since we will never have value as nullptr
 }
 
-RecordBatch::RecordBatch(std::ifstream &file)
+RecordBatch::RecordBatch(std::istream &file)
 {
     file.read(reinterpret_cast<char *>(&base_offset), sizeof(base_offset));
     file.read(reinterpret_cast<char *>(&batch_length), sizeof(batch_length));
@@ -163,30 +186,59 @@ RecordBatch::RecordBatch(std::ifstream &file)
 
     // printDump();
 
-    for (int i = 0; i < records_length; i++)
+    const CompressionCodec codec = static_cast<CompressionCodec>(attributes & RecordBatchHeader::COMPRESSION_CODEC_MASK);
+    if (codec == CompressionCodec::NONE)
     {
-        records.push_back(std::make_unique<Record>(file));
+        for (int i = 0; i < records_length && file.good(); i++)
+        {
+            records.push_back(std::make_unique<Record>(file));
+        }
+        return;
+    }
+
+    // Only the records are compressed, they are inflated and parsed from memory
+    const int64_t compressed_size = static_cast<int64_t>(batch_length) - (RecordBatchHeader::SIZE - RecordBatchHeader::LOG_OVERHEAD);
+    if (compressed_size < 0)
+    {
+        file.setstate(std::ios::failbit);
+        return;
+    }
+
+    std::vector<char> compressed(compressed_size);
+    file.read(compressed.data(), compressed.size());
+
+    if (!file.good())
+        return; // Torn batch, the caller stops here
+
+    std::vector<char> decompressed;
+    if (!decompress(codec, compressed, decompressed))
+    {
+        std::cerr << "Skipping metadata batch at offset " << base_offset << " with an undecodable compression codec " << static_cast<int>(codec) << std::endl;
+        return;
+    }
+
+    std::ispanstream records_stream{std::span<const char>(decompressed)};
+    for (int i = 0; i < records_length && records_stream.good(); i++)
+    {
+        records.push_back(std::make_unique<Record>(records_stream));
     }
 }
 
-DescribeTopicPartitionsResponseBodyV0::Topic LogParser::extractTopicPartitionRecords(int8_t topic_name_len, const std::vector<char> &topic_name)
+void LogParser::loadMetadataImage(MetadataImage &image)
 {
+    // Single pass over the log, every lookup afterwards is served by the image
 
-    // Default Topic Not Found error response
-    DescribeTopicPartitionsResponseBodyV0::Topic response_topic = {.error_code = 3, // Introduce macros for error codes
-                                                                   .topic_name_len = topic_name_len,
-                                                                   .topic_name = topic_name,
-                                                                   .topic_id = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-                                                                   .is_internal = 0,
-                                                                   .partitions_array_len = 1,
-                                                                   .topic_authorized_ops = 0,
-                                                                   .tag_buffer = 0};
-    bool topic_in_records = false;
-
-    while (file.tellg() != FILE_SIZE)
+    // A batch still being written at the tail fails the stream instead of looping past the end
+    while (file.good() && static_cast<size_t>(file.tellg()) < FILE_SIZE)
     {
+        std::streampos batch_start = file.tellg();
         RecordBatch temp_batch(file);
 
+        std::streamoff batch_size = sizeof(temp_batch.base_offset) + sizeof(temp_batch.batch_length) + temp_batch.batch_length;
+        if (!file.good() || static_cast<size_t>(batch_start + batch_size) > FILE_SIZE)
+            break; // Torn batch at the tail, it will be picked up on the next reload
+        file.seekg(batch_start + batch_size);
+
         for (auto &record : temp_batch.records)
         {
             if (record->value == nullptr)
@@ -196,40 +248,30 @@ DescribeTopicPartitionsResponseBodyV0::Topic LogParser::extractTopicPartitionRec
             {
                 const TopicRecord &topic_record = dynamic_cast<const TopicRecord &>(*(record->value));
 
-                if (topic_name == topic_record.topic_name)
-                {
-                    response_topic.error_code = 0;
-                    response_topic.topic_id = topic_record.topic_id;
-                    topic_in_records = true;
-                }
+                image.addTopic(std::string_view(topic_record.topic_name.data(), topic_record.topic_name.size()), topic_record.topic_id);
             }
             else if (record->value->getRecordType() == RecordValue::RECORD_VALUE::PARTITION)
             {
                 const PartitionRecord &partition_record = dynamic_cast<const PartitionRecord &>(*(record->value));
 
-                if (topic_in_records && (partition_record.topic_id == response_topic.topic_id))
-                {
-                    DescribeTopicPartitionsResponseBodyV0::Topic::Partition response_partition = {.error_code = 0, // Introduce macros for error codes
-                                                                                                  .partition_index = partition_record.partition_id,
-                                                                                                  .leader_id = partition_record.leader,
-                                                                                                  .leader_epoch = partition_record.leader_epoch,
-                                                                                                  .replica_nodes_array_len = static_cast<int8_t>(partition_record.replica_array_len.getValue()),
-                                                                                                  .replica_nodes_array = partition_record.replica_array,
-                                                                                                  .isr_nodes_array_len = static_cast<int8_t>(partition_record.isr_array_len.getValue()),
-                                                                                                  .isr_nodes_array = partition_record.isr_array,
-                                                                                                  .elr_nodes_array_len = 1,
-                                                                                                  .last_known_elr_nodes_array_len = 1,
-                                                                                                  .offline_replica_nodes_array_len = 1,
-                                                                                                  .tag_buffer = 0};
-
-                    response_topic.partitions_array_len += 1;
-                    response_topic.partitions_array.push_back(response_partition);
-                }
+                image.addPartition(partition_record.topic_id, partition_record.partition_id, partition_record.leader,
+                                   partition_record.leader_epoch, partition_record.replica_array, partition_record.isr_array);
+            }
+            else if (record->value->getRecordType() == RecordValue::RECORD_VALUE::CONFIG)
+            {
+                const ConfigRecord &config_record = dynamic_cast<const ConfigRecord &>(*(record->value));
+                if (config_record.resource_type != ConfigRecord::TOPIC_RESOURCE)
+                    continue;
+
+                std::optional<std::string_view> value;
+                if (config_record.value_length.getValue() > 0)
+                    value = std::string_view(config_record.value.data(), config_record.value.size());
+                image.setTopicConfig(std::string_view(config_record.resource_name.data(), config_record.resource_name.size()),
+                                     std::string_view(config_record.name.data(), config_record.name.size()), value);
             }
         }
     }
 
-    file.seekg(0); // clear is implicit
-
-    return response_topic;
-}
\ No newline at end of file
+    file.clear();
+    file.seekg(0);
+}
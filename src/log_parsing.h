@@ -1,11 +1,12 @@
 #pragma once
 
 #include "common.h"
-#include "kafka_utils.h"
+#include "metadata_index.h"
 
 class FeatureLevelRecord;
 class TopicRecord;
 class PartitionRecord;
+class ConfigRecord;
 
 class Record;
 class RecordBatch;
@@ -14,7 +15,7 @@ class Varint
 {
 public:
     Varint() = default;
-    void readValue(std::ifstream &file)
+    void readValue(std::istream &file)
     {
         int8_t val;
         constexpr int8_t NO_MSB = 0x7F;
@@ -51,7 +52,7 @@ class UnsignedVarint
 {
 public:
     UnsignedVarint() = default;
-    void readValue(std::ifstream &file)
+    void readValue(std::istream &file)
     {
         uint8_t val;
         constexpr uint8_t NO_MSB = 0x7F;
@@ -94,7 +95,7 @@ public:
         FILE_SIZE = std::filesystem::file_size(file_path); 
     }
 
-    DescribeTopicPartitionsResponseBodyV0::Topic extractTopicPartitionRecords(int8_t topic_name_len, const std::vector<char> &topic_name);
+    void loadMetadataImage(MetadataImage &image);
 
 private:
     std::ifstream file;
@@ -108,9 +109,10 @@ public:
     {
         FEATURE_LEVEL,
         TOPIC,
-        PARTITION
+        PARTITION,
+        CONFIG
     };
-    static std::unique_ptr<RecordValue> parseRecordValue(std::ifstream &file);
+    static std::unique_ptr<RecordValue> parseRecordValue(std::istream &file);
     virtual RECORD_VALUE getRecordType() = 0;
     virtual void printDump() const = 0;
     virtual ~RecordValue() {}
@@ -125,7 +127,7 @@ protected:
 class FeatureLevelRecord : public RecordValue
 {
 public:
-    FeatureLevelRecord(std::ifstream &file, int8_t frame_version_, int8_t type_, int8_t version_);
+    FeatureLevelRecord(std::istream &file, int8_t frame_version_, int8_t type_, int8_t version_);
     RECORD_VALUE getRecordType() override { return RECORD_VALUE::FEATURE_LEVEL; }
 
     void printDump() const override
@@ -150,13 +152,13 @@ private:
     int16_t feature_level;
     UnsignedVarint tagged_fields_count;
 
-    friend DescribeTopicPartitionsResponseBodyV0::Topic LogParser::extractTopicPartitionRecords(int8_t topic_name_len, const std::vector<char> &topic_name);
+    friend void LogParser::loadMetadataImage(MetadataImage &image);
 };
 
 class TopicRecord : public RecordValue
 {
 public:
-    TopicRecord(std::ifstream &file, int8_t frame_version_, int8_t type_, int8_t version_);
+    TopicRecord(std::istream &file, int8_t frame_version_, int8_t type_, int8_t version_);
     RECORD_VALUE getRecordType() override { return RECORD_VALUE::TOPIC; }
 
     void printDump() const override
@@ -186,13 +188,13 @@ private:
     UUID topic_id;
     UnsignedVarint tagged_fields_count;
 
-    friend DescribeTopicPartitionsResponseBodyV0::Topic LogParser::extractTopicPartitionRecords(int8_t topic_name_len, const std::vector<char> &topic_name);
+    friend void LogParser::loadMetadataImage(MetadataImage &image);
 };
 
 class PartitionRecord : public RecordValue
 {
 public:
-    PartitionRecord(std::ifstream &file, int8_t frame_version_, int8_t type_, int8_t version_);
+    PartitionRecord(std::istream &file, int8_t frame_version_, int8_t type_, int8_t version_);
     RECORD_VALUE getRecordType() override { return RECORD_VALUE::PARTITION; }
 
     void printDump() const override
@@ -265,13 +267,52 @@ private:
     std::vector<UUID> directories_array; // Kafka Compact arry (N+1)
     UnsignedVarint tagged_fields_count;
 
-    friend DescribeTopicPartitionsResponseBodyV0::Topic LogParser::extractTopicPartitionRecords(int8_t topic_name_len, const std::vector<char> &topic_name);
+    friend void LogParser::loadMetadataImage(MetadataImage &image);
+};
+
+class ConfigRecord : public RecordValue
+{
+public:
+    static constexpr int8_t TOPIC_RESOURCE = 2;
+
+    ConfigRecord(std::istream &file, int8_t frame_version_, int8_t type_, int8_t version_);
+    RECORD_VALUE getRecordType() override { return RECORD_VALUE::CONFIG; }
+
+    void printDump() const override
+    {
+        std::stringstream ss;
+
+        ss << "ConfigRecord" << "\n"
+           << "Frame version: " << static_cast<int>(frame_version) << "\n"
+           << "Type: " << static_cast<int>(type) << "\n"
+           << "Version: " << static_cast<int>(version) << "\n"
+           << "Resource Type: " << static_cast<int>(resource_type) << "\n"
+           << "Resource Name: " << std::string(resource_name.begin(), resource_name.end()) << "\n"
+           << "Name: " << std::string(name.begin(), name.end()) << "\n"
+           << "Value Length: " << value_length.getValue() << "\n"
+           << "Value: " << std::string(value.begin(), value.end()) << "\n"
+           << "Tagged Fields Count: " << tagged_fields_count.getValue() << "\n";
+
+        std::cout << ss.str() << std::endl;
+    }
+
+private:
+    int8_t resource_type;
+    UnsignedVarint resource_name_length;
+    std::vector<char> resource_name;
+    UnsignedVarint name_length;
+    std::vector<char> name;
+    UnsignedVarint value_length; // Kafka Compact nullable string, 0 when the config was deleted
+    std::vector<char> value;
+    UnsignedVarint tagged_fields_count;
+
+    friend void LogParser::loadMetadataImage(MetadataImage &image);
 };
 
 class Record
 {
 public:
-    Record(std::ifstream &file);
+    Record(std::istream &file);
 
     void printDump() const
     {
@@ -306,13 +347,13 @@ private:
     std::unique_ptr<RecordValue> value;
     UnsignedVarint headers_array_count;
 
-    friend DescribeTopicPartitionsResponseBodyV0::Topic LogParser::extractTopicPartitionRecords(int8_t topic_name_len, const std::vector<char> &topic_name);
+    friend void LogParser::loadMetadataImage(MetadataImage &image);
 };
 
 class RecordBatch
 {
 public:
-    RecordBatch(std::ifstream &file);
+    RecordBatch(std::istream &file);
 
     void printDump() const
     {
@@ -351,5 +392,5 @@ private:
     int32_t records_length;
     std::vector<std::unique_ptr<Record>> records;
 
-    friend DescribeTopicPartitionsResponseBodyV0::Topic LogParser::extractTopicPartitionRecords(int8_t topic_name_len, const std::vector<char> &topic_name);
+    friend void LogParser::loadMetadataImage(MetadataImage &image);
 };
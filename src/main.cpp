@@ -1,6 +1,16 @@
 #include "common.h"
 #include "server_setup.h"
 #include "client_accept.h"
+#include "event_loop.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "metadata_index.h"
+#include "broker_config.h"
+#include "partition_log.h"
+#include "group_coordinator.h"
+#include "shard.h"
+#include "buffer_pool.h"
+#include "admission.h"
 
 std::atomic_bool server_running = true;
 
@@ -15,6 +25,7 @@ void setToBlockSignal()
     sigset_t mask;
     sigemptyset(&mask);
     sigaddset(&mask, SIGINT); // Block Ctrl+C (SIGINT)
+    sigaddset(&mask, SIGTERM);
 
     if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0)
     {
@@ -29,22 +40,17 @@ void setToHandleSignal()
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = 0;
 
-    if (sigaction(SIGINT, &sa, nullptr) == -1)
+    if (sigaction(SIGINT, &sa, nullptr) == -1 || sigaction(SIGTERM, &sa, nullptr) == -1)
     {
         std::perror("Error occured");
         exit(EXIT_FAILURE);
     }
 }
 
-int main(int argc, char *argv[])
+// Accepts connections on the main thread until interrupted, handing them round-robin to the network threads
+void acceptConnections(std::vector<std::unique_ptr<EventLoop>> &network_loops)
 {
-    // Disable output buffering
-    std::cout << std::unitbuf;
-    std::cerr << std::unitbuf;
-
-    setToHandleSignal();
-
-    int server_fd = serverSetup();
+    int server_fd = serverSetup(brokerConfig());
     if (server_fd == 1)
     {
         std::cerr << "Couldn't setup server socket" << std::endl;
@@ -59,9 +65,20 @@ int main(int argc, char *argv[])
     // You can use print statements as follows for debugging, they'll be visible when running tests.
     std::cerr << "Logs from your program will appear here!\n";
 
+    size_t next_loop = 0;
+
     while (true)
     {
-        int client_fd = accept(server_fd, reinterpret_cast<struct sockaddr *>(&client_addr), &client_addr_len);
+        if (AdmissionControl::connectionsFull())
+        {
+            // Connections wait in the listen backlog until others close
+            std::this_thread::sleep_for(std::chrono::milliseconds(AdmissionControl::RETRY_MS));
+            if (!server_running)
+                break;
+            continue;
+        }
+
+        int client_fd = accept4(server_fd, reinterpret_cast<struct sockaddr *>(&client_addr), &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (client_fd == -1)
         {
             if (errno == EINTR)
@@ -74,13 +91,147 @@ int main(int argc, char *argv[])
                 exit(EXIT_FAILURE);
             }
         }
-        std::thread t([client_fd]()
-                      { setToBlockSignal();
-                        Client client(client_fd); });
-        t.detach();
+
+        if (!AdmissionControl::admitConnection(client_addr.sin_addr.s_addr))
+        {
+            close(client_fd);
+            BrokerMetrics::local().add(Counter::CONNECTIONS_REJECTED);
+            continue;
+        }
+
+        setupClientSocket(client_fd, brokerConfig());
+
+        EventLoop &loop = *network_loops[next_loop++ % network_loops.size()];
+        loop.post([client_fd, &loop, peer_addr = client_addr.sin_addr.s_addr]()
+                  { std::make_shared<Client>(client_fd, loop, peer_addr)->start(); });
         std::cout << "Client connected\n";
     }
 
     close(server_fd);
+}
+
+// Sleeps until SIGINT or SIGTERM
+void waitForInterrupt()
+{
+    sigset_t interrupt, previous;
+    sigemptyset(&interrupt);
+    sigaddset(&interrupt, SIGINT);
+    sigaddset(&interrupt, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &interrupt, &previous);
+    while (server_running)
+        sigsuspend(&previous);
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+// Lets every connection answer and send what it has in flight, for at most shutdown.drain.timeout.ms. Nothing new
+// is accepted or read meanwhile.
+void drainConnections(std::vector<std::unique_ptr<EventLoop>> &network_loops)
+{
+    if (ShardSet *shards = ShardSet::active())
+        shards->beginShutdown();
+    for (auto &loop : network_loops)
+        loop->post([&loop = *loop]()
+                   { loop.beginShutdown(); });
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(brokerConfig().shutdown_drain_timeout_ms);
+    while (AdmissionControl::connections() > 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(AdmissionControl::RETRY_MS));
+
+    if (AdmissionControl::connections() > 0)
+        std::cout << "Closing " << AdmissionControl::connections() << " connections with requests still in flight\n";
+}
+
+int main(int argc, char *argv[])
+{
+    // Disable output buffering
+    std::cout << std::unitbuf;
+    std::cerr << std::unitbuf;
+
+    setToHandleSignal();
+
+    auto config = BrokerConfig::fromCommandLine(argc, argv);
+    if (!config)
+        exit(EXIT_FAILURE);
+    setBrokerConfig(std::move(*config));
+
+    // Connections are spread round-robin over the network threads, each running its own event loop. With
+    // shard.count set the shards accept and serve them instead.
+    std::vector<std::unique_ptr<EventLoop>> network_loops;
+    std::vector<std::thread> network_threads;
+    const size_t network_thread_count = brokerConfig().shard_count == 0 ? brokerConfig().num_network_threads : 0;
+    for (size_t i = 0; i < network_thread_count; i++)
+    {
+        EventLoop &loop = *network_loops.emplace_back(std::make_unique<EventLoop>());
+        network_threads.emplace_back([&loop]()
+                                     { setToBlockSignal();
+                                       loop.run(); });
+    }
+
+    for (size_t i = 0; i < network_loops.size(); i++)
+    {
+        EventLoop &loop = *network_loops[i];
+        BrokerMetrics::registerGauge({.name = "kafka_network_pending_tasks", .help = "Tasks posted to a network thread and not run yet",
+                                      .labels = "thread=\"" + std::to_string(i) + "\"", .value = [&loop]()
+                                      { return static_cast<double>(loop.pendingTasks()); }});
+    }
+    BrokerMetrics::registerGauge({.name = "kafka_metadata_image_topics", .help = "Topics in the metadata image", .labels = "", .value = []()
+                                  { return static_cast<double>(MetadataImage::latestStats().topics); }});
+    BrokerMetrics::registerGauge({.name = "kafka_metadata_image_partitions", .help = "Partitions in the metadata image", .labels = "", .value = []()
+                                  { return static_cast<double>(MetadataImage::latestStats().partitions); }});
+    BrokerMetrics::registerGauge({.name = "kafka_metadata_image_bytes", .help = "Memory held by the metadata image indexes", .labels = "", .value = []()
+                                  { return static_cast<double>(MetadataImage::latestStats().memory_bytes); }});
+    BrokerMetrics::registerGauge({.name = "kafka_network_queued_request_bytes", .help = "Received request bytes not processed yet", .labels = "", .value = []()
+                                  { return static_cast<double>(AdmissionControl::queuedBytes()); }});
+    BrokerMetrics::registerGauge({.name = "kafka_buffer_pool_chunks", .help = "Connection buffer chunks mapped by the buffer pool", .labels = "", .value = []()
+                                  { return static_cast<double>(BufferPool::allocatedChunks()); }});
+    BrokerMetrics::registerGauge({.name = "kafka_buffer_pool_free_chunks", .help = "Buffer pool chunks free on the node lists", .labels = "", .value = []()
+                                  { return static_cast<double>(BufferPool::pooledChunks()); }});
+
+    // Log directory I/O, retention and cleaner threads run from the start, not from the first produce or fetch
+    LogManager::instance();
+    // Committed offsets are loaded before the first OffsetFetch can ask for them
+    GroupCoordinator::instance();
+
+    // Prometheus endpoint, only when metrics.port is set
+    std::unique_ptr<MetricsServer> metrics_server;
+    if (brokerConfig().metrics_port != 0)
+    {
+        metrics_server = std::make_unique<MetricsServer>(brokerConfig().metrics_port);
+        if (!metrics_server->start())
+        {
+            std::cerr << "Couldn't serve metrics on port " << brokerConfig().metrics_port << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (brokerConfig().shard_count > 0)
+    {
+        if (!ShardSet::start(brokerConfig().shard_count))
+            exit(EXIT_FAILURE);
+        std::cout << "Waiting for a client to connect...\n";
+
+        waitForInterrupt();
+    }
+    else
+    {
+        acceptConnections(network_loops);
+    }
+
+    // Offsets are appended through the log directory threads or the shards, so those stop last
+    drainConnections(network_loops);
+    GroupCoordinator::instance().shutdown();
+    if (ShardSet *shards = ShardSet::active())
+        shards->stop();
+    for (auto &loop : network_loops)
+        loop->stop();
+    for (auto &thread : network_threads)
+        thread.join();
+    LogManager::instance().shutdown();
+
+    if (metrics_server != nullptr)
+        metrics_server->stop();
+
+    BrokerMetrics::dump(std::cout);
+
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file
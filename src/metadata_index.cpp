@@ -0,0 +1,426 @@
+#include "metadata_index.h"
+#include "log_parsing.h"
+#include "broker_config.h"
+#include "event_loop.h"
+
+static constexpr uint64_t HASH_MULTIPLIER = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t mixHash(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+uint64_t hashBytes(const char *data, size_t len)
+{
+    uint64_t hash = len * HASH_MULTIPLIER;
+    uint64_t chunk;
+
+    // 8 bytes per step, topic names are short so this is usually 1-4 multiplies
+    while (len >= sizeof(chunk))
+    {
+        std::memcpy(&chunk, data, sizeof(chunk));
+        hash = (hash ^ chunk) * HASH_MULTIPLIER;
+        hash ^= hash >> 29;
+        data += sizeof(chunk);
+        len -= sizeof(chunk);
+    }
+
+    if (len > 0)
+    {
+        chunk = 0;
+        std::memcpy(&chunk, data, len);
+        hash = (hash ^ chunk) * HASH_MULTIPLIER;
+    }
+
+    return mixHash(hash);
+}
+
+uint64_t hashUUID(const UUID &uuid)
+{
+    uint64_t high, low;
+    std::memcpy(&high, uuid.data(), sizeof(high));
+    std::memcpy(&low, uuid.data() + sizeof(high), sizeof(low));
+    return mixHash(high ^ (low * HASH_MULTIPLIER));
+}
+
+uint32_t StringInterner::find(std::string_view str) const
+{
+    if (slots.empty())
+        return NOT_FOUND;
+
+    const uint64_t hash = hashBytes(str.data(), str.size());
+    const size_t mask = slots.size() - 1;
+
+    for (size_t slot = hash & mask; slots[slot] != 0; slot = (slot + 1) & mask)
+    {
+        const uint32_t id = slots[slot] - 1;
+        if (entries[id].hash == hash && view(id) == str)
+            return id;
+    }
+
+    return NOT_FOUND;
+}
+
+uint32_t StringInterner::intern(std::string_view str)
+{
+    uint32_t id = find(str);
+    if (id != NOT_FOUND)
+        return id;
+
+    // Keep load factor at or below 1/2 so probe sequences stay short
+    if ((entries.size() + 1) * 2 > slots.size())
+        grow();
+
+    id = entries.size();
+    entries.push_back({.hash = hashBytes(str.data(), str.size()),
+                       .offset = static_cast<uint32_t>(arena.size()),
+                       .length = static_cast<uint32_t>(str.size())});
+    arena.insert(arena.end(), str.begin(), str.end());
+
+    const size_t mask = slots.size() - 1;
+    size_t slot = entries[id].hash & mask;
+    while (slots[slot] != 0)
+        slot = (slot + 1) & mask;
+    slots[slot] = id + 1;
+
+    return id;
+}
+
+size_t StringInterner::memoryBytes() const
+{
+    return arena.capacity() + entries.capacity() * sizeof(Entry) + slots.capacity() * sizeof(uint32_t);
+}
+
+void StringInterner::grow()
+{
+    slots.assign(std::max<size_t>(16, slots.size() * 2), 0);
+
+    const size_t mask = slots.size() - 1;
+    for (uint32_t id = 0; id < entries.size(); id++)
+    {
+        size_t slot = entries[id].hash & mask;
+        while (slots[slot] != 0)
+            slot = (slot + 1) & mask;
+        slots[slot] = id + 1;
+    }
+}
+
+void MetadataImage::addTopic(std::string_view name, const UUID &topic_id)
+{
+    const uint32_t name_id = names.intern(name);
+
+    if (name_id < topic_by_name.size() && topic_by_name[name_id] != NO_TOPIC)
+    {
+        // Topic re-created under the same name, latest TopicRecord wins
+        topics[topic_by_name[name_id]].topic_id = topic_id;
+        return;
+    }
+
+    // Names interned for a topic config may not have a topic (yet)
+    if (name_id >= topic_by_name.size())
+        topic_by_name.resize(name_id + 1, NO_TOPIC);
+    topic_by_name[name_id] = topics.size();
+    topics.push_back({.topic_id = topic_id, .name_id = name_id, .partitions_begin = 0, .partitions_count = 0});
+}
+
+void MetadataImage::addPartition(const UUID &topic_id, int32_t partition_index, int32_t leader_id, int32_t leader_epoch,
+                                 const std::vector<int32_t> &replica_nodes, const std::vector<int32_t> &isr_nodes)
+{
+    PartitionMetadata partition = {.partition_index = partition_index,
+                                   .leader_id = leader_id,
+                                   .leader_epoch = leader_epoch,
+                                   .replica_nodes_begin = static_cast<uint32_t>(nodes.size()),
+                                   .replica_nodes_count = static_cast<uint32_t>(replica_nodes.size()),
+                                   .isr_nodes_begin = static_cast<uint32_t>(nodes.size() + replica_nodes.size()),
+                                   .isr_nodes_count = static_cast<uint32_t>(isr_nodes.size())};
+
+    nodes.insert(nodes.end(), replica_nodes.begin(), replica_nodes.end());
+    nodes.insert(nodes.end(), isr_nodes.begin(), isr_nodes.end());
+    pending_partitions.push_back({topic_id, partition});
+}
+
+void MetadataImage::setTopicConfig(std::string_view topic_name, std::string_view name, std::optional<std::string_view> value)
+{
+    if (name != "cleanup.policy")
+        return;
+
+    const uint32_t name_id = names.intern(topic_name);
+    if (name_id >= cleanup_policies.size())
+        cleanup_policies.resize(name_id + 1, 0);
+    cleanup_policies[name_id] = value ? parseCleanupPolicy(*value).value_or(0) : 0;
+}
+
+size_t MetadataImage::memoryBytes() const
+{
+    return sizeof(*this) + names.memoryBytes() + topics.capacity() * sizeof(TopicMetadata) +
+           (topic_by_name.capacity() + uuid_slots.capacity() + topics_by_rank.capacity()) * sizeof(uint32_t) +
+           partitions.capacity() * sizeof(PartitionMetadata) + nodes.capacity() * sizeof(int32_t) + cleanup_policies.capacity() +
+           pending_partitions.capacity() * sizeof(PendingPartition) + encoded_topics.capacity() * sizeof(WireWriter);
+}
+
+void MetadataImage::finalize()
+{
+    // UUID table
+    size_t capacity = 16;
+    while (capacity < topics.size() * 2)
+        capacity *= 2;
+    uuid_slots.assign(capacity, 0);
+
+    const size_t mask = uuid_slots.size() - 1;
+    for (uint32_t topic_idx = 0; topic_idx < topics.size(); topic_idx++)
+    {
+        size_t slot = hashUUID(topics[topic_idx].topic_id) & mask;
+        while (uuid_slots[slot] != 0)
+            slot = (slot + 1) & mask;
+        uuid_slots[slot] = topic_idx + 1;
+    }
+
+    // Group partitions per topic so each topic owns one contiguous run sorted by partition index
+    std::vector<std::pair<uint32_t, PartitionMetadata>> resolved;
+    resolved.reserve(pending_partitions.size());
+    for (auto &pending : pending_partitions)
+    {
+        const TopicMetadata *topic = findTopic(pending.topic_id);
+        if (topic == nullptr)
+            continue; // Partition of a topic we have no TopicRecord for (or of a deleted incarnation)
+
+        resolved.push_back({static_cast<uint32_t>(topic - topics.data()), pending.partition});
+    }
+
+    std::stable_sort(resolved.begin(), resolved.end(), [](const auto &a, const auto &b)
+                     { return std::tie(a.first, a.second.partition_index) < std::tie(b.first, b.second.partition_index); });
+
+    partitions.clear();
+    partitions.reserve(resolved.size());
+    for (size_t i = 0; i < resolved.size(); i++)
+    {
+        auto &[topic_idx, partition] = resolved[i];
+
+        // Later PartitionRecords for the same partition supersede earlier ones
+        if (i + 1 < resolved.size() && resolved[i + 1].first == topic_idx &&
+            resolved[i + 1].second.partition_index == partition.partition_index)
+            continue;
+
+        TopicMetadata &topic = topics[topic_idx];
+        if (topic.partitions_count == 0)
+            topic.partitions_begin = partitions.size();
+        topic.partitions_count++;
+        partitions.push_back(partition);
+    }
+
+    pending_partitions.clear();
+    pending_partitions.shrink_to_fit();
+
+    encoded_topics_once = std::make_unique<std::once_flag[]>(topics.size());
+    encoded_topics.resize(topics.size());
+
+    topics_by_rank.resize(topics.size());
+    std::iota(topics_by_rank.begin(), topics_by_rank.end(), 0);
+    std::sort(topics_by_rank.begin(), topics_by_rank.end(), [this](uint32_t a, uint32_t b)
+              { return topicName(topics[a]) < topicName(topics[b]); });
+}
+
+size_t MetadataImage::topicRankLowerBound(std::string_view name) const
+{
+    auto it = std::lower_bound(topics_by_rank.begin(), topics_by_rank.end(), name, [this](uint32_t topic_idx, std::string_view value)
+                               { return topicName(topics[topic_idx]) < value; });
+    return it - topics_by_rank.begin();
+}
+
+const TopicMetadata *MetadataImage::findTopic(std::string_view name) const
+{
+    const uint32_t name_id = names.find(name);
+    if (name_id == StringInterner::NOT_FOUND || name_id >= topic_by_name.size() || topic_by_name[name_id] == NO_TOPIC)
+        return nullptr;
+
+    return &topics[topic_by_name[name_id]];
+}
+
+const TopicMetadata *MetadataImage::findTopic(const UUID &topic_id) const
+{
+    if (uuid_slots.empty())
+        return nullptr;
+
+    const size_t mask = uuid_slots.size() - 1;
+    for (size_t slot = hashUUID(topic_id) & mask; uuid_slots[slot] != 0; slot = (slot + 1) & mask)
+    {
+        const TopicMetadata &topic = topics[uuid_slots[slot] - 1];
+        if (topic.topic_id == topic_id)
+            return &topic;
+    }
+
+    return nullptr;
+}
+
+const PartitionMetadata *MetadataImage::findPartition(const TopicMetadata &topic, int32_t partition_index) const
+{
+    auto topic_partitions = topicPartitions(topic);
+    auto partition = std::lower_bound(topic_partitions.begin(), topic_partitions.end(), partition_index, [](const PartitionMetadata &p, int32_t index)
+                                      { return p.partition_index < index; });
+
+    if (partition == topic_partitions.end() || partition->partition_index != partition_index)
+        return nullptr;
+
+    return &*partition;
+}
+
+static std::atomic<size_t> latest_topics = 0;
+static std::atomic<size_t> latest_partitions = 0;
+static std::atomic<size_t> latest_memory_bytes = 0;
+
+struct SegmentFile
+{
+    std::string path;
+    off_t size;
+    timespec mtime;
+
+    bool operator==(const SegmentFile &other) const
+    {
+        return path == other.path && size == other.size && mtime.tv_sec == other.mtime.tv_sec && mtime.tv_nsec == other.mtime.tv_nsec;
+    }
+};
+
+// Non-empty segment files of partition_dir in offset order, names are zero padded so that is name order
+static std::vector<SegmentFile> listSegments(const std::string &partition_dir)
+{
+    std::vector<SegmentFile> segments;
+
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(partition_dir, error))
+    {
+        if (entry.path().extension() != ".log")
+            continue;
+
+        struct stat segment_stat{};
+        if (stat(entry.path().c_str(), &segment_stat) != 0 || segment_stat.st_size == 0)
+            continue;
+        segments.push_back({.path = entry.path().string(), .size = segment_stat.st_size, .mtime = segment_stat.st_mtim});
+    }
+
+    std::sort(segments.begin(), segments.end(), [](const SegmentFile &a, const SegmentFile &b)
+              { return a.path < b.path; });
+    return segments;
+}
+
+// Records of later segments refer to topics of earlier ones, they all go into the same image
+static std::shared_ptr<const MetadataImage> buildImage(const std::vector<SegmentFile> &segments)
+{
+    auto image = std::make_shared<MetadataImage>();
+    for (const SegmentFile &segment : segments)
+    {
+        LogParser log_parser(segment.path);
+        log_parser.loadMetadataImage(*image);
+    }
+    image->finalize();
+
+    latest_topics.store(image->topicCount(), std::memory_order_relaxed);
+    latest_partitions.store(image->partitionCount(), std::memory_order_relaxed);
+    latest_memory_bytes.store(image->memoryBytes(), std::memory_order_relaxed);
+    return image;
+}
+
+// The image requests read. published_version moves after every store, readers only go back to published_image when
+// it did and otherwise keep the copy they loaded last.
+static std::atomic<std::shared_ptr<const MetadataImage>> published_image;
+static std::atomic<uint64_t> published_version = 0;
+
+static void publish(std::shared_ptr<const MetadataImage> image)
+{
+    published_image.store(std::move(image));
+    published_version.fetch_add(1, std::memory_order_release);
+}
+
+// Watches the metadata log from a thread of its own: the segments are stat()ed every REFRESH_INTERVAL_MS and a
+// changed log is parsed into a new image, requests go on with the old one meanwhile. Never destroyed, the thread
+// lives until the process exits.
+struct MetadataRefresher
+{
+    static constexpr int64_t REFRESH_INTERVAL_MS = 100;
+
+    std::string partition_dir = brokerConfig().metadataPartitionDir(); // Only touched on the loop thread once started
+    std::vector<SegmentFile> segments = listSegments(partition_dir);
+    EventLoop loop;
+    CallbackTimer timer{[this]()
+                        { refresh(); }};
+
+    void refresh()
+    {
+        std::vector<SegmentFile> latest = listSegments(partition_dir);
+        if (latest != segments)
+        {
+            publish(buildImage(latest));
+            segments = std::move(latest);
+        }
+        loop.schedule(timer, REFRESH_INTERVAL_MS);
+    }
+
+    static MetadataRefresher &instance()
+    {
+        static std::once_flag started;
+        static MetadataRefresher *refresher = nullptr;
+        std::call_once(started, []()
+                       { refresher = start(); });
+        return *refresher;
+    }
+
+private:
+    static MetadataRefresher *start()
+    {
+        // The first image is built by the first caller, nothing could be served without it
+        MetadataRefresher &refresher = *new MetadataRefresher();
+        publish(buildImage(refresher.segments));
+        refresher.loop.post([&refresher]()
+                            { refresher.loop.schedule(refresher.timer, REFRESH_INTERVAL_MS); });
+
+        spawnWorkerThread([&refresher]()
+                          { refresher.loop.run(); })
+            .detach();
+        return &refresher;
+    }
+};
+
+std::shared_ptr<const MetadataImage> MetadataImage::current()
+{
+    thread_local uint64_t cached_version = 0;
+    thread_local std::shared_ptr<const MetadataImage> cached_image;
+
+    uint64_t version = published_version.load(std::memory_order_acquire);
+    if (version == 0)
+    {
+        MetadataRefresher::instance();
+        version = published_version.load(std::memory_order_acquire);
+    }
+
+    if (version != cached_version)
+    {
+        cached_image = published_image.load();
+        cached_version = version;
+    }
+    return cached_image;
+}
+
+void MetadataImage::reload()
+{
+    // On the refresher's thread, so it can't publish an image of the old directory after this one
+    MetadataRefresher &refresher = MetadataRefresher::instance();
+    std::promise<void> done;
+    refresher.loop.post([&refresher, &done]()
+                        {
+                            refresher.partition_dir = brokerConfig().metadataPartitionDir();
+                            refresher.segments = listSegments(refresher.partition_dir);
+                            publish(buildImage(refresher.segments));
+                            done.set_value(); });
+    done.get_future().wait();
+}
+
+MetadataImage::Stats MetadataImage::latestStats()
+{
+    return {.topics = latest_topics.load(std::memory_order_relaxed),
+            .partitions = latest_partitions.load(std::memory_order_relaxed),
+            .memory_bytes = latest_memory_bytes.load(std::memory_order_relaxed)};
+}
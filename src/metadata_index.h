@@ -0,0 +1,152 @@
+#pragma once
+
+#include "common.h"
+#include "wire_buffer.h"
+
+// Fast 64-bit hashes used by the metadata index, all names and ids are hashed without allocating
+uint64_t hashBytes(const char *data, size_t len);
+uint64_t hashUUID(const UUID &uuid);
+
+// Stores every distinct topic name once in a contiguous arena and hands out dense ids
+class StringInterner
+{
+public:
+    static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+    StringInterner() = default;
+    uint32_t intern(std::string_view str);
+    uint32_t find(std::string_view str) const;
+    std::string_view view(uint32_t id) const { return {arena.data() + entries[id].offset, entries[id].length}; }
+    size_t size() const { return entries.size(); }
+    size_t memoryBytes() const;
+
+private:
+    struct Entry
+    {
+        uint64_t hash;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    void grow();
+
+    std::vector<char> arena;
+    std::vector<Entry> entries;
+    std::vector<uint32_t> slots; // Open addressing (linear probing), holds id + 1 or 0 when empty
+};
+
+struct PartitionMetadata
+{
+    int32_t partition_index;
+    int32_t leader_id;
+    int32_t leader_epoch;
+    uint32_t replica_nodes_begin; // Offset into MetadataImage node array
+    uint32_t replica_nodes_count;
+    uint32_t isr_nodes_begin;
+    uint32_t isr_nodes_count;
+};
+
+struct TopicMetadata
+{
+    UUID topic_id;
+    uint32_t name_id;
+    uint32_t partitions_begin; // Offset into MetadataImage partition array, sorted by partition_index
+    uint32_t partitions_count;
+};
+
+// Immutable snapshot of the cluster metadata log, indexed by topic name and by topic UUID.
+// Partitions of all topics live in one flat array (and replica/ISR ids in another) so a lookup
+// touches a handful of cache lines and never allocates.
+class MetadataImage
+{
+public:
+    MetadataImage() = default;
+
+    // Builder interface, only valid before finalize()
+    void addTopic(std::string_view name, const UUID &topic_id);
+    void addPartition(const UUID &topic_id, int32_t partition_index, int32_t leader_id, int32_t leader_epoch,
+                      const std::vector<int32_t> &replica_nodes, const std::vector<int32_t> &isr_nodes);
+    // Topic level config, keyed by topic name like Kafka's ConfigRecord. Only cleanup.policy is kept, a null value removes it.
+    void setTopicConfig(std::string_view topic_name, std::string_view name, std::optional<std::string_view> value);
+    void finalize();
+
+    const TopicMetadata *findTopic(std::string_view name) const;
+    const TopicMetadata *findTopic(const UUID &topic_id) const;
+    const PartitionMetadata *findPartition(const TopicMetadata &topic, int32_t partition_index) const;
+
+    std::string_view topicName(const TopicMetadata &topic) const { return names.view(topic.name_id); }
+    // CleanupPolicy bits of the topic's cleanup.policy, 0 when it has none (the broker default applies)
+    uint8_t cleanupPolicy(const TopicMetadata &topic) const
+    {
+        return topic.name_id < cleanup_policies.size() ? cleanup_policies[topic.name_id] : 0;
+    }
+    std::span<const PartitionMetadata> topicPartitions(const TopicMetadata &topic) const
+    {
+        return {partitions.data() + topic.partitions_begin, topic.partitions_count};
+    }
+    std::span<const int32_t> replicaNodes(const PartitionMetadata &partition) const
+    {
+        return {nodes.data() + partition.replica_nodes_begin, partition.replica_nodes_count};
+    }
+    std::span<const int32_t> isrNodes(const PartitionMetadata &partition) const
+    {
+        return {nodes.data() + partition.isr_nodes_begin, partition.isr_nodes_count};
+    }
+
+    // Name ordered view of the topics, used to page through them with a cursor
+    size_t topicRankLowerBound(std::string_view name) const;
+    const TopicMetadata &topicByRank(size_t rank) const { return topics[topics_by_rank[rank]]; }
+
+    size_t topicCount() const { return topics.size(); }
+    size_t partitionCount() const { return partitions.size(); }
+    // Footprint of the indexes, not counting memoized topic encodings
+    size_t memoryBytes() const;
+
+    // Memoized wire encoding of a topic, built by encode() on first use and dropped together with the image
+    template <typename Encoder>
+    const WireWriter &encodedTopic(const TopicMetadata &topic, Encoder &&encode) const
+    {
+        const size_t topic_idx = &topic - topics.data();
+        std::call_once(encoded_topics_once[topic_idx], [&]()
+                       { encode(encoded_topics[topic_idx]); });
+        return encoded_topics[topic_idx];
+    }
+
+    // Process-wide image of the metadata log, every segment of the metadata partition directory in offset order.
+    // Parsed on first use, then rebuilt in the background once a segment is added, removed or changed. Takes no lock,
+    // a thread only touches the shared image when a new one was published since its last call.
+    static std::shared_ptr<const MetadataImage> current();
+    // Rebuilds the image from metadata.log.dir as brokerConfig() has it now and waits for it, for tools that point
+    // the config at another log. The broker never changes it.
+    static void reload();
+
+    struct Stats
+    {
+        size_t topics;
+        size_t partitions;
+        size_t memory_bytes;
+    };
+    // Size of the image built last
+    static Stats latestStats();
+
+private:
+    struct PendingPartition
+    {
+        UUID topic_id;
+        PartitionMetadata partition;
+    };
+
+    StringInterner names;
+    std::vector<TopicMetadata> topics;
+    static constexpr uint32_t NO_TOPIC = UINT32_MAX;
+    std::vector<uint32_t> topic_by_name; // name_id -> index into topics, NO_TOPIC for names only a config refers to
+    std::vector<uint32_t> uuid_slots;    // Open addressing (linear probing), holds topic index + 1 or 0 when empty
+    std::vector<uint32_t> topics_by_rank; // Topic indexes sorted by name
+    std::vector<PartitionMetadata> partitions;
+    std::vector<int32_t> nodes;
+    std::vector<PendingPartition> pending_partitions;
+    std::vector<uint8_t> cleanup_policies; // name_id -> CleanupPolicy bits
+
+    mutable std::unique_ptr<std::once_flag[]> encoded_topics_once;
+    mutable std::vector<WireWriter> encoded_topics;
+};
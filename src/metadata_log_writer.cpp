@@ -0,0 +1,142 @@
+#include "metadata_log_writer.h"
+#include "crc32c.h"
+
+// Record value header: frame_version, type, version
+static void writeRecordHeader(WireWriter &value, int8_t type, int8_t version)
+{
+    const int8_t header[] = {1, type, version};
+    value.write(header, sizeof(header));
+}
+
+static void writeCompactString(WireWriter &writer, std::string_view str)
+{
+    writer.writeUnsignedVarint(str.size() + 1);
+    writer.write(str.data(), str.size());
+}
+
+static void writeCompactInt32Array(WireWriter &writer, std::span<const int32_t> values)
+{
+    writer.writeUnsignedVarint(values.size() + 1);
+    for (int32_t value : values)
+        writer.writeBigEndian(value);
+}
+
+MetadataLogWriter::MetadataLogWriter(int32_t max_records_per_batch_)
+    : max_records_per_batch(max_records_per_batch_), batch_record_count(0), next_offset(0)
+{
+    timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void MetadataLogWriter::addFeatureLevel(std::string_view name, int16_t feature_level)
+{
+    WireWriter value;
+    writeRecordHeader(value, 12, 0);
+    writeCompactString(value, name);
+    value.writeBigEndian(feature_level);
+    value.writeUnsignedVarint(0);
+    addRecord(value);
+}
+
+void MetadataLogWriter::addTopic(std::string_view name, const UUID &topic_id)
+{
+    WireWriter value;
+    writeRecordHeader(value, 2, 0);
+    writeCompactString(value, name);
+    value.write(topic_id.data(), topic_id.size());
+    value.writeUnsignedVarint(0);
+    addRecord(value);
+}
+
+void MetadataLogWriter::addPartition(const UUID &topic_id, int32_t partition_index, int32_t leader_id, int32_t leader_epoch,
+                                     std::span<const int32_t> replica_nodes, std::span<const int32_t> isr_nodes)
+{
+    WireWriter value;
+    writeRecordHeader(value, 3, 1);
+    value.writeBigEndian(partition_index);
+    value.write(topic_id.data(), topic_id.size());
+    writeCompactInt32Array(value, replica_nodes);
+    writeCompactInt32Array(value, isr_nodes);
+    writeCompactInt32Array(value, {}); // Removing replicas
+    writeCompactInt32Array(value, {}); // Adding replicas
+    value.writeBigEndian(leader_id);
+    value.writeBigEndian(leader_epoch);
+    value.writeBigEndian<int32_t>(0); // partition_epoch
+    value.writeUnsignedVarint(1);     // No directories
+    value.writeUnsignedVarint(0);
+    addRecord(value);
+}
+
+void MetadataLogWriter::addTopicConfig(std::string_view topic_name, std::string_view name, std::string_view config_value)
+{
+    constexpr int8_t TOPIC_RESOURCE = 2;
+
+    WireWriter value;
+    writeRecordHeader(value, 4, 0);
+    value.write(&TOPIC_RESOURCE, sizeof(TOPIC_RESOURCE));
+    writeCompactString(value, topic_name);
+    writeCompactString(value, name);
+    writeCompactString(value, config_value);
+    value.writeUnsignedVarint(0);
+    addRecord(value);
+}
+
+void MetadataLogWriter::addRecord(const WireWriter &value)
+{
+    WireWriter record;
+    record.write("\0", 1);                 // attributes
+    record.writeVarint(0);                 // timestamp_delta
+    record.writeVarint(batch_record_count); // offset_delta
+    record.writeVarint(-1);                // Null key
+    record.writeVarint(value.size());
+    record.write(value.bytes(), value.size());
+    record.writeUnsignedVarint(0); // No headers
+
+    batch_records.writeVarint(record.size());
+    batch_records.write(record.bytes(), record.size());
+
+    if (++batch_record_count == max_records_per_batch)
+        endBatch();
+}
+
+void MetadataLogWriter::endBatch()
+{
+    if (batch_record_count == 0)
+        return;
+
+    WireWriter crc_covered;
+    crc_covered.writeBigEndian<int16_t>(0); // attributes
+    crc_covered.writeBigEndian<int32_t>(batch_record_count - 1);
+    crc_covered.writeBigEndian(timestamp);
+    crc_covered.writeBigEndian(timestamp);
+    crc_covered.writeBigEndian<int64_t>(-1); // producer_id
+    crc_covered.writeBigEndian<int16_t>(-1); // producer_epoch
+    crc_covered.writeBigEndian<int32_t>(-1); // base_sequence
+    crc_covered.writeBigEndian(batch_record_count);
+    crc_covered.write(batch_records.bytes(), batch_records.size());
+
+    log.writeBigEndian(next_offset);
+    log.writeBigEndian<int32_t>(sizeof(int32_t) + 1 + sizeof(uint32_t) + crc_covered.size());
+    log.writeBigEndian<int32_t>(1); // partition_leader_epoch
+    log.write("\x02", 1);           // magic
+    log.writeBigEndian(crc32c(crc_covered.bytes(), crc_covered.size()));
+    log.write(crc_covered.bytes(), crc_covered.size());
+
+    next_offset += batch_record_count;
+    batch_record_count = 0;
+    batch_records.clear();
+}
+
+const WireWriter &MetadataLogWriter::bytes()
+{
+    endBatch();
+    return log;
+}
+
+bool MetadataLogWriter::writeFile(const std::string &path)
+{
+    endBatch();
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(log.bytes(), log.size());
+    return file.good();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common.h"
+#include "wire_buffer.h"
+
+// Encodes cluster metadata records into v2 RecordBatches laid out like a __cluster_metadata segment,
+// for tools and benchmarks that need a synthetic metadata log
+class MetadataLogWriter
+{
+public:
+    static constexpr int32_t DEFAULT_MAX_RECORDS_PER_BATCH = 1000;
+
+    explicit MetadataLogWriter(int32_t max_records_per_batch_ = DEFAULT_MAX_RECORDS_PER_BATCH);
+
+    void addFeatureLevel(std::string_view name, int16_t feature_level);
+    void addTopic(std::string_view name, const UUID &topic_id);
+    void addPartition(const UUID &topic_id, int32_t partition_index, int32_t leader_id, int32_t leader_epoch,
+                      std::span<const int32_t> replica_nodes, std::span<const int32_t> isr_nodes);
+    void addTopicConfig(std::string_view topic_name, std::string_view name, std::string_view value);
+
+    // Closes the batch being filled, the next record starts a new one
+    void endBatch();
+
+    // Every batch so far (after closing the open one)
+    const WireWriter &bytes();
+    bool writeFile(const std::string &path);
+
+private:
+    void addRecord(const WireWriter &value);
+
+    int32_t max_records_per_batch;
+    WireWriter log;
+    WireWriter batch_records;
+    int32_t batch_record_count;
+    int64_t next_offset;
+    int64_t timestamp;
+};
@@ -0,0 +1,160 @@
+#include "metrics.h"
+#include "kafka_utils.h"
+
+std::mutex BrokerMetrics::registry_mutex;
+std::vector<std::unique_ptr<ThreadMetrics>> BrokerMetrics::registry;
+std::deque<CallbackGauge> BrokerMetrics::callback_gauges;
+
+void HistogramSnapshot::add(const LatencyHistogram &histogram)
+{
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        const uint64_t count = histogram.counts[i].load(std::memory_order_relaxed);
+        counts[i] += count;
+        total_count += count;
+    }
+    sum_ns += histogram.sum_ns.load(std::memory_order_relaxed);
+    max_ns = std::max(max_ns, histogram.max_ns.load(std::memory_order_relaxed));
+}
+
+uint64_t HistogramSnapshot::percentile(double quantile) const
+{
+    if (total_count == 0)
+        return 0;
+
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(quantile * total_count)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+            return std::min(LatencyHistogram::bucketUpperBound(i), max_ns);
+    }
+    return max_ns;
+}
+
+ThreadMetrics::~ThreadMetrics()
+{
+    for (auto &api : apis)
+        delete api.load();
+}
+
+ApiMetrics &ThreadMetrics::api(int16_t api_key)
+{
+    ApiMetrics *metrics = apis[api_key].load(std::memory_order_relaxed);
+    if (metrics == nullptr)
+    {
+        // Published with release so a concurrent snapshot sees it fully constructed
+        metrics = new ApiMetrics();
+        apis[api_key].store(metrics, std::memory_order_release);
+    }
+    return *metrics;
+}
+
+ThreadMetrics &BrokerMetrics::local()
+{
+    thread_local ThreadMetrics *metrics = []()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        return registry.emplace_back(std::make_unique<ThreadMetrics>()).get();
+    }();
+    return *metrics;
+}
+
+std::vector<ApiSnapshot> BrokerMetrics::snapshot()
+{
+    std::vector<ApiSnapshot> snapshots;
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+
+    for (int16_t api_key = 0; api_key <= ThreadMetrics::MAX_API_KEY; api_key++)
+    {
+        ApiSnapshot snapshot = {.api_key = api_key, .stages = {}, .requests = 0, .request_bytes = 0, .response_bytes = 0};
+        bool seen = false;
+
+        for (auto &thread_metrics : registry)
+        {
+            const ApiMetrics *metrics = thread_metrics->findApi(api_key);
+            if (metrics == nullptr)
+                continue;
+
+            seen = true;
+            for (size_t stage = 0; stage < REQUEST_STAGES; stage++)
+                snapshot.stages[stage].add(metrics->stages[stage]);
+            snapshot.requests += metrics->requests.load(std::memory_order_relaxed);
+            snapshot.request_bytes += metrics->request_bytes.load(std::memory_order_relaxed);
+            snapshot.response_bytes += metrics->response_bytes.load(std::memory_order_relaxed);
+        }
+
+        if (seen)
+            snapshots.push_back(std::move(snapshot));
+    }
+
+    return snapshots;
+}
+
+std::array<uint64_t, COUNTERS> BrokerMetrics::counters()
+{
+    std::array<uint64_t, COUNTERS> totals{};
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto &thread_metrics : registry)
+        for (size_t i = 0; i < COUNTERS; i++)
+            totals[i] += thread_metrics->counters[i].load(std::memory_order_relaxed);
+    return totals;
+}
+
+std::array<int64_t, GAUGES> BrokerMetrics::gauges()
+{
+    std::array<int64_t, GAUGES> totals{};
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto &thread_metrics : registry)
+        for (size_t i = 0; i < GAUGES; i++)
+            totals[i] += thread_metrics->gauges[i].load(std::memory_order_relaxed);
+    return totals;
+}
+
+void BrokerMetrics::registerGauge(CallbackGauge gauge)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    callback_gauges.push_back(std::move(gauge));
+}
+
+std::vector<std::pair<const CallbackGauge *, double>> BrokerMetrics::callbackGauges()
+{
+    std::vector<std::pair<const CallbackGauge *, double>> values;
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto &gauge : callback_gauges)
+        values.emplace_back(&gauge, gauge.value());
+    return values;
+}
+
+void BrokerMetrics::dump(std::ostream &out)
+{
+    auto micros = [](uint64_t ns)
+    { return ns / 1000.0; };
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+
+    for (auto &snapshot : snapshot())
+    {
+        ss << apiName(snapshot.api_key) << ": requests=" << snapshot.requests << " request_bytes=" << snapshot.request_bytes
+           << " response_bytes=" << snapshot.response_bytes << "\n";
+
+        for (size_t stage = 0; stage < REQUEST_STAGES; stage++)
+        {
+            const HistogramSnapshot &histogram = snapshot.stages[stage];
+            if (histogram.count() == 0)
+                continue;
+
+            ss << "  " << REQUEST_STAGE_NAMES[stage] << " us: p50=" << micros(histogram.percentile(0.5))
+               << " p99=" << micros(histogram.percentile(0.99)) << " p999=" << micros(histogram.percentile(0.999))
+               << " max=" << micros(histogram.max()) << " count=" << histogram.count() << "\n";
+        }
+    }
+
+    out << ss.str();
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "common.h"
+
+inline uint64_t monotonicNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Wall clock in epoch milliseconds, as record and commit timestamps are
+inline int64_t wallClockMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Counter with a single writing thread, bumped without a locked instruction and read from any thread
+inline void bumpCounter(std::atomic<uint64_t> &counter, uint64_t amount = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// Gauge with a single writing thread, kept as that thread's running sum of changes
+inline void addToGauge(std::atomic<int64_t> &gauge, int64_t delta)
+{
+    gauge.store(gauge.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+// Log-linear latency histogram in the spirit of HdrHistogram: every power of two range is split into SUB_BUCKETS
+// linear buckets, so a value is reported at most 1/SUB_BUCKETS too high. Recording is a few arithmetic instructions
+// and relaxed stores, written by one thread and read by any.
+class LatencyHistogram
+{
+public:
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int MAX_VALUE_BITS = 40; // Nanoseconds, a little over 18 minutes
+    static constexpr int BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    void record(uint64_t value_ns)
+    {
+        bumpCounter(counts[bucketIndex(value_ns)]);
+        bumpCounter(sum_ns, value_ns);
+        if (value_ns > max_ns.load(std::memory_order_relaxed))
+            max_ns.store(value_ns, std::memory_order_relaxed);
+    }
+
+    static size_t bucketIndex(uint64_t value)
+    {
+        value = std::min(value, (uint64_t(1) << MAX_VALUE_BITS) - 1);
+        if (value < SUB_BUCKETS)
+            return value;
+
+        const int shift = std::bit_width(value) - SUB_BUCKET_BITS - 1;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+    }
+
+    // Largest value that falls into bucket index
+    static uint64_t bucketUpperBound(size_t index)
+    {
+        if (index < SUB_BUCKETS)
+            return index;
+
+        const int shift = index / SUB_BUCKETS - 1;
+        return ((SUB_BUCKETS + index % SUB_BUCKETS + 1) << shift) - 1;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> counts{};
+    std::atomic<uint64_t> sum_ns = 0;
+    std::atomic<uint64_t> max_ns = 0;
+
+    friend class HistogramSnapshot;
+};
+
+// Sum of LatencyHistograms taken at one point in time
+class HistogramSnapshot
+{
+public:
+    void add(const LatencyHistogram &histogram);
+
+    uint64_t count() const { return total_count; }
+    uint64_t sum() const { return sum_ns; }
+    uint64_t max() const { return max_ns; }
+    // Upper bound of the bucket holding the quantile (0 < quantile <= 1), 0 when empty
+    uint64_t percentile(double quantile) const;
+
+private:
+    std::array<uint64_t, LatencyHistogram::BUCKETS> counts{};
+    uint64_t total_count = 0;
+    uint64_t sum_ns = 0;
+    uint64_t max_ns = 0;
+};
+
+// Where the time of a request goes, from its first byte arriving to the last byte of its response leaving
+enum class RequestStage
+{
+    RECEIVE, // First byte of the frame read until the whole frame is buffered
+    DECODE,  // Frame to request objects
+    HANDLE,  // process* handler
+    DELAY,   // Parked in a purgatory (delayed fetch)
+    ENCODE,  // Response objects to bytes
+    SEND,    // Response queued until fully written to the socket
+    TOTAL,   // Whole frame buffered until the response is fully written
+    COUNT
+};
+
+constexpr size_t REQUEST_STAGES = static_cast<size_t>(RequestStage::COUNT);
+constexpr std::array<std::string_view, REQUEST_STAGES> REQUEST_STAGE_NAMES = {"receive", "decode", "handle", "delay", "encode", "send", "total"};
+
+// Everything one thread recorded about one API
+struct ApiMetrics
+{
+    std::array<LatencyHistogram, REQUEST_STAGES> stages;
+    std::atomic<uint64_t> requests = 0;
+    std::atomic<uint64_t> request_bytes = 0;
+    std::atomic<uint64_t> response_bytes = 0;
+
+    void record(RequestStage stage, uint64_t elapsed_ns) { stages[static_cast<size_t>(stage)].record(elapsed_ns); }
+};
+
+// Broker-wide counters, only ever increasing
+enum class Counter
+{
+    CONNECTIONS_ACCEPTED,
+    CONNECTIONS_CLOSED,
+    CONNECTIONS_REJECTED,
+    LOG_APPENDS,
+    LOG_APPEND_BYTES,
+    LOG_READS,
+    LOG_READ_BYTES,
+    LOG_SEGMENTS_DELETED,
+    LOG_CLEANER_REMOVED_BYTES,
+    OFFSET_COMMITS,
+    THROTTLED_RESPONSES,
+    THROTTLE_TIME_MS,
+    COUNT
+};
+
+// Broker-wide gauges, every thread keeps its own share and the shares are summed
+enum class Gauge
+{
+    IN_FLIGHT_REQUESTS,    // Decoded and not yet fully answered
+    DELAYED_REQUESTS,      // Parked in a purgatory
+    UNSENT_RESPONSE_BYTES, // Encoded and waiting for the socket
+    COUNT
+};
+
+constexpr size_t COUNTERS = static_cast<size_t>(Counter::COUNT);
+constexpr size_t GAUGES = static_cast<size_t>(Gauge::COUNT);
+
+// Metrics of one thread, only that thread writes them. ApiMetrics are allocated on an API's first request
+// so idle APIs cost a pointer.
+class ThreadMetrics
+{
+public:
+    static constexpr int16_t MAX_API_KEY = 127;
+
+    ~ThreadMetrics();
+
+    ApiMetrics &api(int16_t api_key);
+    const ApiMetrics *findApi(int16_t api_key) const { return apis[api_key].load(std::memory_order_acquire); }
+
+    void add(Counter counter, uint64_t amount = 1) { bumpCounter(counters[static_cast<size_t>(counter)], amount); }
+    void add(Gauge gauge, int64_t delta) { addToGauge(gauges[static_cast<size_t>(gauge)], delta); }
+
+private:
+    std::array<std::atomic<ApiMetrics *>, MAX_API_KEY + 1> apis{};
+    std::array<std::atomic<uint64_t>, COUNTERS> counters{};
+    std::array<std::atomic<int64_t>, GAUGES> gauges{};
+
+    friend class BrokerMetrics;
+};
+
+struct ApiSnapshot
+{
+    int16_t api_key;
+    std::array<HistogramSnapshot, REQUEST_STAGES> stages;
+    uint64_t requests;
+    uint64_t request_bytes;
+    uint64_t response_bytes;
+};
+
+// Value owned by another component (a queue length, the metadata image size), read through a callback that must not block
+struct CallbackGauge
+{
+    std::string name;
+    std::string help;
+    std::string labels; // Prometheus label set without braces, may be empty
+    std::function<double()> value;
+};
+
+// Process-wide registry of ThreadMetrics, aggregated only when someone asks
+class BrokerMetrics
+{
+public:
+    // The calling thread's metrics, registered on first use and kept after the thread exits
+    static ThreadMetrics &local();
+
+    // Sum over every thread of each API that has seen requests, ordered by API key
+    static std::vector<ApiSnapshot> snapshot();
+    static std::array<uint64_t, COUNTERS> counters();
+    static std::array<int64_t, GAUGES> gauges();
+    static void dump(std::ostream &out);
+
+    static void registerGauge(CallbackGauge gauge);
+    static std::vector<std::pair<const CallbackGauge *, double>> callbackGauges();
+
+private:
+    static std::mutex registry_mutex;
+    static std::vector<std::unique_ptr<ThreadMetrics>> registry;
+    static std::deque<CallbackGauge> callback_gauges;
+};
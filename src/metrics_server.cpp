@@ -0,0 +1,214 @@
+#include "metrics_server.h"
+#include "metrics.h"
+#include "kafka_utils.h"
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+bool MetricsServer::start()
+{
+    server_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server_fd < 0)
+    {
+        std::cerr << "Failed to create metrics socket" << std::endl;
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    if (bind(server_fd, reinterpret_cast<struct sockaddr *>(&server_addr), sizeof(server_addr)) != 0 || listen(server_fd, 16) != 0)
+    {
+        std::cerr << "Failed to listen for metrics on port " << port << std::endl;
+        close(server_fd);
+        server_fd = -1;
+        return false;
+    }
+
+    thread = spawnWorkerThread([this]()
+                               { run(); });
+
+    std::cout << "Serving metrics on port " << port << "\n";
+    return true;
+}
+
+void MetricsServer::stop()
+{
+    if (server_fd == -1)
+        return;
+
+    // Wakes the blocked accept()
+    stopping = true;
+    shutdown(server_fd, SHUT_RDWR);
+    if (thread.joinable())
+        thread.join();
+
+    close(server_fd);
+    server_fd = -1;
+}
+
+void MetricsServer::run()
+{
+    while (!stopping.load())
+    {
+        int client_fd = accept4(server_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (!stopping.load())
+                std::perror("Error occured");
+            break;
+        }
+
+        struct timeval timeout{.tv_sec = SOCKET_TIMEOUT_MS / 1000, .tv_usec = (SOCKET_TIMEOUT_MS % 1000) * 1000};
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        serve(client_fd);
+        close(client_fd);
+    }
+}
+
+void MetricsServer::serve(int client_fd)
+{
+    // One request per connection, only the request line matters
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < MAX_REQUEST_SIZE)
+    {
+        ssize_t received = recv(client_fd, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+            return;
+        request.append(buffer, received);
+    }
+
+    std::string_view request_line = std::string_view(request).substr(0, request.find("\r\n"));
+    std::string status = "200 OK";
+    std::string body;
+    if (request_line.starts_with("GET /metrics ") || request_line.starts_with("GET / "))
+        body = render();
+    else
+    {
+        status = "404 Not Found";
+        body = "Only GET /metrics is served\n";
+    }
+
+    std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n" +
+                           "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+
+    size_t sent = 0;
+    while (sent < response.size())
+    {
+        ssize_t result = send(client_fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0)
+            return;
+        sent += result;
+    }
+}
+
+static void writeFamily(std::ostringstream &out, std::string_view name, std::string_view type, std::string_view help)
+{
+    out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+}
+
+std::string MetricsServer::render()
+{
+    std::ostringstream out;
+    out << std::setprecision(9);
+
+    const auto counters = BrokerMetrics::counters();
+    const auto gauges = BrokerMetrics::gauges();
+    auto counter = [&](Counter c)
+    { return counters[static_cast<size_t>(c)]; };
+    auto gauge = [&](Gauge g)
+    { return gauges[static_cast<size_t>(g)]; };
+
+    writeFamily(out, "kafka_network_connections", "gauge", "Open client connections");
+    out << "kafka_network_connections " << counter(Counter::CONNECTIONS_ACCEPTED) - counter(Counter::CONNECTIONS_CLOSED) << "\n";
+    writeFamily(out, "kafka_network_connections_accepted_total", "counter", "Client connections accepted");
+    out << "kafka_network_connections_accepted_total " << counter(Counter::CONNECTIONS_ACCEPTED) << "\n";
+    writeFamily(out, "kafka_network_connections_rejected_total", "counter", "Connections closed for max.connections.per.ip");
+    out << "kafka_network_connections_rejected_total " << counter(Counter::CONNECTIONS_REJECTED) << "\n";
+    writeFamily(out, "kafka_network_in_flight_requests", "gauge", "Requests decoded and not yet fully answered");
+    out << "kafka_network_in_flight_requests " << gauge(Gauge::IN_FLIGHT_REQUESTS) << "\n";
+    writeFamily(out, "kafka_network_delayed_requests", "gauge", "Requests parked in a purgatory");
+    out << "kafka_network_delayed_requests " << gauge(Gauge::DELAYED_REQUESTS) << "\n";
+    writeFamily(out, "kafka_network_unsent_response_bytes", "gauge", "Encoded response bytes waiting for the socket");
+    out << "kafka_network_unsent_response_bytes " << gauge(Gauge::UNSENT_RESPONSE_BYTES) << "\n";
+    writeFamily(out, "kafka_network_throttled_responses_total", "counter", "Responses to clients over quota, their connections muted");
+    out << "kafka_network_throttled_responses_total " << counter(Counter::THROTTLED_RESPONSES) << "\n";
+    writeFamily(out, "kafka_network_throttle_time_ms_total", "counter", "Time connections were muted for by quotas");
+    out << "kafka_network_throttle_time_ms_total " << counter(Counter::THROTTLE_TIME_MS) << "\n";
+
+    writeFamily(out, "kafka_log_appends_total", "counter", "Record sets appended to partition logs");
+    out << "kafka_log_appends_total " << counter(Counter::LOG_APPENDS) << "\n";
+    writeFamily(out, "kafka_log_append_bytes_total", "counter", "Record bytes appended to partition logs");
+    out << "kafka_log_append_bytes_total " << counter(Counter::LOG_APPEND_BYTES) << "\n";
+    writeFamily(out, "kafka_log_reads_total", "counter", "Partition log reads");
+    out << "kafka_log_reads_total " << counter(Counter::LOG_READS) << "\n";
+    writeFamily(out, "kafka_log_read_bytes_total", "counter", "Record bytes read from partition logs");
+    out << "kafka_log_read_bytes_total " << counter(Counter::LOG_READ_BYTES) << "\n";
+    writeFamily(out, "kafka_log_segments_deleted_total", "counter", "Log segments deleted by retention");
+    out << "kafka_log_segments_deleted_total " << counter(Counter::LOG_SEGMENTS_DELETED) << "\n";
+    writeFamily(out, "kafka_log_cleaner_removed_bytes_total", "counter", "Bytes compaction removed from logs");
+    out << "kafka_log_cleaner_removed_bytes_total " << counter(Counter::LOG_CLEANER_REMOVED_BYTES) << "\n";
+    writeFamily(out, "kafka_group_offset_commits_total", "counter", "Offsets committed to __consumer_offsets");
+    out << "kafka_group_offset_commits_total " << counter(Counter::OFFSET_COMMITS) << "\n";
+
+    // Components register their own gauges, families are grouped by name
+    std::string_view last_name;
+    for (auto &[callback_gauge, value] : BrokerMetrics::callbackGauges())
+    {
+        if (callback_gauge->name != last_name)
+            writeFamily(out, callback_gauge->name, "gauge", callback_gauge->help);
+        last_name = callback_gauge->name;
+
+        out << callback_gauge->name;
+        if (!callback_gauge->labels.empty())
+            out << "{" << callback_gauge->labels << "}";
+        out << " " << value << "\n";
+    }
+
+    const auto snapshots = BrokerMetrics::snapshot();
+
+    writeFamily(out, "kafka_requests_total", "counter", "Requests received per API");
+    for (auto &snapshot : snapshots)
+        out << "kafka_requests_total{api=\"" << apiName(snapshot.api_key) << "\"} " << snapshot.requests << "\n";
+    writeFamily(out, "kafka_request_bytes_total", "counter", "Request bytes received per API");
+    for (auto &snapshot : snapshots)
+        out << "kafka_request_bytes_total{api=\"" << apiName(snapshot.api_key) << "\"} " << snapshot.request_bytes << "\n";
+    writeFamily(out, "kafka_response_bytes_total", "counter", "Response bytes sent per API");
+    for (auto &snapshot : snapshots)
+        out << "kafka_response_bytes_total{api=\"" << apiName(snapshot.api_key) << "\"} " << snapshot.response_bytes << "\n";
+
+    // Quantiles cover everything since startup, rates over windows come from the _sum and _count series
+    writeFamily(out, "kafka_request_latency_seconds", "summary", "Time spent per request stage and API");
+    for (auto &snapshot : snapshots)
+    {
+        for (size_t stage = 0; stage < REQUEST_STAGES; stage++)
+        {
+            const HistogramSnapshot &histogram = snapshot.stages[stage];
+            if (histogram.count() == 0)
+                continue;
+
+            std::ostringstream labels;
+            labels << "api=\"" << apiName(snapshot.api_key) << "\",stage=\"" << REQUEST_STAGE_NAMES[stage] << "\"";
+
+            for (double quantile : {0.5, 0.99, 0.999})
+                out << "kafka_request_latency_seconds{" << labels.str() << ",quantile=\"" << quantile << "\"} "
+                    << histogram.percentile(quantile) / 1e9 << "\n";
+            out << "kafka_request_latency_seconds_sum{" << labels.str() << "} " << histogram.sum() / 1e9 << "\n";
+            out << "kafka_request_latency_seconds_count{" << labels.str() << "} " << histogram.count() << "\n";
+        }
+    }
+
+    return out.str();
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+
+// Serves BrokerMetrics over HTTP in the Prometheus text format (GET /metrics) on its own thread.
+// Everything is rendered from relaxed reads of the per-thread metrics, so a scrape never waits for the
+// network threads and nothing runs while nobody scrapes.
+class MetricsServer
+{
+public:
+    explicit MetricsServer(uint16_t port_) : port(port_), server_fd(-1), stopping(false) {}
+    ~MetricsServer();
+
+    bool start();
+    void stop();
+
+    static std::string render();
+
+private:
+    static constexpr size_t MAX_REQUEST_SIZE = 8 * 1024;
+    static constexpr int SOCKET_TIMEOUT_MS = 1000; // A stuck scraper only delays the next one this long
+
+    void run();
+    void serve(int client_fd);
+
+    uint16_t port;
+    int server_fd;
+    std::atomic_bool stopping;
+    std::thread thread;
+};
@@ -0,0 +1,1127 @@
+#include "partition_log.h"
+#include "metadata_index.h"
+#include "metrics.h"
+#include "broker_config.h"
+#include "crc32c.h"
+#include "compression.h"
+#include "log_cleaner.h"
+#include "group_coordinator.h"
+#include "shard.h"
+
+size_t TopicPartitionHash::operator()(const TopicPartition &topic_partition) const
+{
+    return hashUUID(topic_partition.topic_id) ^ (static_cast<uint64_t>(topic_partition.partition) * 0x9E3779B97F4A7C15ULL);
+}
+
+bool readVarlong(const char *&data, const char *end, int64_t &value)
+{
+    // Zigzag encoded like every signed varint of a record
+    uint64_t raw = 0;
+    for (int shift = 0; shift < 64 && data < end; shift += 7)
+    {
+        const uint8_t byte = *data++;
+        raw |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (byte < 0x80)
+        {
+            value = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+CompressionCodec batchCodec(std::span<const char> batch)
+{
+    return static_cast<CompressionCodec>(readBE16(batch.data() + RecordBatchHeader::ATTRIBUTES_POS) & RecordBatchHeader::COMPRESSION_CODEC_MASK);
+}
+
+std::span<const char> batchRecords(std::span<const char> batch, std::vector<char> &buffer)
+{
+    const std::span<const char> records = batch.subspan(RecordBatchHeader::SIZE);
+    const CompressionCodec codec = batchCodec(batch);
+    if (codec == CompressionCodec::NONE)
+        return records;
+    if (!decompress(codec, records, buffer))
+        return {};
+    return buffer;
+}
+
+// CRC and record framing: as many records as the header says, offset deltas counting up from 0, nothing left over.
+// Records of a codec the broker is built without can't be walked, only their CRC is checked.
+static bool validateBatch(std::span<const char> batch, std::vector<char> &buffer)
+{
+    const uint32_t crc = readBE32(batch.data() + RecordBatchHeader::CRC_POS);
+    if (crc != crc32c(batch.data() + RecordBatchHeader::ATTRIBUTES_POS, batch.size() - RecordBatchHeader::ATTRIBUTES_POS))
+        return false;
+
+    const CompressionCodec codec = batchCodec(batch);
+    if (static_cast<int8_t>(codec) > static_cast<int8_t>(CompressionCodec::ZSTD))
+        return false;
+    if (!compressionSupported(codec))
+        return true;
+
+    const std::span<const char> records = batchRecords(batch, buffer);
+    const int32_t records_count = readBE32(batch.data() + RecordBatchHeader::RECORDS_COUNT_POS);
+    if (records.empty() || records_count != readBE32(batch.data() + RecordBatchHeader::LAST_OFFSET_DELTA_POS) + 1)
+        return false;
+
+    // Record: length, attributes, timestamp delta, offset delta, ... all varints but the attributes
+    const char *record = records.data();
+    const char *end = records.data() + records.size();
+    for (int32_t i = 0; i < records_count; i++)
+    {
+        int64_t length, timestamp_delta, offset_delta;
+        if (!readVarlong(record, end, length) || length <= 0 || length > end - record)
+            return false;
+
+        const char *next_record = record + length;
+        const char *field = record + sizeof(int8_t);
+        if (!readVarlong(field, next_record, timestamp_delta) || !readVarlong(field, next_record, offset_delta) || offset_delta != i)
+            return false;
+
+        record = next_record;
+    }
+    return record == end;
+}
+
+bool encodeBatch(std::span<const char> batch, std::span<const char> records, int32_t records_count, CompressionCodec codec, std::vector<char> &output)
+{
+    std::vector<char> compressed;
+    if (codec != CompressionCodec::NONE && !compress(codec, records, compressed))
+        return false;
+    const std::span<const char> encoded = codec == CompressionCodec::NONE ? records : std::span<const char>(compressed);
+
+    const size_t batch_start = output.size();
+    output.insert(output.end(), batch.begin(), batch.begin() + RecordBatchHeader::SIZE);
+    output.insert(output.end(), encoded.begin(), encoded.end());
+    char *header = output.data() + batch_start;
+
+    int32_t batch_length = RecordBatchHeader::SIZE - RecordBatchHeader::LOG_OVERHEAD + encoded.size();
+    convertH32toBE(batch_length);
+    std::memcpy(header + RecordBatchHeader::BATCH_LENGTH_POS, &batch_length, sizeof(batch_length));
+
+    int16_t attributes = (readBE16(header + RecordBatchHeader::ATTRIBUTES_POS) & ~RecordBatchHeader::COMPRESSION_CODEC_MASK) | static_cast<int16_t>(codec);
+    convertH16toBE(attributes);
+    std::memcpy(header + RecordBatchHeader::ATTRIBUTES_POS, &attributes, sizeof(attributes));
+
+    convertH32toBE(records_count);
+    std::memcpy(header + RecordBatchHeader::RECORDS_COUNT_POS, &records_count, sizeof(records_count));
+
+    int32_t crc = crc32c(header + RecordBatchHeader::ATTRIBUTES_POS, output.size() - batch_start - RecordBatchHeader::ATTRIBUTES_POS);
+    convertH32toBE(crc);
+    std::memcpy(header + RecordBatchHeader::CRC_POS, &crc, sizeof(crc));
+    return true;
+}
+
+static std::string segmentFileName(int64_t base_offset)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%020lld.log", static_cast<long long>(base_offset));
+    return name;
+}
+
+static bool preadAll(int fd, char *buffer, size_t len, off_t position)
+{
+    while (len > 0)
+    {
+        ssize_t bytes = pread(fd, buffer, len, position);
+        if (bytes <= 0)
+        {
+            if (bytes == -1 && errno == EINTR)
+                continue;
+            return false;
+        }
+        buffer += bytes;
+        len -= bytes;
+        position += bytes;
+    }
+    return true;
+}
+
+// pwrite() of every buffer in order, as few pwritev() calls as partial writes and IOV_MAX allow. Advances iov.
+static bool pwritevAll(int fd, std::vector<iovec> &iov, off_t position)
+{
+    size_t first = 0;
+    while (first < iov.size())
+    {
+        ssize_t bytes = pwritev(fd, iov.data() + first, std::min<size_t>(iov.size() - first, IOV_MAX), position);
+        if (bytes <= 0)
+        {
+            if (bytes == -1 && errno == EINTR)
+                continue;
+            return false;
+        }
+        position += bytes;
+
+        while (first < iov.size() && static_cast<size_t>(bytes) >= iov[first].iov_len)
+            bytes -= iov[first++].iov_len;
+        if (bytes > 0)
+        {
+            iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + bytes;
+            iov[first].iov_len -= bytes;
+        }
+    }
+    return true;
+}
+
+PartitionLog::PartitionLog(const std::string &dir_path_, LogOpenMode mode) : dir_path(dir_path_), read_only(mode == LogOpenMode::READ_ONLY), log_end_offset(0)
+{
+    std::error_code error;
+    if (!read_only)
+        std::filesystem::create_directories(dir_path, error);
+
+    std::vector<int64_t> base_offsets;
+    for (auto &entry : std::filesystem::directory_iterator(dir_path, error))
+    {
+        if (entry.path().extension() != ".log")
+            continue;
+
+        std::string stem = entry.path().stem().string();
+        int64_t base_offset;
+        if (std::from_chars(stem.data(), stem.data() + stem.size(), base_offset).ec == std::errc())
+            base_offsets.push_back(base_offset);
+    }
+    std::sort(base_offsets.begin(), base_offsets.end());
+
+    // Only the active segment is CRC checked, the closed ones were whole when the log rolled past them
+    for (int64_t base_offset : base_offsets)
+        loadSegment(base_offset, dir_path + "/" + segmentFileName(base_offset),
+                    mode == LogOpenMode::RECOVER && base_offset != base_offsets.back() ? LogOpenMode::READ_WRITE : mode);
+
+    if (segments.empty() && !read_only)
+        rollSegment(0);
+}
+
+PartitionLog::~PartitionLog()
+{
+    for (auto &segment : segments)
+        close(segment.fd);
+}
+
+void PartitionLog::indexSegment(Segment &segment, LogOpenMode mode)
+{
+    struct stat segment_stat{};
+    fstat(segment.fd, &segment_stat);
+    const uint64_t file_size = segment_stat.st_size;
+
+    // Only batch headers are read, the records themselves only when verifying
+    char header[RecordBatchHeader::SIZE];
+    std::vector<char> batch;
+    uint64_t position = 0;
+    while (position + RecordBatchHeader::SIZE <= file_size && preadAll(segment.fd, header, sizeof(header), position))
+    {
+        const int64_t batch_base_offset = readBE64(header + RecordBatchHeader::BASE_OFFSET_POS);
+        const int32_t batch_length = readBE32(header + RecordBatchHeader::BATCH_LENGTH_POS);
+        const uint64_t batch_size = RecordBatchHeader::LOG_OVERHEAD + static_cast<uint64_t>(batch_length);
+
+        if (batch_length < static_cast<int32_t>(RecordBatchHeader::SIZE - RecordBatchHeader::LOG_OVERHEAD) || position + batch_size > file_size)
+            break;
+
+        if (mode == LogOpenMode::RECOVER)
+        {
+            batch.resize(batch_size);
+            if (!preadAll(segment.fd, batch.data(), batch.size(), position) ||
+                static_cast<uint32_t>(readBE32(batch.data() + RecordBatchHeader::CRC_POS)) != crc32c(batch.data() + RecordBatchHeader::ATTRIBUTES_POS, batch.size() - RecordBatchHeader::ATTRIBUTES_POS))
+                break;
+        }
+
+        const int64_t max_timestamp = readBE64(header + RecordBatchHeader::MAX_TIMESTAMP_POS);
+        segment.max_timestamp = std::max(segment.max_timestamp, max_timestamp);
+        segment.largest_timestamp = std::max(segment.largest_timestamp, max_timestamp);
+
+        segment.batches.push_back({.base_offset = batch_base_offset,
+                                   .last_offset = batch_base_offset + readBE32(header + RecordBatchHeader::LAST_OFFSET_DELTA_POS),
+                                   .max_timestamp = max_timestamp,
+                                   .largest_timestamp = segment.largest_timestamp,
+                                   .position = static_cast<uint32_t>(position),
+                                   .size = static_cast<uint32_t>(batch_size)});
+        position += batch_size;
+    }
+
+    if (position < file_size && mode != LogOpenMode::READ_ONLY)
+    {
+        // Torn (or corrupt) batch left behind by a crash, the log continues from the last good one
+        if (ftruncate(segment.fd, position) != 0)
+            std::perror("Error occured");
+    }
+
+    segment.size = position;
+}
+
+void PartitionLog::loadSegment(int64_t base_offset, const std::string &path, LogOpenMode mode)
+{
+    Segment segment = {.base_offset = base_offset,
+                       .fd = mode == LogOpenMode::READ_ONLY ? open(path.c_str(), O_RDONLY) : open(path.c_str(), O_RDWR | O_CREAT, 0644),
+                       .path = path,
+                       .size = 0,
+                       .max_timestamp = -1,
+                       .largest_timestamp = segments.empty() ? INT64_MIN : segments.back().largest_timestamp,
+                       .batches = {}};
+    if (segment.fd == -1)
+    {
+        std::perror("Error occured");
+        return;
+    }
+
+    indexSegment(segment, mode);
+
+    log_end_offset = segment.batches.empty() ? std::max(log_end_offset, base_offset) : segment.batches.back().last_offset + 1;
+    segments.push_back(std::move(segment));
+}
+
+void PartitionLog::rollSegment(int64_t base_offset)
+{
+    const std::string path = dir_path + "/" + segmentFileName(base_offset);
+    Segment segment = {.base_offset = base_offset,
+                       .fd = open(path.c_str(), O_RDWR | O_CREAT, 0644),
+                       .path = path,
+                       .size = 0,
+                       .max_timestamp = -1,
+                       .largest_timestamp = segments.empty() ? INT64_MIN : segments.back().largest_timestamp,
+                       .batches = {}};
+    if (segment.fd == -1)
+    {
+        std::perror("Error occured");
+        return;
+    }
+    segments.push_back(std::move(segment));
+}
+
+bool PartitionLog::prepareAppend(std::vector<char> &records, std::vector<std::pair<size_t, size_t>> &batch_bounds)
+{
+    // Validate the framing of every batch before touching the log
+
+    batch_bounds.clear();
+    size_t position = 0;
+    while (position < records.size())
+    {
+        if (records.size() - position < RecordBatchHeader::SIZE)
+            return false;
+
+        const int32_t batch_length = readBE32(records.data() + position + RecordBatchHeader::BATCH_LENGTH_POS);
+        const size_t batch_size = RecordBatchHeader::LOG_OVERHEAD + static_cast<size_t>(batch_length);
+        if (batch_length < static_cast<int32_t>(RecordBatchHeader::SIZE - RecordBatchHeader::LOG_OVERHEAD) ||
+            batch_size > records.size() - position || records[position + RecordBatchHeader::MAGIC_POS] != 2)
+            return false;
+
+        batch_bounds.push_back({position, batch_size});
+        position += batch_size;
+    }
+
+    if (batch_bounds.empty())
+        return false;
+
+    // Producer compressed batches normally go to disk as they are, only a compression.type naming another codec
+    // makes the broker re-encode them
+    const std::optional<CompressionCodec> &compression_type = brokerConfig().compression_type;
+    std::vector<char> recompressed;
+    std::vector<char> buffer;
+    for (auto &[batch_position, batch_size] : batch_bounds)
+    {
+        const std::span<const char> batch(records.data() + batch_position, batch_size);
+        if (!validateBatch(batch, buffer))
+            return false;
+
+        if (compression_type && (*compression_type != batchCodec(batch) || !recompressed.empty()))
+        {
+            if (recompressed.empty())
+                recompressed.assign(records.begin(), records.begin() + batch_position);
+
+            if (*compression_type == batchCodec(batch))
+            {
+                recompressed.insert(recompressed.end(), batch.begin(), batch.end());
+                continue;
+            }
+
+            const std::span<const char> batch_records = batchRecords(batch, buffer);
+            const int32_t records_count = readBE32(batch.data() + RecordBatchHeader::RECORDS_COUNT_POS);
+            if (batch_records.empty() || !encodeBatch(batch, batch_records, records_count, *compression_type, recompressed))
+                return false;
+        }
+    }
+
+    if (!recompressed.empty())
+    {
+        records.swap(recompressed);
+
+        batch_bounds.clear();
+        for (size_t position = 0; position < records.size();)
+        {
+            const size_t batch_size = RecordBatchHeader::LOG_OVERHEAD + readBE32(records.data() + position + RecordBatchHeader::BATCH_LENGTH_POS);
+            batch_bounds.push_back({position, batch_size});
+            position += batch_size;
+        }
+    }
+    return true;
+}
+
+int64_t PartitionLog::append(std::vector<char> &records)
+{
+    std::vector<char> *record_sets[] = {&records};
+    int64_t base_offset;
+    appendAll(record_sets, {&base_offset, 1});
+    return base_offset;
+}
+
+void PartitionLog::appendAll(std::span<std::vector<char> *const> record_sets, std::span<int64_t> base_offsets)
+{
+    // Checked (and recompressed) one by one outside the lock, a malformed record set fails alone
+    std::vector<std::vector<std::pair<size_t, size_t>>> batch_bounds(record_sets.size());
+    for (size_t i = 0; i < record_sets.size(); i++)
+        base_offsets[i] = prepareAppend(*record_sets[i], batch_bounds[i]) ? 0 : -1;
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    if (segments.empty())
+    {
+        std::fill(base_offsets.begin(), base_offsets.end(), -1);
+        return;
+    }
+
+    // Record sets going into the active segment with the next pwritev(), offsets are assigned as they are added
+    std::vector<iovec> pending_writes;
+    std::vector<size_t> pending_sets;
+    std::vector<BatchEntry> entries;
+    uint64_t pending_bytes = 0;
+    int64_t next_offset = log_end_offset;
+    int64_t segment_max_timestamp = segments.back().max_timestamp;
+    int64_t largest_timestamp = segments.back().largest_timestamp;
+    uint64_t appended_bytes = 0;
+
+    auto write_pending = [&]()
+    {
+        Segment &active_segment = segments.back();
+        if (!pending_writes.empty() && !pwritevAll(active_segment.fd, pending_writes, active_segment.size))
+        {
+            std::perror("Error occured");
+            for (size_t i : pending_sets)
+                base_offsets[i] = -1;
+            next_offset = log_end_offset;
+            segment_max_timestamp = active_segment.max_timestamp;
+            largest_timestamp = active_segment.largest_timestamp;
+        }
+        else
+        {
+            active_segment.size += pending_bytes;
+            active_segment.max_timestamp = segment_max_timestamp;
+            active_segment.largest_timestamp = largest_timestamp;
+            active_segment.batches.insert(active_segment.batches.end(), entries.begin(), entries.end());
+            unflushed_messages += next_offset - log_end_offset;
+            log_end_offset = next_offset;
+            appended_bytes += pending_bytes;
+        }
+
+        pending_writes.clear();
+        pending_sets.clear();
+        entries.clear();
+        pending_bytes = 0;
+    };
+
+    for (size_t i = 0; i < record_sets.size(); i++)
+    {
+        if (base_offsets[i] == -1)
+            continue;
+        std::vector<char> &records = *record_sets[i];
+
+        const uint64_t segment_size = segments.back().size + pending_bytes;
+        if (segment_size > 0 && segment_size + records.size() > brokerConfig().log_segment_bytes)
+        {
+            write_pending();
+            rollSegment(log_end_offset);
+            segment_max_timestamp = segments.back().max_timestamp;
+            largest_timestamp = segments.back().largest_timestamp;
+        }
+
+        const uint64_t records_position = segments.back().size + pending_bytes;
+        base_offsets[i] = next_offset;
+        for (auto &[batch_position, batch_size] : batch_bounds[i])
+        {
+            char *batch = records.data() + batch_position;
+
+            int64_t batch_base_offset = next_offset;
+            convertH64toBE(batch_base_offset);
+            std::memcpy(batch + RecordBatchHeader::BASE_OFFSET_POS, &batch_base_offset, sizeof(batch_base_offset));
+
+            const int64_t last_offset = next_offset + readBE32(batch + RecordBatchHeader::LAST_OFFSET_DELTA_POS);
+            const int64_t max_timestamp = readBE64(batch + RecordBatchHeader::MAX_TIMESTAMP_POS);
+            segment_max_timestamp = std::max(segment_max_timestamp, max_timestamp);
+            largest_timestamp = std::max(largest_timestamp, max_timestamp);
+
+            entries.push_back({.base_offset = next_offset,
+                               .last_offset = last_offset,
+                               .max_timestamp = max_timestamp,
+                               .largest_timestamp = largest_timestamp,
+                               .position = static_cast<uint32_t>(records_position + batch_position),
+                               .size = static_cast<uint32_t>(batch_size)});
+            next_offset = last_offset + 1;
+        }
+
+        pending_writes.push_back({.iov_base = records.data(), .iov_len = records.size()});
+        pending_sets.push_back(i);
+        pending_bytes += records.size();
+    }
+    write_pending();
+
+    ThreadMetrics &metrics = BrokerMetrics::local();
+    metrics.add(Counter::LOG_APPENDS, std::count_if(base_offsets.begin(), base_offsets.end(), [](int64_t base_offset)
+                                                    { return base_offset != -1; }));
+    metrics.add(Counter::LOG_APPEND_BYTES, appended_bytes);
+}
+
+std::pair<const PartitionLog::Segment *, const PartitionLog::BatchEntry *> PartitionLog::locate(int64_t offset) const
+{
+    if (offset >= log_end_offset)
+        return {nullptr, nullptr};
+
+    auto segment = std::upper_bound(segments.begin(), segments.end(), offset, [](int64_t value, const Segment &s)
+                                    { return value < s.base_offset; });
+    if (segment != segments.begin())
+        segment--;
+
+    // The offset may fall in a gap (empty segment), in which case the next batch after it is used
+    for (; segment != segments.end(); segment++)
+    {
+        auto batch = std::lower_bound(segment->batches.begin(), segment->batches.end(), offset, [](const BatchEntry &b, int64_t value)
+                                      { return b.last_offset < value; });
+        if (batch != segment->batches.end())
+            return {&*segment, &*batch};
+    }
+
+    return {nullptr, nullptr};
+}
+
+int16_t PartitionLog::read(int64_t fetch_offset, size_t max_bytes, bool min_one_batch, std::vector<char> &records) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    records.clear();
+
+    if (segments.empty() || fetch_offset < segments.front().base_offset || fetch_offset > log_end_offset)
+        return 1; // OFFSET_OUT_OF_RANGE
+
+    auto [segment, batch] = locate(fetch_offset);
+    if (segment == nullptr)
+        return 0;
+
+    // Contiguous batches from a single segment, the next fetch picks up the following segment
+    size_t read_size = 0;
+    for (auto it = batch; it != segment->batches.data() + segment->batches.size(); it++)
+    {
+        if (read_size + it->size > max_bytes && !(min_one_batch && read_size == 0))
+            break;
+        read_size += it->size;
+    }
+
+    records.resize(read_size);
+    if (!preadAll(segment->fd, records.data(), read_size, batch->position))
+    {
+        records.clear();
+        return -1; // UNKNOWN_SERVER_ERROR
+    }
+
+    ThreadMetrics &metrics = BrokerMetrics::local();
+    metrics.add(Counter::LOG_READS);
+    metrics.add(Counter::LOG_READ_BYTES, read_size);
+
+    return 0;
+}
+
+int64_t PartitionLog::bytesAvailable(int64_t fetch_offset) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    if (segments.empty() || fetch_offset < segments.front().base_offset || fetch_offset > log_end_offset)
+        return -1;
+
+    auto [segment, batch] = locate(fetch_offset);
+    if (segment == nullptr)
+        return 0;
+
+    int64_t available = segment->size - batch->position;
+    for (auto it = segment + 1; it != segments.data() + segments.size(); it++)
+        available += it->size;
+
+    return available;
+}
+
+int64_t PartitionLog::highWatermark() const
+{
+    // Single replica, everything appended is committed
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return log_end_offset;
+}
+
+int64_t PartitionLog::logStartOffset() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return segments.empty() ? 0 : segments.front().base_offset;
+}
+
+TimestampAndOffset PartitionLog::offsetForTimestamp(int64_t timestamp) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return offsetForTimestampLocked(timestamp);
+}
+
+TimestampAndOffset PartitionLog::offsetOfMaxTimestamp() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    if (segments.empty() || segments.back().largest_timestamp == INT64_MIN)
+        return {-1, -1};
+
+    // The first batch reaching the largest timestamp holds it
+    return offsetForTimestampLocked(segments.back().largest_timestamp);
+}
+
+TimestampAndOffset PartitionLog::offsetForTimestampLocked(int64_t timestamp) const
+{
+    auto segment = std::partition_point(segments.begin(), segments.end(), [timestamp](const Segment &s)
+                                        { return s.largest_timestamp < timestamp; });
+    if (segment == segments.end())
+        return {-1, -1};
+
+    auto batch = std::partition_point(segment->batches.begin(), segment->batches.end(), [timestamp](const BatchEntry &b)
+                                      { return b.largest_timestamp < timestamp; });
+
+    // The running maximum only bounds the answer from below (it may carry a timestamp of a deleted segment),
+    // the batch itself has to reach timestamp
+    while (true)
+    {
+        for (; batch != segment->batches.end(); batch++)
+        {
+            if (batch->max_timestamp >= timestamp)
+                return searchBatch(*segment, *batch, timestamp);
+        }
+
+        if (++segment == segments.end())
+            return {-1, -1};
+        batch = segment->batches.begin();
+    }
+}
+
+TimestampAndOffset PartitionLog::searchBatch(const Segment &segment, const BatchEntry &batch, int64_t timestamp) const
+{
+    std::vector<char> data(batch.size);
+    if (!preadAll(segment.fd, data.data(), data.size(), batch.position))
+        return {batch.max_timestamp, batch.base_offset};
+
+    // Records of a codec the broker can't decode can't be walked, the batch start is the closest offset that is never too late
+    std::vector<char> buffer;
+    const std::span<const char> records = batchRecords(data, buffer);
+    if (records.empty())
+        return {batch.max_timestamp, batch.base_offset};
+
+    const int64_t base_timestamp = readBE64(data.data() + RecordBatchHeader::BASE_TIMESTAMP_POS);
+    const char *record = records.data();
+    const char *end = records.data() + records.size();
+
+    // Record: length, attributes, timestamp delta, offset delta, ... all varints but the attributes
+    int64_t length, timestamp_delta, offset_delta;
+    while (readVarlong(record, end, length) && length > 0 && length <= end - record)
+    {
+        const char *next_record = record + length;
+        const char *field = record + sizeof(int8_t);
+
+        if (!readVarlong(field, next_record, timestamp_delta) || !readVarlong(field, next_record, offset_delta))
+            break;
+        if (base_timestamp + timestamp_delta >= timestamp)
+            return {base_timestamp + timestamp_delta, batch.base_offset + offset_delta};
+
+        record = next_record;
+    }
+
+    return {batch.max_timestamp, batch.base_offset};
+}
+
+void PartitionLog::flush()
+{
+    // The shared lock keeps retention from closing the files, readers go on and appends run on this same thread
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    for (size_t i = first_unflushed_segment; i < segments.size(); i++)
+    {
+        if (fdatasync(segments[i].fd) != 0)
+            std::perror("Error occured");
+    }
+    first_unflushed_segment = segments.empty() ? 0 : segments.size() - 1;
+    unflushed_messages = 0;
+}
+
+std::vector<PartitionLog::SegmentInfo> PartitionLog::segmentInfos() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    std::vector<SegmentInfo> infos;
+    infos.reserve(segments.size());
+    for (auto &segment : segments)
+        infos.push_back({.base_offset = segment.base_offset, .path = segment.path, .size = segment.size});
+    return infos;
+}
+
+bool PartitionLog::replaceSegments(const std::vector<SegmentInfo> &replaced, const std::vector<std::string> &cleaned_paths)
+{
+    // Indexed before taking the lock, the running timestamp maximum starts over as the log start is replaced too
+    std::vector<Segment> cleaned;
+    for (size_t i = 0; i < cleaned_paths.size(); i++)
+    {
+        Segment segment = {.base_offset = replaced[i].base_offset,
+                           .fd = open(cleaned_paths[i].c_str(), read_only ? O_RDONLY : O_RDWR),
+                           .path = replaced[i].path,
+                           .size = 0,
+                           .max_timestamp = -1,
+                           .largest_timestamp = cleaned.empty() ? INT64_MIN : cleaned.back().largest_timestamp,
+                           .batches = {}};
+        if (segment.fd == -1)
+        {
+            std::perror("Error occured");
+            for (auto &opened : cleaned)
+                close(opened.fd);
+            return false;
+        }
+        indexSegment(segment, read_only ? LogOpenMode::READ_ONLY : LogOpenMode::READ_WRITE);
+        cleaned.push_back(std::move(segment));
+    }
+
+    std::vector<int> replaced_fds;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+
+        // The active segment is never replaced
+        bool unchanged = cleaned.size() < segments.size();
+        for (size_t i = 0; unchanged && i < cleaned.size(); i++)
+            unchanged = segments[i].base_offset == replaced[i].base_offset && segments[i].size == replaced[i].size;
+
+        for (size_t i = 0; unchanged && i < cleaned.size(); i++)
+        {
+            // Stops at the first failure, the remaining segments keep their (larger) timestamp bounds
+            if (std::rename(cleaned_paths[i].c_str(), segments[i].path.c_str()) != 0)
+            {
+                std::perror("Error occured");
+                break;
+            }
+            replaced_fds.push_back(segments[i].fd);
+            std::swap(segments[i], cleaned[i]);
+        }
+    }
+
+    // cleaned holds whatever wasn't swapped in
+    for (size_t i = replaced_fds.size(); i < cleaned.size(); i++)
+    {
+        close(cleaned[i].fd);
+        unlink(cleaned_paths[i].c_str());
+    }
+    for (int fd : replaced_fds)
+        close(fd);
+
+    return replaced_fds.size() == cleaned.size();
+}
+
+size_t PartitionLog::enforceRetention(int64_t now_ms, int64_t retention_ms, int64_t retention_bytes)
+{
+    std::vector<Segment> deleted;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+
+        // The active (last) segment is never deleted
+        size_t expired = 0;
+        for (; retention_ms >= 0 && expired + 1 < segments.size(); expired++)
+        {
+            int64_t segment_timestamp = segments[expired].max_timestamp;
+            if (segment_timestamp < 0)
+            {
+                struct stat segment_stat{};
+                fstat(segments[expired].fd, &segment_stat);
+                segment_timestamp = segment_stat.st_mtim.tv_sec * 1000LL + segment_stat.st_mtim.tv_nsec / 1000000;
+            }
+            if (now_ms - segment_timestamp <= retention_ms)
+                break;
+        }
+
+        if (retention_bytes >= 0)
+        {
+            uint64_t log_size = 0;
+            for (size_t i = expired; i < segments.size(); i++)
+                log_size += segments[i].size;
+            for (; expired + 1 < segments.size() && log_size - segments[expired].size >= static_cast<uint64_t>(retention_bytes); expired++)
+                log_size -= segments[expired].size;
+        }
+
+        if (expired == 0)
+            return 0;
+
+        deleted.assign(std::make_move_iterator(segments.begin()), std::make_move_iterator(segments.begin() + expired));
+        segments.erase(segments.begin(), segments.begin() + expired);
+        first_unflushed_segment -= std::min(first_unflushed_segment, expired);
+    }
+
+    for (auto &segment : deleted)
+    {
+        close(segment.fd);
+        if (unlink(segment.path.c_str()) != 0)
+            std::perror("Error occured");
+    }
+
+    BrokerMetrics::local().add(Counter::LOG_SEGMENTS_DELETED, deleted.size());
+    return deleted.size();
+}
+
+AppendQueue::~AppendQueue()
+{
+    takeAll();
+}
+
+bool AppendQueue::push(std::unique_ptr<Append> append)
+{
+    Append *node = append.release();
+    node->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+        ;
+    return node->next == nullptr;
+}
+
+std::vector<std::unique_ptr<AppendQueue::Append>> AppendQueue::takeAll()
+{
+    // Newest first on the stack
+    std::vector<std::unique_ptr<Append>> appends;
+    for (Append *node = head.exchange(nullptr, std::memory_order_acquire); node != nullptr;)
+    {
+        Append *next = node->next;
+        appends.emplace_back(node);
+        node = next;
+    }
+    std::reverse(appends.begin(), appends.end());
+    return appends;
+}
+
+// Partition directories are named <topic>-<partition>, everything else in a log directory is skipped
+static bool isPartitionDir(const std::filesystem::directory_entry &entry)
+{
+    const std::string name = entry.path().filename().string();
+    return entry.is_directory() && name.find('-') != std::string::npos && !name.starts_with("__cluster_metadata");
+}
+
+// Checks the active segment of every partition in a directory left without the clean shutdown marker, cutting
+// each log at its first corrupt batch. Logs are opened lazily, so this is done for all of them up front.
+static void recoverLogDir(const std::string &path)
+{
+    const uint64_t start_ns = monotonicNs();
+    size_t recovered = 0;
+    std::error_code error;
+    for (auto &entry : std::filesystem::directory_iterator(path, error))
+    {
+        if (!isPartitionDir(entry))
+            continue;
+        PartitionLog(entry.path().string(), LogOpenMode::RECOVER);
+        recovered++;
+    }
+    if (recovered > 0)
+        std::cout << "Recovered " << recovered << " partition logs in " << path << " after an unclean shutdown in "
+                  << (monotonicNs() - start_ns) / 1000000 << " ms\n";
+}
+
+LogManager::LogManager(const std::vector<std::string> &log_dirs_) : shard_logs(brokerConfig().shard_count)
+{
+    for (const std::string &path : log_dirs_)
+    {
+        LogDir &dir = log_dirs.emplace_back(LogDir{.path = path, .partitions = 0, .io_loop = std::make_unique<EventLoop>(), .flush_timer = nullptr, .logs = {}});
+
+        std::error_code error;
+        for (auto &entry : std::filesystem::directory_iterator(path, error))
+        {
+            if (isPartitionDir(entry))
+                dir.partitions++;
+        }
+
+        // Removed while the broker runs, a crash from here on is an unclean shutdown
+        const std::string marker = path + "/" + CLEAN_SHUTDOWN_FILE;
+        if (!std::filesystem::remove(marker, error))
+            recoverLogDir(path);
+
+        // Never joined, like the LogManager the threads live until the process exits
+        EventLoop &io_loop = *dir.io_loop;
+        spawnWorkerThread([&io_loop]()
+                          { io_loop.run(); })
+            .detach();
+
+        BrokerMetrics::registerGauge({.name = "kafka_log_dir_pending_tasks", .help = "Appends and flushes queued for a log directory's I/O thread",
+                                      .labels = "dir=\"" + path + "\"", .value = [&io_loop]()
+                                      { return static_cast<double>(io_loop.pendingTasks()); }});
+
+        const int64_t flush_interval_ms = brokerConfig().log_flush_interval_ms;
+        if (flush_interval_ms != INT64_MAX)
+        {
+            dir.flush_timer = std::make_unique<CallbackTimer>([this, &dir, flush_interval_ms]()
+                                                              {
+                                                                  flushDir(dir);
+                                                                  dir.io_loop->schedule(*dir.flush_timer, flush_interval_ms); });
+            io_loop.post([&dir, flush_interval_ms]()
+                         { dir.io_loop->schedule(*dir.flush_timer, flush_interval_ms); });
+        }
+    }
+
+    const BrokerConfig &config = brokerConfig();
+    if (config.log_retention_ms >= 0 || config.log_retention_bytes >= 0)
+    {
+        retention_loop = std::make_unique<EventLoop>();
+        retention_timer = std::make_unique<CallbackTimer>([this, interval_ms = config.log_retention_check_interval_ms]()
+                                                          {
+                                                              enforceRetention();
+                                                              retention_loop->schedule(*retention_timer, interval_ms); });
+        retention_loop->post([this, interval_ms = config.log_retention_check_interval_ms]()
+                             { retention_loop->schedule(*retention_timer, interval_ms); });
+
+        spawnWorkerThread([&retention_loop = *retention_loop]()
+                          { retention_loop.run(); })
+            .detach();
+    }
+
+    if (config.log_cleaner_enable)
+    {
+        cleaner = std::make_unique<LogCleaner>();
+        cleaner_loop = std::make_unique<EventLoop>();
+        cleaner_timer = std::make_unique<CallbackTimer>([this, backoff_ms = config.log_cleaner_backoff_ms]()
+                                                        {
+                                                            cleanLogs();
+                                                            cleaner_loop->schedule(*cleaner_timer, backoff_ms); });
+        cleaner_loop->post([this, backoff_ms = config.log_cleaner_backoff_ms]()
+                           { cleaner_loop->schedule(*cleaner_timer, backoff_ms); });
+
+        spawnWorkerThread([&cleaner_loop = *cleaner_loop]()
+                          { cleaner_loop.run(); })
+            .detach();
+    }
+}
+
+LogManager &LogManager::instance()
+{
+    // Never destroyed, the detached I/O, retention and cleaner threads run its event loops until the process exits
+    static LogManager &log_manager = *new LogManager(brokerConfig().log_dirs);
+    return log_manager;
+}
+
+LogManager::OpenLog &LogManager::openLog(const TopicPartition &topic_partition, std::string_view topic_name)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = logs.find(topic_partition);
+        if (it != logs.end())
+            return it->second;
+    }
+
+    std::lock_guard<std::shared_mutex> lock(mutex);
+    OpenLog &open_log = logs[topic_partition];
+    if (open_log.log != nullptr)
+        return open_log;
+
+    const std::string partition_dir = std::string(topic_name) + "-" + std::to_string(topic_partition.partition);
+
+    // Wherever the partition already has data, otherwise the least loaded directory (the first one on ties)
+    auto dir = std::find_if(log_dirs.begin(), log_dirs.end(), [&](const LogDir &d)
+                            { return std::filesystem::is_directory(d.path + "/" + partition_dir); });
+    if (dir == log_dirs.end())
+    {
+        dir = std::min_element(log_dirs.begin(), log_dirs.end(), [](const LogDir &a, const LogDir &b)
+                               { return a.partitions < b.partitions; });
+        dir->partitions++;
+    }
+
+    open_log.log = std::make_unique<PartitionLog>(dir->path + "/" + partition_dir, LogOpenMode::READ_WRITE);
+    open_log.dir = &*dir;
+    open_log.append_queue = std::make_unique<AppendQueue>();
+    dir->logs.push_back(open_log.log.get());
+    return open_log;
+}
+
+PartitionLog &LogManager::getLog(const TopicPartition &topic_partition, std::string_view topic_name)
+{
+    return *openLog(topic_partition, topic_name).log;
+}
+
+void LogManager::appendAsync(const TopicPartition &topic_partition, std::string_view topic_name, std::vector<char> records,
+                             std::function<void(int64_t base_offset, PartitionLog &log)> on_appended)
+{
+    if (ShardSet *shards = ShardSet::active())
+    {
+        shards->submit(shards->owner(topic_partition), [this, topic_partition, topic_name = std::string(topic_name), records = std::move(records), on_appended = std::move(on_appended)]() mutable
+                       { queueAppend(shardLog(topic_partition, topic_name), std::move(records), std::move(on_appended)); });
+        return;
+    }
+    queueAppend(openLog(topic_partition, topic_name), std::move(records), std::move(on_appended));
+}
+
+LogManager::OpenLog &LogManager::shardLog(const TopicPartition &topic_partition, std::string_view topic_name)
+{
+    auto &open_logs = shard_logs[ShardSet::currentShard()];
+    auto it = open_logs.find(topic_partition);
+    if (it != open_logs.end())
+        return *it->second;
+
+    OpenLog &open_log = openLog(topic_partition, topic_name);
+    open_logs.emplace(topic_partition, &open_log);
+    return open_log;
+}
+
+void LogManager::queueAppend(OpenLog &open_log, std::vector<char> records, std::function<void(int64_t base_offset, PartitionLog &log)> on_appended)
+{
+    auto append = std::make_unique<AppendQueue::Append>(AppendQueue::Append{.records = std::move(records), .on_appended = std::move(on_appended), .next = nullptr});
+    if (!open_log.append_queue->push(std::move(append)))
+        return;
+
+    auto drain = [this, &open_log]()
+    { drainAppends(open_log); };
+    if (ShardSet *shards = ShardSet::active())
+        shards->submit(ShardSet::currentShard(), drain);
+    else
+        open_log.dir->io_loop->post(drain);
+}
+
+void LogManager::drainAppends(OpenLog &open_log)
+{
+    std::vector<std::unique_ptr<AppendQueue::Append>> appends = open_log.append_queue->takeAll();
+
+    std::vector<std::vector<char> *> record_sets;
+    record_sets.reserve(appends.size());
+    for (auto &append : appends)
+        record_sets.push_back(&append->records);
+    std::vector<int64_t> base_offsets(appends.size());
+
+    PartitionLog &log = *open_log.log;
+    log.appendAll(record_sets, base_offsets);
+    if (log.unflushedMessages() >= brokerConfig().log_flush_interval_messages)
+        log.flush();
+
+    for (size_t i = 0; i < appends.size(); i++)
+        appends[i]->on_appended(base_offsets[i], log);
+}
+
+// Waits for what is already queued on loop and stops it
+static void stopLoop(EventLoop &loop)
+{
+    std::promise<void> done;
+    loop.post([&loop, &done]()
+              {
+                  loop.stop();
+                  done.set_value(); });
+    done.get_future().wait();
+}
+
+void LogManager::shutdown()
+{
+    if (retention_loop != nullptr)
+        stopLoop(*retention_loop);
+    if (cleaner_loop != nullptr)
+        stopLoop(*cleaner_loop);
+    for (LogDir &dir : log_dirs)
+        stopLoop(*dir.io_loop);
+
+    std::lock_guard<std::shared_mutex> lock(mutex);
+    for (auto &[topic_partition, open_log] : logs)
+        open_log.log->flush();
+    const size_t closed = logs.size();
+    for (auto &open_logs : shard_logs)
+        open_logs.clear();
+    for (LogDir &dir : log_dirs)
+        dir.logs.clear();
+    logs.clear();
+
+    for (LogDir &dir : log_dirs)
+    {
+        if (!std::filesystem::is_directory(dir.path))
+            continue;
+
+        // The marker and its directory entry are on disk before the process exits
+        const std::string marker = dir.path + "/" + CLEAN_SHUTDOWN_FILE;
+        int fd = open(marker.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1 || fsync(fd) != 0)
+            std::perror("Error occured");
+        if (fd != -1)
+            close(fd);
+        int dir_fd = open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd == -1 || fsync(dir_fd) != 0)
+            std::perror("Error occured");
+        if (dir_fd != -1)
+            close(dir_fd);
+    }
+    std::cout << "Flushed and closed " << closed << " partition logs\n";
+}
+
+void LogManager::flushDir(LogDir &dir)
+{
+    std::vector<PartitionLog *> dir_logs;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        dir_logs = dir.logs;
+    }
+
+    for (PartitionLog *log : dir_logs)
+    {
+        if (log->unflushedMessages() > 0)
+            log->flush();
+    }
+}
+
+// Open logs whose topic's cleanup.policy (or log.cleanup.policy) has policy
+static std::vector<PartitionLog *> logsWithPolicy(const std::vector<std::pair<TopicPartition, PartitionLog *>> &open_logs, uint8_t policy)
+{
+    const BrokerConfig &config = brokerConfig();
+    auto metadata_image = MetadataImage::current();
+
+    std::vector<PartitionLog *> matching;
+    for (auto &[topic_partition, log] : open_logs)
+    {
+        // __consumer_offsets is always compacted, like in Kafka
+        const TopicMetadata *topic = metadata_image->findTopic(topic_partition.topic_id);
+        const uint8_t topic_policy = topic_partition == CONSUMER_OFFSETS_PARTITION ? CLEANUP_COMPACT
+                                     : topic != nullptr                            ? metadata_image->cleanupPolicy(*topic)
+                                                                                   : 0;
+        if ((topic_policy != 0 ? topic_policy : config.log_cleanup_policy) & policy)
+            matching.push_back(log);
+    }
+    return matching;
+}
+
+std::vector<std::pair<TopicPartition, PartitionLog *>> LogManager::openLogs()
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    std::vector<std::pair<TopicPartition, PartitionLog *>> open_logs;
+    for (auto &[topic_partition, open_log] : logs)
+        open_logs.push_back({topic_partition, open_log.log.get()});
+    return open_logs;
+}
+
+void LogManager::enforceRetention()
+{
+    const BrokerConfig &config = brokerConfig();
+    const int64_t now_ms = wallClockMs();
+    for (PartitionLog *log : logsWithPolicy(openLogs(), CLEANUP_DELETE))
+        log->enforceRetention(now_ms, config.log_retention_ms, config.log_retention_bytes);
+}
+
+void LogManager::cleanLogs()
+{
+    const int64_t now_ms = wallClockMs();
+    for (PartitionLog *log : logsWithPolicy(openLogs(), CLEANUP_COMPACT))
+        cleaner->clean(*log, LogCleaner::recordKey, now_ms);
+
+    if (!brokerConfig().metadata_log_compaction_enable)
+        return;
+
+    // Opened for the cleaning only, and only once there is a closed segment to clean. Read-only: the controller may be
+    // in the middle of appending to the active segment.
+    const std::string metadata_dir = brokerConfig().metadataPartitionDir();
+    size_t metadata_segments = 0;
+    std::error_code error;
+    for (auto &entry : std::filesystem::directory_iterator(metadata_dir, error))
+    {
+        if (entry.path().extension() == ".log")
+            metadata_segments++;
+    }
+    if (metadata_segments < 2)
+        return;
+
+    PartitionLog metadata_log(metadata_dir, LogOpenMode::READ_ONLY);
+    if (auto stats = cleaner->clean(metadata_log, LogCleaner::metadataRecordKey, now_ms))
+        std::cout << "Compacted " << stats->segments << " metadata log segments from " << stats->bytes_before << " to " << stats->bytes_after << " bytes" << std::endl;
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include "common.h"
+#include "event_loop.h"
+#include "compression.h"
+#include "wire_buffer.h"
+
+class LogCleaner;
+
+struct TopicPartition
+{
+    UUID topic_id;
+    int32_t partition;
+
+    bool operator==(const TopicPartition &other) const = default;
+};
+
+struct TopicPartitionHash
+{
+    size_t operator()(const TopicPartition &topic_partition) const;
+};
+
+// On-disk layout of a v2 RecordBatch header, fields are big-endian on disk
+struct RecordBatchHeader
+{
+    static constexpr size_t SIZE = 61;
+    static constexpr size_t BASE_OFFSET_POS = 0;
+    static constexpr size_t BATCH_LENGTH_POS = 8;
+    static constexpr size_t MAGIC_POS = 16;
+    static constexpr size_t CRC_POS = 17; // Covers everything from the attributes on
+    static constexpr size_t ATTRIBUTES_POS = 21;
+    static constexpr size_t LAST_OFFSET_DELTA_POS = 23;
+    static constexpr size_t BASE_TIMESTAMP_POS = 27;
+    static constexpr size_t MAX_TIMESTAMP_POS = 35;
+    static constexpr size_t RECORDS_COUNT_POS = 57;
+    static constexpr size_t LOG_OVERHEAD = 12; // base_offset + batch_length, not counted in batch_length
+    static constexpr int16_t COMPRESSION_CODEC_MASK = 0x07;
+};
+
+// Zigzag varlong of a record field, false when it runs past end
+bool readVarlong(const char *&data, const char *end, int64_t &value);
+// Codec of a v2 batch, from its attributes
+CompressionCodec batchCodec(std::span<const char> batch);
+// Records of a v2 batch, decompressed into buffer when the batch is compressed. Empty when they can't be decoded.
+std::span<const char> batchRecords(std::span<const char> batch, std::vector<char> &buffer);
+// Appends to output the header of batch followed by records (records_count of them) encoded with codec,
+// with batch_length, attributes and CRC fixed up to match
+bool encodeBatch(std::span<const char> batch, std::span<const char> records, int32_t records_count, CompressionCodec codec, std::vector<char> &output);
+
+struct TimestampAndOffset
+{
+    int64_t timestamp;
+    int64_t offset;
+};
+
+enum class LogOpenMode
+{
+    READ_WRITE, // Only a torn batch at the very end of a segment is dropped
+    RECOVER,    // After an unclean shutdown, the active segment is cut at its first batch failing its CRC
+    READ_ONLY   // Log another process appends to, nothing is created, written or truncated
+};
+
+// One partition directory, a sequence of segment files named after their base offset.
+// Every batch is indexed in memory (offset -> file position), reads are pread()s under a shared lock.
+class PartitionLog
+{
+public:
+    // A READ_ONLY log (the cluster metadata log, for the cleaner) is only good for segmentInfos() and
+    // replaceSegments(), and holds no segment at all when the directory has none
+    PartitionLog(const std::string &dir_path_, LogOpenMode mode);
+    ~PartitionLog();
+
+    // Assigns offsets to every batch in records and appends them, returns the base offset or -1 if records are malformed.
+    // Batches are checked (CRC and record framing, decompressed if needed) and re-encoded only when compression.type
+    // asks for a different codec, otherwise they are stored byte for byte.
+    int64_t append(std::vector<char> &records);
+    // append() of several record sets under one lock, written to the active segment with a single pwritev() (one per
+    // segment when they fill it). base_offsets[i] is what append() would have returned for *record_sets[i], a
+    // malformed record set fails alone.
+    void appendAll(std::span<std::vector<char> *const> record_sets, std::span<int64_t> base_offsets);
+
+    // Copies whole batches starting at the one holding fetch_offset, up to max_bytes (at least one batch if min_one_batch).
+    // Returns a Kafka error code, OFFSET_OUT_OF_RANGE when fetch_offset is outside the log.
+    int16_t read(int64_t fetch_offset, size_t max_bytes, bool min_one_batch, std::vector<char> &records) const;
+
+    // Bytes between fetch_offset and the end of the log, -1 when fetch_offset is outside the log
+    int64_t bytesAvailable(int64_t fetch_offset) const;
+
+    int64_t highWatermark() const;
+    int64_t logStartOffset() const;
+
+    // First record with a timestamp at or after timestamp, {-1, -1} when there is none.
+    // Binary searches the in-memory time index down to one batch, which is the only thing read from disk.
+    TimestampAndOffset offsetForTimestamp(int64_t timestamp) const;
+    // Record with the largest timestamp, {-1, -1} for an empty log
+    TimestampAndOffset offsetOfMaxTimestamp() const;
+
+    // fdatasync()s every segment written since the last flush. Appends and flushes only happen on the I/O
+    // thread of the log directory, so the unflushed state needs no lock.
+    void flush();
+    int64_t unflushedMessages() const { return unflushed_messages; }
+
+    struct SegmentInfo
+    {
+        int64_t base_offset;
+        std::string path;
+        uint64_t size;
+    };
+    // Every segment in offset order, the last is the active one
+    std::vector<SegmentInfo> segmentInfos() const;
+    // Swaps the leading segments, as returned by segmentInfos(), for compacted copies holding a subset of their
+    // batches that are renamed over them. False, leaving the log and the copies alone, when those segments were
+    // deleted or changed in the meantime. Only the swap itself holds the lock.
+    bool replaceSegments(const std::vector<SegmentInfo> &replaced, const std::vector<std::string> &cleaned_paths);
+
+    const std::string &path() const { return dir_path; }
+
+    // Deletes closed segments from the start of the log whose newest timestamp (file mtime when the batches carry
+    // none) is more than retention_ms before now_ms, then as many as the log can lose and still hold retention_bytes.
+    // Only the segment list is touched under the lock, files are closed and unlinked after. Returns the segments deleted.
+    size_t enforceRetention(int64_t now_ms, int64_t retention_ms, int64_t retention_bytes);
+
+private:
+    struct BatchEntry
+    {
+        int64_t base_offset;
+        int64_t last_offset;
+        int64_t max_timestamp;
+        int64_t largest_timestamp; // Time index, largest max_timestamp of the log up to this batch so it never decreases
+        uint32_t position;
+        uint32_t size;
+    };
+
+    struct Segment
+    {
+        int64_t base_offset;
+        int fd;
+        std::string path;
+        uint64_t size;
+        int64_t max_timestamp;     // Of this segment's batches, what time based retention goes by
+        int64_t largest_timestamp; // Of the log up to the end of this segment
+        std::vector<BatchEntry> batches;
+    };
+
+    // Checks the batches of records and re-encodes them for compression.type, false when they are malformed
+    static bool prepareAppend(std::vector<char> &records, std::vector<std::pair<size_t, size_t>> &batch_bounds);
+    // Indexes the batch headers of segment.fd, truncating a torn batch at the end (with RECOVER, the first batch whose
+    // CRC doesn't match and everything after it). READ_ONLY stops at a torn batch and leaves it, it may be half written.
+    static void indexSegment(Segment &segment, LogOpenMode mode);
+    void loadSegment(int64_t base_offset, const std::string &path, LogOpenMode mode);
+    void rollSegment(int64_t base_offset);
+    // Segment and batch holding offset, {nullptr, nullptr} when offset is past the end
+    std::pair<const Segment *, const BatchEntry *> locate(int64_t offset) const;
+    TimestampAndOffset offsetForTimestampLocked(int64_t timestamp) const;
+    TimestampAndOffset searchBatch(const Segment &segment, const BatchEntry &batch, int64_t timestamp) const;
+
+    std::string dir_path;
+    const bool read_only;
+    mutable std::shared_mutex mutex;
+    std::vector<Segment> segments;
+    int64_t log_end_offset;
+
+    int64_t unflushed_messages = 0;
+    size_t first_unflushed_segment = 0;
+};
+
+// Record sets waiting to be appended to one partition. Any thread push()es, only the I/O thread of the partition's
+// directory takes them, all at once. A lock-free (Treiber) stack: producers never wait for each other or for the
+// appender, and the push that finds the queue empty is the one that schedules the drain.
+class AppendQueue
+{
+public:
+    struct Append
+    {
+        std::vector<char> records;
+        std::function<void(int64_t base_offset, PartitionLog &log)> on_appended;
+        Append *next;
+    };
+
+    AppendQueue() : head(nullptr) {}
+    ~AppendQueue();
+
+    // True when the queue was empty before, the caller then has to schedule a takeAll()
+    bool push(std::unique_ptr<Append> append);
+    // Everything pushed so far, oldest first
+    std::vector<std::unique_ptr<Append>> takeAll();
+
+private:
+    std::atomic<Append *> head;
+};
+
+// Owns every PartitionLog of the broker, opened lazily on first access. Each of log.dirs gets an I/O thread that
+// runs every append and flush of the partitions placed there, so disks are written in parallel. Produces queue up
+// per partition and whatever queued while the I/O thread was busy is appended with one write. A partition
+// stays in the directory already holding it, new ones go to the directory with the fewest partitions.
+// Retention is checked for every open log each log.retention.check.interval.ms on a thread of its own, and the
+// cleaner compacts logs with cleanup.policy=compact (and the metadata log) every log.cleaner.backoff.ms on another.
+// With shard.count set, the shard owning a partition runs its appends instead of the I/O thread (see ShardSet).
+// A log directory without the clean shutdown marker shutdown() leaves behind is recovered before anything is served.
+class LogManager
+{
+public:
+    static constexpr const char *CLEAN_SHUTDOWN_FILE = ".kafka_cleanshutdown";
+
+    static LogManager &instance();
+
+    PartitionLog &getLog(const TopicPartition &topic_partition, std::string_view topic_name);
+
+    // Appends records on the I/O thread of the directory holding the partition's log (its shard's thread with
+    // shard.count set), together with whatever else is queued for the partition, flushing it every
+    // log.flush.interval.messages, then runs on_appended there with the base offset append() returned
+    void appendAsync(const TopicPartition &topic_partition, std::string_view topic_name, std::vector<char> records,
+                     std::function<void(int64_t base_offset, PartitionLog &log)> on_appended);
+
+    // Stops retention and the cleaner after their current pass, runs the appends already queued, fsyncs and closes
+    // every log and writes the clean shutdown marker into each log directory. Nothing may use the logs afterwards.
+    void shutdown();
+
+private:
+    struct LogDir
+    {
+        std::string path;
+        size_t partitions;
+        std::unique_ptr<EventLoop> io_loop;
+        std::unique_ptr<CallbackTimer> flush_timer;
+        std::vector<PartitionLog *> logs; // Guarded by the LogManager mutex
+    };
+
+    struct OpenLog
+    {
+        std::unique_ptr<PartitionLog> log;
+        LogDir *dir;
+        std::unique_ptr<AppendQueue> append_queue;
+    };
+
+    LogManager(const std::vector<std::string> &log_dirs_);
+    // Already open logs only take the shared lock
+    OpenLog &openLog(const TopicPartition &topic_partition, std::string_view topic_name);
+    // openLog() from the owning shard, looked up in the shard's own map once opened
+    OpenLog &shardLog(const TopicPartition &topic_partition, std::string_view topic_name);
+    void queueAppend(OpenLog &open_log, std::vector<char> records, std::function<void(int64_t base_offset, PartitionLog &log)> on_appended);
+    void drainAppends(OpenLog &open_log);
+    void flushDir(LogDir &dir);
+    std::vector<std::pair<TopicPartition, PartitionLog *>> openLogs();
+    void enforceRetention();
+    void cleanLogs();
+
+    std::deque<LogDir> log_dirs;
+    // Thread deleting segments past retention, apart from the I/O threads so deletes never hold up appends
+    std::unique_ptr<EventLoop> retention_loop;
+    std::unique_ptr<CallbackTimer> retention_timer;
+    std::unique_ptr<EventLoop> cleaner_loop;
+    std::unique_ptr<CallbackTimer> cleaner_timer;
+    std::unique_ptr<LogCleaner> cleaner;
+    std::shared_mutex mutex;
+    std::unordered_map<TopicPartition, OpenLog, TopicPartitionHash> logs; // Only erased by shutdown()
+    std::vector<std::unordered_map<TopicPartition, OpenLog *, TopicPartitionHash>> shard_logs; // By shard, only used by its thread
+};
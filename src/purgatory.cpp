@@ -0,0 +1,114 @@
+#include "purgatory.h"
+
+bool DelayedOperation::maybeComplete()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (completed.load() || !try_complete())
+        return false;
+
+    completeLocked();
+    return true;
+}
+
+bool DelayedOperation::forceComplete()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (completed.load())
+        return false;
+
+    completeLocked();
+    return true;
+}
+
+void DelayedOperation::completeLocked()
+{
+    completed = true;
+    if (purgatory != nullptr)
+        purgatory->completed_since_purge++;
+    on_complete();
+}
+
+bool Purgatory::tryCompleteElseWatch(const std::shared_ptr<DelayedOperation> &operation, const std::vector<TopicPartition> &keys)
+{
+    constexpr size_t PURGE_INTERVAL = 1000;
+
+    operation->purgatory = this;
+
+    if (operation->maybeComplete())
+        return true;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (completed_since_purge.load() >= PURGE_INTERVAL)
+            purgeCompleted();
+
+        for (auto &key : keys)
+            watchers[key].push_back(operation);
+    }
+
+    // The partition may have changed between the first check and the watch being registered
+    return operation->maybeComplete();
+}
+
+size_t Purgatory::checkAndComplete(const TopicPartition &key)
+{
+    std::vector<std::shared_ptr<DelayedOperation>> operations;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = watchers.find(key);
+        if (it == watchers.end())
+            return 0;
+
+        std::erase_if(it->second, [](const auto &operation)
+                      { return operation->isCompleted(); });
+        if (it->second.empty())
+        {
+            watchers.erase(it);
+            return 0;
+        }
+        operations = it->second;
+    }
+
+    size_t completed = 0;
+    for (auto &operation : operations)
+    {
+        if (operation->maybeComplete())
+            completed++;
+    }
+
+    return completed;
+}
+
+size_t Purgatory::watched() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    size_t watched = 0;
+    for (auto &[key, operations] : watchers)
+        watched += operations.size();
+    return watched;
+}
+
+void Purgatory::purgeCompleted()
+{
+    // Operations completed through another key (or expired) stay on idle watcher lists until swept here
+    for (auto it = watchers.begin(); it != watchers.end();)
+    {
+        std::erase_if(it->second, [](const auto &operation)
+                      { return operation->isCompleted(); });
+        it = it->second.empty() ? watchers.erase(it) : std::next(it);
+    }
+    completed_since_purge = 0;
+}
+
+Purgatory &fetchPurgatory()
+{
+    // Never destroyed, network threads may still be using it while the process exits
+    static Purgatory &purgatory = *new Purgatory();
+    return purgatory;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "common.h"
+#include "timer_wheel.h"
+#include "partition_log.h"
+
+class Purgatory;
+
+// A request that could not be answered right away. It completes exactly once, either when try_complete()
+// reports it can be answered after one of its partitions changed, or when it times out. The timeout is the
+// TimerTask, scheduled by the owner on its EventLoop.
+class DelayedOperation : public TimerTask, public std::enable_shared_from_this<DelayedOperation>
+{
+public:
+    DelayedOperation(std::function<bool()> try_complete_, std::function<void()> on_complete_)
+        : try_complete(std::move(try_complete_)), on_complete(std::move(on_complete_)) {}
+
+    bool maybeComplete();
+    bool forceComplete();
+    bool isCompleted() const { return completed.load(); }
+
+    void onExpire() override { forceComplete(); }
+
+private:
+    void completeLocked();
+
+    std::mutex mutex; // Serializes try_complete() with completion so neither runs after on_complete()
+    std::atomic_bool completed = false;
+    std::function<bool()> try_complete;
+    std::function<void()> on_complete;
+
+    Purgatory *purgatory = nullptr;
+
+    friend class Purgatory;
+};
+
+// Parks DelayedOperations on per-partition watcher lists until a change to one of their partitions completes them.
+// Completed operations are dropped from the lists lazily, when their key is checked or in a periodic sweep.
+class Purgatory
+{
+public:
+    Purgatory() : completed_since_purge(0) {}
+
+    // Completes operation now if possible, otherwise watches it on keys until it completes
+    bool tryCompleteElseWatch(const std::shared_ptr<DelayedOperation> &operation, const std::vector<TopicPartition> &keys);
+
+    // Called after key's partition changed (e.g. the high watermark moved), returns how many operations completed
+    size_t checkAndComplete(const TopicPartition &key);
+
+    size_t watched() const;
+
+private:
+    void purgeCompleted();
+
+    mutable std::mutex mutex;
+    std::unordered_map<TopicPartition, std::vector<std::shared_ptr<DelayedOperation>>, TopicPartitionHash> watchers;
+    std::atomic<size_t> completed_since_purge;
+
+    friend class DelayedOperation;
+};
+
+Purgatory &fetchPurgatory();
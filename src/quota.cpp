@@ -0,0 +1,80 @@
+#include "quota.h"
+#include "broker_config.h"
+#include "metrics.h"
+
+int64_t QuotaBucket::charge(int64_t rate, double cost, uint64_t now_ns)
+{
+    const int64_t now = static_cast<int64_t>(now_ns);
+    const int64_t cost_ns = static_cast<int64_t>(cost * 1e9 / static_cast<double>(rate));
+    int64_t full_at = full_at_ns.load(std::memory_order_relaxed);
+    int64_t charged;
+    do
+        charged = std::max(full_at, now - BURST_NS) + cost_ns;
+    while (!full_at_ns.compare_exchange_weak(full_at, charged, std::memory_order_relaxed));
+    return std::max<int64_t>(charged - now, 0);
+}
+
+int32_t ClientQuota::record(int16_t api_key, size_t request_bytes, size_t response_bytes)
+{
+    const BrokerConfig &config = brokerConfig();
+    const uint64_t now_ns = monotonicNs();
+    last_used_ns.store(now_ns, std::memory_order_relaxed);
+
+    int64_t debt_ns = 0;
+    if (config.quota_request_rate_default != INT64_MAX)
+        debt_ns = requests.charge(config.quota_request_rate_default, 1, now_ns);
+    if (api_key == 0 && config.quota_producer_default != INT64_MAX) // Produce
+        debt_ns = std::max(debt_ns, produce_bytes.charge(config.quota_producer_default, request_bytes, now_ns));
+    if (api_key == 1 && config.quota_consumer_default != INT64_MAX) // Fetch
+        debt_ns = std::max(debt_ns, fetch_bytes.charge(config.quota_consumer_default, response_bytes, now_ns));
+
+    return static_cast<int32_t>(std::min<int64_t>(debt_ns / (1000 * 1000), MAX_THROTTLE_MS));
+}
+
+// Client ids seen recently. Connections keep their client id's quotas, the map only keeps them across reconnects
+// until they have been unused for EXPIRY_NS.
+class ClientQuotas
+{
+public:
+    static constexpr uint64_t EXPIRY_NS = 60ULL * 60 * 1000 * 1000 * 1000;
+
+    std::shared_ptr<ClientQuota> get(std::string_view client_id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string key(client_id);
+        auto it = quotas.find(key);
+        if (it != quotas.end())
+            return it->second;
+
+        if (quotas.size() >= sweep_at)
+            sweep();
+        auto quota = std::make_shared<ClientQuota>();
+        quotas.emplace(std::move(key), quota);
+        return quota;
+    }
+
+private:
+    void sweep()
+    {
+        const uint64_t now_ns = monotonicNs();
+        std::erase_if(quotas, [&](const auto &entry)
+                      { return entry.second.use_count() == 1 &&
+                               now_ns - entry.second->last_used_ns.load(std::memory_order_relaxed) > EXPIRY_NS; });
+        sweep_at = std::max<size_t>(1024, 2 * quotas.size());
+    }
+
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<ClientQuota>> quotas;
+    size_t sweep_at = 1024;
+};
+
+std::shared_ptr<ClientQuota> ClientQuota::forClient(std::string_view client_id)
+{
+    const BrokerConfig &config = brokerConfig();
+    if (config.quota_producer_default == INT64_MAX && config.quota_consumer_default == INT64_MAX &&
+        config.quota_request_rate_default == INT64_MAX)
+        return nullptr;
+
+    static ClientQuotas client_quotas;
+    return client_quotas.get(client_id);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.h"
+
+// Token bucket holding up to BURST_NS worth of its rate, kept as the time it is back to full (GCRA) in a single
+// atomic, so every connection of a client id charges the same bucket whichever thread serves it. A charge always
+// goes through and may leave the bucket in debt, the debt is how long the client has to hold off.
+class QuotaBucket
+{
+public:
+    static constexpr int64_t BURST_NS = 1000 * 1000 * 1000;
+
+    // cost units against rate units per second, returns the debt in ns (0 while the bucket still had credit)
+    int64_t charge(int64_t rate, double cost, uint64_t now_ns);
+
+private:
+    std::atomic<int64_t> full_at_ns{INT64_MIN / 2};
+};
+
+// Quotas of one client id, shared by its connections
+class ClientQuota
+{
+public:
+    static constexpr int32_t MAX_THROTTLE_MS = 10 * 1000; // Longest mute at a time, further debt carries over
+
+    // Charges one answered request, returns its throttle_time_ms
+    int32_t record(int16_t api_key, size_t request_bytes, size_t response_bytes);
+
+    // Looks up (or creates) the quotas of client_id, nullptr when no quota is configured
+    static std::shared_ptr<ClientQuota> forClient(std::string_view client_id);
+
+private:
+    QuotaBucket produce_bytes;
+    QuotaBucket fetch_bytes;
+    QuotaBucket requests;
+    std::atomic<uint64_t> last_used_ns{0};
+
+    friend class ClientQuotas;
+};
@@ -1,6 +1,6 @@
 #include "server_setup.h"
 
-int serverSetup()
+int serverSetup(const BrokerConfig &config, bool reuse_port)
 {
     int server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd < 0)
@@ -18,21 +18,42 @@ int serverSetup()
         std::cerr << "setsockopt failed: " << std::endl;
         return 1;
     }
+    if (reuse_port && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)
+    {
+        close(server_fd);
+        std::cerr << "setsockopt failed: " << std::endl;
+        return 1;
+    }
 
     struct sockaddr_in server_addr{};
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(9092);
+    server_addr.sin_port = htons(config.listener_port);
+
+    if (!config.listener_host.empty())
+    {
+        struct addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo *address = nullptr;
+        if (getaddrinfo(config.listener_host.c_str(), nullptr, &hints, &address) != 0)
+        {
+            close(server_fd);
+            std::cerr << "Failed to resolve listener host " << config.listener_host << std::endl;
+            return 1;
+        }
+        server_addr.sin_addr = reinterpret_cast<struct sockaddr_in *>(address->ai_addr)->sin_addr;
+        freeaddrinfo(address);
+    }
 
     if (bind(server_fd, reinterpret_cast<struct sockaddr *>(&server_addr), sizeof(server_addr)) != 0)
     {
         close(server_fd);
-        std::cerr << "Failed to bind to port 9092" << std::endl;
+        std::cerr << "Failed to bind to port " << config.listener_port << std::endl;
         return 1;
     }
 
-    int connection_backlog = 5;
-    if (listen(server_fd, connection_backlog) != 0)
+    if (listen(server_fd, config.socket_listen_backlog_size) != 0)
     {
         close(server_fd);
         std::cerr << "listen failed" << std::endl;
@@ -40,4 +61,14 @@ int serverSetup()
     }
 
     return server_fd;
-}
\ No newline at end of file
+}
+void setupClientSocket(int client_fd, const BrokerConfig &config)
+{
+    // Responses are written whole, no point in Nagle holding back their tail
+    int no_delay = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    if (config.socket_send_buffer_bytes != -1)
+        setsockopt(client_fd, SOL_SOCKET, SO_SNDBUF, &config.socket_send_buffer_bytes, sizeof(int));
+    if (config.socket_receive_buffer_bytes != -1)
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVBUF, &config.socket_receive_buffer_bytes, sizeof(int));
+}
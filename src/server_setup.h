@@ -1,5 +1,10 @@
 #pragma once
 
 #include "common.h"
+#include "broker_config.h"
 
-int serverSetup();
\ No newline at end of file
+// Listening socket, 1 on failure. With reuse_port several sockets bind the same port and the kernel spreads
+// connections over them.
+int serverSetup(const BrokerConfig &config, bool reuse_port = false);
+// TCP_NODELAY and socket.send/receive.buffer.bytes for an accepted connection
+void setupClientSocket(int client_fd, const BrokerConfig &config);
\ No newline at end of file
@@ -0,0 +1,256 @@
+#include "shard.h"
+#include "client_accept.h"
+#include "server_setup.h"
+#include "broker_config.h"
+#include "metrics.h"
+#include "admission.h"
+
+std::atomic<ShardSet *> ShardSet::active_set = nullptr;
+thread_local size_t ShardSet::current_shard = ShardSet::NO_SHARD;
+
+// Accepts the connections the kernel hands to one shard's listening socket, they stay on that shard
+class ShardSet::Acceptor : public EventHandler
+{
+public:
+    explicit Acceptor(Shard &shard_) : shard(shard_), retry_timer([this]()
+                                                                 { shard.loop->modifyFd(shard.listen_fd, EPOLLIN); }) {}
+    ~Acceptor() { shard.loop->cancel(retry_timer); }
+
+    void onShutdown() override
+    {
+        shard.loop->cancel(retry_timer);
+        shard.loop->removeFd(shard.listen_fd);
+        close(shard.listen_fd);
+        shard.listen_fd = -1;
+    }
+
+    void onEvents(uint32_t) override
+    {
+        while (true)
+        {
+            if (AdmissionControl::connectionsFull())
+            {
+                // Connections wait in the listen backlog until others close
+                shard.loop->modifyFd(shard.listen_fd, 0);
+                shard.loop->schedule(retry_timer, AdmissionControl::RETRY_MS);
+                return;
+            }
+
+            struct sockaddr_in client_addr{};
+            socklen_t client_addr_len = sizeof(client_addr);
+            int client_fd = accept4(shard.listen_fd, reinterpret_cast<struct sockaddr *>(&client_addr), &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client_fd == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    std::perror("Error occured");
+                return;
+            }
+
+            if (!AdmissionControl::admitConnection(client_addr.sin_addr.s_addr))
+            {
+                close(client_fd);
+                BrokerMetrics::local().add(Counter::CONNECTIONS_REJECTED);
+                continue;
+            }
+
+            setupClientSocket(client_fd, brokerConfig());
+            std::make_shared<Client>(client_fd, *shard.loop, client_addr.sin_addr.s_addr)->start();
+            std::cout << "Client connected\n";
+        }
+    }
+
+private:
+    Shard &shard;
+    CallbackTimer retry_timer; // Resumes accepting after max.connections was reached
+};
+
+// Runs what other shards sent once the shard's eventfd says there is something
+class ShardSet::Inbox : public EventHandler
+{
+public:
+    Inbox(ShardSet &shard_set_, Shard &shard_) : shard_set(shard_set_), shard(shard_) {}
+
+    void onEvents(uint32_t) override
+    {
+        uint64_t count;
+        while (read(shard.wakeup_fd, &count, sizeof(count)) > 0)
+            ;
+
+        // Cleared before the rings are read: a sender either sees it cleared and writes the eventfd again, or its
+        // message is already visible below
+        shard.wakeup_pending.store(false, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        shard_set.drainInbound(shard);
+    }
+
+private:
+    ShardSet &shard_set;
+    Shard &shard;
+};
+
+ShardSet::ShardSet(size_t shard_count)
+{
+    for (size_t i = 0; i < shard_count; i++)
+    {
+        auto shard = std::make_unique<Shard>();
+        shard->index = i;
+        shard->cpu = -1;
+        shard->loop = std::make_unique<EventLoop>();
+        shard->listen_fd = -1;
+        shard->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        shard->wakeup_pending = false;
+        if (shard->wakeup_fd == -1)
+        {
+            std::perror("Error occured");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t from = 0; from < shard_count; from++)
+            shard->inbound.push_back(std::make_unique<SpscQueue<std::function<void()>>>(QUEUE_CAPACITY));
+        shards.push_back(std::move(shard));
+    }
+}
+
+bool ShardSet::start(size_t shard_count)
+{
+    // Never destroyed, like the loops of the network threads
+    ShardSet *shard_set = new ShardSet(shard_count);
+
+    for (auto &shard : shard_set->shards)
+    {
+        shard->listen_fd = serverSetup(brokerConfig(), true);
+        if (shard->listen_fd == 1)
+        {
+            std::cerr << "Couldn't setup the listening socket of shard " << shard->index << std::endl;
+            return false;
+        }
+        // Accepted until EAGAIN
+        fcntl(shard->listen_fd, F_SETFL, fcntl(shard->listen_fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    // One CPU per shard out of those the broker may run on, unpinned when there aren't enough
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    std::vector<int> cpus;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+                cpus.push_back(cpu);
+        }
+    }
+    if (cpus.size() >= shard_count)
+    {
+        for (auto &shard : shard_set->shards)
+            shard->cpu = cpus[shard->index];
+    }
+    else
+    {
+        std::cerr << "shard.count " << shard_count << " is more than the " << cpus.size() << " CPUs available, shards are not pinned" << std::endl;
+    }
+
+    for (auto &shard : shard_set->shards)
+    {
+        EventLoop &loop = *shard->loop;
+        BrokerMetrics::registerGauge({.name = "kafka_network_pending_tasks", .help = "Tasks posted to a network thread and not run yet",
+                                      .labels = "thread=\"" + std::to_string(shard->index) + "\"", .value = [&loop]()
+                                      { return static_cast<double>(loop.pendingTasks()); }});
+    }
+
+    // Partitions are routed to their owners from the first request on
+    active_set = shard_set;
+
+    for (auto &shard : shard_set->shards)
+        shard->thread = spawnWorkerThread([shard_set, &shard = *shard]()
+                                          { shard_set->run(shard); });
+
+    std::cout << "Serving connections on " << shard_count << " shards\n";
+    return true;
+}
+
+void ShardSet::run(Shard &shard)
+{
+    current_shard = shard.index;
+
+    if (shard.cpu != -1)
+    {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(shard.cpu, &cpu_set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0)
+            std::cerr << "Couldn't pin shard " << shard.index << " to CPU " << shard.cpu << std::endl;
+    }
+
+    shard.loop->addFd(shard.wakeup_fd, EPOLLIN, std::make_shared<Inbox>(*this, shard));
+    shard.loop->addFd(shard.listen_fd, EPOLLIN, std::make_shared<Acceptor>(shard));
+    shard.loop->run();
+}
+
+void ShardSet::submit(size_t index, std::function<void()> task)
+{
+    Shard &shard = *shards[index];
+
+    // Outside the shards, or with the ring full, the loop's own queue takes it
+    if (current_shard == NO_SHARD || !shard.inbound[current_shard]->push(std::move(task)))
+    {
+        shard.loop->post(std::move(task));
+        return;
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!shard.wakeup_pending.load(std::memory_order_relaxed) && !shard.wakeup_pending.exchange(true))
+    {
+        uint64_t count = 1;
+        if (write(shard.wakeup_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+            std::perror("Error occured");
+    }
+}
+
+void ShardSet::post(EventLoop &loop, std::function<void()> task)
+{
+    ShardSet *shard_set = active();
+    if (shard_set != nullptr && current_shard != NO_SHARD)
+    {
+        for (auto &shard : shard_set->shards)
+        {
+            if (shard->loop.get() == &loop)
+            {
+                shard_set->submit(shard->index, std::move(task));
+                return;
+            }
+        }
+    }
+    loop.post(std::move(task));
+}
+
+void ShardSet::drainInbound(Shard &shard)
+{
+    std::function<void()> task;
+    for (auto &queue : shard.inbound)
+    {
+        while (queue->pop(task))
+            task();
+    }
+    task = nullptr;
+}
+
+void ShardSet::beginShutdown()
+{
+    for (auto &shard : shards)
+        shard->loop->post([&loop = *shard->loop]()
+                          { loop.beginShutdown(); });
+}
+
+void ShardSet::stop()
+{
+    for (auto &shard : shards)
+        shard->loop->stop();
+    for (auto &shard : shards)
+    {
+        shard->thread.join();
+        if (shard->listen_fd != -1)
+            close(shard->listen_fd);
+    }
+}
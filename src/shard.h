@@ -0,0 +1,110 @@
+#pragma once
+
+#include "common.h"
+#include "event_loop.h"
+#include "partition_log.h"
+
+// Bounded single producer, single consumer ring. The producer and the consumer each keep a cached copy of the
+// other side's index, so the shared cache lines are only read when the ring looks full or empty.
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity) : slots(std::bit_ceil(capacity)), mask(slots.size() - 1), head(0), cached_tail(0), tail(0), cached_head(0) {}
+
+    // Producer only, false (value untouched) when the ring is full
+    bool push(T &&value)
+    {
+        const size_t position = tail.load(std::memory_order_relaxed);
+        if (position - cached_head == slots.size())
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (position - cached_head == slots.size())
+                return false;
+        }
+        slots[position & mask] = std::move(value);
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only
+    bool pop(T &value)
+    {
+        const size_t position = head.load(std::memory_order_relaxed);
+        if (position == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (position == cached_tail)
+                return false;
+        }
+        value = std::move(slots[position & mask]);
+        slots[position & mask] = T(); // Whatever value holds on to goes with it, not with the next lap
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> slots;
+    const size_t mask;
+
+    alignas(64) std::atomic<size_t> head; // Consumer side
+    size_t cached_tail;
+    alignas(64) std::atomic<size_t> tail; // Producer side
+    size_t cached_head;
+};
+
+// Shared-nothing broker mode (shard.count > 0). Each shard is a reactor thread pinned to its own CPU with its own
+// listening socket on the broker port (SO_REUSEPORT), so the connections it accepts never leave it. Every partition
+// is owned by one shard (by hash), which runs all appends to it and keeps its own partition -> log map. Shards
+// only talk through one SPSC ring per ordered pair of shards, a shard's eventfd is written when a message finds it
+// idle. Threads that aren't shards (group coordinator, log directory I/O) go through the EventLoop queue instead.
+// Fetches still read logs directly from the connection's shard, under the log's shared lock.
+class ShardSet
+{
+public:
+    static constexpr size_t NO_SHARD = SIZE_MAX;
+    static constexpr size_t QUEUE_CAPACITY = 256; // Per pair of shards, shard.count^2 of them
+
+    // Starts shard_count shards on the broker port, false (after printing why) when they couldn't listen
+    static bool start(size_t shard_count);
+    // The running shards, nullptr unless shard.count is set
+    static ShardSet *active() { return active_set.load(std::memory_order_acquire); }
+    // Shard of the calling thread, NO_SHARD outside of the shards
+    static size_t currentShard() { return current_shard; }
+    // Runs task on loop, over the ring from the calling shard when loop is a shard's
+    static void post(EventLoop &loop, std::function<void()> task);
+
+    size_t size() const { return shards.size(); }
+    size_t owner(const TopicPartition &topic_partition) const { return TopicPartitionHash{}(topic_partition) % shards.size(); }
+    // Runs task on shard, from any thread
+    void submit(size_t shard, std::function<void()> task);
+
+    // Closes the listening sockets and lets every connection finish (EventLoop::beginShutdown() on each shard)
+    void beginShutdown();
+    void stop();
+
+private:
+    struct Shard
+    {
+        size_t index;
+        int cpu; // -1 when the thread isn't pinned
+        std::unique_ptr<EventLoop> loop;
+        std::thread thread;
+        int listen_fd;
+        int wakeup_fd;
+        alignas(64) std::atomic_bool wakeup_pending; // An eventfd write is on its way, senders can skip theirs
+        std::vector<std::unique_ptr<SpscQueue<std::function<void()>>>> inbound; // By sending shard
+    };
+
+    class Acceptor;
+    class Inbox;
+
+    explicit ShardSet(size_t shard_count);
+    void run(Shard &shard);
+    void drainInbound(Shard &shard);
+
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    static std::atomic<ShardSet *> active_set;
+    static thread_local size_t current_shard;
+};
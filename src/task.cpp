@@ -0,0 +1,20 @@
+#include "task.h"
+#include "shard.h"
+
+std::function<void()> LoopEvent::notifier()
+{
+    return [event = shared_from_this()]()
+    {
+        ShardSet::post(event->loop, [event]()
+                       { event->onSet(); });
+    };
+}
+
+void LoopEvent::onSet()
+{
+    if (set)
+        return;
+    set = true;
+    if (waiter)
+        std::exchange(waiter, {}).resume();
+}
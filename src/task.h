@@ -0,0 +1,116 @@
+#pragma once
+
+#include "common.h"
+#include "event_loop.h"
+
+template <typename T>
+struct TaskResult
+{
+    std::optional<T> value;
+
+    void return_value(T result) { value = std::move(result); }
+    T result() { return std::move(*value); }
+};
+
+template <>
+struct TaskResult<void>
+{
+    void return_void() {}
+    void result() {}
+};
+
+// Coroutine run on an EventLoop thread. A Task starts when it is co_awaited, or spawn()ed without an awaiter, and
+// hands control straight back to its awaiter when it finishes. Handlers read as straight-line code and suspend
+// (on a LoopEvent) where they used to be split into a callback.
+template <typename T = void>
+class [[nodiscard]] Task
+{
+public:
+    struct promise_type : TaskResult<T>
+    {
+        std::coroutine_handle<> continuation; // Awaiting coroutine
+        bool detached = false;                // Spawned, the frame frees itself
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        auto final_suspend() noexcept { return FinalAwaiter{}; }
+        void unhandled_exception() { std::terminate(); } // Handlers report errors in their responses
+    };
+
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+    {
+        handle.promise().continuation = awaiter;
+        return handle;
+    }
+    T await_resume() { return handle.promise().result(); }
+
+    // Starts task without an awaiter, it runs until its first suspension before this returns
+    friend void spawn(Task task)
+    {
+        std::coroutine_handle<promise_type> started = std::exchange(task.handle, {});
+        started.promise().detached = true;
+        started.resume();
+    }
+
+private:
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> finished) noexcept
+        {
+            promise_type &promise = finished.promise();
+            if (promise.detached)
+            {
+                finished.destroy();
+                return std::noop_coroutine();
+            }
+            return promise.continuation ? promise.continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> handle_) : handle(handle_) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// One-shot event a coroutine on loop can co_await, set through notifier() from any thread. The waiter is always
+// resumed on the loop thread, from a posted task, never from inside the notifying call.
+class LoopEvent : public std::enable_shared_from_this<LoopEvent>
+{
+public:
+    struct Awaiter
+    {
+        LoopEvent &event;
+
+        bool await_ready() const noexcept { return event.set; }
+        void await_suspend(std::coroutine_handle<> handle) noexcept { event.waiter = handle; }
+        void await_resume() noexcept {}
+    };
+
+    explicit LoopEvent(EventLoop &loop_) : loop(loop_), set(false) {}
+    LoopEvent(const LoopEvent &) = delete;
+    LoopEvent &operator=(const LoopEvent &) = delete;
+
+    // Callback for whatever completes the wait (a DelayedOperation's on_complete)
+    std::function<void()> notifier();
+
+    Awaiter operator co_await() noexcept { return Awaiter{*this}; }
+
+private:
+    void onSet();
+
+    EventLoop &loop;
+    bool set; // Only touched on the loop thread
+    std::coroutine_handle<> waiter;
+};
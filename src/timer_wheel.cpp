@@ -0,0 +1,151 @@
+#include "timer_wheel.h"
+
+static uint64_t rotateRight(uint64_t value, int shift)
+{
+    return shift == 0 ? value : (value >> shift) | (value << (64 - shift));
+}
+
+TimerWheel::TimerWheel(int64_t start_ms) : current_ms(start_ms), task_count(0), occupied{}
+{
+    for (auto &level : slots)
+        level.fill(nullptr);
+}
+
+void TimerWheel::schedule(TimerTask &task, int64_t expiration_ms)
+{
+    if (task.isScheduled())
+        unlink(task);
+
+    task.expiration_ms = expiration_ms;
+    link(task);
+}
+
+void TimerWheel::cancel(TimerTask &task)
+{
+    if (task.isScheduled())
+        unlink(task);
+}
+
+void TimerWheel::link(TimerTask &task)
+{
+    // Overdue tasks fire on the next tick, tasks beyond the last wheel wait in its furthest slot and get re-linked on cascade
+    constexpr int64_t MAX_SPAN = int64_t(1) << (SLOT_BITS * LEVELS);
+    const int64_t expiration = std::clamp(task.expiration_ms, current_ms, current_ms + MAX_SPAN - 1);
+    const int64_t delta = expiration - current_ms;
+
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (int64_t(1) << (SLOT_BITS * (level + 1))))
+        level++;
+
+    const int index = (expiration >> (SLOT_BITS * level)) & (SLOTS - 1);
+    TimerTask *&head = slots[level][index];
+
+    task.prev = nullptr;
+    task.next = head;
+    if (head != nullptr)
+        head->prev = &task;
+    head = &task;
+    task.slot = &head;
+
+    occupied[level] |= uint64_t(1) << index;
+    task_count++;
+}
+
+void TimerWheel::unlink(TimerTask &task)
+{
+    if (task.prev != nullptr)
+        task.prev->next = task.next;
+    else
+        *task.slot = task.next;
+
+    if (task.next != nullptr)
+        task.next->prev = task.prev;
+
+    if (*task.slot == nullptr)
+    {
+        const size_t position = task.slot - &slots[0][0];
+        occupied[position / SLOTS] &= ~(uint64_t(1) << (position % SLOTS));
+    }
+
+    task.prev = task.next = nullptr;
+    task.slot = nullptr;
+    task_count--;
+}
+
+void TimerWheel::cascade(int level, int64_t tick)
+{
+    const int index = (tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+
+    TimerTask *task = slots[level][index];
+    slots[level][index] = nullptr;
+    occupied[level] &= ~(uint64_t(1) << index);
+
+    while (task != nullptr)
+    {
+        TimerTask *next = task->next;
+        task->slot = nullptr;
+        task_count--;
+        link(*task);
+        task = next;
+    }
+}
+
+int64_t TimerWheel::nextTickMs() const
+{
+    if (task_count == 0)
+        return INT64_MAX;
+
+    int64_t next_tick = INT64_MAX;
+
+    const int index = current_ms & (SLOTS - 1);
+    if (occupied[0] != 0)
+        next_tick = current_ms + std::countr_zero(rotateRight(occupied[0], index));
+
+    for (int level = 1; level < LEVELS; level++)
+    {
+        if (occupied[level] == 0)
+            continue;
+
+        // A level slot is cascaded when its block starts, the current block already has been unless we are at its first tick
+        const int shift = SLOT_BITS * level;
+        const int64_t block = current_ms >> shift;
+        const int64_t first_block = (current_ms & ((int64_t(1) << shift) - 1)) == 0 ? block : block + 1;
+        const int distance = std::countr_zero(rotateRight(occupied[level], first_block & (SLOTS - 1)));
+
+        next_tick = std::min(next_tick, (first_block + distance) << shift);
+    }
+
+    return next_tick;
+}
+
+void TimerWheel::advance(int64_t now_ms, std::vector<TimerTask *> &expired)
+{
+    // Jumps straight between ticks that have work, so idle stretches cost nothing
+    while (true)
+    {
+        const int64_t tick = nextTickMs();
+        if (tick > now_ms)
+            break;
+
+        current_ms = tick;
+
+        int top_level = 0;
+        while (top_level < LEVELS - 1 && (tick & ((int64_t(1) << (SLOT_BITS * (top_level + 1))) - 1)) == 0)
+            top_level++;
+
+        for (int level = top_level; level >= 1; level--)
+            cascade(level, tick);
+
+        const int index = tick & (SLOTS - 1);
+        while (slots[0][index] != nullptr)
+        {
+            TimerTask *task = slots[0][index];
+            unlink(*task);
+            expired.push_back(task);
+        }
+
+        current_ms = tick + 1;
+    }
+
+    current_ms = std::max(current_ms, now_ms + 1);
+}
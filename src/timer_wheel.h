@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+
+// Something that can be scheduled on a TimerWheel, the owner keeps it alive while it is scheduled
+class TimerTask
+{
+public:
+    virtual ~TimerTask() {}
+    virtual void onExpire() = 0;
+
+    bool isScheduled() const { return slot != nullptr; }
+    int64_t expirationMs() const { return expiration_ms; }
+
+private:
+    int64_t expiration_ms = 0;
+    TimerTask *prev = nullptr;
+    TimerTask *next = nullptr;
+    TimerTask **slot = nullptr; // Head of the wheel slot this task is linked into
+
+    friend class TimerWheel;
+};
+
+// Hierarchical timing wheel with 1ms ticks: LEVELS wheels of 64 slots each, level L slot spans 64^L ms.
+// Schedule and cancel are O(1) list operations, tasks cascade into finer wheels as their time approaches.
+// Not thread safe, callers serialize access.
+class TimerWheel
+{
+public:
+    static constexpr int LEVELS = 5; // 64^5 ms, a little over 12 days before tasks get parked in the last slot
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+
+    explicit TimerWheel(int64_t start_ms);
+
+    void schedule(TimerTask &task, int64_t expiration_ms);
+    void cancel(TimerTask &task);
+
+    // Moves time forward to now_ms, unlinking every task that is due into expired (tasks are not run here)
+    void advance(int64_t now_ms, std::vector<TimerTask *> &expired);
+
+    // Earliest tick that needs processing (an expiry or a cascade), INT64_MAX if nothing is scheduled
+    int64_t nextTickMs() const;
+    size_t size() const { return task_count; }
+
+    static int64_t nowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    void link(TimerTask &task);
+    void unlink(TimerTask &task);
+    void cascade(int level, int64_t tick);
+
+    int64_t current_ms; // Next tick to be processed
+    size_t task_count;
+    std::array<std::array<TimerTask *, SLOTS>, LEVELS> slots;
+    std::array<uint64_t, LEVELS> occupied; // Bit per non-empty slot
+};
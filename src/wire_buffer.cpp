@@ -0,0 +1,92 @@
+#include "wire_buffer.h"
+
+void WireWriter::writeSlow(const char *src, size_t len)
+{
+    if (!chained)
+    {
+        const size_t used = cursor - begin;
+        const size_t capacity = std::max<size_t>({used + len, 2 * static_cast<size_t>(end - begin), 256});
+        std::unique_ptr<char[]> grown(new char[capacity]);
+        if (used > 0)
+            std::memcpy(grown.get(), begin, used);
+        array = std::move(grown);
+        begin = array.get();
+        cursor = begin + used;
+        end = begin + capacity;
+        std::memcpy(cursor, src, len);
+        cursor += len;
+        return;
+    }
+
+    while (len > 0)
+    {
+        if (cursor == end)
+        {
+            if (!chunks.empty())
+                begin_offset += BufferPool::CHUNK_SIZE;
+            chunks.push_back(BufferPool::acquire());
+            begin = cursor = chunks.back();
+            end = begin + BufferPool::CHUNK_SIZE;
+        }
+        const size_t copied = std::min(len, static_cast<size_t>(end - cursor));
+        std::memcpy(cursor, src, copied);
+        cursor += copied;
+        src += copied;
+        len -= copied;
+    }
+}
+
+void WireWriter::clear()
+{
+    for (char *chunk : chunks)
+        BufferPool::release(chunk);
+    chunks.clear();
+    chunks_offset = 0;
+    begin_offset = 0;
+    if (chained)
+        begin = cursor = end = nullptr;
+    else
+        cursor = begin; // The array is kept for the next response
+}
+
+size_t WireWriter::gather(size_t offset, iovec *iov, size_t max_iov) const
+{
+    const size_t total = size();
+    size_t count = 0;
+    size_t index = (offset - chunks_offset) / BufferPool::CHUNK_SIZE;
+    size_t skip = (offset - chunks_offset) % BufferPool::CHUNK_SIZE;
+    while (offset < total && count < max_iov)
+    {
+        const size_t len = std::min(BufferPool::CHUNK_SIZE - skip, total - offset);
+        iov[count].iov_base = chunks[index] + skip;
+        iov[count].iov_len = len;
+        count++;
+        index++;
+        skip = 0;
+        offset += len;
+    }
+    return count;
+}
+
+void WireWriter::release(size_t offset)
+{
+    // The chunk being filled stays, even once fully sent
+    while (chunks.size() > 1 && offset >= chunks_offset + BufferPool::CHUNK_SIZE)
+    {
+        BufferPool::release(chunks.front());
+        chunks.pop_front();
+        chunks_offset += BufferPool::CHUNK_SIZE;
+    }
+}
+
+void WireWriter::swap(WireWriter &other) noexcept
+{
+    std::swap(chained, other.chained);
+    std::swap(begin, other.begin);
+    std::swap(cursor, other.cursor);
+    std::swap(end, other.end);
+    std::swap(begin_offset, other.begin_offset);
+    array.swap(other.array);
+    chunks.swap(other.chunks);
+    std::swap(chunks_offset, other.chunks_offset);
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "common.h"
+#include "buffer_pool.h"
+
+inline size_t unsignedVarintSize(uint32_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// Big-endian field at data, for records and batches already in memory
+inline int64_t readBE64(const char *data)
+{
+    int64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    convertBE64toH(value);
+    return value;
+}
+
+inline int32_t readBE32(const char *data)
+{
+    int32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    convertBE32toH(value);
+    return value;
+}
+
+inline int16_t readBE16(const char *data)
+{
+    int16_t value;
+    std::memcpy(&value, data, sizeof(value));
+    convertBE16toH(value);
+    return value;
+}
+
+// Unsigned varint at data, false when it runs past end or is longer than a uint32_t
+inline bool readUnsignedVarint(const char *&data, const char *end, uint32_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 35 && data < end; shift += 7)
+    {
+        const uint8_t byte = *data++;
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (byte < 0x80)
+            return true;
+    }
+    return false;
+}
+
+// Cursor over one complete request frame, fields are copied out raw (big-endian) like recv() used to
+class WireReader
+{
+public:
+    WireReader(const char *data_, size_t size_) : data(data_), size(size_), pos(0), overrun(false) {}
+
+    void read(void *dest, size_t len)
+    {
+        if (len > size - pos)
+        {
+            overrun = true;
+            std::memset(dest, 0, len);
+            pos = size;
+            return;
+        }
+        std::memcpy(dest, data + pos, len);
+        pos += len;
+    }
+
+    template <typename T>
+    T readBigEndian()
+    {
+        using U = std::make_unsigned_t<T>;
+        U raw;
+        read(&raw, sizeof(raw));
+        if constexpr (sizeof(T) == 2)
+            raw = be16toh(raw);
+        else if constexpr (sizeof(T) == 4)
+            raw = be32toh(raw);
+        else if constexpr (sizeof(T) == 8)
+            raw = be64toh(raw);
+        return static_cast<T>(raw);
+    }
+
+    uint32_t readUnsignedVarint()
+    {
+        const char *cursor = data + pos;
+        uint32_t value;
+        if (!::readUnsignedVarint(cursor, data + size, value))
+        {
+            overrun = true;
+            pos = size;
+            return 0;
+        }
+        pos = cursor - data;
+        return value;
+    }
+
+    void skip(size_t len)
+    {
+        if (len > size - pos)
+        {
+            overrun = true;
+            pos = size;
+            return;
+        }
+        pos += len;
+    }
+
+    size_t remaining() const { return size - pos; }
+    bool ok() const { return !overrun; }
+
+private:
+    const char *data;
+    size_t size;
+    size_t pos;
+    bool overrun;
+};
+
+// Growable output buffer a whole response is encoded into. By default one contiguous array (bytes()). A chained
+// writer fills BufferPool chunks one after another instead: a large response never reallocates or moves, it is
+// sent straight from the chunks (gather()) and every chunk goes back to the pool once sent (release()).
+class WireWriter
+{
+public:
+    WireWriter() : chained(false), begin(nullptr), cursor(nullptr), end(nullptr), begin_offset(0), chunks_offset(0) {}
+    explicit WireWriter(bool chained_) : WireWriter() { chained = chained_; }
+    ~WireWriter() { clear(); }
+    WireWriter(const WireWriter &) = delete;
+    WireWriter &operator=(const WireWriter &) = delete;
+    WireWriter(WireWriter &&other) noexcept : WireWriter() { swap(other); }
+    WireWriter &operator=(WireWriter &&other) noexcept
+    {
+        WireWriter moved(std::move(other));
+        swap(moved);
+        return *this;
+    }
+
+    void write(const void *src, size_t len)
+    {
+        if (len <= static_cast<size_t>(end - cursor))
+        {
+            if (len > 0) // src may be null for an empty write
+                std::memcpy(cursor, src, len);
+            cursor += len;
+            return;
+        }
+        writeSlow(static_cast<const char *>(src), len);
+    }
+
+    void writeUnsignedVarint(uint32_t value)
+    {
+        char encoded[5];
+        size_t size = 0;
+        while (value >= 0x80)
+        {
+            encoded[size++] = static_cast<char>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        encoded[size++] = static_cast<char>(value);
+        write(encoded, size);
+    }
+
+    // Zigzag encoded signed varint (varlong), as in record fields
+    void writeVarint(int64_t value)
+    {
+        uint64_t zigzag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+        char encoded[10];
+        size_t size = 0;
+        while (zigzag >= 0x80)
+        {
+            encoded[size++] = static_cast<char>((zigzag & 0x7F) | 0x80);
+            zigzag >>= 7;
+        }
+        encoded[size++] = static_cast<char>(zigzag);
+        write(encoded, size);
+    }
+
+    template <typename T>
+    void writeBigEndian(T value)
+    {
+        using U = std::make_unsigned_t<T>;
+        U raw = static_cast<U>(value);
+        if constexpr (sizeof(T) == 2)
+            raw = htobe16(raw);
+        else if constexpr (sizeof(T) == 4)
+            raw = htobe32(raw);
+        else if constexpr (sizeof(T) == 8)
+            raw = htobe64(raw);
+        write(&raw, sizeof(raw));
+    }
+
+    // Contiguous writers only
+    const char *bytes() const { return begin; }
+    // Bytes written since the last clear(), released ones included
+    size_t size() const { return begin_offset + (cursor - begin); }
+    void clear();
+
+    // Chained writers only: iovecs over [offset, size()) (at most max_iov of them), offset not yet released
+    size_t gather(size_t offset, iovec *iov, size_t max_iov) const;
+    // Gives every chunk wholly before offset back to the pool, offsets stay as they are
+    void release(size_t offset);
+
+private:
+    void writeSlow(const char *src, size_t len);
+    void swap(WireWriter &other) noexcept;
+
+    bool chained;
+    char *begin; // Of the array, or of the chunk being filled
+    char *cursor;
+    char *end;
+    size_t begin_offset;         // Offset of begin
+    std::unique_ptr<char[]> array;
+    std::deque<char *> chunks;   // Chained writers, all full but the last
+    size_t chunks_offset;        // Offset of chunks.front()
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "common.h"
+
+// Checks of the ctest executables: a failed check is reported and counted, main() ends with checkResult()
+
+inline int check_failures = 0;
+
+#define CHECK(...)                                                                              \
+    do                                                                                          \
+    {                                                                                           \
+        if (!(__VA_ARGS__))                                                                     \
+        {                                                                                       \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #__VA_ARGS__ "\n"; \
+            check_failures++;                                                                   \
+        }                                                                                       \
+    } while (false)
+
+inline int checkResult(std::string_view name)
+{
+    if (check_failures > 0)
+    {
+        std::cerr << check_failures << " checks failed\n";
+        return EXIT_FAILURE;
+    }
+    std::cout << "All " << name << " checks passed\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,242 @@
+#include "common.h"
+#include "wire_buffer.h"
+#include "kafka_utils.h"
+#include "metadata_index.h"
+#include "metadata_log_writer.h"
+#include "broker_config.h"
+#include "check.h"
+
+// Pagination of DescribeTopicPartitions over a small metadata image: pages cut short by response_partition_limit,
+// requests resuming from a cursor, and cursors naming topics the image doesn't have.
+
+namespace
+{
+
+constexpr int16_t UNKNOWN_TOPIC_OR_PARTITION = 3;
+
+using TopicPartitionName = std::pair<std::string, int32_t>;
+
+struct Page
+{
+    std::vector<TopicPartitionName> partitions;
+    std::vector<std::pair<std::string, int16_t>> topic_errors;
+    std::optional<TopicPartitionName> next_cursor;
+    bool consumed; // Every byte of the response read, its size matching the message size
+};
+
+// alpha has 3 partitions, bravo 5 and delta 2
+void writeMetadataLog(const std::filesystem::path &metadata_log_dir)
+{
+    constexpr std::array<int32_t, 1> REPLICAS = {1};
+    const std::pair<std::string_view, int32_t> topics[] = {{"delta", 2}, {"alpha", 3}, {"bravo", 5}};
+
+    MetadataLogWriter writer;
+    writer.addFeatureLevel("metadata.version", 20);
+    uint8_t id = 1;
+    for (auto &[name, partitions] : topics)
+    {
+        UUID topic_id{};
+        topic_id[0] = id++;
+        writer.addTopic(name, topic_id);
+        for (int32_t partition = 0; partition < partitions; partition++)
+            writer.addPartition(topic_id, partition, 1, 0, REPLICAS, REPLICAS);
+    }
+
+    std::filesystem::create_directories(metadata_log_dir / "__cluster_metadata-0");
+    writer.writeFile(metadata_log_dir / "__cluster_metadata-0" / "00000000000000000000.log");
+}
+
+std::string readCompactString(WireReader &reader)
+{
+    const uint32_t len = reader.readUnsignedVarint();
+    std::string str(len > 0 ? std::min<size_t>(len - 1, reader.remaining()) : 0, '\0');
+    reader.read(str.data(), str.size());
+    return str;
+}
+
+void skipCompactInt32Array(WireReader &reader)
+{
+    const uint32_t len = reader.readUnsignedVarint();
+    reader.skip(len > 0 ? (len - 1) * sizeof(int32_t) : 0);
+}
+
+// One request and its response, parsed back from the bytes that would be sent
+Page describe(const std::vector<std::string> &topics, int32_t partition_limit, std::optional<TopicPartitionName> cursor)
+{
+    WireWriter body;
+    body.writeUnsignedVarint(topics.size() + 1);
+    for (auto &topic : topics)
+    {
+        sendCompactString(body, topic.size() + 1, std::vector<char>(topic.begin(), topic.end()));
+        sendTaggedFields(body, 0);
+    }
+    body.writeBigEndian(partition_limit);
+    body.writeBigEndian<int8_t>(cursor ? 1 : -1);
+    if (cursor)
+    {
+        sendCompactString(body, cursor->first.size() + 1, std::vector<char>(cursor->first.begin(), cursor->first.end()));
+        body.writeBigEndian(cursor->second);
+        sendTaggedFields(body, 0);
+    }
+    sendTaggedFields(body, 0);
+
+    WireWriter frame;
+    frame.writeBigEndian<int32_t>(2 + 2 + 4 + 2 + 4 + 1 + body.size());
+    frame.writeBigEndian<int16_t>(75);
+    frame.writeBigEndian<int16_t>(0);
+    frame.writeBigEndian<int32_t>(1);
+    frame.writeBigEndian<int16_t>(4);
+    frame.write("test", 4);
+    sendTaggedFields(frame, 0);
+    frame.write(body.bytes(), body.size());
+
+    WireReader request_reader(frame.bytes(), frame.size());
+    RequestHeaderV2 request_header;
+    request_header.receive(request_reader);
+    DescribeTopicPartitionsRequestBodyV0 request_body;
+    request_body.receive(request_reader);
+    CHECK(request_reader.ok() && request_reader.remaining() == 0);
+
+    auto [response_header, response_body] = processDescribeTopicPartitions(request_header, request_body);
+    WireWriter response;
+    response_header->respond(response);
+    response_body->respond(response);
+
+    WireReader reader(response.bytes(), response.size());
+    Page page = {.partitions = {}, .topic_errors = {}, .next_cursor = std::nullopt, .consumed = false};
+    const int32_t message_size = reader.readBigEndian<int32_t>();
+    reader.skip(sizeof(int32_t) + 1 + sizeof(int32_t)); // Correlation id, header tagged fields, throttle time
+
+    const uint32_t topics_len = reader.readUnsignedVarint();
+    for (uint32_t i = 0; i + 1 < topics_len && reader.ok(); i++)
+    {
+        const int16_t error_code = reader.readBigEndian<int16_t>();
+        const std::string name = readCompactString(reader);
+        reader.skip(16 + 1); // Topic id, is_internal
+        if (error_code != 0)
+            page.topic_errors.emplace_back(name, error_code);
+
+        const uint32_t partitions_len = reader.readUnsignedVarint();
+        for (uint32_t j = 0; j + 1 < partitions_len && reader.ok(); j++)
+        {
+            reader.skip(sizeof(int16_t));
+            page.partitions.emplace_back(name, reader.readBigEndian<int32_t>());
+            reader.skip(2 * sizeof(int32_t)); // Leader id and epoch
+            for (int array = 0; array < 5; array++)
+                skipCompactInt32Array(reader);
+            reader.readUnsignedVarint();
+        }
+        reader.skip(sizeof(int32_t)); // Authorized operations
+        reader.readUnsignedVarint();
+    }
+
+    if (reader.readBigEndian<int8_t>() != -1)
+    {
+        const std::string name = readCompactString(reader);
+        page.next_cursor = {name, reader.readBigEndian<int32_t>()};
+        reader.readUnsignedVarint();
+    }
+    reader.readUnsignedVarint();
+
+    page.consumed = reader.ok() && reader.remaining() == 0 && message_size == static_cast<int32_t>(response.size() - sizeof(message_size));
+    CHECK(page.consumed);
+    return page;
+}
+
+// alpha 0..2, bravo 0..4, delta 0..1
+std::vector<TopicPartitionName> allPartitions()
+{
+    std::vector<TopicPartitionName> partitions;
+    for (int32_t partition = 0; partition < 3; partition++)
+        partitions.emplace_back("alpha", partition);
+    for (int32_t partition = 0; partition < 5; partition++)
+        partitions.emplace_back("bravo", partition);
+    for (int32_t partition = 0; partition < 2; partition++)
+        partitions.emplace_back("delta", partition);
+    return partitions;
+}
+
+void testLimitSmallerThanOneTopic()
+{
+    // First page stops inside alpha
+    const Page first = describe({}, 2, std::nullopt);
+    CHECK(first.partitions == std::vector<TopicPartitionName>({{"alpha", 0}, {"alpha", 1}}));
+    CHECK(first.next_cursor == TopicPartitionName("alpha", 2));
+
+    // Following the cursors walks every partition once, in order, whatever the limit
+    for (int32_t limit : {1, 2, 3, 4, 7})
+    {
+        std::vector<TopicPartitionName> walked;
+        std::optional<TopicPartitionName> cursor;
+        int pages = 0;
+        do
+        {
+            const Page page = describe({}, limit, cursor);
+            CHECK(!page.partitions.empty() && page.partitions.size() <= static_cast<size_t>(limit));
+            walked.insert(walked.end(), page.partitions.begin(), page.partitions.end());
+            cursor = page.next_cursor;
+        } while (cursor && ++pages < 20);
+        CHECK(walked == allPartitions());
+    }
+
+    // A page filled by the last partition of a topic resumes at the start of the next one
+    CHECK(describe({}, 3, std::nullopt).next_cursor == TopicPartitionName("bravo", 0));
+}
+
+void testCursorMidTopic()
+{
+    const Page page = describe({}, 10, TopicPartitionName("bravo", 3));
+    CHECK(page.partitions == std::vector<TopicPartitionName>({{"bravo", 3}, {"bravo", 4}, {"delta", 0}, {"delta", 1}}));
+    CHECK(!page.next_cursor);
+
+    // Only the topics asked for, starting with the cursor's
+    const Page requested = describe({"delta", "bravo"}, 3, TopicPartitionName("bravo", 3));
+    CHECK(requested.partitions == std::vector<TopicPartitionName>({{"bravo", 3}, {"bravo", 4}, {"delta", 0}}));
+    CHECK(requested.next_cursor == TopicPartitionName("delta", 1));
+
+    // Past the last partition of its topic the cursor moves on to the next topic
+    CHECK(describe({}, 10, TopicPartitionName("alpha", 7)).partitions.front() == TopicPartitionName("bravo", 0));
+}
+
+void testCursorOfUnknownTopic()
+{
+    // Every topic: resumes with the first topic after the cursor's name
+    const Page page = describe({}, 10, TopicPartitionName("charlie", 4));
+    CHECK(page.partitions == std::vector<TopicPartitionName>({{"delta", 0}, {"delta", 1}}));
+    CHECK(page.topic_errors.empty() && !page.next_cursor);
+
+    // Past the last topic the page is empty and final
+    const Page past_end = describe({}, 10, TopicPartitionName("zulu", 0));
+    CHECK(past_end.partitions.empty() && past_end.topic_errors.empty() && !past_end.next_cursor);
+
+    // Requested topics: the unknown one is answered with an error and takes none of the limit
+    const Page requested = describe({"charlie", "delta"}, 2, TopicPartitionName("charlie", 4));
+    CHECK(requested.topic_errors == std::vector<std::pair<std::string, int16_t>>({{"charlie", UNKNOWN_TOPIC_OR_PARTITION}}));
+    CHECK(requested.partitions == std::vector<TopicPartitionName>({{"delta", 0}, {"delta", 1}}));
+    CHECK(!requested.next_cursor);
+}
+
+} // namespace
+
+int main()
+{
+    char scratch[] = "/tmp/kafka_describe_topic_partitions_test.XXXXXX";
+    if (mkdtemp(scratch) == nullptr)
+    {
+        std::perror("Error occured");
+        return EXIT_FAILURE;
+    }
+
+    writeMetadataLog(scratch);
+    BrokerConfig config;
+    config.metadata_log_dir = scratch;
+    setBrokerConfig(std::move(config));
+    MetadataImage::reload();
+
+    testLimitSmallerThanOneTopic();
+    testCursorMidTopic();
+    testCursorOfUnknownTopic();
+
+    std::filesystem::remove_all(scratch);
+    return checkResult("DescribeTopicPartitions");
+}
@@ -0,0 +1,323 @@
+#include "common.h"
+#include "broker_config.h"
+#include "partition_log.h"
+#include "log_cleaner.h"
+#include "check.h"
+
+// Behaviour tests of the log cleaner: logs are written to a scratch directory, cleaned, and read back through
+// PartitionLog. Exits non-zero when a check fails.
+
+namespace
+{
+
+struct TestRecord
+{
+    std::optional<std::string> key;
+    std::optional<std::string> value; // nullopt for a tombstone
+};
+
+struct ReadRecord
+{
+    int64_t offset;
+    std::optional<std::string> key;
+    std::optional<std::string> value;
+};
+
+void putVarlong(std::vector<char> &out, int64_t value)
+{
+    uint64_t zigzag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    while (zigzag >= 0x80)
+    {
+        out.push_back(static_cast<char>(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    out.push_back(static_cast<char>(zigzag));
+}
+
+template <typename T>
+void putBE(char *at, T value)
+{
+    for (size_t i = 0; i < sizeof(T); i++)
+        at[i] = static_cast<char>(static_cast<std::make_unsigned_t<T>>(value) >> (8 * (sizeof(T) - 1 - i)));
+}
+
+void putOptional(std::vector<char> &out, const std::optional<std::string> &bytes)
+{
+    putVarlong(out, bytes ? static_cast<int64_t>(bytes->size()) : -1);
+    if (bytes)
+        out.insert(out.end(), bytes->begin(), bytes->end());
+}
+
+// Uncompressed v2 batch of records, all with the same timestamp
+std::vector<char> makeBatch(const std::vector<TestRecord> &records, int64_t timestamp, int64_t base_offset = 0)
+{
+    std::vector<char> encoded;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        std::vector<char> record = {0}; // Attributes
+        putVarlong(record, 0);          // Timestamp delta
+        putVarlong(record, static_cast<int64_t>(i));
+        putOptional(record, records[i].key);
+        putOptional(record, records[i].value);
+        putVarlong(record, 0); // Headers
+
+        putVarlong(encoded, static_cast<int64_t>(record.size()));
+        encoded.insert(encoded.end(), record.begin(), record.end());
+    }
+
+    std::vector<char> header(RecordBatchHeader::SIZE, 0);
+    putBE<int64_t>(header.data() + RecordBatchHeader::BASE_OFFSET_POS, base_offset);
+    header[RecordBatchHeader::MAGIC_POS] = 2;
+    putBE<int32_t>(header.data() + RecordBatchHeader::LAST_OFFSET_DELTA_POS, static_cast<int32_t>(records.size()) - 1);
+    putBE<int64_t>(header.data() + RecordBatchHeader::BASE_TIMESTAMP_POS, timestamp);
+    putBE<int64_t>(header.data() + RecordBatchHeader::MAX_TIMESTAMP_POS, timestamp);
+
+    std::vector<char> batch;
+    encodeBatch(header, encoded, static_cast<int32_t>(records.size()), CompressionCodec::NONE, batch);
+    return batch;
+}
+
+int64_t append(PartitionLog &log, const std::vector<TestRecord> &records, int64_t timestamp)
+{
+    std::vector<char> batch = makeBatch(records, timestamp);
+    return log.append(batch);
+}
+
+// Every record from the log start to the high watermark, fetched the way consumers do
+std::vector<ReadRecord> readLog(const PartitionLog &log)
+{
+    std::vector<ReadRecord> read;
+    std::vector<char> records, buffer;
+    int64_t offset = log.logStartOffset();
+    while (offset < log.highWatermark() && log.read(offset, 1 << 20, true, records) == 0 && !records.empty())
+    {
+        for (size_t position = 0; position < records.size();)
+        {
+            int64_t base_offset;
+            int32_t batch_length, last_offset_delta;
+            std::memcpy(&base_offset, records.data() + position + RecordBatchHeader::BASE_OFFSET_POS, sizeof(base_offset));
+            std::memcpy(&batch_length, records.data() + position + RecordBatchHeader::BATCH_LENGTH_POS, sizeof(batch_length));
+            std::memcpy(&last_offset_delta, records.data() + position + RecordBatchHeader::LAST_OFFSET_DELTA_POS, sizeof(last_offset_delta));
+            convertBE64toH(base_offset);
+            convertBE32toH(batch_length);
+            convertBE32toH(last_offset_delta);
+
+            const std::span<const char> batch(records.data() + position, RecordBatchHeader::LOG_OVERHEAD + batch_length);
+            forEachRecord(base_offset, batchRecords(batch, buffer), [&](const CleanerRecord &record, std::span<const char>)
+                          {
+                              auto text = [](const std::optional<std::span<const char>> &bytes)
+                              { return bytes ? std::optional<std::string>(std::string(bytes->begin(), bytes->end())) : std::nullopt; };
+                              read.push_back({.offset = record.offset, .key = text(record.key), .value = text(record.value)}); });
+
+            offset = base_offset + last_offset_delta + 1;
+            position += batch.size();
+        }
+    }
+    return read;
+}
+
+std::vector<int64_t> offsetsOf(const std::vector<ReadRecord> &records)
+{
+    std::vector<int64_t> offsets;
+    for (auto &record : records)
+        offsets.push_back(record.offset);
+    return offsets;
+}
+
+// Every test works in a directory of its own under the scratch directory
+std::filesystem::path scratch_dir;
+
+std::string testDir(const std::string &name)
+{
+    const std::filesystem::path dir = scratch_dir / name;
+    std::filesystem::remove_all(dir);
+    return dir.string();
+}
+
+// One batch per segment, every closed segment counts as cleanable
+BrokerConfig cleanerConfig()
+{
+    BrokerConfig config;
+    config.log_segment_bytes = 1;
+    config.log_cleaner_min_cleanable_ratio = 0;
+    config.log_cleaner_dedupe_buffer_size = 1024 * 1024;
+    return config;
+}
+
+int64_t nowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void testKeepsLatestRecordOfEachKey()
+{
+    setBrokerConfig(cleanerConfig());
+    PartitionLog log(testDir("latest"), LogOpenMode::READ_WRITE);
+    const int64_t now_ms = nowMs();
+
+    append(log, {{"a", "1"}}, now_ms);
+    append(log, {{"b", "1"}}, now_ms);
+    append(log, {{std::nullopt, "no key"}}, now_ms);
+    append(log, {{"a", "2"}, {"c", "1"}}, now_ms);
+    append(log, {{"b", std::nullopt}}, now_ms);
+    append(log, {{"c", "2"}}, now_ms); // Active segment, never cleaned
+
+    LogCleaner cleaner;
+    auto stats = cleaner.clean(log, LogCleaner::recordKey, now_ms);
+    CHECK(stats && stats->segments == 5 && stats->bytes_after < stats->bytes_before);
+
+    // Superseded records are gone, everything else keeps its offset: the gaps are skipped by fetches
+    const std::vector<ReadRecord> records = readLog(log);
+    CHECK(offsetsOf(records) == std::vector<int64_t>({2, 3, 4, 5, 6}));
+    if (records.size() == 5)
+    {
+        CHECK(!records[0].key && records[0].value == "no key"); // Keyless records are always kept
+        CHECK(records[1].key == "a" && records[1].value == "2");
+        CHECK(records[2].key == "c" && records[2].value == "1"); // c=2 is in the active segment, past what was cleaned
+        CHECK(records[3].key == "b" && !records[3].value);       // Tombstone stays for delete.retention.ms
+        CHECK(records[4].key == "c" && records[4].value == "2");
+    }
+    CHECK(log.logStartOffset() == 0 && log.highWatermark() == 7);
+
+    // Appends go on after the last offset. Once c=2 is in a closed segment the batch holding a=2 and c=1 is
+    // rewritten with a=2 alone.
+    CHECK(append(log, {{"d", "1"}}, now_ms) == 7);
+    CHECK(cleaner.clean(log, LogCleaner::recordKey, now_ms));
+    CHECK(offsetsOf(readLog(log)) == std::vector<int64_t>({2, 3, 5, 6, 7}));
+    CHECK(!cleaner.clean(log, LogCleaner::recordKey, now_ms));
+
+    // The cleaned segments are what a restart finds
+    PartitionLog reopened(log.path(), LogOpenMode::READ_WRITE);
+    CHECK(offsetsOf(readLog(reopened)) == std::vector<int64_t>({2, 3, 5, 6, 7}));
+}
+
+void testTombstoneRetention(int64_t delete_retention_ms, bool tombstone_kept)
+{
+    BrokerConfig config = cleanerConfig();
+    config.log_cleaner_delete_retention_ms = delete_retention_ms;
+    setBrokerConfig(config);
+    PartitionLog log(testDir("tombstones"), LogOpenMode::READ_WRITE);
+    const int64_t now_ms = nowMs();
+    const int64_t old_ms = now_ms - 60 * 1000;
+
+    append(log, {{"a", "1"}}, old_ms);
+    append(log, {{"a", std::nullopt}}, old_ms);
+    append(log, {{"b", "1"}}, old_ms);
+
+    // The first cleaning never drops a tombstone, the records it deletes may not be cleaned yet elsewhere
+    LogCleaner cleaner;
+    CHECK(cleaner.clean(log, LogCleaner::recordKey, now_ms));
+    CHECK(offsetsOf(readLog(log)) == std::vector<int64_t>({1, 2}));
+
+    // Once it is in the cleaned part and older than delete.retention.ms it goes
+    append(log, {{"c", "1"}}, now_ms);
+    CHECK(cleaner.clean(log, LogCleaner::recordKey, now_ms));
+    CHECK(offsetsOf(readLog(log)) == (tombstone_kept ? std::vector<int64_t>({1, 2, 3}) : std::vector<int64_t>({2, 3})));
+}
+
+void testReplaceSegmentsRefusesChangedSegments()
+{
+    setBrokerConfig(cleanerConfig());
+    PartitionLog log(testDir("replace"), LogOpenMode::READ_WRITE);
+    const int64_t now_ms = nowMs();
+
+    append(log, {{"a", "1"}}, now_ms);
+    append(log, {{"a", "2"}}, now_ms);
+    append(log, {{"a", "3"}}, now_ms);
+    const std::vector<PartitionLog::SegmentInfo> segments = log.segmentInfos();
+    CHECK(segments.size() == 3);
+
+    auto copyOf = [](const PartitionLog::SegmentInfo &segment)
+    {
+        const std::string copy = segment.path + ".cleaned";
+        std::filesystem::copy_file(segment.path, copy, std::filesystem::copy_options::overwrite_existing);
+        return copy;
+    };
+
+    // A segment whose size differs from what the cleaner read
+    std::vector<PartitionLog::SegmentInfo> stale = {segments[0]};
+    stale[0].size++;
+    std::vector<std::string> copies = {copyOf(segments[0])};
+    CHECK(!log.replaceSegments(stale, copies));
+    CHECK(!std::filesystem::exists(copies[0]));
+
+    // The active segment
+    copies = {copyOf(segments[0]), copyOf(segments[1]), copyOf(segments[2])};
+    CHECK(!log.replaceSegments(segments, copies));
+
+    // A segment retention deleted in the meantime
+    copies = {copyOf(segments[0])};
+    CHECK(log.enforceRetention(now_ms, -1, 1) == 2);
+    CHECK(!log.replaceSegments({segments[0]}, copies));
+    CHECK(!std::filesystem::exists(copies[0]));
+
+    CHECK(offsetsOf(readLog(log)) == std::vector<int64_t>({2}));
+}
+
+// __cluster_metadata record value: frame version, type, version, name, then a level
+TestRecord metadataRecord(int8_t type, const std::string &name, int16_t level)
+{
+    std::string value = {1, static_cast<char>(type), 0, static_cast<char>(name.size() + 1)};
+    value += name;
+    value.push_back(static_cast<char>(level >> 8));
+    value.push_back(static_cast<char>(level));
+    return {std::nullopt, value};
+}
+
+void writeFile(const std::string &path, const std::vector<char> &bytes)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), bytes.size());
+}
+
+void testMetadataLogOpenedReadOnly()
+{
+    setBrokerConfig(cleanerConfig());
+
+    // Nothing is created for a log that isn't there
+    const std::string missing = testDir("missing");
+    CHECK(PartitionLog(missing, LogOpenMode::READ_ONLY).segmentInfos().empty());
+    CHECK(!std::filesystem::exists(missing));
+
+    const std::string dir = testDir("metadata");
+    std::filesystem::create_directories(dir);
+    const int64_t now_ms = nowMs();
+    writeFile(dir + "/00000000000000000000.log",
+              makeBatch({metadataRecord(12, "metadata.version", 1), metadataRecord(2, "topic", 0), metadataRecord(12, "metadata.version", 2)}, now_ms, 0));
+
+    // The controller is halfway through appending a batch to the active segment
+    std::vector<char> active = makeBatch({metadataRecord(2, "other", 0)}, now_ms, 3);
+    const std::vector<char> next = makeBatch({metadataRecord(2, "more", 0)}, now_ms, 4);
+    active.insert(active.end(), next.begin(), next.begin() + next.size() / 2);
+    writeFile(dir + "/00000000000000000003.log", active);
+
+    PartitionLog log(dir, LogOpenMode::READ_ONLY);
+    LogCleaner cleaner;
+    CHECK(cleaner.clean(log, LogCleaner::metadataRecordKey, now_ms));
+    CHECK(offsetsOf(readLog(log)) == std::vector<int64_t>({1, 2, 3}));
+
+    // The torn batch is left for the controller to finish
+    CHECK(std::filesystem::file_size(dir + "/00000000000000000003.log") == active.size());
+}
+
+} // namespace
+
+int main()
+{
+    char scratch[] = "/tmp/kafka_log_cleaner_test.XXXXXX";
+    if (mkdtemp(scratch) == nullptr)
+    {
+        std::perror("Error occured");
+        return EXIT_FAILURE;
+    }
+    scratch_dir = scratch;
+
+    testKeepsLatestRecordOfEachKey();
+    testTombstoneRetention(1000, false);
+    testTombstoneRetention(24 * 60 * 60 * 1000, true);
+    testReplaceSegmentsRefusesChangedSegments();
+    testMetadataLogOpenedReadOnly();
+
+    std::filesystem::remove_all(scratch_dir);
+    return checkResult("log cleaner");
+}
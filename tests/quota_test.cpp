@@ -0,0 +1,109 @@
+#include "common.h"
+#include "quota.h"
+#include "broker_config.h"
+#include "check.h"
+
+// Behaviour tests of the GCRA quota bucket with explicit times: credit for one second of the rate, debt growing
+// linearly past it and paid back as time passes, and idle time never adding up to more than the burst.
+
+namespace
+{
+
+constexpr int64_t MS = 1000 * 1000;
+constexpr uint64_t START_NS = 1000ULL * 1000 * MS; // Far enough from 0 for a full bucket
+
+void testDebtGrowsLinearlyPastBurst()
+{
+    // 1000 units per second, charged 100 at a time at the same instant
+    QuotaBucket bucket;
+    for (int i = 1; i <= 10; i++)
+        CHECK(bucket.charge(1000, 100, START_NS) == 0);
+    for (int i = 1; i <= 5; i++)
+        CHECK(bucket.charge(1000, 100, START_NS) == i * 100 * MS);
+
+    // One charge far over the burst is let through as well, as debt
+    QuotaBucket large;
+    CHECK(large.charge(1000, 5000, START_NS) == 4000 * MS);
+}
+
+void testDebtCarriesOver()
+{
+    QuotaBucket bucket;
+    CHECK(bucket.charge(1000, 1200, START_NS) == 200 * MS);
+
+    // Paid back at the rate time passes, a new charge adds to what is left
+    CHECK(bucket.charge(1000, 0, START_NS + 50 * MS) == 150 * MS);
+    CHECK(bucket.charge(1000, 100, START_NS + 150 * MS) == 150 * MS);
+    CHECK(bucket.charge(1000, 0, START_NS + 300 * MS) == 0);
+
+    // Then credit builds up again from empty: 300 ms of it after another 300 ms
+    CHECK(bucket.charge(1000, 300, START_NS + 600 * MS) == 0);
+    CHECK(bucket.charge(1000, 1, START_NS + 600 * MS) == 1 * MS);
+}
+
+void testBurstIsCapped()
+{
+    QuotaBucket bucket;
+    CHECK(bucket.charge(1000, 1000, START_NS) == 0);
+
+    // Ten idle seconds refill the bucket, but only up to one second of the rate
+    const uint64_t later_ns = START_NS + 10 * 1000 * MS;
+    CHECK(bucket.charge(1000, 1000, later_ns) == 0);
+    CHECK(bucket.charge(1000, 100, later_ns) == 100 * MS);
+
+    // Rates below one unit per second still get one second of credit
+    QuotaBucket slow;
+    CHECK(slow.charge(1, 0.5, START_NS) == 0);
+    CHECK(slow.charge(1, 0.5, START_NS) == 0);
+    CHECK(slow.charge(1, 1, START_NS) == 1000 * MS);
+}
+
+void testConcurrentCharges()
+{
+    // Connections of a client id on different threads charge one bucket, none of the charges is lost
+    constexpr int THREADS = 4;
+    constexpr int CHARGES = 1000;
+    QuotaBucket bucket;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < THREADS; i++)
+        threads.emplace_back([&bucket]()
+                             {
+                                 for (int charge = 0; charge < CHARGES; charge++)
+                                     bucket.charge(1000, 1, START_NS); });
+    for (auto &thread : threads)
+        thread.join();
+
+    CHECK(bucket.charge(1000, 0, START_NS) == (THREADS * CHARGES - 1000) * MS);
+}
+
+void testThrottleTimeIsCapped()
+{
+    // One request per second: the first goes through, then the debt grows past what one throttle waits out
+    BrokerConfig config;
+    config.quota_request_rate_default = 1;
+    setBrokerConfig(std::move(config));
+
+    std::shared_ptr<ClientQuota> quota = ClientQuota::forClient("quota-test");
+    CHECK(quota != nullptr && ClientQuota::forClient("quota-test") == quota);
+    if (quota == nullptr)
+        return;
+
+    CHECK(quota->record(18, 0, 0) == 0);
+    int32_t throttle_ms = 0;
+    for (int i = 0; i < 20; i++)
+        throttle_ms = quota->record(18, 0, 0);
+    CHECK(throttle_ms == ClientQuota::MAX_THROTTLE_MS);
+}
+
+} // namespace
+
+int main()
+{
+    testDebtGrowsLinearlyPastBurst();
+    testDebtCarriesOver();
+    testBurstIsCapped();
+    testConcurrentCharges();
+    testThrottleTimeIsCapped();
+
+    return checkResult("quota");
+}
@@ -0,0 +1,177 @@
+#include "common.h"
+#include "timer_wheel.h"
+#include "check.h"
+
+// Behaviour tests of the hierarchical timer wheel, driven by a fake clock: time only moves when advance() is called,
+// across the 64 ms, 4 s, 4 min and 3 h boundaries between its levels.
+
+namespace
+{
+
+constexpr int64_t START_MS = 1000003; // Not aligned to any level
+
+struct TestTask : TimerTask
+{
+    int64_t fired_at_ms = -1;
+    int fired = 0;
+
+    void onExpire() override { fired++; }
+};
+
+// Advances to now_ms and runs what expired, like the event loop does. Returns the expired tasks in order.
+std::vector<TestTask *> advanceTo(TimerWheel &wheel, int64_t now_ms)
+{
+    std::vector<TimerTask *> expired;
+    wheel.advance(now_ms, expired);
+
+    std::vector<TestTask *> tasks;
+    for (TimerTask *task : expired)
+    {
+        auto &test_task = static_cast<TestTask &>(*task);
+        CHECK(!test_task.isScheduled());
+        test_task.fired_at_ms = now_ms;
+        test_task.onExpire();
+        tasks.push_back(&test_task);
+    }
+    return tasks;
+}
+
+bool expiresInOrder(const std::vector<TestTask *> &tasks)
+{
+    return std::ranges::is_sorted(tasks, {}, [](const TestTask *task)
+                                  { return task->expirationMs(); });
+}
+
+// Delays on both sides of every level boundary, up to past the span of the last level
+const std::vector<int64_t> &boundaryDelays()
+{
+    static const std::vector<int64_t> delays = [] {
+        std::vector<int64_t> delays = {0, 1, 2};
+        for (int level = 1; level <= TimerWheel::LEVELS; level++)
+        {
+            const int64_t span = int64_t(1) << (TimerWheel::SLOT_BITS * level);
+            delays.insert(delays.end(), {span - 1, span, span + 1, 3 * span + 17});
+        }
+        return delays;
+    }();
+    return delays;
+}
+
+void testExpiresAcrossLevels()
+{
+    TimerWheel wheel(START_MS);
+    CHECK(wheel.nextTickMs() == INT64_MAX);
+
+    std::vector<TestTask> tasks(boundaryDelays().size());
+    for (size_t i = 0; i < tasks.size(); i++)
+        wheel.schedule(tasks[i], START_MS + boundaryDelays()[i]);
+    CHECK(wheel.size() == tasks.size());
+
+    // Small steps while the finer levels cascade, then longer ones. Every task fires on the first advance that
+    // reaches its expiration, never before and never twice.
+    std::vector<TestTask *> fired;
+    int64_t previous_ms = START_MS - 1;
+    for (int64_t now_ms = START_MS; wheel.size() > 0; now_ms += 1 + (now_ms - START_MS) / 256)
+    {
+        CHECK(wheel.nextTickMs() > previous_ms);
+        const std::vector<TestTask *> expired = advanceTo(wheel, now_ms);
+        for (TestTask *task : expired)
+            CHECK(task->expirationMs() > previous_ms && task->expirationMs() <= now_ms);
+        fired.insert(fired.end(), expired.begin(), expired.end());
+        previous_ms = now_ms;
+    }
+
+    CHECK(fired.size() == tasks.size());
+    CHECK(expiresInOrder(fired));
+    for (auto &task : tasks)
+        CHECK(task.fired == 1);
+}
+
+void testOneLongAdvance()
+{
+    // Every level is cascaded within the one call, tasks still come out in expiration order
+    TimerWheel wheel(START_MS);
+    std::vector<TestTask> tasks(boundaryDelays().size());
+    for (size_t i = 0; i < tasks.size(); i++)
+        wheel.schedule(tasks[tasks.size() - 1 - i], START_MS + boundaryDelays()[i]);
+
+    const std::vector<TestTask *> fired = advanceTo(wheel, START_MS + (int64_t(1) << 40));
+    CHECK(fired.size() == tasks.size());
+    CHECK(expiresInOrder(fired));
+    CHECK(wheel.size() == 0 && wheel.nextTickMs() == INT64_MAX);
+}
+
+void testOverdueFiresOnNextTick()
+{
+    TimerWheel wheel(START_MS);
+    advanceTo(wheel, START_MS + 100);
+
+    TestTask overdue;
+    wheel.schedule(overdue, START_MS);
+    CHECK(wheel.nextTickMs() == START_MS + 101);
+    CHECK(advanceTo(wheel, START_MS + 100).empty());
+    CHECK(advanceTo(wheel, START_MS + 101).size() == 1 && overdue.fired == 1);
+}
+
+void testCancel()
+{
+    TimerWheel wheel(START_MS);
+    TestTask kept, cancelled_early, cancelled_after_cascade;
+    wheel.schedule(kept, START_MS + 5000);
+    wheel.schedule(cancelled_early, START_MS + 5000);
+    wheel.schedule(cancelled_after_cascade, START_MS + 300000); // Level 3
+
+    wheel.cancel(cancelled_early);
+    CHECK(!cancelled_early.isScheduled() && wheel.size() == 2);
+    wheel.cancel(cancelled_early); // Cancelling twice is harmless
+    CHECK(wheel.size() == 2);
+
+    advanceTo(wheel, START_MS + 299990); // Cascaded down to the finest level by now
+    CHECK(kept.fired == 1 && cancelled_early.fired == 0);
+    CHECK(cancelled_after_cascade.isScheduled());
+    CHECK(wheel.nextTickMs() <= START_MS + 300000);
+
+    wheel.cancel(cancelled_after_cascade);
+    CHECK(wheel.size() == 0 && wheel.nextTickMs() == INT64_MAX);
+    advanceTo(wheel, START_MS + 400000);
+    CHECK(cancelled_after_cascade.fired == 0);
+}
+
+void testReschedule()
+{
+    TimerWheel wheel(START_MS);
+    TestTask sooner, later, other;
+    wheel.schedule(sooner, START_MS + 100000);
+    wheel.schedule(later, START_MS + 10);
+    wheel.schedule(other, START_MS + 5000);
+
+    // Moved between levels in both directions, each task is linked once
+    wheel.schedule(sooner, START_MS + 20);
+    wheel.schedule(later, START_MS + 200000);
+    CHECK(wheel.size() == 3);
+
+    CHECK(advanceTo(wheel, START_MS + 19).empty());
+    const std::vector<TestTask *> fired = advanceTo(wheel, START_MS + 20);
+    CHECK(fired.size() == 1 && fired[0] == &sooner);
+
+    advanceTo(wheel, START_MS + 199999);
+    CHECK(later.fired == 0 && other.fired == 1);
+
+    // Pushed back again just before it is due
+    wheel.schedule(later, START_MS + 250000);
+    CHECK(advanceTo(wheel, START_MS + 249999).empty());
+    CHECK(advanceTo(wheel, START_MS + 250000).size() == 1 && later.fired == 1 && sooner.fired == 1);
+}
+
+} // namespace
+
+int main()
+{
+    testExpiresAcrossLevels();
+    testOneLongAdvance();
+    testOverdueFiresOnNextTick();
+    testCancel();
+    testReschedule();
+
+    return checkResult("timer wheel");
+}
@@ -0,0 +1,239 @@
+#include "common.h"
+#include "wire_buffer.h"
+#include "kafka_utils.h"
+#include "check.h"
+
+// Round trips of the request and response field codecs: unsigned varints at their size boundaries, compact strings
+// and arrays, tagged fields, and a whole ApiVersions exchange in its flexible and non-flexible versions.
+
+namespace
+{
+
+std::vector<char> bytesOf(std::string_view text)
+{
+    return std::vector<char>(text.begin(), text.end());
+}
+
+void testUnsignedVarintBoundaries()
+{
+    struct Boundary
+    {
+        uint32_t value;
+        size_t size;
+    };
+    const Boundary boundaries[] = {{0, 1}, {127, 1}, {128, 2}, {(1u << 14) - 1, 2}, {1u << 14, 3}, {(1u << 21) - 1, 3},
+                                   {1u << 21, 4}, {(1u << 28) - 1, 4}, {1u << 28, 5}, {UINT32_MAX, 5}};
+
+    for (auto &boundary : boundaries)
+    {
+        WireWriter writer;
+        writer.writeUnsignedVarint(boundary.value);
+        CHECK(writer.size() == boundary.size);
+        CHECK(unsignedVarintSize(boundary.value) == boundary.size);
+
+        WireReader reader(writer.bytes(), writer.size());
+        CHECK(reader.readUnsignedVarint() == boundary.value);
+        CHECK(reader.ok() && reader.remaining() == 0);
+
+        const char *data = writer.bytes();
+        uint32_t value;
+        CHECK(readUnsignedVarint(data, writer.bytes() + writer.size(), value) && value == boundary.value);
+        CHECK(data == writer.bytes() + writer.size());
+
+        // Cut short by a byte it is an overrun, not a smaller value
+        WireReader truncated(writer.bytes(), writer.size() - 1);
+        truncated.readUnsignedVarint();
+        CHECK(!truncated.ok());
+    }
+
+    // Six bytes can't be a uint32_t
+    const char too_long[] = {'\x80', '\x80', '\x80', '\x80', '\x80', '\x01'};
+    WireReader reader(too_long, sizeof(too_long));
+    reader.readUnsignedVarint();
+    CHECK(!reader.ok());
+}
+
+void testCompactStrings()
+{
+    struct Case
+    {
+        uint32_t len;
+        std::vector<char> str;
+    };
+    const Case cases[] = {{0, {}}, {1, {}}, {4, bytesOf("abc")}, {201, std::vector<char>(200, 'x')}}; // Null, empty, short, two byte length
+
+    for (auto &sent : cases)
+    {
+        WireWriter writer;
+        sendCompactString(writer, sent.len, sent.str);
+        CHECK(writer.size() == unsignedVarintSize(sent.len) + sent.str.size());
+
+        WireReader reader(writer.bytes(), writer.size());
+        uint32_t len;
+        std::vector<char> str = bytesOf("stale");
+        recvCompactString(reader, len, str);
+        CHECK(reader.ok() && reader.remaining() == 0);
+        CHECK(len == sent.len && str == sent.str);
+    }
+
+    // A length past the end of the frame fails it
+    WireWriter writer;
+    writer.writeUnsignedVarint(11);
+    writer.write("abc", 3);
+    WireReader reader(writer.bytes(), writer.size());
+    uint32_t len;
+    std::vector<char> str;
+    recvCompactString(reader, len, str);
+    CHECK(!reader.ok() && str.empty());
+}
+
+void testCompactArrays()
+{
+    WireWriter null_array;
+    sendCompactArray(null_array, 0, {});
+    CHECK(null_array.size() == 1 && null_array.bytes()[0] == 0);
+
+    const std::vector<int32_t> nodes = {static_cast<int32_t>(htobe32(1)), static_cast<int32_t>(htobe32(-1))};
+    WireWriter writer;
+    sendCompactArray(writer, nodes.size() + 1, nodes);
+    WireReader reader(writer.bytes(), writer.size());
+    CHECK(reader.readUnsignedVarint() == 3);
+    CHECK(reader.readBigEndian<int32_t>() == 1);
+    CHECK(reader.readBigEndian<int32_t>() == -1);
+    CHECK(reader.ok() && reader.remaining() == 0);
+}
+
+void testTaggedFields()
+{
+    WireWriter none;
+    sendTaggedFields(none, 0);
+    CHECK(none.size() == 1 && none.bytes()[0] == 0);
+
+    // Fields of unknown tags are skipped, whatever their size, and what follows them is read as usual
+    WireWriter writer;
+    writer.writeUnsignedVarint(3);
+    writer.writeUnsignedVarint(0);
+    writer.writeUnsignedVarint(3);
+    writer.write("abc", 3);
+    writer.writeUnsignedVarint(200);
+    writer.writeUnsignedVarint(0);
+    writer.writeUnsignedVarint(1u << 20);
+    writer.writeUnsignedVarint(300);
+    writer.write(std::string(300, 't').data(), 300);
+    writer.writeBigEndian<int32_t>(42);
+
+    WireReader reader(writer.bytes(), writer.size());
+    uint32_t tag_buffer;
+    recvTaggedFields(reader, tag_buffer);
+    CHECK(tag_buffer == 3);
+    CHECK(reader.readBigEndian<int32_t>() == 42);
+    CHECK(reader.ok() && reader.remaining() == 0);
+
+    // A field longer than the frame fails it
+    WireWriter overlong;
+    overlong.writeUnsignedVarint(1);
+    overlong.writeUnsignedVarint(0);
+    overlong.writeUnsignedVarint(10);
+    overlong.write("abc", 3);
+    WireReader overlong_reader(overlong.bytes(), overlong.size());
+    recvTaggedFields(overlong_reader, tag_buffer);
+    CHECK(!overlong_reader.ok());
+}
+
+struct ApiVersionsResponse
+{
+    int32_t correlation_id;
+    int16_t error_code;
+    std::vector<std::array<int16_t, 3>> api_keys;
+    bool consumed; // Every byte of the frame read, its size matching the message size
+};
+
+// One ApiVersions exchange at api_version, with the header tagged fields and body only the flexible versions have
+ApiVersionsResponse exchangeApiVersions(int16_t api_version)
+{
+    const bool flexible = api_version >= APIVersionsRequestBodyV4::FIRST_FLEXIBLE_VERSION;
+
+    WireWriter body;
+    if (flexible)
+    {
+        sendCompactString(body, 5, bytesOf("test"));
+        sendCompactString(body, 2, bytesOf("1"));
+        sendTaggedFields(body, 0);
+    }
+
+    WireWriter frame;
+    frame.writeBigEndian<int32_t>(2 + 2 + 4 + 2 + 4 + (flexible ? 1 : 0) + body.size());
+    frame.writeBigEndian<int16_t>(18);
+    frame.writeBigEndian(api_version);
+    frame.writeBigEndian<int32_t>(7);
+    frame.writeBigEndian<int16_t>(4);
+    frame.write("test", 4);
+    if (flexible)
+        sendTaggedFields(frame, 0);
+    frame.write(body.bytes(), body.size());
+
+    WireReader request_reader(frame.bytes(), frame.size());
+    RequestHeaderV2 request_header;
+    request_header.receive(request_reader);
+    APIVersionsRequestBodyV4 request_body(request_header.getAPIVersion());
+    request_body.receive(request_reader);
+    CHECK(request_reader.ok() && request_reader.remaining() == 0);
+
+    auto [response_header, response_body] = processAPIVersions(request_header, request_body);
+    WireWriter response;
+    response_header->respond(response);
+    response_body->respond(response);
+
+    // Unsupported versions are answered in v0
+    const bool response_flexible = flexible && api_version <= APIVersionsRequestBodyV4::MAX_VERSION;
+    const bool has_throttle_time = api_version >= 1 && api_version <= APIVersionsRequestBodyV4::MAX_VERSION;
+
+    WireReader reader(response.bytes(), response.size());
+    const int32_t message_size = reader.readBigEndian<int32_t>();
+    ApiVersionsResponse parsed = {.correlation_id = reader.readBigEndian<int32_t>(), .error_code = reader.readBigEndian<int16_t>(), .api_keys = {}, .consumed = false};
+    const uint32_t count = response_flexible ? reader.readUnsignedVarint() - 1 : reader.readBigEndian<int32_t>();
+    for (uint32_t i = 0; i < count && reader.ok(); i++)
+    {
+        parsed.api_keys.push_back({reader.readBigEndian<int16_t>(), reader.readBigEndian<int16_t>(), reader.readBigEndian<int16_t>()});
+        if (response_flexible)
+            CHECK(reader.readUnsignedVarint() == 0);
+    }
+    if (has_throttle_time)
+        reader.readBigEndian<int32_t>();
+    if (response_flexible)
+        CHECK(reader.readUnsignedVarint() == 0);
+    parsed.consumed = reader.ok() && reader.remaining() == 0 && message_size == static_cast<int32_t>(response.size() - sizeof(message_size));
+    return parsed;
+}
+
+void testApiVersionsExchange()
+{
+    for (int16_t api_version = 0; api_version <= APIVersionsRequestBodyV4::MAX_VERSION; api_version++)
+    {
+        const ApiVersionsResponse response = exchangeApiVersions(api_version);
+        CHECK(response.consumed);
+        CHECK(response.correlation_id == 7 && response.error_code == 0);
+        CHECK(std::ranges::find(response.api_keys, std::array<int16_t, 3>{18, 0, APIVersionsRequestBodyV4::MAX_VERSION}) != response.api_keys.end());
+        for (auto &[api_key, min_version, max_version] : response.api_keys)
+            CHECK(isSupportedVersion(api_key, min_version) && isSupportedVersion(api_key, max_version) && !isSupportedVersion(api_key, max_version + 1));
+    }
+
+    // The unsupported version only learns which ApiVersions versions to retry with
+    const ApiVersionsResponse unsupported = exchangeApiVersions(APIVersionsRequestBodyV4::MAX_VERSION + 1);
+    CHECK(unsupported.consumed);
+    CHECK(unsupported.error_code == 35);
+    CHECK(unsupported.api_keys == std::vector<std::array<int16_t, 3>>({{18, 0, APIVersionsRequestBodyV4::MAX_VERSION}}));
+}
+
+} // namespace
+
+int main()
+{
+    testUnsignedVarintBoundaries();
+    testCompactStrings();
+    testCompactArrays();
+    testTaggedFields();
+    testApiVersionsExchange();
+
+    return checkResult("wire codec");
+}
@@ -0,0 +1,247 @@
+#include "common.h"
+#include "metadata_log_writer.h"
+
+// Writes a synthetic __cluster_metadata log, FeatureLevelRecords followed by every topic's TopicRecord,
+// ConfigRecords and PartitionRecords, for loading and DescribeTopicPartitions tests at production cluster sizes.
+// Leader elections append a new PartitionRecord for every partition, the history a long lived cluster piles up.
+
+namespace
+{
+
+struct Options
+{
+    std::string log_dir = "/tmp/kraft-combined-logs";
+    size_t topics = 1000;
+    size_t partitions_per_topic = 50;
+    size_t brokers = 3;
+    size_t replicas = 3;
+    size_t isr = 0; // 0 keeps every replica in sync
+    size_t feature_levels = 1;
+    int32_t batch_size = 0; // Records per batch, 0 is a batch per topic like a CreateTopics on the controller
+    uint64_t segment_bytes = 0; // 0 writes a single segment
+    std::string topic_prefix = "topic";
+    std::vector<std::pair<std::string, std::string>> topic_configs; // Given to every topic
+    size_t leader_elections = 0;
+    uint64_t seed = 1;
+};
+
+void usage()
+{
+    std::cerr << "Usage: kafka_metadata_gen [--log-dir DIR] [--topics N] [--partitions-per-topic N] [--brokers N]\n"
+                 "                          [--replicas N] [--isr N] [--feature-levels N] [--batch-size RECORDS]\n"
+                 "                          [--segment-bytes BYTES] [--topic-prefix PREFIX] [--topic-config KEY=VALUE]...\n"
+                 "                          [--leader-elections N] [--seed N]\n"
+                 "Writes DIR/__cluster_metadata-0/<base offset>.log, replacing the segments already there\n";
+    exit(EXIT_FAILURE);
+}
+
+template <typename T>
+T parseNumber(std::string_view text)
+{
+    T value{};
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end != text.data() + text.size())
+    {
+        std::cerr << "Invalid number " << text << "\n";
+        usage();
+    }
+    return value;
+}
+
+Options parseOptions(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view flag = argv[i];
+        if (i + 1 >= argc)
+            usage();
+        std::string_view value = argv[++i];
+
+        if (flag == "--log-dir")
+            options.log_dir = value;
+        else if (flag == "--topics")
+            options.topics = parseNumber<size_t>(value);
+        else if (flag == "--partitions-per-topic")
+            options.partitions_per_topic = parseNumber<size_t>(value);
+        else if (flag == "--brokers")
+            options.brokers = parseNumber<size_t>(value);
+        else if (flag == "--replicas")
+            options.replicas = parseNumber<size_t>(value);
+        else if (flag == "--isr")
+            options.isr = parseNumber<size_t>(value);
+        else if (flag == "--feature-levels")
+            options.feature_levels = parseNumber<size_t>(value);
+        else if (flag == "--batch-size")
+            options.batch_size = parseNumber<int32_t>(value);
+        else if (flag == "--segment-bytes")
+            options.segment_bytes = parseNumber<uint64_t>(value);
+        else if (flag == "--topic-prefix")
+            options.topic_prefix = value;
+        else if (flag == "--topic-config")
+        {
+            const size_t separator = value.find('=');
+            if (separator == std::string_view::npos)
+                usage();
+            options.topic_configs.emplace_back(value.substr(0, separator), value.substr(separator + 1));
+        }
+        else if (flag == "--leader-elections")
+            options.leader_elections = parseNumber<size_t>(value);
+        else if (flag == "--seed")
+            options.seed = parseNumber<uint64_t>(value);
+        else
+            usage();
+    }
+
+    if (options.isr == 0)
+        options.isr = options.replicas;
+    if (options.brokers == 0 || options.replicas == 0 || options.replicas > options.brokers || options.isr > options.replicas ||
+        options.batch_size < 0 || options.topic_prefix.empty())
+        usage();
+    return options;
+}
+
+// Random (version 4) UUID, never the all-zero id Kafka reserves
+UUID randomTopicId(std::mt19937_64 &random)
+{
+    UUID topic_id;
+    const uint64_t high = random(), low = random();
+    for (size_t i = 0; i < 8; i++)
+    {
+        topic_id[i] = static_cast<uint8_t>(high >> (56 - 8 * i));
+        topic_id[8 + i] = static_cast<uint8_t>(low >> (56 - 8 * i));
+    }
+    topic_id[6] = (topic_id[6] & 0x0F) | 0x40;
+    topic_id[8] = (topic_id[8] & 0x3F) | 0x80;
+    return topic_id;
+}
+
+std::string segmentFileName(int64_t base_offset)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%020lld.log", static_cast<long long>(base_offset));
+    return name;
+}
+
+// Cuts the log into segments of about segment_bytes at batch boundaries, each named after its first offset
+bool writeSegments(const std::filesystem::path &dir, const WireWriter &log, uint64_t segment_bytes, size_t &segments)
+{
+    size_t segment_begin = 0;
+    size_t position = 0;
+    segments = 0;
+
+    while (segment_begin < log.size())
+    {
+        int64_t base_offset;
+        std::memcpy(&base_offset, log.bytes() + segment_begin, sizeof(base_offset));
+        convertBE64toH(base_offset);
+
+        // Whole batches until the segment is full, at least one
+        position = segment_begin;
+        do
+        {
+            int32_t batch_length;
+            std::memcpy(&batch_length, log.bytes() + position + sizeof(int64_t), sizeof(batch_length));
+            convertBE32toH(batch_length);
+            position += sizeof(int64_t) + sizeof(int32_t) + batch_length;
+        } while (position < log.size() && (segment_bytes == 0 || position - segment_begin < segment_bytes));
+
+        std::ofstream file(dir / segmentFileName(base_offset), std::ios::binary | std::ios::trunc);
+        file.write(log.bytes() + segment_begin, position - segment_begin);
+        if (!file.good())
+            return false;
+
+        segments++;
+        segment_begin = position;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const Options options = parseOptions(argc, argv);
+
+    // Real feature names first, made up ones beyond those
+    constexpr std::array<std::pair<std::string_view, int16_t>, 4> FEATURES = {{{"metadata.version", 20}, {"kraft.version", 1}, {"group.version", 1}, {"transaction.version", 2}}};
+
+    MetadataLogWriter writer(options.batch_size == 0 ? INT32_MAX : options.batch_size);
+    for (size_t i = 0; i < options.feature_levels; i++)
+    {
+        if (i < FEATURES.size())
+            writer.addFeatureLevel(FEATURES[i].first, FEATURES[i].second);
+        else
+            writer.addFeatureLevel("synthetic.feature." + std::to_string(i), 1);
+    }
+    if (options.batch_size == 0)
+        writer.endBatch();
+
+    // Replicas are assigned round-robin like Kafka's rack-unaware assignment, the first replica leads
+    std::mt19937_64 random(options.seed);
+    std::vector<UUID> topic_ids;
+    std::vector<int32_t> replica_nodes(options.replicas);
+    for (size_t topic = 0; topic < options.topics; topic++)
+    {
+        const UUID topic_id = randomTopicId(random);
+        const std::string topic_name = options.topic_prefix + std::to_string(topic);
+        writer.addTopic(topic_name, topic_id);
+        topic_ids.push_back(topic_id);
+
+        for (auto &[name, value] : options.topic_configs)
+            writer.addTopicConfig(topic_name, name, value);
+
+        for (size_t partition = 0; partition < options.partitions_per_topic; partition++)
+        {
+            const size_t first_broker = topic * options.partitions_per_topic + partition;
+            for (size_t replica = 0; replica < options.replicas; replica++)
+                replica_nodes[replica] = static_cast<int32_t>((first_broker + replica) % options.brokers + 1);
+
+            writer.addPartition(topic_id, static_cast<int32_t>(partition), replica_nodes[0], 0, replica_nodes,
+                                std::span<const int32_t>(replica_nodes).first(options.isr));
+        }
+
+        if (options.batch_size == 0)
+            writer.endBatch();
+    }
+
+    // Each election moves leadership to the next replica and bumps the leader epoch
+    for (size_t election = 1; election <= options.leader_elections; election++)
+    {
+        for (size_t topic = 0; topic < options.topics; topic++)
+        {
+            for (size_t partition = 0; partition < options.partitions_per_topic; partition++)
+            {
+                const size_t first_broker = topic * options.partitions_per_topic + partition;
+                for (size_t replica = 0; replica < options.replicas; replica++)
+                    replica_nodes[replica] = static_cast<int32_t>((first_broker + replica) % options.brokers + 1);
+
+                writer.addPartition(topic_ids[topic], static_cast<int32_t>(partition), replica_nodes[election % options.replicas],
+                                    static_cast<int32_t>(election), replica_nodes, std::span<const int32_t>(replica_nodes).first(options.isr));
+            }
+
+            if (options.batch_size == 0)
+                writer.endBatch();
+        }
+    }
+
+    const std::filesystem::path dir = std::filesystem::path(options.log_dir) / "__cluster_metadata-0";
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    for (auto &entry : std::filesystem::directory_iterator(dir, error))
+        if (entry.path().extension() == ".log")
+            std::filesystem::remove(entry.path(), error);
+
+    const WireWriter &log = writer.bytes();
+    size_t segments = 0;
+    if (!writeSegments(dir, log, options.segment_bytes, segments))
+    {
+        std::cerr << "Couldn't write " << dir.string() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Wrote " << options.topics << " topics, " << options.topics * options.partitions_per_topic << " partitions, "
+              << options.feature_levels << " feature levels, " << options.leader_elections << " leader elections (" << log.size() << " bytes in " << segments << " segments) to "
+              << dir.string() << "\n";
+    return EXIT_SUCCESS;
+}